@@ -7,42 +7,162 @@
 #define SHELL_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <termios.h>
+#include <time.h>
 
 /**
- * @brief Maximum command line length
+ * @brief Arena memory block header (usable bytes follow the header)
  */
-#define MAX_LINE_LEN 4096
+typedef struct arena_block {
+  struct arena_block *next; /**< Previously filled block (NULL if first) */
+  size_t size;              /**< Usable bytes in this block */
+  size_t used;              /**< Bytes already handed out */
+} arena_block_t;
 
 /**
- * @brief Maximum number of tokens in a command
+ * @brief Bump allocator; everything allocated from it is freed at once
+ *
+ * A zero-initialized arena is empty and valid.
  */
-#define MAX_TOKENS 256
+typedef struct {
+  arena_block_t *head; /**< Block currently being filled (NULL if empty) */
+} arena_t;
+
+/**
+ * @brief Text fed to a command's stdin: a here-document (<<WORD, <<-WORD)
+ * or a here-string (<<<word)
+ */
+typedef struct here_doc {
+  const char *delimiter; /**< Line ending the body (NULL for a here-string) */
+  const char *body;      /**< Text to feed */
+  size_t len;            /**< Length of body in bytes */
+  bool strip_tabs;       /**< <<-: leading tabs were removed from lines */
+  bool expand;           /**< body still needs parameter expansion */
+  struct here_doc *next; /**< Next here-document of the line (not strings) */
+} here_doc_t;
+
+/**
+ * @brief What a redirection does to its descriptor
+ */
+typedef enum {
+  REDIR_OPEN, /**< Open path onto fd (<, >, >>, >|, <>) */
+  REDIR_DUP,  /**< Make fd a copy of source (n>&m, n<&m) */
+  REDIR_CLOSE /**< Close fd (n>&-, n<&-) */
+} redir_kind_t;
 
 /**
- * @brief Maximum number of commands in a pipeline
+ * @brief One redirection of a command
  */
-#define MAX_PIPES 64
+typedef struct {
+  redir_kind_t kind;    /**< Operation */
+  int fd;               /**< Descriptor it changes */
+  int source;           /**< REDIR_DUP: descriptor copied onto fd */
+  int flags;            /**< REDIR_OPEN: open flags */
+  const char *path;     /**< REDIR_OPEN: file to open */
+  const char *raw_path; /**< REDIR_OPEN: source text of path if it needs
+                             expansion, else NULL */
+} redir_t;
 
 /**
  * @brief Command structure representing a single command in a pipeline
+ *
+ * Redirections are applied in the order written, after the pipe ends and
+ * the here-document, so "2>&1 >file" and ">file 2>&1" differ as usual.
  */
 typedef struct {
-  char **argv;        /**< Argument vector (NULL-terminated) */
-  char *input_file;   /**< Input redirection file (NULL if none) */
-  char *output_file;  /**< Output redirection file (NULL if none) */
-  bool append_output; /**< Append mode for output redirection */
-  bool background;    /**< Background execution flag */
+  char **argv;          /**< Argument vector (NULL-terminated) */
+  char **raw_argv;      /**< Source text of words to expand at run time,
+                             NULL for literal words (NULL if all are
+                             literal) */
+  redir_t *redirs;      /**< Redirections in order (NULL if none) */
+  size_t num_redirs;    /**< Number of redirections */
+  here_doc_t *here_doc; /**< Stdin text (or NULL); a later < replaces it */
+  bool background;      /**< Background execution flag */
 } command_t;
 
+/**
+ * @brief Find the redirection that decides where a descriptor points
+ * @param cmd Command to look at
+ * @param fd Descriptor
+ * @return Last redirection of fd, or NULL if fd is left as inherited
+ */
+const redir_t *command_redir(const command_t *cmd, int fd);
+
+/**
+ * @brief Control operator joining a pipeline to the next one in its list
+ */
+typedef enum {
+  LIST_END, /**< Last pipeline of the list */
+  LIST_SEQ, /**< ; or &: the next pipeline always runs */
+  LIST_AND, /**< &&: the next pipeline runs if this one succeeded */
+  LIST_OR   /**< ||: the next pipeline runs if this one failed */
+} list_op_t;
+
 /**
  * @brief Pipeline structure containing multiple commands
+ *
+ * A line is parsed into a list of pipelines chained through next. Only the
+ * first one owns an arena; the others, like everything they point to, are
+ * allocated from it and go away with it.
  */
-typedef struct {
-  command_t *commands; /**< Array of commands */
-  size_t num_commands; /**< Number of commands in pipeline */
+typedef struct pipeline {
+  command_t *commands;   /**< Array of commands */
+  size_t num_commands;   /**< Number of commands in pipeline */
+  arena_t arena;         /**< Owns commands, argv vectors and strings */
+  bool timed;            /**< Prefixed with the time keyword */
+  bool expand;           /**< Some command has raw_argv or a here_doc to
+                              expand */
+  here_doc_t *here_docs; /**< Here-documents of the whole list, in the
+                              order of their bodies (first pipeline only) */
+  bool unterminated;     /**< The text ended before a here-document's
+                              delimiter line (first pipeline only) */
+  list_op_t next_op;     /**< How next is joined to this pipeline */
+  struct pipeline *next; /**< Next pipeline of the list (or NULL) */
 } pipeline_t;
 
+/**
+ * @brief Make sure the arena can serve at least bytes without growing
+ * @param arena Arena to prepare
+ * @param bytes Number of bytes that should fit in the current block
+ * @return 0 on success, -1 on allocation failure
+ */
+int arena_reserve(arena_t *arena, size_t bytes);
+
+/**
+ * @brief Allocate uninitialized, maximally aligned memory from an arena
+ * @param arena Arena to allocate from
+ * @param bytes Number of bytes requested
+ * @return Pointer to the memory, or NULL on allocation failure
+ */
+void *arena_alloc(arena_t *arena, size_t bytes);
+
+/**
+ * @brief Copy len bytes of str into the arena and NUL-terminate them
+ * @param arena Arena to allocate from
+ * @param str Source bytes
+ * @param len Number of bytes to copy
+ * @return NUL-terminated copy, or NULL on allocation failure
+ */
+char *arena_strndup(arena_t *arena, const char *str, size_t len);
+
+/**
+ * @brief Free every block owned by an arena and reset it to empty
+ * @param arena Arena to release
+ */
+void arena_release(arena_t *arena);
+
+/**
+ * @brief Free the block kept for reuse by the next arena
+ *
+ * Lets leak checkers see every arena byte returned to malloc.
+ */
+void arena_trim(void);
+
 /**
  * @brief Parse a command line into a pipeline structure
  * @param line Input command line string
@@ -51,6 +171,48 @@ typedef struct {
  */
 int parse_command(const char *line, pipeline_t *pipeline);
 
+/**
+ * @brief Parse a command line that is not NUL-terminated
+ *
+ * Like parse_command, for a span of a larger buffer such as one line of a
+ * memory-mapped script. The bytes are copied once into the pipeline's
+ * arena and tokenized in place there: quotes and escapes are removed
+ * inside the copy and argv entries point straight into it, so line may be
+ * read-only and need not outlive the pipeline.
+ *
+ * @param line Start of the command line
+ * @param len Length of the command line in bytes
+ * @param pipeline Output pipeline structure (must be freed with free_pipeline)
+ * @return 0 on success, -1 on error
+ */
+int parse_command_len(const char *line, size_t len, pipeline_t *pipeline);
+
+/**
+ * @brief Check whether a line ends the here-document being read
+ *
+ * Used by readers that collect the body lines following a command line
+ * whose pipeline is unterminated, before parsing the whole text again.
+ *
+ * @param doc In/out here-document waiting for its delimiter; advanced to
+ * the next one (NULL after the last) when line is the delimiter
+ * @param line Line without its newline
+ * @param len Length of line
+ */
+void parse_here_doc_line(const here_doc_t **doc, const char *line,
+                         size_t len);
+
+/**
+ * @brief Measure the command substitution starting at text
+ *
+ * $(...) ends at the ) that balances it, skipping quotes and nested
+ * substitutions; `...` ends at the next unescaped backquote.
+ *
+ * @param text Position of a "$(" or a backquote
+ * @return Length up to and including the closing ) or `, or 0 if the
+ * substitution is not terminated
+ */
+size_t parse_substitution_len(const char *text);
+
 /**
  * @brief Free resources allocated by parse_command
  * @param pipeline Pipeline structure to free
@@ -62,7 +224,1045 @@ void free_pipeline(pipeline_t *pipeline);
  * @param pipeline Pipeline structure to execute
  * @return Exit status of the last command in pipeline
  */
-int execute_pipeline(pipeline_t *pipeline);
+int execute_pipeline(const pipeline_t *pipeline);
+
+/**
+ * @brief Execute a list of pipelines joined by ;, &, && and ||
+ *
+ * Runs the list in one pass: && and || skip the next pipeline depending on
+ * the status of the last one that ran, and ; or & never skip. $? follows
+ * every pipeline, and the list stops early on Ctrl+C or exit.
+ *
+ * @param list First pipeline of the list
+ * @return Exit status of the last pipeline that ran
+ */
+int execute_list(const pipeline_t *list);
+
+/**
+ * @brief Parse cache counters, as reported by the parsecache builtin
+ */
+typedef struct {
+  unsigned long hits;      /**< Lines answered from the cache */
+  unsigned long misses;    /**< Lines that had to be parsed */
+  unsigned long evictions; /**< Entries dropped to make room */
+  size_t entries;          /**< Pipelines currently cached */
+  size_t capacity;         /**< Maximum number of cached pipelines */
+} parse_cache_stats_t;
+
+/**
+ * @brief Parse a command line, reusing the result for a line seen before
+ *
+ * Lines are looked up by their raw bytes in an LRU cache; only misses are
+ * tokenized and parsed. The returned pipeline is shared and must not be
+ * modified. Parse errors are not cached.
+ *
+ * @param line Start of the command line (need not be NUL-terminated)
+ * @param len Length of the command line in bytes
+ * @param pipeline Output pipeline (release with parse_cache_release)
+ * @return 0 on success, -1 on error
+ */
+int parse_cache_parse(const char *line, size_t len,
+                      const pipeline_t **pipeline);
+
+/**
+ * @brief Drop a reference obtained from parse_cache_parse
+ *
+ * A pipeline evicted while in use is freed by its last release.
+ *
+ * @param pipeline Pipeline to release (NULL is ignored)
+ */
+void parse_cache_release(const pipeline_t *pipeline);
+
+/**
+ * @brief Forget every cached pipeline
+ */
+void parse_cache_clear(void);
+
+/**
+ * @brief Change how many pipelines are kept (0 disables the cache)
+ *
+ * Cached entries are dropped.
+ *
+ * @param capacity Maximum number of cached pipelines
+ */
+void parse_cache_resize(size_t capacity);
+
+/**
+ * @brief Get the cache counters
+ * @param stats Output counters
+ */
+void parse_cache_stats(parse_cache_stats_t *stats);
+
+/**
+ * @brief Reset the hit, miss and eviction counters
+ */
+void parse_cache_reset_stats(void);
+
+/**
+ * @brief Resolve a command name to an executable path through the cache
+ *
+ * Names containing a slash are returned unchanged. Other names are looked
+ * up in the cache and, on a miss, searched for in PATH and remembered. The
+ * whole cache is dropped when PATH changes.
+ *
+ * @param name Command name (argv[0])
+ * @return Executable path (valid until the cache changes), or NULL if the
+ * command was not found
+ */
+const char *path_cache_lookup(const char *name);
+
+/**
+ * @brief Forget the cached location of a command (e.g. after ENOENT)
+ * @param name Command name
+ */
+void path_cache_forget(const char *name);
+
+/**
+ * @brief Forget every cached command location
+ */
+void path_cache_clear(void);
+
+/**
+ * @brief List the names of every cached command
+ * @param count Output number of names
+ * @return Newly allocated vector of names (valid until the cache changes),
+ * or NULL on allocation failure
+ */
+const char **path_cache_names(size_t *count);
+
+/**
+ * @brief Print the cache contents in the format of the hash builtin
+ * @param out Output stream
+ */
+void path_cache_print(FILE *out);
+
+/**
+ * @brief Check whether a string is a valid variable name
+ * @param name Start of the name
+ * @param len Length of the name
+ * @return true for a letter or underscore followed by letters, digits and
+ * underscores
+ */
+bool vars_valid_name(const char *name, size_t len);
+
+/**
+ * @brief Get the value of a shell variable
+ *
+ * The process environment is imported on first use of any vars_ function.
+ *
+ * @param name Variable name
+ * @return Value (valid until the variable changes), or NULL if unset
+ */
+const char *vars_get(const char *name);
+
+/**
+ * @brief Set a shell variable, keeping its exported state
+ * @param name Variable name
+ * @param value New value
+ * @return 0 on success, -1 on an invalid name or allocation failure
+ */
+int vars_set(const char *name, const char *value);
+
+/**
+ * @brief Export a variable to commands, creating it empty if unset
+ * @param name Variable name
+ * @return 0 on success, -1 on an invalid name or allocation failure
+ */
+int vars_export(const char *name);
+
+/**
+ * @brief Remove a variable (and its environment entry)
+ * @param name Variable name
+ */
+void vars_unset(const char *name);
+
+/**
+ * @brief Environment of exported variables, ready to pass to exec
+ *
+ * The array is updated in place as variables change; environ always
+ * points at it, so the shell never has to rebuild an environment.
+ *
+ * @return NULL-terminated "NAME=value" array
+ */
+char **vars_envp(void);
+
+/**
+ * @brief Print exported variables, sorted, in the format of export -p
+ * @param out Output stream
+ */
+void vars_print_exported(FILE *out);
+
+/**
+ * @brief Directory cache counters of the pathname expander
+ */
+typedef struct {
+  unsigned long lists; /**< Directory listings requested */
+  unsigned long reads; /**< Listings that had to read the directory */
+  size_t dirs;         /**< Directories currently cached */
+} glob_cache_stats_t;
+
+/**
+ * @brief Expand a pathname pattern against the file system
+ *
+ * Components without metacharacters are taken as they are; only the
+ * others list their directory, each at most once until glob_cache_clear.
+ * Names starting with a dot only match an explicit leading dot.
+ *
+ * @param pattern Pattern as built by parse_word_pattern
+ * @param arena Arena providing the matches and the vector
+ * @param matches Output: sorted matching paths
+ * @param count Output: number of matches (0 if nothing matched)
+ * @return 0 on success, -1 on allocation failure
+ */
+int glob_expand(const char *pattern, arena_t *arena, char ***matches,
+                size_t *count);
+
+/**
+ * @brief Drop every cached directory listing (before each pipeline runs)
+ */
+void glob_cache_clear(void);
+
+/**
+ * @brief Get a name from a directory listing, reading it on first use
+ * @param path Directory ("" for the current one)
+ * @param index Position of the name in the listing (unsorted, no . or ..)
+ * @param is_dir Output: whether the name is a directory, following symlinks
+ * @return Name (valid until glob_cache_clear), or NULL past the last one
+ */
+const char *glob_dir_entry(const char *path, size_t index, bool *is_dir);
+
+/**
+ * @brief Get the directory cache counters
+ * @param stats Output counters
+ */
+void glob_cache_stats(glob_cache_stats_t *stats);
+
+/**
+ * @brief Expand the words of a pipeline that needs it (pipeline.expand)
+ *
+ * The commands are copied with parameters ($NAME, ${NAME}, $?, $$) and
+ * command substitutions ($(...), `...`) replaced, unquoted results split
+ * at blanks (except in leading NAME=value words), and pattern words
+ * replaced by their matches, or by the word itself when nothing matches.
+ * A command left with no words becomes ":". Redirection filenames are
+ * expanded the same way but never split, and must come out as one word.
+ * The source pipeline is left untouched, since it may be shared through
+ * the parse cache; the copy points into its strings and must not outlive
+ * it.
+ *
+ * @param in Parsed pipeline
+ * @param out Output pipeline (must be freed with free_pipeline)
+ * @return 0 on success, -1 on allocation failure, 1 if a redirection
+ * filename was ambiguous (message printed, out left empty)
+ */
+int expand_pipeline(const pipeline_t *in, pipeline_t *out);
+
+/**
+ * @brief Check whether the shell can perform a stage by only moving data
+ *
+ * Accepts "cat [FILE...]" and "tee [FILE]" without options, redirecting
+ * at most stdin and stdout to files. A stage that would read the shell's
+ * own stdin is refused.
+ *
+ * @param cmd Stage to check
+ * @param from_pipe Whether the stage's stdin is a pipe from the previous one
+ * @return true if mover_run can perform the stage
+ */
+bool mover_handles(const command_t *cmd, bool from_pipe);
+
+/**
+ * @brief Perform a stage accepted by mover_handles inside the shell
+ *
+ * Data is moved with splice, tee or copy_file_range where the descriptors
+ * allow it and through a buffer otherwise. Stops early on SIGINT.
+ *
+ * @param cmd Stage to perform
+ * @param input_fd Descriptor the stage reads as its stdin
+ * @param output_fd Descriptor the stage writes as its stdout
+ * @return Exit status the real command would have returned
+ */
+int mover_run(const command_t *cmd, int input_fd, int output_fd);
+
+/**
+ * @brief One process of a job
+ */
+typedef struct {
+  pid_t pid;                /**< Process ID */
+  int status;               /**< Raw wait status (valid once done) */
+  bool done;                /**< Process has been reaped */
+  bool stopped;             /**< Stopped by a signal (job control only) */
+  struct rusage usage;      /**< Resource usage from wait4 (valid once done) */
+  struct timespec spawned;  /**< Monotonic time the launch started */
+  struct timespec launched; /**< Monotonic time the launch call returned */
+  struct timespec exited;   /**< Monotonic time the process was reaped */
+} job_proc_t;
+
+/**
+ * @brief A launched pipeline tracked until all its processes are reaped
+ */
+typedef struct {
+  int id;                /**< Job number shown as [id] */
+  pid_t pgid;            /**< Process group (first process; job control) */
+  job_proc_t *procs;     /**< Processes in pipeline order */
+  size_t num_procs;      /**< Number of processes */
+  size_t num_done;       /**< Number of processes already reaped */
+  bool background;       /**< Started with &, or stopped or sent with bg */
+  char *command;         /**< Command text for the jobs builtin */
+  unsigned long touched; /**< Order it last stopped or went to background */
+  bool stop_shown;       /**< The Stopped notice has been printed */
+  bool has_modes;        /**< modes holds the terminal settings at its stop */
+  struct termios modes;  /**< Settings restored when it is resumed by fg */
+} job_t;
+
+/**
+ * @brief Install the SIGCHLD handler that drives reaping
+ */
+void jobs_init(void);
+
+/**
+ * @brief Turn on job control on a terminal
+ *
+ * Waits to be in the foreground, moves the shell into a process group of
+ * its own, takes the terminal and ignores SIGTSTP, SIGTTIN and SIGTTOU.
+ * @param fd Descriptor of the terminal (stdin)
+ * @return 0 on success, -1 if job control is not possible (stays off)
+ */
+int jobs_control_init(int fd);
+
+/**
+ * @brief Give the terminal back to whoever had it before jobs_control_init
+ */
+void jobs_control_end(void);
+
+/**
+ * @brief Turn job control off in a forked subshell, leaving the terminal
+ * to the shell that forked it
+ */
+void jobs_control_forget(void);
+
+/**
+ * @brief Get the terminal jobs are handed while in the foreground
+ * @return Close-on-exec descriptor, or -1 without job control
+ */
+int jobs_terminal(void);
+
+/**
+ * @brief Run a job in the foreground until it exits or stops
+ *
+ * With job control the job is given the terminal for the wait and the
+ * shell takes it back afterwards. A job that stops is moved to the
+ * background and a Stopped notice is printed.
+ * @param job Job to wait for
+ * @param resume Send SIGCONT first (fg) and restore its terminal settings
+ * @return Exit status of the job, or 128 + the signal that stopped it
+ */
+int jobs_foreground(job_t *job, bool resume);
+
+/**
+ * @brief Let a stopped job continue in the background (bg)
+ * @return 0 on success, -1 on failure (message printed)
+ */
+int jobs_background(job_t *job);
+
+/**
+ * @brief Get the job fg and bg act on without an argument: the one that
+ * most recently stopped or went to the background
+ * @return Job, or NULL if there is none
+ */
+job_t *jobs_current(void);
+
+/**
+ * @brief Register a launched pipeline in the job table
+ * @param pipeline Pipeline the processes were started for
+ * @param pids Process IDs in pipeline order
+ * @param num_procs Number of processes
+ * @param background Whether the pipeline runs in the background
+ * @return New job, or NULL on allocation failure
+ */
+job_t *jobs_add(const pipeline_t *pipeline, const pid_t *pids,
+                size_t num_procs, bool background);
+
+/**
+ * @brief Register a single process running a command given as text
+ *
+ * Used for helper processes such as parallel's workers; the job is a
+ * foreground one, so jobs, wait and the completion notices ignore it.
+ *
+ * @param command Command text (copied)
+ * @param pid Process ID
+ * @return New job, or NULL on allocation failure
+ */
+job_t *jobs_add_command(const char *command, pid_t pid);
+
+/**
+ * @brief Reap every child that exited since the last call, in one batch
+ *
+ * Costs no system call when SIGCHLD has not been delivered in between.
+ */
+void jobs_reap(void);
+
+/**
+ * @brief Block until every process of a job has exited, or with job
+ * control until all that have not are stopped
+ *
+ * Children of other jobs that exit first are recorded along the way, so
+ * processes are collected in the order they actually finish.
+ *
+ * @param job Job to wait for
+ * @return Exit status of the job's last process (see jobs_status)
+ */
+int jobs_wait(job_t *job);
+
+/**
+ * @brief Block until any child exits and record it in its job
+ *
+ * Lets a caller juggling several jobs react to whichever finishes first.
+ * When no children are left, every unfinished job is marked done.
+ *
+ * @return 0 if a child was reaped, -1 if none was (no children, error)
+ */
+int jobs_wait_any(void);
+
+/**
+ * @brief Wait for every background job and drop it from the table
+ * @return Exit status of the last job waited for
+ */
+int jobs_wait_all(void);
+
+/**
+ * @brief Check whether every process of a job has been reaped
+ */
+bool jobs_is_done(const job_t *job);
+
+/**
+ * @brief Check whether every process of a job still running is stopped
+ */
+bool jobs_is_stopped(const job_t *job);
+
+/**
+ * @brief Get the exit status of a job's last process, or 128 + the signal
+ * that stopped a stopped job
+ */
+int jobs_status(const job_t *job);
+
+/**
+ * @brief Find a background job by "%n" job number or by process ID
+ * @param spec Job specification
+ * @return Matching job, or NULL if none
+ */
+job_t *jobs_find(const char *spec);
+
+/**
+ * @brief Remove a job from the table and free it
+ */
+void jobs_remove(job_t *job);
+
+/**
+ * @brief Print background jobs in the format of the jobs builtin
+ * @param out Output stream
+ */
+void jobs_print(FILE *out);
+
+/**
+ * @brief Report and forget background jobs that have finished
+ */
+void jobs_notify(void);
+
+/**
+ * @brief Convert a raw wait status into a shell exit status
+ */
+int jobs_decode_status(int status);
+
+/**
+ * @brief How history_search compares entries with the search text
+ */
+typedef enum {
+  HISTORY_PREFIX,   /**< The entry starts with the text */
+  HISTORY_SUBSTRING /**< The entry contains the text */
+} history_match_t;
+
+/**
+ * @brief Open a history log and map its index
+ *
+ * The index (path plus ".idx") is brought up to date with the log first:
+ * entries appended without it are indexed, and an index that does not
+ * match the log is rebuilt. Nothing else of the log is read.
+ *
+ * @param path Log file, or NULL for ~/.shell_history
+ * @return 0 on success, -1 on failure (history stays closed)
+ */
+int history_open(const char *path);
+
+/**
+ * @brief Arrange for history to be opened when it is first used
+ *
+ * The first call that adds or looks up entries opens the log named by
+ * HISTFILE at that point, or ~/.shell_history when interactive is set.
+ * @param interactive Keep history even when HISTFILE is unset
+ */
+void history_open_lazily(bool interactive);
+
+/**
+ * @brief Unmap and close the history files
+ */
+void history_close(void);
+
+/**
+ * @brief Append a command to the log and the index
+ *
+ * Empty and multi-line commands, and repeats of the previous entry, are
+ * not recorded. Does nothing while history is closed.
+ *
+ * @param line Command line (not NUL-terminated)
+ * @param len Length of line
+ * @return 0 on success or when skipped, -1 on write failure
+ */
+int history_add(const char *line, size_t len);
+
+/**
+ * @brief Get the number of history entries, oldest first
+ */
+size_t history_count(void);
+
+/**
+ * @brief Get an entry
+ * @param index Entry number, from 0 (oldest)
+ * @param len Output length of the entry
+ * @return Start of the entry in the mapped log (not NUL-terminated), or
+ * NULL if there is no such entry
+ */
+const char *history_get(size_t index, size_t *len);
+
+/**
+ * @brief Find the newest matching entry before a position
+ *
+ * Prefix searches compare the record's stored first bytes, so entries are
+ * only read from the log when those match.
+ *
+ * @param text Text to look for
+ * @param len Length of text
+ * @param match Prefix or substring match
+ * @param index In: search entries before this one (history_count() for
+ * all); out: the match
+ * @return true if an entry matched
+ */
+bool history_search(const char *text, size_t len, history_match_t match,
+                    size_t *index);
+
+/**
+ * @brief Options of a parallel run (the parallel builtin)
+ */
+typedef struct {
+  long jobs;          /**< Jobs running at once (0: number of online CPUs) */
+  bool group;         /**< Copy out each job's stdout in one piece */
+  bool keep_order;    /**< Copy out job output in input order (groups) */
+  char **command;     /**< Template words; {} is replaced by the input */
+  size_t command_len; /**< Template words (0: each input is a command line) */
+  char **inputs;      /**< NULL-terminated inputs, or NULL to read stdin */
+} parallel_opts_t;
+
+/**
+ * @brief Run one job per input with bounded concurrency
+ *
+ * Keeps up to opts->jobs worker processes running, starting the next input
+ * as soon as any worker exits. Workers read /dev/null; Ctrl+C stops new
+ * starts and lets the running ones finish.
+ *
+ * @param opts Options and inputs
+ * @return Number of failed jobs, capped at 101
+ */
+int parallel_run(const parallel_opts_t *opts);
+
+/**
+ * @brief How inter-stage pipes are sized (set -o pipesize)
+ */
+typedef enum {
+  PIPE_SIZE_DEFAULT, /**< Leave the kernel default */
+  PIPE_SIZE_FIXED,   /**< Request a fixed capacity */
+  PIPE_SIZE_AUTO     /**< Grow while pipelines keep stalling on pipes */
+} pipe_size_mode_t;
+
+/**
+ * @brief Choose how new pipes are sized
+ * @param mode Sizing mode
+ * @param bytes Capacity for PIPE_SIZE_FIXED (ignored otherwise)
+ */
+void pipe_size_set(pipe_size_mode_t mode, size_t bytes);
+
+/**
+ * @brief Size a freshly created pipe according to the current mode
+ *
+ * Sizes above what the kernel allows are reduced until accepted.
+ *
+ * @param fd Either end of the pipe
+ */
+void pipe_size_apply(int fd);
+
+/**
+ * @brief Feed a finished foreground job to adaptive sizing
+ *
+ * In auto mode the size doubles (up to 1 MiB) after a pipeline whose
+ * processes spent their time switching in and out on the pipes.
+ *
+ * @param job Job whose processes have all been reaped
+ */
+void pipe_size_observe(const job_t *job);
+
+/**
+ * @brief Print the sizing mode and the effective size of the last pipe
+ * @param out Output stream
+ */
+void pipe_size_print(FILE *out);
+
+/**
+ * @brief Resources set -o can limit for spawned stages
+ */
+typedef enum {
+  LIMIT_CPU,    /**< CPU seconds (RLIMIT_CPU) */
+  LIMIT_AS,     /**< Address space in bytes (RLIMIT_AS) */
+  LIMIT_NOFILE, /**< Open descriptors (RLIMIT_NOFILE) */
+  LIMIT_COUNT   /**< Number of resources */
+} limit_resource_t;
+
+/**
+ * @brief Limit a resource for every stage launched from now on
+ *
+ * The value becomes both the soft and the hard limit of the stage, so it
+ * cannot raise it again. The shell itself is not limited.
+ *
+ * @param resource Resource to limit
+ * @param value Limit, or RLIM_INFINITY to stop limiting it
+ */
+void limits_set(limit_resource_t resource, rlim_t value);
+
+/**
+ * @brief Get the set -o option name of a resource limit
+ */
+const char *limits_name(limit_resource_t resource);
+
+/**
+ * @brief Start every stage launched from now on in a cgroup v2 directory
+ * @param dir Cgroup directory, or NULL to leave stages in the shell's cgroup
+ * @return 0 on success, -1 if dir cannot be opened (errno set) or is not
+ * on a cgroup v2 file system (errno EINVAL)
+ */
+int limits_set_cgroup(const char *dir);
+
+/**
+ * @brief Check whether stages get limits or a cgroup
+ *
+ * posix_spawn cannot set either, so such stages take the fork path, and
+ * cat or tee stages are not moved in-process.
+ */
+bool limits_active(void);
+
+/**
+ * @brief Fork a stage, straight into the chosen cgroup if there is one
+ *
+ * Uses clone3 with CLONE_INTO_CGROUP, so the child never runs outside the
+ * cgroup; kernels without it get a plain fork and the child moves itself
+ * from limits_apply.
+ *
+ * @return As fork
+ */
+pid_t limits_fork(void);
+
+/**
+ * @brief Apply the limits in a child forked by limits_fork, before it execs
+ * @return 0 on success, -1 on error (message printed)
+ */
+int limits_apply(void);
+
+/**
+ * @brief Print the limits and the cgroup in the format of set -o
+ * @param out Output stream
+ */
+void limits_print(FILE *out);
+
+/**
+ * @brief Timing of one foreground pipeline run, for time and stats output
+ *
+ * Per-process timestamps and usage live in the job; this holds what only
+ * execute_pipeline knows.
+ */
+typedef struct {
+  struct timespec start;        /**< Before the first stage was launched */
+  struct timespec end;          /**< After every stage finished */
+  size_t inline_stage;          /**< Stage the shell ran itself, or
+                                     num_commands if none */
+  struct timespec inline_start; /**< When the shell started that stage */
+  struct timespec inline_end;   /**< When the shell finished it */
+  struct rusage inline_usage;   /**< Shell CPU and switches spent on it */
+  int inline_status;            /**< Exit status of that stage */
+} pipeline_run_t;
+
+/**
+ * @brief Check whether a pipeline's run must be reported
+ *
+ * True for "time" pipelines, with set -o stats, or when a trace file is
+ * open. SHELL_TRACE in the environment opens a trace file on first use.
+ *
+ * @param pipeline Pipeline about to run
+ */
+bool stats_wanted(const pipeline_t *pipeline);
+
+/**
+ * @brief Report a finished foreground pipeline
+ *
+ * "time" prints real/user/sys to stderr, stats mode prints one line per
+ * stage (launch, exec and exit times, CPU, max RSS, context switches) and
+ * the trace file gets one JSON object per pipeline.
+ *
+ * @param pipeline Pipeline that ran
+ * @param job Job holding its processes (all reaped)
+ * @param run Timing collected by execute_pipeline
+ * @param status Exit status of the pipeline
+ */
+void stats_report(const pipeline_t *pipeline, const job_t *job,
+                  const pipeline_run_t *run, int status);
+
+/**
+ * @brief Turn the per-stage stats table on or off (set -o stats)
+ */
+void stats_set_enabled(bool enabled);
+
+/**
+ * @brief Append JSON lines traces to path, or stop tracing if path is NULL
+ * @return 0 on success, -1 if the file cannot be opened
+ */
+int stats_set_trace(const char *path);
+
+/**
+ * @brief Print the stats and trace settings in the format of set -o
+ * @param out Output stream
+ */
+void stats_print(FILE *out);
+
+/**
+ * @brief Hot-path phases with latency histograms (SHELL_PROFILE=1)
+ */
+typedef enum {
+  PROFILE_LOOKUP, /**< parse_cache_parse, hits included */
+  PROFILE_PARSE,  /**< Tokenizing and parsing one line (cache misses) */
+  PROFILE_SPAWN,  /**< Launching one process until the launch returns */
+  PROFILE_WAIT,   /**< Waiting for a foreground job */
+  PROFILE_NUM_PHASES
+} profile_phase_t;
+
+/**
+ * @brief Turn profiling on if SHELL_PROFILE is set to a non-empty value
+ * other than "0"; the counters are then printed to stderr at exit
+ */
+void profile_init(void);
+
+/**
+ * @brief Start timing a phase
+ * @param start Receives the start time when profiling is on
+ * @return true if profiling is on and profile_stop must follow
+ */
+bool profile_start(struct timespec *start);
+
+/**
+ * @brief Finish timing a phase started with profile_start
+ * @param phase Phase to charge
+ * @param start Time filled in by profile_start
+ */
+void profile_stop(profile_phase_t phase, const struct timespec *start);
+
+/**
+ * @brief Add one sample to a phase's histogram
+ * @param phase Phase to charge
+ * @param ns Duration in nanoseconds
+ */
+void profile_record(profile_phase_t phase, uint64_t ns);
+
+/**
+ * @brief Estimate a percentile of a phase (within about 6%)
+ * @param phase Phase to query
+ * @param percent Percentile between 0 and 100
+ * @return Duration in nanoseconds, or 0 without samples
+ */
+uint64_t profile_percentile(profile_phase_t phase, double percent);
+
+/**
+ * @brief Check whether profiling is on
+ */
+bool profile_enabled(void);
+
+/**
+ * @brief Print one line per phase: count, total, mean, p50, p99 and max
+ * @param out Output stream
+ */
+void profile_print(FILE *out);
+
+/**
+ * @brief Forget all samples
+ */
+void profile_reset(void);
+
+/**
+ * @brief Startup phases timed by --startup-profile
+ */
+typedef enum {
+  STARTUP_SIGNALS,    /**< Signal handlers and the child reaper */
+  STARTUP_TERMINAL,   /**< Line editor setup */
+  STARTUP_HISTORY,    /**< Opening history and mapping its index */
+  STARTUP_PATH_CACHE, /**< First PATH search, which creates the cache */
+  STARTUP_NUM_PHASES
+} startup_phase_t;
+
+/**
+ * @brief Turn startup timing on; call first thing in main
+ */
+void startup_profile_enable(void);
+
+/**
+ * @brief Start timing a startup phase
+ * @param start Receives the start time when startup timing is on
+ * @return true if startup timing is on and startup_profile_stop must follow
+ */
+bool startup_profile_start(struct timespec *start);
+
+/**
+ * @brief Finish timing a startup phase; only its first run counts
+ *
+ * A phase that ends after startup_profile_report is printed on its own.
+ * @param phase Phase to charge
+ * @param start Time filled in by startup_profile_start
+ */
+void startup_profile_stop(startup_phase_t phase, const struct timespec *start);
+
+/**
+ * @brief Print the startup breakdown, once, when the first command can be
+ * read; phases that have not run yet are listed as "not yet"
+ * @param out Output stream, also used for phases that finish later
+ */
+void startup_profile_report(FILE *out);
+
+/**
+ * @brief Handler for a builtin command
+ * @param argv Argument vector (argv[0] is the builtin's name)
+ * @return Exit status
+ */
+typedef int (*builtin_fn)(char **argv);
+
+/**
+ * @brief Entry in the builtin registry
+ */
+typedef struct {
+  const char *name; /**< Command name */
+  builtin_fn fn;    /**< Handler */
+} builtin_t;
+
+/**
+ * @brief Find the builtin called name
+ *
+ * A NAME=value word finds the assignment builtin, which sets variables.
+ *
+ * @param name Command name (argv[0])
+ * @return Registry entry, or NULL if name is not a builtin
+ */
+const builtin_t *builtin_lookup(const char *name);
+
+/**
+ * @brief Get the name of a builtin by its position in the registry
+ * @param index Position, from 0
+ * @return Name, or NULL past the last builtin
+ */
+const char *builtin_name(size_t index);
+
+/**
+ * @brief Check whether the exit builtin has asked the shell to leave
+ * @param status Output exit status (may be NULL)
+ * @return true if the shell should exit
+ */
+bool builtin_exit_requested(int *status);
+
+/**
+ * @brief Buffered line reader over a file descriptor
+ *
+ * Input is read in large chunks and lines are handed out as spans of the
+ * internal buffer, so there is no limit on line length and no per-line copy.
+ */
+typedef struct {
+  int fd;          /**< Descriptor being read */
+  char *buf;       /**< Buffered bytes (NULL until the first read) */
+  size_t capacity; /**< Allocated size of buf */
+  size_t start;    /**< Offset of the first unconsumed byte */
+  size_t end;      /**< Offset just past the last buffered byte */
+  bool eof;        /**< read() has reported end of file */
+} input_t;
+
+/**
+ * @brief Prepare a reader for fd (no memory is allocated yet)
+ * @param in Reader to initialize
+ * @param fd Descriptor to read from
+ */
+void input_init(input_t *in, int fd);
+
+/**
+ * @brief Free the reader's buffer
+ * @param in Reader to release
+ */
+void input_free(input_t *in);
+
+/**
+ * @brief Get the next line without its newline
+ *
+ * The line is NUL-terminated inside the reader's buffer and may be modified
+ * in place; it stays valid until the next call. A final line without a
+ * trailing newline is returned as well.
+ *
+ * @param in Reader
+ * @param line Output start of the line
+ * @param len Output length of the line
+ * @return 1 if a line was read, 0 at end of file, -1 on error (errno set)
+ */
+int input_read_line(input_t *in, char **line, size_t *len);
+
+/**
+ * @brief One tab completion candidate
+ */
+typedef struct {
+  const char *name; /**< Name without the directory part */
+  bool dir;         /**< The name is a directory */
+} complete_match_t;
+
+/**
+ * @brief Candidates for the word being completed
+ */
+typedef struct {
+  const complete_match_t *matches; /**< Sorted candidates, no repeats */
+  size_t count;                    /**< Number of candidates */
+  size_t prefix_len;               /**< Word bytes after the last slash */
+  bool pending;                    /**< Some directories still listing */
+} complete_result_t;
+
+/**
+ * @brief Tab completion counters
+ */
+typedef struct {
+  unsigned long listers; /**< Directory listers started */
+  unsigned long scans;   /**< Queries that scanned the listings */
+  unsigned long refines; /**< Queries that narrowed the last candidates */
+} complete_stats_t;
+
+/**
+ * @brief Find the completions of a word
+ *
+ * The first word of a command completes builtins, hashed commands and the
+ * executables on PATH; any other word, or one with a slash, completes
+ * names in its directory. Directories are listed in the background: what
+ * has not arrived yet is missing from the result and flagged as pending,
+ * and complete_fds() tells what to poll for the rest.
+ *
+ * @param word Word before the cursor, with quoting removed
+ * @param len Length of the word
+ * @param command The word is in command position
+ * @param result Output candidates, valid until the next complete_* call
+ * @return 0 on success, -1 on allocation failure
+ */
+int complete_query(const char *word, size_t len, bool command,
+                   complete_result_t *result);
+
+/**
+ * @brief Get the pipes of the directory listings still arriving
+ * @param fds Output descriptors to poll for reading
+ * @param max Capacity of fds
+ * @return Number of descriptors stored
+ */
+size_t complete_fds(int *fds, size_t max);
+
+/**
+ * @brief Take in whatever the listers have written so far, without blocking
+ * @return true if any listing changed (new names or finished)
+ */
+bool complete_progress(void);
+
+/**
+ * @brief Start a new line: forget file listings, keep recent PATH listings
+ */
+void complete_new_line(void);
+
+/**
+ * @brief Drop every listing and candidate (counters are kept)
+ */
+void complete_clear(void);
+
+/**
+ * @brief Get the completion counters
+ * @param stats Output counters
+ */
+void complete_stats(complete_stats_t *stats);
+
+/**
+ * @brief Take over a terminal for line editing
+ * @param in_fd Terminal the keys are read from
+ * @param out_fd Terminal the line is drawn on
+ * @return 0 on success, -1 if in_fd is not a terminal that can be edited on
+ */
+int lineedit_init(int in_fd, int out_fd);
+
+/**
+ * @brief Read one line with editing, history search and tab completion
+ *
+ * The terminal is in raw mode only while the line is being edited. Keys
+ * are handled while directories for a completion are still being listed.
+ *
+ * @param prompt Prompt drawn before the line
+ * @param line Output line, NUL-terminated, valid until the next call
+ * @param len Output length of the line
+ * @return 1 if a line was read, 0 at end of input (Ctrl+D on an empty
+ * line), -1 on error (errno set)
+ */
+int lineedit_read(const char *prompt, char **line, size_t *len);
+
+/**
+ * @brief Release the editor's buffers and completion listings
+ */
+void lineedit_free(void);
+
+/**
+ * @brief Get the exit status of the most recent pipeline
+ * @return Exit status
+ */
+int shell_last_status(void);
+
+/**
+ * @brief Output of a command substitution, mapped from the memory file
+ * the commands wrote it into
+ */
+typedef struct {
+  const char *data; /**< Output, or NULL if there was none */
+  size_t len;       /**< Bytes of output without its trailing newlines */
+  size_t mapped;    /**< Bytes mapped at data (for munmap) */
+} capture_t;
+
+/**
+ * @brief Run commands in a subshell and capture their standard output
+ *
+ * The subshell writes into an anonymous memory file, which is mapped once
+ * it has exited, so the output is never read or copied by the shell.
+ *
+ * @param commands Commands, as written between $( and ) or backquotes
+ * @param len Length of commands
+ * @param out Output mapping (unmap with munmap when mapped is nonzero)
+ * @return Exit status of the commands, or -1 if they could not be run
+ */
+int shell_substitute(const char *commands, size_t len, capture_t *out);
+
+/**
+ * @brief Get the status of the last command substitution in the current
+ * pipeline, which a command of nothing but assignments returns
+ * @return Exit status, or 0 if no substitution has run
+ */
+int shell_substitution_status(void);
+
+/**
+ * @brief Check whether SIGINT arrived since the current line started
+ * @return true if the user pressed Ctrl+C
+ */
+bool shell_interrupted(void);
 
 /**
  * @brief Main shell REPL loop
@@ -70,6 +1270,24 @@ int execute_pipeline(pipeline_t *pipeline);
  */
 int shell_main(void);
 
+/**
+ * @brief Run a script file without prompting
+ *
+ * Regular files are memory-mapped and parsed line by line straight out of
+ * the mapping; anything else (pipes, devices) is read through input_t.
+ *
+ * @param path Script to run
+ * @return Exit status of the last command, 127 if the file cannot be opened
+ */
+int shell_run_file(const char *path);
+
+/**
+ * @brief Run newline-separated commands given as a string (shell -c)
+ * @param commands Commands to run
+ * @return Exit status of the last command
+ */
+int shell_run_string(const char *commands);
+
 /**
  * @brief Setup signal handlers for the shell
  */
@@ -0,0 +1,143 @@
+/**
+ * @file arena.c
+ * @brief Bump allocator used to hold all memory owned by a pipeline
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "shell.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Alignment of every allocation handed out by the arena
+ */
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+/**
+ * @brief Smallest block the arena will request from malloc
+ */
+#define ARENA_MIN_BLOCK 512
+
+/**
+ * @brief Largest block kept around for reuse after an arena is released
+ */
+#define ARENA_SPARE_MAX (64 * 1024)
+
+/**
+ * @brief Round a size up to the arena alignment
+ */
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/**
+ * @brief Size of the block header, padded so data stays aligned
+ */
+#define ARENA_HEADER ARENA_ROUND(sizeof(arena_block_t))
+
+/**
+ * @brief One released block recycled by the next arena that needs memory
+ *
+ * The shell parses one line at a time, so keeping a single block makes
+ * steady-state parsing allocation-free. Arenas are not thread-safe.
+ */
+static arena_block_t *g_spare_block = NULL;
+
+/**
+ * @brief Get the first usable byte of a block
+ */
+static unsigned char *block_data(arena_block_t *block) {
+  return (unsigned char *)block + ARENA_HEADER;
+}
+
+/**
+ * @brief Allocate a fresh block and push it on the arena
+ * @param arena Arena to grow
+ * @param min_size Minimum number of usable bytes required
+ * @return 0 on success, -1 on allocation failure
+ */
+static int arena_grow(arena_t *arena, size_t min_size) {
+  size_t size = ARENA_MIN_BLOCK;
+
+  // Grow geometrically so long inputs need only a few blocks
+  if (arena->head && arena->head->size * 2 > size)
+    size = arena->head->size * 2;
+  if (min_size > size)
+    size = ARENA_ROUND(min_size);
+
+  arena_block_t *block;
+  if (g_spare_block && g_spare_block->size >= min_size) {
+    block = g_spare_block;
+    g_spare_block = NULL;
+  } else {
+    block = malloc(ARENA_HEADER + size);
+    if (!block)
+      return -1;
+    block->size = size;
+  }
+
+  block->next = arena->head;
+  block->used = 0;
+  arena->head = block;
+  return 0;
+}
+
+int arena_reserve(arena_t *arena, size_t bytes) {
+  if (!arena)
+    return -1;
+
+  if (arena->head && arena->head->size - arena->head->used >= bytes)
+    return 0;
+
+  return arena_grow(arena, bytes);
+}
+
+void *arena_alloc(arena_t *arena, size_t bytes) {
+  if (!arena)
+    return NULL;
+
+  bytes = ARENA_ROUND(bytes ? bytes : 1);
+  if (arena_reserve(arena, bytes) == -1)
+    return NULL;
+
+  arena_block_t *block = arena->head;
+  void *ptr = block_data(block) + block->used;
+  block->used += bytes;
+  return ptr;
+}
+
+char *arena_strndup(arena_t *arena, const char *str, size_t len) {
+  char *copy = arena_alloc(arena, len + 1);
+  if (!copy)
+    return NULL;
+
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+void arena_release(arena_t *arena) {
+  if (!arena)
+    return;
+
+  arena_block_t *block = arena->head;
+  while (block) {
+    arena_block_t *next = block->next;
+
+    // Keep the largest reasonably sized block for the next arena
+    if (block->size <= ARENA_SPARE_MAX &&
+        (!g_spare_block || g_spare_block->size < block->size)) {
+      free(g_spare_block);
+      g_spare_block = block;
+    } else {
+      free(block);
+    }
+    block = next;
+  }
+  arena->head = NULL;
+}
+
+void arena_trim(void) {
+  free(g_spare_block);
+  g_spare_block = NULL;
+}
@@ -0,0 +1,889 @@
+/**
+ * @file builtins.c
+ * @brief Commands executed inside the shell process
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "shell.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool g_exit_requested = false;
+static int g_exit_status = 0;
+
+/**
+ * @brief Parse a decimal integer argument
+ * @param str String to parse
+ * @param value Output value
+ * @return 0 on success, -1 if str is not a valid integer
+ */
+static int parse_int(const char *str, long *value) {
+  char *end;
+  errno = 0;
+  *value = strtol(str, &end, 10);
+  if (errno != 0 || end == str || *end != '\0')
+    return -1;
+  return 0;
+}
+
+/**
+ * @brief Built-in : and true: do nothing, successfully
+ */
+static int builtin_true(char **argv) {
+  (void)argv;
+  return 0;
+}
+
+/**
+ * @brief Built-in false: do nothing, unsuccessfully
+ */
+static int builtin_false(char **argv) {
+  (void)argv;
+  return 1;
+}
+
+/**
+ * @brief Built-in cd: change the shell's working directory
+ *
+ * With no argument changes to $HOME; "cd -" changes to $OLDPWD and prints
+ * it. PWD and OLDPWD are kept up to date.
+ */
+static int builtin_cd(char **argv) {
+  const char *dir = argv[1];
+  bool print_dir = false;
+
+  if (!dir) {
+    dir = vars_get("HOME");
+    if (!dir) {
+      fprintf(stderr, "cd: HOME not set\n");
+      return 1;
+    }
+  } else if (strcmp(dir, "-") == 0) {
+    dir = vars_get("OLDPWD");
+    if (!dir) {
+      fprintf(stderr, "cd: OLDPWD not set\n");
+      return 1;
+    }
+    print_dir = true;
+  }
+
+  char old_cwd[PATH_MAX];
+  bool have_old = getcwd(old_cwd, sizeof(old_cwd)) != NULL;
+
+  if (chdir(dir) == -1) {
+    fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+    return 1;
+  }
+
+  if (have_old && (vars_set("OLDPWD", old_cwd) == -1 ||
+                   vars_export("OLDPWD") == -1))
+    perror("cd: OLDPWD");
+
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd))) {
+    if (vars_set("PWD", cwd) == -1 || vars_export("PWD") == -1)
+      perror("cd: PWD");
+    if (print_dir)
+      printf("%s\n", cwd);
+  }
+  return 0;
+}
+
+/**
+ * @brief Built-in echo: print arguments separated by spaces
+ *
+ * A leading -n suppresses the trailing newline.
+ */
+static int builtin_echo(char **argv) {
+  int i = 1;
+  bool newline = true;
+  if (argv[1] && strcmp(argv[1], "-n") == 0) {
+    newline = false;
+    i++;
+  }
+
+  for (; argv[i]; i++) {
+    fputs(argv[i], stdout);
+    if (argv[i + 1])
+      putchar(' ');
+  }
+  if (newline)
+    putchar('\n');
+
+  if (fflush(stdout) == EOF) {
+    perror("echo");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Built-in exit: leave the shell
+ *
+ * Without an argument the shell exits with the status of the last
+ * pipeline. The REPL notices the request after the pipeline finishes.
+ */
+static int builtin_exit(char **argv) {
+  long status = shell_last_status();
+
+  if (argv[1] && parse_int(argv[1], &status) == -1) {
+    fprintf(stderr, "exit: %s: numeric argument required\n", argv[1]);
+    status = 2;
+  }
+
+  g_exit_requested = true;
+  g_exit_status = (int)(status & 0xff);
+  return g_exit_status;
+}
+
+/**
+ * @brief Built-in hash: inspect and manage the PATH lookup cache
+ *
+ * With no arguments the cache is listed, -r empties it, -d forgets the named
+ * commands and any other arguments are looked up and remembered.
+ */
+static int builtin_hash(char **argv) {
+  if (!argv[1]) {
+    path_cache_print(stdout);
+    return 0;
+  }
+
+  int status = 0;
+  bool forget = false;
+  for (int i = 1; argv[i]; i++) {
+    if (strcmp(argv[i], "-r") == 0) {
+      path_cache_clear();
+    } else if (strcmp(argv[i], "-d") == 0) {
+      forget = true;
+    } else if (forget) {
+      path_cache_forget(argv[i]);
+    } else if (!path_cache_lookup(argv[i])) {
+      fprintf(stderr, "hash: %s: not found\n", argv[i]);
+      status = 1;
+    }
+  }
+  return status;
+}
+
+/**
+ * @brief Print one history entry with its number
+ */
+static void print_history_entry(size_t index) {
+  size_t len;
+  const char *entry = history_get(index, &len);
+  if (entry)
+    printf("%5zu  %.*s\n", index + 1, (int)len, entry);
+}
+
+/**
+ * @brief Built-in history: list or search the command history
+ *
+ * "history" lists every entry, "history N" the last N; -p TEXT lists the
+ * entries starting with TEXT and -s TEXT those containing it.
+ */
+static int builtin_history(char **argv) {
+  size_t count = history_count();
+  if (argv[1] && (strcmp(argv[1], "-p") == 0 || strcmp(argv[1], "-s") == 0)) {
+    if (!argv[2]) {
+      fprintf(stderr, "history: %s: search text expected\n", argv[1]);
+      return 2;
+    }
+
+    // Matches come newest first; print them oldest first
+    history_match_t match = argv[1][1] == 'p' ? HISTORY_PREFIX
+                                              : HISTORY_SUBSTRING;
+    size_t *found = NULL;
+    size_t num_found = 0, cap = 0;
+    for (size_t at = count;
+         history_search(argv[2], strlen(argv[2]), match, &at);) {
+      if (num_found == cap) {
+        cap = cap ? cap * 2 : 64;
+        size_t *grown = realloc(found, cap * sizeof(size_t));
+        if (!grown) {
+          perror("history");
+          free(found);
+          return 1;
+        }
+        found = grown;
+      }
+      found[num_found++] = at;
+    }
+    while (num_found > 0)
+      print_history_entry(found[--num_found]);
+    free(found);
+    return 0;
+  }
+
+  long last = (long)count;
+  if (argv[1] && (parse_int(argv[1], &last) == -1 || last < 0)) {
+    fprintf(stderr, "history: %s: invalid option\n", argv[1]);
+    return 2;
+  }
+  size_t start = (size_t)last < count ? count - (size_t)last : 0;
+  for (size_t i = start; i < count; i++)
+    print_history_entry(i);
+  return 0;
+}
+
+/**
+ * @brief Built-in jobs: list background jobs and their state
+ */
+static int builtin_jobs(char **argv) {
+  (void)argv;
+  jobs_print(stdout);
+  return 0;
+}
+
+/**
+ * @brief Find the job named by a fg or bg argument, or the current job
+ * @param name Builtin name for error messages
+ * @param spec "%n" job number, process ID, or NULL for the current job
+ * @return Job, or NULL with a message printed
+ */
+static job_t *control_job(const char *name, const char *spec) {
+  if (jobs_terminal() == -1) {
+    fprintf(stderr, "%s: no job control\n", name);
+    return NULL;
+  }
+  job_t *job = spec ? jobs_find(spec) : jobs_current();
+  if (!job)
+    fprintf(stderr, "%s: %s: no such job\n", name, spec ? spec : "current");
+  return job;
+}
+
+/**
+ * @brief Built-in fg: continue a job in the foreground and wait for it
+ *
+ * Without an argument the job that stopped or went to the background last
+ * is used. Returns the job's status, 148 if it stops again.
+ */
+static int builtin_fg(char **argv) {
+  job_t *job = control_job("fg", argv[1]);
+  if (!job)
+    return 1;
+
+  printf("%s\n", job->command);
+  fflush(stdout);
+  int status = jobs_foreground(job, true);
+  if (jobs_is_done(job))
+    jobs_remove(job);
+  return status;
+}
+
+/**
+ * @brief Built-in bg: let stopped jobs continue in the background
+ *
+ * Arguments are "%n" job numbers or process IDs; without one the current
+ * job is continued.
+ */
+static int builtin_bg(char **argv) {
+  int status = 0;
+  int i = 1;
+  do {
+    job_t *job = control_job("bg", argv[i]);
+    if (job && jobs_background(job) == 0)
+      printf("[%d]  %s &\n", job->id, job->command);
+    else
+      status = 1;
+  } while (argv[i] && argv[++i]);
+  return status;
+}
+
+/**
+ * @brief Built-in wait: wait for background jobs to finish
+ *
+ * Without arguments waits for every background job. Arguments are "%n"
+ * job numbers or process IDs; the status of the last one is returned.
+ */
+static int builtin_wait(char **argv) {
+  if (!argv[1])
+    return jobs_wait_all();
+
+  int status = 0;
+  for (int i = 1; argv[i]; i++) {
+    job_t *job = jobs_find(argv[i]);
+    if (!job) {
+      fprintf(stderr, "wait: %s: no such job\n", argv[i]);
+      status = 127;
+      continue;
+    }
+    status = jobs_wait(job);
+    if (jobs_is_done(job))
+      jobs_remove(job);
+  }
+  return status;
+}
+
+/**
+ * @brief Built-in parallel: run one job per input, N at a time
+ *
+ * parallel [-j N] [-g | -k] [command [args]] [::: inputs]. Inputs are the
+ * words after ::: or else the lines of stdin. With a command, {} in its
+ * words is replaced by the input (or the input is appended); without one,
+ * every input is a command line. -j defaults to the number of online CPUs,
+ * -g keeps each job's output together and -k also keeps input order.
+ */
+static int builtin_parallel(char **argv) {
+  parallel_opts_t opts = {0, false, false, NULL, 0, NULL};
+  int i = 1;
+  for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+    const char *opt = argv[i];
+    if (strcmp(opt, "--") == 0) {
+      i++;
+      break;
+    }
+    if (strcmp(opt, "-g") == 0) {
+      opts.group = true;
+    } else if (strcmp(opt, "-k") == 0) {
+      opts.group = opts.keep_order = true;
+    } else if (strncmp(opt, "-j", 2) == 0) {
+      const char *value = opt[2] ? opt + 2 : argv[++i];
+      if (!value || parse_int(value, &opts.jobs) == -1 || opts.jobs < 1) {
+        fprintf(stderr, "parallel: -j: %s: invalid job count\n",
+                value ? value : "");
+        return 2;
+      }
+    } else {
+      fprintf(stderr, "parallel: %s: invalid option\n", opt);
+      return 2;
+    }
+  }
+
+  opts.command = &argv[i];
+  for (; argv[i]; i++) {
+    if (strcmp(argv[i], ":::") == 0) {
+      opts.inputs = &argv[i + 1];
+      break;
+    }
+    opts.command_len++;
+  }
+  return parallel_run(&opts);
+}
+
+/**
+ * @brief Built-in parsecache: report and tune the parse cache
+ *
+ * With no arguments prints the counters; -r forgets cached pipelines and
+ * resets the counters, -s N changes the number of cached pipelines.
+ */
+static int builtin_parsecache(char **argv) {
+  for (int i = 1; argv[i]; i++) {
+    if (strcmp(argv[i], "-r") == 0) {
+      parse_cache_clear();
+      parse_cache_reset_stats();
+    } else if (strcmp(argv[i], "-s") == 0) {
+      long size;
+      if (!argv[i + 1] || parse_int(argv[i + 1], &size) == -1 || size < 0) {
+        fprintf(stderr, "parsecache: -s: size expected\n");
+        return 2;
+      }
+      parse_cache_resize((size_t)size);
+      i++;
+    } else {
+      fprintf(stderr, "parsecache: %s: invalid option\n", argv[i]);
+      return 2;
+    }
+  }
+
+  if (argv[1])
+    return 0;
+
+  parse_cache_stats_t stats;
+  parse_cache_stats(&stats);
+  unsigned long lookups = stats.hits + stats.misses;
+  printf("hits\t%lu\nmisses\t%lu\nevictions\t%lu\nentries\t%zu/%zu\n",
+         stats.hits, stats.misses, stats.evictions, stats.entries,
+         stats.capacity);
+  printf("hit rate\t%.1f%%\n",
+         lookups ? 100.0 * (double)stats.hits / (double)lookups : 0.0);
+  return 0;
+}
+
+/**
+ * @brief Built-in pwd: print the working directory
+ */
+static int builtin_pwd(char **argv) {
+  (void)argv;
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd))) {
+    perror("pwd");
+    return 1;
+  }
+  printf("%s\n", cwd);
+  return 0;
+}
+
+/**
+ * @brief Parse a byte count with an optional k, m or g suffix
+ * @return 0 on success, -1 if str is not a positive size up to max
+ */
+static int parse_size(const char *str, size_t max, size_t *bytes) {
+  char *end;
+  errno = 0;
+  long value = strtol(str, &end, 10);
+  if (errno != 0 || end == str || value <= 0)
+    return -1;
+
+  long scale = 1;
+  if (*end == 'k' || *end == 'K')
+    scale = 1024;
+  else if (*end == 'm' || *end == 'M')
+    scale = 1024 * 1024;
+  else if (*end == 'g' || *end == 'G')
+    scale = 1024 * 1024 * 1024;
+  if (scale != 1)
+    end++;
+  if (*end != '\0' || (size_t)value > max / (size_t)scale)
+    return -1;
+
+  *bytes = (size_t)(value * scale);
+  return 0;
+}
+
+/**
+ * @brief Built-in shellstats: print the hot-path latency histograms
+ *
+ * Only available when the shell was started with SHELL_PROFILE=1; -r
+ * forgets the samples collected so far.
+ */
+static int builtin_shellstats(char **argv) {
+  if (!profile_enabled()) {
+    fprintf(stderr, "shellstats: profiling is off (start with "
+                    "SHELL_PROFILE=1)\n");
+    return 1;
+  }
+
+  if (argv[1] && strcmp(argv[1], "-r") == 0 && !argv[2]) {
+    profile_reset();
+    return 0;
+  }
+  if (argv[1]) {
+    fprintf(stderr, "shellstats: %s: invalid option\n", argv[1]);
+    return 2;
+  }
+
+  profile_print(stdout);
+  return 0;
+}
+
+/**
+ * @brief Find the resource limit a set -o option is about
+ * @param option Option as given, NAME or NAME=value
+ * @param value Set to the text after =, or NULL if there is none
+ * @return The resource, or LIMIT_COUNT if option is not a limit
+ */
+static limit_resource_t limit_option(const char *option, const char **value) {
+  for (int i = 0; i < LIMIT_COUNT; i++) {
+    const char *name = limits_name((limit_resource_t)i);
+    size_t len = strlen(name);
+    if (strncmp(option, name, len) == 0 &&
+        (option[len] == '\0' || option[len] == '=')) {
+      *value = option[len] ? option + len + 1 : NULL;
+      return (limit_resource_t)i;
+    }
+  }
+  *value = NULL;
+  return LIMIT_COUNT;
+}
+
+/**
+ * @brief Built-in set: change shell options
+ *
+ * Supports -o pipesize=N|auto|default, -o stats, -o trace=FILE,
+ * -o limit-cpu=SECONDS, -o limit-as=SIZE, -o limit-nofile=N,
+ * -o cgroup=DIR and the matching +o forms; "set -o" lists the current
+ * settings.
+ */
+static int builtin_set(char **argv) {
+  if (!argv[1] || (strcmp(argv[1], "-o") == 0 && !argv[2])) {
+    pipe_size_print(stdout);
+    stats_print(stdout);
+    limits_print(stdout);
+    return 0;
+  }
+
+  for (int i = 1; argv[i]; i++) {
+    bool enable = strcmp(argv[i], "-o") == 0;
+    if (!enable && strcmp(argv[i], "+o") != 0) {
+      fprintf(stderr, "set: %s: invalid option\n", argv[i]);
+      return 2;
+    }
+
+    const char *option = argv[++i];
+    if (!option) {
+      fprintf(stderr, "set: option name expected\n");
+      return 2;
+    }
+
+    size_t bytes;
+    const char *limit_value;
+    limit_resource_t resource = limit_option(option, &limit_value);
+    if (!enable && strcmp(option, "pipesize") == 0) {
+      pipe_size_set(PIPE_SIZE_DEFAULT, 0);
+    } else if (enable && strncmp(option, "pipesize=", 9) == 0) {
+      const char *value = option + 9;
+      if (strcmp(value, "auto") == 0) {
+        pipe_size_set(PIPE_SIZE_AUTO, 0);
+      } else if (strcmp(value, "default") == 0) {
+        pipe_size_set(PIPE_SIZE_DEFAULT, 0);
+      } else if (parse_size(value, INT_MAX, &bytes) == 0) {
+        pipe_size_set(PIPE_SIZE_FIXED, bytes);
+      } else {
+        fprintf(stderr, "set: pipesize: %s: invalid size\n", value);
+        return 2;
+      }
+    } else if (strcmp(option, "stats") == 0) {
+      stats_set_enabled(enable);
+    } else if (!enable && strcmp(option, "trace") == 0) {
+      stats_set_trace(NULL);
+    } else if (enable && strncmp(option, "trace=", 6) == 0) {
+      if (stats_set_trace(option + 6) == -1) {
+        fprintf(stderr, "set: trace: %s: %s\n", option + 6, strerror(errno));
+        return 1;
+      }
+    } else if (!enable && resource != LIMIT_COUNT && !limit_value) {
+      limits_set(resource, RLIM_INFINITY);
+    } else if (enable && resource != LIMIT_COUNT && limit_value) {
+      // A size for the address space, a plain count otherwise
+      long count = 0;
+      bool valid = resource == LIMIT_AS
+                       ? parse_size(limit_value, SIZE_MAX, &bytes) == 0
+                       : parse_int(limit_value, &count) == 0 && count > 0;
+      if (!valid) {
+        fprintf(stderr, "set: %s: %s: invalid limit\n", limits_name(resource),
+                limit_value);
+        return 2;
+      }
+      limits_set(resource,
+                 resource == LIMIT_AS ? (rlim_t)bytes : (rlim_t)count);
+    } else if (!enable && strcmp(option, "cgroup") == 0) {
+      limits_set_cgroup(NULL);
+    } else if (enable && strncmp(option, "cgroup=", 7) == 0) {
+      if (limits_set_cgroup(option + 7) == -1) {
+        fprintf(stderr, "set: cgroup: %s: %s\n", option + 7,
+                errno == EINVAL ? "not a cgroup v2 directory"
+                                : strerror(errno));
+        return 1;
+      }
+    } else {
+      fprintf(stderr, "set: %s: invalid option name\n", option);
+      return 2;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Length of the name in a NAME=value word, or 0 if it is not one
+ */
+static size_t assignment_name_len(const char *word) {
+  const char *eq = strchr(word, '=');
+  if (!eq || !vars_valid_name(word, (size_t)(eq - word)))
+    return 0;
+  return (size_t)(eq - word);
+}
+
+/**
+ * @brief Set a variable from a NAME=value word
+ * @param word Assignment word
+ * @param len Length of NAME
+ * @param export Whether to export the variable as well
+ * @return 0 on success, 1 on failure
+ */
+static int assign(const char *word, size_t len, bool export) {
+  char *name = strndup(word, len);
+  int status = 0;
+  if (!name || vars_set(name, word + len + 1) == -1 ||
+      (export && vars_export(name) == -1)) {
+    perror(name ? name : "assignment");
+    status = 1;
+  }
+  free(name);
+  return status;
+}
+
+/**
+ * @brief NAME=value words as a command: set shell variables
+ *
+ * Assignments in front of another command (NAME=value cmd) are not
+ * supported and report an error instead of running cmd. The status is that
+ * of the last command substitution in the words, so x=$(cmd) || ... works.
+ */
+static int builtin_assign(char **argv) {
+  for (int i = 0; argv[i]; i++) {
+    size_t len = assignment_name_len(argv[i]);
+    if (len == 0) {
+      fprintf(stderr, "%s: assignments before a command are not "
+                      "supported\n", argv[0]);
+      return 1;
+    }
+    if (assign(argv[i], len, false) != 0)
+      return 1;
+  }
+  return shell_substitution_status();
+}
+
+/**
+ * @brief Built-in export: pass variables to commands
+ *
+ * "export NAME=value" sets and exports, "export NAME" exports an existing
+ * (or empty) variable; without arguments or with -p the exported variables
+ * are listed.
+ */
+static int builtin_export(char **argv) {
+  int first = argv[1] && strcmp(argv[1], "-p") == 0 ? 2 : 1;
+  if (!argv[first]) {
+    vars_print_exported(stdout);
+    return 0;
+  }
+
+  int status = 0;
+  for (int i = first; argv[i]; i++) {
+    size_t len = assignment_name_len(argv[i]);
+    if (len > 0) {
+      status |= assign(argv[i], len, true);
+    } else if (!vars_valid_name(argv[i], strlen(argv[i]))) {
+      fprintf(stderr, "export: %s: not a valid identifier\n", argv[i]);
+      status = 1;
+    } else if (vars_export(argv[i]) == -1) {
+      perror("export");
+      status = 1;
+    }
+  }
+  return status;
+}
+
+/**
+ * @brief Built-in unset: remove variables
+ */
+static int builtin_unset(char **argv) {
+  int status = 0;
+  for (int i = 1; argv[i]; i++) {
+    if (!vars_valid_name(argv[i], strlen(argv[i]))) {
+      fprintf(stderr, "unset: %s: not a valid identifier\n", argv[i]);
+      status = 1;
+      continue;
+    }
+    vars_unset(argv[i]);
+  }
+  return status;
+}
+
+/**
+ * @brief Evaluate a unary test primary
+ * @return 0 if true, 1 if false, 2 for an unknown operator
+ */
+static int test_unary(const char *op, const char *arg) {
+  struct stat st;
+
+  if (op[0] != '-' || op[1] == '\0' || op[2] != '\0')
+    return 2;
+
+  switch (op[1]) {
+  case 'n':
+    return arg[0] != '\0' ? 0 : 1;
+  case 'z':
+    return arg[0] == '\0' ? 0 : 1;
+  case 't': {
+    long fd;
+    return parse_int(arg, &fd) == 0 && isatty((int)fd) ? 0 : 1;
+  }
+  case 'h':
+  case 'L':
+    return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode) ? 0 : 1;
+  case 'r':
+    return access(arg, R_OK) == 0 ? 0 : 1;
+  case 'w':
+    return access(arg, W_OK) == 0 ? 0 : 1;
+  case 'x':
+    return access(arg, X_OK) == 0 ? 0 : 1;
+  default:
+    break;
+  }
+
+  if (!strchr("bcdefpsS", op[1]))
+    return 2;
+  if (stat(arg, &st) == -1)
+    return 1;
+
+  switch (op[1]) {
+  case 'b':
+    return S_ISBLK(st.st_mode) ? 0 : 1;
+  case 'c':
+    return S_ISCHR(st.st_mode) ? 0 : 1;
+  case 'd':
+    return S_ISDIR(st.st_mode) ? 0 : 1;
+  case 'f':
+    return S_ISREG(st.st_mode) ? 0 : 1;
+  case 'p':
+    return S_ISFIFO(st.st_mode) ? 0 : 1;
+  case 's':
+    return st.st_size > 0 ? 0 : 1;
+  case 'S':
+    return S_ISSOCK(st.st_mode) ? 0 : 1;
+  default:
+    return 0; // -e
+  }
+}
+
+/**
+ * @brief Evaluate a binary test primary
+ * @return 0 if true, 1 if false, 2 on error
+ */
+static int test_binary(const char *lhs, const char *op, const char *rhs) {
+  if (strcmp(op, "=") == 0)
+    return strcmp(lhs, rhs) == 0 ? 0 : 1;
+  if (strcmp(op, "!=") == 0)
+    return strcmp(lhs, rhs) != 0 ? 0 : 1;
+
+  static const char *const int_ops[] = {"-eq", "-ne", "-lt",
+                                        "-le", "-gt", "-ge"};
+  for (size_t i = 0; i < sizeof(int_ops) / sizeof(int_ops[0]); i++) {
+    if (strcmp(op, int_ops[i]) != 0)
+      continue;
+
+    long a, b;
+    if (parse_int(lhs, &a) == -1 || parse_int(rhs, &b) == -1) {
+      fprintf(stderr, "test: integer expression expected\n");
+      return 2;
+    }
+
+    bool result[] = {a == b, a != b, a < b, a <= b, a > b, a >= b};
+    return result[i] ? 0 : 1;
+  }
+
+  fprintf(stderr, "test: %s: binary operator expected\n", op);
+  return 2;
+}
+
+/**
+ * @brief Evaluate test arguments with the POSIX rules for up to four args
+ * @return 0 if true, 1 if false, 2 on error
+ */
+static int test_eval(int argc, char **argv) {
+  switch (argc) {
+  case 0:
+    return 1;
+  case 1:
+    return argv[0][0] != '\0' ? 0 : 1;
+  case 2: {
+    if (strcmp(argv[0], "!") == 0)
+      return test_eval(1, argv + 1) == 0 ? 1 : 0;
+    int result = test_unary(argv[0], argv[1]);
+    if (result == 2)
+      fprintf(stderr, "test: %s: unary operator expected\n", argv[0]);
+    return result;
+  }
+  case 3:
+    if (strcmp(argv[0], "!") == 0) {
+      int inner = test_eval(2, argv + 1);
+      return inner == 2 ? 2 : !inner;
+    }
+    if (strcmp(argv[0], "(") == 0 && strcmp(argv[2], ")") == 0)
+      return test_eval(1, argv + 1);
+    return test_binary(argv[0], argv[1], argv[2]);
+  case 4:
+    if (strcmp(argv[0], "!") == 0) {
+      int inner = test_eval(3, argv + 1);
+      return inner == 2 ? 2 : !inner;
+    }
+    break;
+  default:
+    break;
+  }
+
+  fprintf(stderr, "test: too many arguments\n");
+  return 2;
+}
+
+/**
+ * @brief Built-in test: evaluate a conditional expression
+ */
+static int builtin_test(char **argv) {
+  int argc = 0;
+  while (argv[argc + 1])
+    argc++;
+  return test_eval(argc, argv + 1);
+}
+
+/**
+ * @brief Built-in [: test with a mandatory closing bracket
+ */
+static int builtin_bracket(char **argv) {
+  int argc = 0;
+  while (argv[argc + 1])
+    argc++;
+
+  if (argc == 0 || strcmp(argv[argc], "]") != 0) {
+    fprintf(stderr, "[: missing ']'\n");
+    return 2;
+  }
+  return test_eval(argc - 1, argv + 1);
+}
+
+/**
+ * @brief Registry of builtins, sorted by name for binary search
+ */
+static const builtin_t g_builtins[] = {
+    {":", builtin_true},
+    {"[", builtin_bracket},
+    {"bg", builtin_bg},
+    {"cd", builtin_cd},
+    {"echo", builtin_echo},
+    {"exit", builtin_exit},
+    {"export", builtin_export},
+    {"false", builtin_false},
+    {"fg", builtin_fg},
+    {"hash", builtin_hash},
+    {"history", builtin_history},
+    {"jobs", builtin_jobs},
+    {"parallel", builtin_parallel},
+    {"parsecache", builtin_parsecache},
+    {"pwd", builtin_pwd},
+    {"set", builtin_set},
+    {"shellstats", builtin_shellstats},
+    {"test", builtin_test},
+    {"true", builtin_true},
+    {"unset", builtin_unset},
+    {"wait", builtin_wait},
+};
+
+/**
+ * @brief Pseudo-builtin for commands that start with NAME=value
+ */
+static const builtin_t g_assign = {"=", builtin_assign};
+
+/**
+ * @brief Compare a name against a registry entry for bsearch
+ */
+static int compare_builtin(const void *key, const void *entry) {
+  return strcmp(key, ((const builtin_t *)entry)->name);
+}
+
+const builtin_t *builtin_lookup(const char *name) {
+  if (!name)
+    return NULL;
+  if (assignment_name_len(name) > 0)
+    return &g_assign;
+
+  return bsearch(name, g_builtins, sizeof(g_builtins) / sizeof(g_builtins[0]),
+                 sizeof(g_builtins[0]), compare_builtin);
+}
+
+const char *builtin_name(size_t index) {
+  if (index >= sizeof(g_builtins) / sizeof(g_builtins[0]))
+    return NULL;
+  return g_builtins[index].name;
+}
+
+bool builtin_exit_requested(int *status) {
+  if (g_exit_requested && status)
+    *status = g_exit_status;
+  return g_exit_requested;
+}
@@ -0,0 +1,574 @@
+/**
+ * @file complete.c
+ * @brief Tab completion candidates from directories listed in the background
+ *
+ * Every directory a completion needs is listed by a short-lived child
+ * process that reads it through the glob directory reader and writes the
+ * names down a pipe. A directory on a slow or hung network mount therefore
+ * costs the editor one descriptor to poll, never a blocked keystroke.
+ * Listings are kept once they arrive: PATH directories for a minute, other
+ * directories until the next line, and a listing still on its way is
+ * never started twice.
+ *
+ * The candidates of the last query are remembered with its prefix. A query
+ * that only extends that prefix (one more letter, then Tab again) filters
+ * them instead of scanning the listings again, as long as no listing has
+ * changed in between.
+ */
+
+#define _GNU_SOURCE // pipe2
+
+#include "shell.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Seconds a listing of a PATH directory is reused
+ */
+#define COMPLETE_PATH_TTL 60
+
+/**
+ * @brief Directories being listed at once, at most
+ */
+#define COMPLETE_MAX_LISTERS 32
+
+/**
+ * @brief Bytes a lister collects before writing them to its pipe
+ */
+#define COMPLETE_WRITE_BUFFER (16 * 1024)
+
+/**
+ * @brief Bytes read from a lister's pipe at a time
+ */
+#define COMPLETE_READ_CHUNK (64 * 1024)
+
+/**
+ * @brief Search path used when PATH is unset (as in the PATH cache)
+ */
+#define COMPLETE_DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+/**
+ * @brief Names of one directory as received from its lister
+ *
+ * Records are a type byte ('d' for directories, 'f' for anything else)
+ * followed by the NUL-terminated name; a record cut off by the pipe is
+ * completed by a later read.
+ */
+typedef struct {
+  char *dir;       /**< Directory as written ("" for the current one) */
+  bool command;    /**< Only executables are listed (a PATH directory) */
+  char *data;      /**< Records received so far */
+  size_t len;      /**< Bytes received */
+  size_t capacity; /**< Allocated bytes of data */
+  int fd;          /**< Pipe from the lister, or -1 once it is done */
+  pid_t pid;       /**< Lister process */
+  time_t started;  /**< When the lister was started */
+} listing_t;
+
+/**
+ * @brief Listings, the last query and its candidates
+ */
+static struct {
+  listing_t **listings;      /**< Cached listings (stable pointers) */
+  size_t count;              /**< Number of listings */
+  size_t capacity;           /**< Slots in listings */
+  listing_t known;           /**< Builtins and hashed commands */
+  bool known_valid;          /**< known is up to date for this line */
+  unsigned long generation;  /**< Bumped whenever any listing changes */
+  char *prefix;              /**< Prefix of the last query */
+  size_t prefix_len;         /**< Length of prefix */
+  char *dir;                 /**< Directory of the last query */
+  bool command;              /**< The last query completed a command */
+  unsigned long matched_gen; /**< Generation the matches were made at */
+  complete_match_t *matches; /**< Candidates of the last query */
+  size_t match_count;        /**< Number of candidates */
+  size_t match_capacity;     /**< Slots in matches */
+  complete_stats_t stats;    /**< Counters */
+} g_complete = {.known = {.fd = -1}};
+
+/**
+ * @brief Make room for at least need bytes in a listing
+ * @return 0 on success, -1 on allocation failure
+ */
+static int reserve_data(listing_t *listing, size_t need) {
+  if (need <= listing->capacity)
+    return 0;
+
+  size_t capacity = listing->capacity ? listing->capacity : 4096;
+  while (capacity < need)
+    capacity *= 2;
+  char *data = realloc(listing->data, capacity);
+  if (!data)
+    return -1;
+  listing->data = data;
+  listing->capacity = capacity;
+  return 0;
+}
+
+/**
+ * @brief Append one record to a listing
+ * @return 0 on success, -1 on allocation failure
+ */
+static int append_record(listing_t *listing, char type, const char *name) {
+  size_t size = strlen(name) + 1;
+  if (reserve_data(listing, listing->len + 1 + size) == -1)
+    return -1;
+  listing->data[listing->len] = type;
+  memcpy(listing->data + listing->len + 1, name, size);
+  listing->len += 1 + size;
+  return 0;
+}
+
+/**
+ * @brief Write a whole buffer to a descriptor, retrying short writes
+ * @return 0 on success, -1 on failure
+ */
+static int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return -1;
+    buf += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/**
+ * @brief Check whether a directory entry is an executable
+ */
+static bool is_executable(const char *dir, const char *name) {
+  char path[PATH_MAX];
+  if ((size_t)snprintf(path, sizeof(path), "%s/%s", *dir ? dir : ".",
+                       name) >= sizeof(path))
+    return false;
+  return access(path, X_OK) == 0;
+}
+
+/**
+ * @brief Body of a lister process: write the records of a directory
+ * @param dir Directory to list
+ * @param command List only executables that are not directories
+ * @param fd Write end of the pipe
+ * @return Exit status of the lister
+ */
+static int run_lister(const char *dir, bool command, int fd) {
+  // The inherited listings may be as old as the last pipeline
+  glob_cache_clear();
+
+  char out[COMPLETE_WRITE_BUFFER];
+  size_t used = 0;
+  const char *name;
+  bool is_dir;
+  for (size_t i = 0; (name = glob_dir_entry(dir, i, &is_dir)); i++) {
+    if (command && (is_dir || !is_executable(dir, name)))
+      continue;
+
+    size_t size = strlen(name) + 2;
+    if (used + size > sizeof(out)) {
+      if (write_all(fd, out, used) == -1)
+        return 1;
+      used = 0;
+    }
+    out[used] = is_dir ? 'd' : 'f';
+    memcpy(out + used + 1, name, size - 1);
+    used += size;
+  }
+  return write_all(fd, out, used) == -1 ? 1 : 0;
+}
+
+/**
+ * @brief Count the listers still running
+ */
+static size_t running_listers(void) {
+  size_t running = 0;
+  for (size_t i = 0; i < g_complete.count; i++)
+    running += g_complete.listings[i]->fd != -1;
+  return running;
+}
+
+/**
+ * @brief Free a listing, abandoning its lister if it still runs
+ *
+ * The lister is not waited for: it dies of SIGPIPE on its next write, or
+ * finishes, and is reaped with the other children.
+ */
+static void free_listing(listing_t *listing) {
+  if (listing->fd != -1)
+    close(listing->fd);
+  free(listing->dir);
+  free(listing->data);
+  free(listing);
+}
+
+/**
+ * @brief Fork a lister for a directory
+ * @return New listing, or NULL if it could not be started
+ */
+static listing_t *start_listing(const char *dir, bool command) {
+  if (running_listers() >= COMPLETE_MAX_LISTERS)
+    return NULL;
+  if (g_complete.count == g_complete.capacity) {
+    size_t capacity = g_complete.capacity ? g_complete.capacity * 2 : 16;
+    listing_t **listings =
+        realloc(g_complete.listings, capacity * sizeof(listing_t *));
+    if (!listings)
+      return NULL;
+    g_complete.listings = listings;
+    g_complete.capacity = capacity;
+  }
+
+  listing_t *listing = calloc(1, sizeof(listing_t));
+  int fds[2];
+  if (!listing || !(listing->dir = strdup(dir)) ||
+      pipe2(fds, O_CLOEXEC) == -1) {
+    if (listing)
+      free(listing->dir);
+    free(listing);
+    return NULL;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    _exit(run_lister(dir, command, fds[1]));
+  }
+  close(fds[1]);
+  if (pid == -1) {
+    close(fds[0]);
+    free(listing->dir);
+    free(listing);
+    return NULL;
+  }
+
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  listing->command = command;
+  listing->fd = fds[0];
+  listing->pid = pid;
+  listing->started = time(NULL);
+  g_complete.listings[g_complete.count++] = listing;
+  g_complete.stats.listers++;
+  return listing;
+}
+
+/**
+ * @brief Get the listing of a directory, starting its lister if needed
+ * @return Listing (maybe still arriving), or NULL if none could be started
+ */
+static listing_t *get_listing(const char *dir, bool command) {
+  for (size_t i = 0; i < g_complete.count; i++) {
+    listing_t *listing = g_complete.listings[i];
+    if (listing->command != command || strcmp(listing->dir, dir) != 0)
+      continue;
+
+    // Programs come and go rarely; list a PATH directory again now and then
+    if (!command || listing->fd != -1 ||
+        time(NULL) - listing->started < COMPLETE_PATH_TTL)
+      return listing;
+    free_listing(listing);
+    g_complete.listings[i] = g_complete.listings[--g_complete.count];
+    g_complete.generation++;
+    break;
+  }
+  return start_listing(dir, command);
+}
+
+/**
+ * @brief Rebuild the builtins and hashed commands for this line
+ * @return 0 on success, -1 on allocation failure
+ */
+static int update_known(void) {
+  if (g_complete.known_valid)
+    return 0;
+
+  g_complete.known.len = 0;
+  const char *name;
+  for (size_t i = 0; (name = builtin_name(i)); i++) {
+    if (append_record(&g_complete.known, 'f', name) == -1)
+      return -1;
+  }
+
+  size_t count;
+  const char **names = path_cache_names(&count);
+  if (!names)
+    return -1;
+  for (size_t i = 0; i < count; i++) {
+    if (append_record(&g_complete.known, 'f', names[i]) == -1) {
+      free(names);
+      return -1;
+    }
+  }
+  free(names);
+
+  g_complete.known_valid = true;
+  g_complete.generation++;
+  return 0;
+}
+
+/**
+ * @brief Add the names of a listing that start with prefix
+ * @return 0 on success, -1 on allocation failure
+ */
+static int add_matches(const listing_t *listing, const char *prefix,
+                       size_t len) {
+  const char *p = listing->data;
+  const char *end = listing->data + listing->len;
+  while (p < end) {
+    const char *nul = memchr(p, '\0', (size_t)(end - p));
+    if (!nul)
+      break; // The rest of the record is still in the pipe
+    const char *name = p + 1;
+    bool dir = *p == 'd';
+    p = nul + 1;
+
+    // Dot files only for an explicit dot, as in pathname expansion
+    if (strncmp(name, prefix, len) != 0 || (name[0] == '.' && len == 0))
+      continue;
+
+    if (g_complete.match_count == g_complete.match_capacity) {
+      size_t capacity =
+          g_complete.match_capacity ? g_complete.match_capacity * 2 : 64;
+      complete_match_t *matches =
+          realloc(g_complete.matches, capacity * sizeof(complete_match_t));
+      if (!matches)
+        return -1;
+      g_complete.matches = matches;
+      g_complete.match_capacity = capacity;
+    }
+    g_complete.matches[g_complete.match_count++] =
+        (complete_match_t){name, dir};
+  }
+  return 0;
+}
+
+/**
+ * @brief Compare two candidates by name for qsort
+ */
+static int compare_matches(const void *a, const void *b) {
+  return strcmp(((const complete_match_t *)a)->name,
+                ((const complete_match_t *)b)->name);
+}
+
+/**
+ * @brief Sort the candidates and drop repeated names
+ */
+static void sort_matches(void) {
+  if (g_complete.match_count == 0)
+    return;
+  qsort(g_complete.matches, g_complete.match_count, sizeof(complete_match_t),
+        compare_matches);
+
+  size_t kept = 0;
+  for (size_t i = 0; i < g_complete.match_count; i++) {
+    if (kept > 0 && strcmp(g_complete.matches[kept - 1].name,
+                           g_complete.matches[i].name) == 0)
+      continue;
+    g_complete.matches[kept++] = g_complete.matches[i];
+  }
+  g_complete.match_count = kept;
+}
+
+/**
+ * @brief Narrow the last query's candidates down to a longer prefix
+ */
+static void refine_matches(const char *prefix, size_t len) {
+  size_t kept = 0;
+  for (size_t i = 0; i < g_complete.match_count; i++) {
+    if (strncmp(g_complete.matches[i].name, prefix, len) == 0)
+      g_complete.matches[kept++] = g_complete.matches[i];
+  }
+  g_complete.match_count = kept;
+}
+
+/**
+ * @brief Remember a query so the next one can build on it
+ * @return 0 on success, -1 on allocation failure
+ */
+static int remember_query(const char *dir, size_t dir_len, bool command,
+                          const char *prefix, size_t len) {
+  char *saved_dir = strndup(dir, dir_len);
+  char *saved_prefix = strndup(prefix, len);
+  if (!saved_dir || !saved_prefix) {
+    free(saved_dir);
+    free(saved_prefix);
+    return -1;
+  }
+  free(g_complete.dir);
+  free(g_complete.prefix);
+  g_complete.dir = saved_dir;
+  g_complete.prefix = saved_prefix;
+  g_complete.prefix_len = len;
+  g_complete.command = command;
+  g_complete.matched_gen = g_complete.generation;
+  return 0;
+}
+
+int complete_query(const char *word, size_t len, bool command,
+                   complete_result_t *result) {
+  // A word with a slash names a path, even in command position
+  const char *slash = NULL;
+  for (const char *p = word; p < word + len; p++) {
+    if (*p == '/')
+      slash = p;
+  }
+  command = command && !slash;
+  size_t dir_len = slash ? (size_t)(slash - word) + 1 : 0;
+  const char *prefix = word + dir_len;
+  size_t prefix_len = len - dir_len;
+
+  char *dir = strndup(word, dir_len);
+  if (!dir)
+    return -1;
+
+  // Make sure every directory involved is listed or on its way
+  listing_t *relevant[COMPLETE_MAX_LISTERS + 1];
+  size_t num_relevant = 0;
+  if (command) {
+    if (update_known() == -1) {
+      free(dir);
+      return -1;
+    }
+    relevant[num_relevant++] = &g_complete.known;
+
+    const char *path = getenv("PATH");
+    if (!path)
+      path = COMPLETE_DEFAULT_PATH;
+    while (num_relevant < sizeof(relevant) / sizeof(relevant[0])) {
+      const char *end = strchr(path, ':');
+      size_t elem_len = end ? (size_t)(end - path) : strlen(path);
+      char *elem = strndup(path, elem_len);
+      listing_t *listing = elem ? get_listing(elem, true) : NULL;
+      free(elem);
+      if (listing)
+        relevant[num_relevant++] = listing;
+      if (!end)
+        break;
+      path = end + 1;
+    }
+  } else {
+    listing_t *listing = get_listing(dir, false);
+    if (listing)
+      relevant[num_relevant++] = listing;
+  }
+
+  int status = 0;
+  if (g_complete.prefix && g_complete.matched_gen == g_complete.generation &&
+      g_complete.command == command && strcmp(g_complete.dir, dir) == 0 &&
+      prefix_len >= g_complete.prefix_len &&
+      memcmp(prefix, g_complete.prefix, g_complete.prefix_len) == 0 &&
+      (g_complete.prefix_len > 0 || prefix_len == 0 || prefix[0] != '.')) {
+    refine_matches(prefix, prefix_len);
+    g_complete.stats.refines++;
+  } else {
+    g_complete.match_count = 0;
+    for (size_t i = 0; i < num_relevant && status == 0; i++)
+      status = add_matches(relevant[i], prefix, prefix_len);
+    sort_matches();
+    g_complete.stats.scans++;
+  }
+  if (status == 0)
+    status = remember_query(dir, dir_len, command, prefix, prefix_len);
+  free(dir);
+  if (status == -1) {
+    g_complete.prefix_len = 0;
+    free(g_complete.prefix);
+    g_complete.prefix = NULL;
+    return -1;
+  }
+
+  result->matches = g_complete.matches;
+  result->count = g_complete.match_count;
+  result->prefix_len = prefix_len;
+  result->pending = false;
+  for (size_t i = 0; i < num_relevant; i++)
+    result->pending |= relevant[i]->fd != -1;
+  return 0;
+}
+
+size_t complete_fds(int *fds, size_t max) {
+  size_t count = 0;
+  for (size_t i = 0; i < g_complete.count && count < max; i++) {
+    if (g_complete.listings[i]->fd != -1)
+      fds[count++] = g_complete.listings[i]->fd;
+  }
+  return count;
+}
+
+bool complete_progress(void) {
+  bool changed = false;
+  for (size_t i = 0; i < g_complete.count; i++) {
+    listing_t *listing = g_complete.listings[i];
+    while (listing->fd != -1) {
+      if (reserve_data(listing, listing->len + COMPLETE_READ_CHUNK) == -1) {
+        // Keep what arrived; the rest of the listing is lost
+        close(listing->fd);
+        listing->fd = -1;
+        changed = true;
+        break;
+      }
+
+      ssize_t n = read(listing->fd, listing->data + listing->len,
+                       listing->capacity - listing->len);
+      if (n > 0) {
+        listing->len += (size_t)n;
+        changed = true;
+        continue;
+      }
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n == -1 && errno == EAGAIN)
+        break;
+
+      // End of the listing (or a broken pipe): the lister has exited
+      close(listing->fd);
+      listing->fd = -1;
+      waitpid(listing->pid, NULL, WNOHANG);
+      changed = true;
+    }
+  }
+
+  if (changed)
+    g_complete.generation++;
+  return changed;
+}
+
+void complete_new_line(void) {
+  // Commands may have created or removed files; PATH listings age out
+  for (size_t i = 0; i < g_complete.count;) {
+    listing_t *listing = g_complete.listings[i];
+    if (!listing->command && listing->fd == -1) {
+      free_listing(listing);
+      g_complete.listings[i] = g_complete.listings[--g_complete.count];
+      continue;
+    }
+    i++;
+  }
+  g_complete.known_valid = false;
+  g_complete.generation++;
+}
+
+void complete_clear(void) {
+  for (size_t i = 0; i < g_complete.count; i++)
+    free_listing(g_complete.listings[i]);
+  free(g_complete.listings);
+  free(g_complete.known.data);
+  free(g_complete.matches);
+  free(g_complete.prefix);
+  free(g_complete.dir);
+
+  complete_stats_t stats = g_complete.stats;
+  memset(&g_complete, 0, sizeof(g_complete));
+  g_complete.known.fd = -1;
+  g_complete.stats = stats;
+}
+
+void complete_stats(complete_stats_t *stats) { *stats = g_complete.stats; }
@@ -0,0 +1,634 @@
+/**
+ * @file expand.c
+ * @brief Run-time word expansion of parsed pipelines
+ *
+ * Parsed pipelines are shared through the parse cache, so expansion never
+ * touches them: each run gets a private copy whose argv vectors hold the
+ * expanded words. Literal words are shared with the original.
+ *
+ * A word is expanded in one pass over its source text: $NAME, ${NAME}, $?,
+ * $$ and command substitutions are replaced outside single quotes,
+ * unquoted results are split at blanks, and fields with an unquoted *, ?
+ * or [ become pathname patterns.
+ *
+ * Command output arrives as a mapping of the memory file the subshell
+ * wrote. Fields that are nothing but output, which covers "$(cmd)" and
+ * an unquoted $(cmd) split into words, are copied from the mapping
+ * straight into the arena; only output joined to other text in a field
+ * goes through the field buffers.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * @brief Characters a backslash escapes inside double quotes (as in the
+ * parser)
+ */
+static const char DQUOTE_ESCAPES[] = "\"\\$`";
+
+/**
+ * @brief Characters that split unquoted expansion results into fields
+ */
+static const char FIELD_SEPARATORS[] = " \t\n";
+
+/**
+ * @brief Growable byte buffer
+ */
+typedef struct {
+  char *buf;       /**< Contents (not NUL-terminated) */
+  size_t len;      /**< Bytes used */
+  size_t capacity; /**< Bytes allocated */
+} buffer_t;
+
+/**
+ * @brief State of the expansion of one command's words
+ */
+typedef struct {
+  arena_t *arena;   /**< Arena of the expanded pipeline */
+  char **words;     /**< Expanded words so far (malloc'd vector) */
+  size_t count;     /**< Number of words */
+  size_t capacity;  /**< Slots in words */
+  buffer_t text;    /**< Current field with quotes removed */
+  buffer_t pattern; /**< Current field as a glob_expand pattern */
+  bool has_meta;    /**< The field has an unquoted metacharacter */
+  bool started;     /**< The field exists, even if empty ("") */
+  bool one_field;   /**< No field splitting or globbing (here-strings and
+                         assignments) */
+  bool no_split;    /**< No field splitting (redirection filenames) */
+} expansion_t;
+
+/**
+ * @brief Append one byte to a buffer
+ * @return 0 on success, -1 on allocation failure
+ */
+static int buffer_push(buffer_t *b, char c) {
+  if (b->len == b->capacity) {
+    size_t capacity = b->capacity ? b->capacity * 2 : 64;
+    char *grown = realloc(b->buf, capacity);
+    if (!grown)
+      return -1;
+    b->buf = grown;
+    b->capacity = capacity;
+  }
+  b->buf[b->len++] = c;
+  return 0;
+}
+
+/**
+ * @brief Append bytes to a buffer
+ * @return 0 on success, -1 on allocation failure
+ */
+static int buffer_append(buffer_t *b, const char *bytes, size_t len) {
+  if (b->len + len > b->capacity) {
+    size_t capacity = b->capacity ? b->capacity : 64;
+    while (capacity < b->len + len)
+      capacity *= 2;
+    char *grown = realloc(b->buf, capacity);
+    if (!grown)
+      return -1;
+    b->buf = grown;
+    b->capacity = capacity;
+  }
+  memcpy(b->buf + b->len, bytes, len);
+  b->len += len;
+  return 0;
+}
+
+/**
+ * @brief Append an expanded word to the command's vector
+ * @return 0 on success, -1 on allocation failure
+ */
+static int push_word(expansion_t *ex, char *word) {
+  if (ex->count == ex->capacity) {
+    size_t capacity = ex->capacity ? ex->capacity * 2 : 16;
+    char **grown = realloc(ex->words, capacity * sizeof(char *));
+    if (!grown)
+      return -1;
+    ex->words = grown;
+    ex->capacity = capacity;
+  }
+  ex->words[ex->count++] = word;
+  return 0;
+}
+
+/**
+ * @brief Add a character to the current field
+ * @param ex Expansion state
+ * @param c Character
+ * @param quoted Whether c only matches itself (quoted, escaped or an
+ * expansion result that is not a metacharacter)
+ * @return 0 on success, -1 on allocation failure
+ */
+static int field_char(expansion_t *ex, char c, bool quoted) {
+  ex->started = true;
+  if (!quoted && (c == '*' || c == '?' || c == '['))
+    ex->has_meta = true;
+  if ((quoted || c == '\\') && strchr("*?[]\\", c) &&
+      buffer_push(&ex->pattern, '\\') == -1)
+    return -1;
+  if (buffer_push(&ex->pattern, c) == -1)
+    return -1;
+  return buffer_push(&ex->text, c);
+}
+
+/**
+ * @brief Finish the current field: add its matches, or the field itself
+ * @return 0 on success, -1 on allocation failure
+ */
+static int end_field(expansion_t *ex) {
+  if (!ex->started)
+    return 0;
+
+  int result = 0;
+  size_t count = 0;
+  if (ex->has_meta && !ex->one_field) {
+    char **matches;
+    if (buffer_push(&ex->pattern, '\0') == -1 ||
+        glob_expand(ex->pattern.buf, ex->arena, &matches, &count) == -1)
+      return -1;
+    for (size_t i = 0; i < count && result == 0; i++)
+      result = push_word(ex, matches[i]);
+  }
+
+  // A pattern without matches stays as it was written (minus quotes)
+  if (count == 0) {
+    char *word = arena_strndup(ex->arena, ex->text.buf ? ex->text.buf : "",
+                               ex->text.len);
+    result = word ? push_word(ex, word) : -1;
+  }
+
+  ex->text.len = 0;
+  ex->pattern.len = 0;
+  ex->has_meta = false;
+  ex->started = false;
+  return result;
+}
+
+/**
+ * @brief Measure the leading bytes of a value that are copied as they are
+ * (not separators, metacharacters, backslashes or NULs)
+ * @param split Whether separators split the value
+ */
+static size_t plain_run(const char *p, const char *end, bool split) {
+  const char *q = p;
+  while (q < end && *q != '\0' && !strchr("*?[]\\", *q) &&
+         !(split && strchr(FIELD_SEPARATORS, *q)))
+    q++;
+  return (size_t)(q - p);
+}
+
+/**
+ * @brief Add the value of a parameter to the current field(s)
+ * @param ex Expansion state
+ * @param value Value to add (NUL bytes in it are dropped)
+ * @param len Length of value
+ * @param quoted Whether the parameter was inside double quotes
+ * @return 0 on success, -1 on allocation failure
+ */
+static int add_value(expansion_t *ex, const char *value, size_t len,
+                     bool quoted) {
+  if (quoted)
+    ex->started = true;
+
+  bool split = !quoted && !ex->one_field && !ex->no_split;
+  const char *end = value + len;
+  for (const char *p = value; p < end;) {
+    // Runs of ordinary bytes read the same in the text and the pattern
+    size_t run = plain_run(p, end, split);
+    if (run > 0) {
+      ex->started = true;
+      if (buffer_append(&ex->text, p, run) == -1 ||
+          buffer_append(&ex->pattern, p, run) == -1)
+        return -1;
+      p += run;
+      continue;
+    }
+
+    int result = 0;
+    if (*p != '\0' && split && strchr(FIELD_SEPARATORS, *p))
+      result = end_field(ex);
+    else if (*p != '\0')
+      result = field_char(ex, *p, quoted || !strchr("*?[", *p));
+    if (result == -1)
+      return -1;
+    p++;
+  }
+  return 0;
+}
+
+/**
+ * @brief Check whether bytes of output can become a word as they are
+ */
+static bool is_plain_word(const char *p, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] == '\0' || p[i] == '*' || p[i] == '?' || p[i] == '[')
+      return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Add the output of a command substitution to the current field(s)
+ * @param ex Expansion state
+ * @param data Output
+ * @param len Length of the output
+ * @param quoted Whether the substitution was inside double quotes
+ * @param whole Whether nothing follows the substitution in its word
+ * @return 0 on success, -1 on allocation failure
+ */
+static int add_output(expansion_t *ex, const char *data, size_t len,
+                      bool quoted, bool whole) {
+  if (quoted || ex->one_field || ex->no_split) {
+    // "$(cmd)" on its own is one word, copied once (unquoted, only if it
+    // is no pattern)
+    bool plain = quoted ? !memchr(data, '\0', len) : is_plain_word(data, len);
+    if (whole && ex->text.len == 0 && plain) {
+      char *word = arena_strndup(ex->arena, data, len);
+      ex->started = false;
+      return word ? push_word(ex, word) : -1;
+    }
+    return add_value(ex, data, len, quoted);
+  }
+
+  const char *end = data + len;
+  for (const char *p = data; p < end;) {
+    const char *q = p;
+    while (q < end && (*q == '\0' || !strchr(FIELD_SEPARATORS, *q)))
+      q++;
+    size_t n = (size_t)(q - p);
+
+    // Fields made of output alone need neither buffer nor pattern
+    if (n > 0 && (q < end || whole) && !ex->started && is_plain_word(p, n)) {
+      char *word = arena_strndup(ex->arena, p, n);
+      if (!word || push_word(ex, word) == -1)
+        return -1;
+    } else if (add_value(ex, p, n, false) == -1 ||
+               (q < end && end_field(ex) == -1)) {
+      return -1;
+    }
+
+    for (p = q; p < end && *p != '\0' && strchr(FIELD_SEPARATORS, *p);)
+      p++;
+  }
+  return 0;
+}
+
+/**
+ * @brief Expand the parameter starting at a $
+ * @param ex Expansion state
+ * @param src Position of the $, advanced past the parameter if expanded
+ * @param quoted Whether the $ is inside double quotes
+ * @return 1 if expanded, 0 if the $ is literal, -1 on allocation failure
+ */
+static int expand_parameter(expansion_t *ex, const char **src, bool quoted) {
+  const char *p = *src + 1;
+  char number[32];
+  const char *value;
+  size_t len;
+
+  if (*p == '?' || *p == '$') {
+    long n = *p == '?' ? (long)shell_last_status() : (long)getpid();
+    snprintf(number, sizeof(number), "%ld", n);
+    value = number;
+    *src = p + 1;
+  } else {
+    bool braced = *p == '{';
+    const char *name = p + braced;
+    for (len = 0; vars_valid_name(name, len + 1); len++)
+      ;
+    if (len == 0 || (braced && name[len] != '}'))
+      return 0;
+
+    char saved[64];
+    char *copy = len < sizeof(saved) ? saved : malloc(len + 1);
+    if (!copy)
+      return -1;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    value = vars_get(copy);
+    if (copy != saved)
+      free(copy);
+
+    *src = name + len + braced;
+    if (!value)
+      value = "";
+  }
+  return add_value(ex, value, strlen(value), quoted) == -1 ? -1 : 1;
+}
+
+/**
+ * @brief Run the command substitution starting at a $( or backquote and
+ * add its output
+ * @param ex Expansion state
+ * @param src Position of the substitution, advanced past it if expanded
+ * @param quoted Whether the substitution is inside double quotes
+ * @return 1 if expanded, 0 if it is not terminated (so literal), -1 on
+ * failure
+ */
+static int expand_substitution(expansion_t *ex, const char **src,
+                               bool quoted) {
+  size_t len = parse_substitution_len(*src);
+  if (len == 0)
+    return 0;
+
+  const char *commands = *src + 2;
+  size_t commands_len = len - 3;
+  char *unescaped = NULL;
+  if (**src == '`') {
+    // Within backquotes a backslash only escapes $, ` and itself
+    commands = unescaped = malloc(len);
+    if (!unescaped)
+      return -1;
+    commands_len = 0;
+    for (size_t i = 1; i < len - 1; i++) {
+      if ((*src)[i] == '\\' && i + 2 < len && strchr("$`\\", (*src)[i + 1]))
+        i++;
+      unescaped[commands_len++] = (*src)[i];
+    }
+  }
+
+  capture_t out;
+  int status = shell_substitute(commands, commands_len, &out);
+  free(unescaped);
+  if (status == -1)
+    return -1;
+
+  const char *after = *src + len;
+  bool whole = !ex->one_field && (quoted ? after[0] == '"' && !after[1]
+                                         : !after[0]);
+  int result = add_output(ex, out.data ? out.data : "", out.len, quoted,
+                          whole);
+  if (out.mapped)
+    munmap((void *)out.data, out.mapped);
+  *src = after;
+  return result == -1 ? -1 : 1;
+}
+
+/**
+ * @brief Expand one word from its source text
+ *
+ * Follows the quoting rules of the parser's lexer.
+ *
+ * @param ex Expansion state
+ * @param raw Source text of the word
+ * @return 0 on success, -1 on allocation failure
+ */
+static int expand_word(expansion_t *ex, const char *raw) {
+  char quote_char = '\0';
+  const char *src = raw;
+  while (*src) {
+    char c = *src;
+    int result = 0;
+
+    if (quote_char == '\'') {
+      if (c == '\'')
+        quote_char = '\0';
+      else
+        result = field_char(ex, c, true);
+      src++;
+    } else if (c == '\\' && src[1] != '\0') {
+      if (quote_char == '"' && !strchr(DQUOTE_ESCAPES, src[1])) {
+        result = field_char(ex, c, true);
+        src++;
+      } else {
+        result = field_char(ex, src[1], true);
+        src += 2;
+      }
+    } else if ((c == '`' || (c == '$' && src[1] == '(')) &&
+               (result = expand_substitution(ex, &src, quote_char != '\0'))) {
+      // src was advanced past the substitution
+    } else if (c == '$' &&
+               (result = expand_parameter(ex, &src, quote_char != '\0'))) {
+      // src was advanced past the parameter
+    } else if (quote_char == '"') {
+      if (c == '"')
+        quote_char = '\0';
+      else
+        result = field_char(ex, c, true);
+      src++;
+    } else if (c == '"' || c == '\'') {
+      quote_char = c;
+      ex->started = true;
+      src++;
+    } else {
+      result = field_char(ex, c, false);
+      src++;
+    }
+
+    if (result == -1)
+      return -1;
+  }
+  return end_field(ex);
+}
+
+/**
+ * @brief Build the expanded argv of one command
+ * @param cmd Command with raw_argv set
+ * @param arena Arena of the expanded pipeline
+ * @return New argv vector, or NULL on allocation failure
+ */
+static char **expand_argv(const command_t *cmd, arena_t *arena) {
+  expansion_t ex = {arena,        NULL,  0,     0,    {NULL, 0, 0},
+                    {NULL, 0, 0}, false, false, false, false};
+  char **argv = NULL;
+  int result = 0;
+  bool assigning = true;
+
+  for (size_t i = 0; cmd->argv[i] && result == 0; i++) {
+    // Leading NAME=value words take their value whole, as x=$(cmd) must
+    const char *eq = strchr(cmd->argv[i], '=');
+    assigning = assigning && eq &&
+                vars_valid_name(cmd->argv[i], (size_t)(eq - cmd->argv[i]));
+    ex.one_field = assigning;
+
+    if (cmd->raw_argv[i])
+      result = expand_word(&ex, cmd->raw_argv[i]);
+    else
+      result = push_word(&ex, cmd->argv[i]);
+  }
+
+  // A command whose words all expanded to nothing still performs its
+  // redirections, like the : builtin
+  if (result == 0 && ex.count == 0) {
+    char *noop = arena_strndup(arena, ":", 1);
+    result = noop ? push_word(&ex, noop) : -1;
+  }
+
+  if (result == 0)
+    argv = arena_alloc(arena, (ex.count + 1) * sizeof(char *));
+  if (argv) {
+    memcpy(argv, ex.words, ex.count * sizeof(char *));
+    argv[ex.count] = NULL;
+  }
+
+  free(ex.words);
+  free(ex.text.buf);
+  free(ex.pattern.buf);
+  return argv;
+}
+
+/**
+ * @brief Expand parameters and command substitutions in the body of a
+ * here-document or here-string
+ *
+ * Here-documents only know backslash escapes of $, `, \ and newline; quotes
+ * are ordinary text. A here-string is one word, expanded without field
+ * splitting and followed by a newline.
+ *
+ * @param doc Here-document with expand set
+ * @param arena Arena of the expanded pipeline
+ * @return Expanded copy, or NULL on allocation failure
+ */
+static here_doc_t *expand_here_doc(const here_doc_t *doc, arena_t *arena) {
+  expansion_t ex = {arena,        NULL,  0,     0,    {NULL, 0, 0},
+                    {NULL, 0, 0}, false, false, true, false};
+  here_doc_t *copy = arena_alloc(arena, sizeof(here_doc_t));
+  int result = copy ? 0 : -1;
+
+  if (result == 0 && !doc->delimiter) {
+    // The stored body is the word's source text plus its newline
+    char *word = arena_strndup(arena, doc->body, doc->len - 1);
+    result = word ? expand_word(&ex, word) : -1;
+    if (result == 0 && ex.count == 0)
+      result = push_word(&ex, "");
+    if (result == 0) {
+      ex.text.len = 0;
+      for (const char *p = ex.words[0]; *p && result == 0; p++)
+        result = buffer_push(&ex.text, *p);
+      if (result == 0)
+        result = buffer_push(&ex.text, '\n');
+    }
+  }
+
+  for (size_t i = 0; doc->delimiter && result == 0 && i < doc->len;) {
+    const char *src = doc->body + i;
+    if (*src == '\\' && i + 1 < doc->len && strchr("$\\\n`", src[1])) {
+      // A backslash-newline joins lines; the others escape one character
+      if (src[1] != '\n')
+        result = buffer_push(&ex.text, src[1]);
+      i += 2;
+    } else if ((*src == '`' || (*src == '$' && src[1] == '(')) &&
+               (result = expand_substitution(&ex, &src, true))) {
+      i = (size_t)(src - doc->body);
+      result = result == -1 ? -1 : 0;
+    } else if (*src == '$' && (result = expand_parameter(&ex, &src, true))) {
+      i = (size_t)(src - doc->body);
+      result = result == -1 ? -1 : 0;
+    } else {
+      result = buffer_push(&ex.text, *src);
+      i++;
+    }
+  }
+
+  char *body = NULL;
+  if (result == 0)
+    body = arena_strndup(arena, ex.text.buf ? ex.text.buf : "", ex.text.len);
+  if (body) {
+    *copy = *doc;
+    copy->body = body;
+    copy->len = ex.text.len;
+    copy->expand = false;
+  }
+
+  free(ex.words);
+  free(ex.text.buf);
+  free(ex.pattern.buf);
+  return body ? copy : NULL;
+}
+
+/**
+ * @brief Expand the filenames of a command's redirections into a copy of
+ * its redirection vector
+ *
+ * Expansion results are not split, but a pattern still matches files and
+ * must then match just one.
+ *
+ * @param cmd Command whose redirs are replaced by the copy
+ * @param arena Arena of the expanded pipeline
+ * @return 0 on success, -1 on allocation failure, 1 if a filename did not
+ * expand to exactly one word (message printed)
+ */
+static int expand_redirs(command_t *cmd, arena_t *arena) {
+  redir_t *redirs = arena_alloc(arena, cmd->num_redirs * sizeof(redir_t));
+  if (!redirs)
+    return -1;
+  memcpy(redirs, cmd->redirs, cmd->num_redirs * sizeof(redir_t));
+  cmd->redirs = redirs;
+
+  expansion_t ex = {arena,        NULL,  0,     0,    {NULL, 0, 0},
+                    {NULL, 0, 0}, false, false, false, true};
+  int result = 0;
+  for (size_t i = 0; i < cmd->num_redirs && result == 0; i++) {
+    redir_t *r = &redirs[i];
+    if (!r->raw_path)
+      continue;
+    ex.count = 0;
+    result = expand_word(&ex, r->raw_path);
+    if (result == 0 && ex.count != 1) {
+      fprintf(stderr, "%s: ambiguous redirect\n", r->raw_path);
+      result = 1;
+    } else if (result == 0) {
+      r->path = ex.words[0];
+      r->raw_path = NULL;
+    }
+  }
+
+  free(ex.words);
+  free(ex.text.buf);
+  free(ex.pattern.buf);
+  return result;
+}
+
+int expand_pipeline(const pipeline_t *in, pipeline_t *out) {
+  out->commands = NULL;
+  out->num_commands = 0;
+  out->arena.head = NULL;
+  out->timed = in->timed;
+  out->expand = false;
+  out->here_docs = NULL;
+  out->unterminated = false;
+  out->next_op = LIST_END;
+  out->next = NULL;
+  int failure = -1; // What the error path returns
+
+  out->commands = arena_alloc(&out->arena,
+                              in->num_commands * sizeof(command_t));
+  if (!out->commands)
+    goto error;
+  memcpy(out->commands, in->commands, in->num_commands * sizeof(command_t));
+  out->num_commands = in->num_commands;
+
+  for (size_t i = 0; i < out->num_commands; i++) {
+    command_t *cmd = &out->commands[i];
+    if (cmd->here_doc && cmd->here_doc->expand &&
+        !(cmd->here_doc = expand_here_doc(cmd->here_doc, &out->arena)))
+      goto error;
+    bool expand_paths = false;
+    for (size_t j = 0; j < cmd->num_redirs; j++)
+      expand_paths |= cmd->redirs[j].raw_path != NULL;
+    int result = expand_paths ? expand_redirs(cmd, &out->arena) : 0;
+    if (result != 0) {
+      failure = result;
+      goto error;
+    }
+    if (!cmd->raw_argv)
+      continue;
+
+    cmd->argv = expand_argv(cmd, &out->arena);
+    cmd->raw_argv = NULL;
+    if (!cmd->argv)
+      goto error;
+  }
+  return 0;
+
+error:
+  free_pipeline(out);
+  return failure;
+}
@@ -0,0 +1,472 @@
+/**
+ * @file glob.c
+ * @brief Pathname expansion with a per-pipeline directory listing cache
+ *
+ * Directories are read with getdents64 into one flat listing each and kept
+ * until the next pipeline runs, so every glob of a pipeline that looks at
+ * the same directory shares a single read. Components without metacharacters
+ * never list anything: they are appended to the path and, at the end,
+ * checked with one lstat.
+ */
+
+#define _GNU_SOURCE // syscall, DT_* constants
+
+#include "shell.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * @brief Bytes of directory records fetched per getdents64 call
+ */
+#define GLOB_DENTS_BUFFER (256 * 1024)
+
+/**
+ * @brief Record layout returned by the getdents64 system call
+ */
+typedef struct {
+  uint64_t d_ino;          /**< Inode number */
+  int64_t d_off;           /**< Offset of the next record */
+  unsigned short d_reclen; /**< Length of this record */
+  unsigned char d_type;    /**< File type, or DT_UNKNOWN */
+  char d_name[];           /**< NUL-terminated name */
+} kernel_dirent_t;
+
+/**
+ * @brief One name of a directory listing
+ */
+typedef struct {
+  size_t name;        /**< Offset of the name in the listing's names */
+  unsigned char type; /**< File type from the directory (may be DT_UNKNOWN) */
+} dir_entry_t;
+
+/**
+ * @brief Everything a directory contains, except . and ..
+ */
+typedef struct {
+  char *path;           /**< Directory as spelled in the pattern ("" is .) */
+  uint32_t hash;        /**< FNV-1a hash of path */
+  char *names;          /**< NUL-terminated names, back to back */
+  dir_entry_t *entries; /**< One entry per name */
+  size_t count;         /**< Number of entries */
+} dir_listing_t;
+
+/**
+ * @brief Listings read since the last glob_cache_clear
+ */
+static struct {
+  dir_listing_t **dirs; /**< Cached listings (stable pointers) */
+  size_t count;         /**< Number of cached listings */
+  size_t capacity;      /**< Slots in dirs */
+  unsigned long lists;  /**< Listings requested */
+  unsigned long reads;  /**< Listings read from the kernel */
+} g_glob;
+
+static char g_dents[GLOB_DENTS_BUFFER] __attribute__((aligned(8)));
+
+/**
+ * @brief Growable NUL-terminated string
+ */
+typedef struct {
+  char *buf;       /**< Contents */
+  size_t len;      /**< Length without the terminator */
+  size_t capacity; /**< Allocated bytes */
+} strbuf_t;
+
+/**
+ * @brief State of one expansion
+ */
+typedef struct {
+  const char *pattern; /**< Whole pattern */
+  char *components;    /**< Scratch with the same layout as pattern */
+  strbuf_t path;       /**< Path built so far */
+  arena_t *arena;      /**< Arena receiving the matches */
+  char **matches;      /**< Matches found so far (malloc'd vector) */
+  size_t count;        /**< Number of matches */
+  size_t capacity;     /**< Slots in matches */
+} glob_state_t;
+
+/**
+ * @brief Make room for at least need elements in a malloc'd vector
+ * @return 0 on success, -1 on allocation failure
+ */
+static int reserve(void **items, size_t *capacity, size_t need,
+                   size_t elem_size) {
+  if (need <= *capacity)
+    return 0;
+
+  size_t grown = *capacity ? *capacity : 16;
+  while (grown < need)
+    grown *= 2;
+  void *resized = realloc(*items, grown * elem_size);
+  if (!resized)
+    return -1;
+
+  *items = resized;
+  *capacity = grown;
+  return 0;
+}
+
+/**
+ * @brief FNV-1a hash of a NUL-terminated string
+ */
+static uint32_t hash_path(const char *path) {
+  uint32_t hash = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+    hash ^= *p;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief Read a whole directory into a listing
+ *
+ * A directory that cannot be opened is listed as empty, so a pattern
+ * through it simply matches nothing.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+static int read_listing(dir_listing_t *dir) {
+  int fd = open(*dir->path ? dir->path : ".",
+                O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+    return 0;
+
+  size_t names_len = 0, names_cap = 0, entries_cap = 0;
+  long got;
+  while ((got = syscall(SYS_getdents64, fd, g_dents, sizeof(g_dents))) > 0) {
+    for (long off = 0; off < got;) {
+      const kernel_dirent_t *d = (const kernel_dirent_t *)(g_dents + off);
+      off += d->d_reclen;
+
+      const char *name = d->d_name;
+      if (name[0] == '.' &&
+          (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        continue;
+
+      size_t size = strlen(name) + 1;
+      if (reserve((void **)&dir->names, &names_cap, names_len + size, 1) ==
+              -1 ||
+          reserve((void **)&dir->entries, &entries_cap, dir->count + 1,
+                  sizeof(dir_entry_t)) == -1) {
+        close(fd);
+        return -1;
+      }
+
+      memcpy(dir->names + names_len, name, size);
+      dir->entries[dir->count].name = names_len;
+      dir->entries[dir->count].type = d->d_type;
+      dir->count++;
+      names_len += size;
+    }
+  }
+
+  // A read error keeps whatever was listed before it
+  close(fd);
+  return 0;
+}
+
+/**
+ * @brief Listing of a directory, read on first use during this line
+ * @param path Directory ("" for the current one)
+ * @return Listing, or NULL on allocation failure
+ */
+static const dir_listing_t *get_listing(const char *path) {
+  g_glob.lists++;
+  uint32_t hash = hash_path(path);
+  for (size_t i = 0; i < g_glob.count; i++) {
+    dir_listing_t *dir = g_glob.dirs[i];
+    if (dir->hash == hash && strcmp(dir->path, path) == 0)
+      return dir;
+  }
+
+  if (reserve((void **)&g_glob.dirs, &g_glob.capacity, g_glob.count + 1,
+              sizeof(dir_listing_t *)) == -1)
+    return NULL;
+
+  dir_listing_t *dir = calloc(1, sizeof(*dir));
+  if (!dir)
+    return NULL;
+  dir->path = strdup(path);
+  dir->hash = hash;
+  if (!dir->path || read_listing(dir) == -1) {
+    free(dir->names);
+    free(dir->entries);
+    free(dir->path);
+    free(dir);
+    return NULL;
+  }
+
+  g_glob.reads++;
+  g_glob.dirs[g_glob.count++] = dir;
+  return dir;
+}
+
+/**
+ * @brief Append bytes to a string buffer
+ * @return 0 on success, -1 on allocation failure
+ */
+static int strbuf_append(strbuf_t *sb, const char *data, size_t len) {
+  if (reserve((void **)&sb->buf, &sb->capacity, sb->len + len + 1, 1) == -1)
+    return -1;
+  memcpy(sb->buf + sb->len, data, len);
+  sb->len += len;
+  sb->buf[sb->len] = '\0';
+  return 0;
+}
+
+/**
+ * @brief Cut a string buffer back to an earlier length
+ */
+static void strbuf_truncate(strbuf_t *sb, size_t len) {
+  sb->len = len;
+  sb->buf[len] = '\0';
+}
+
+/**
+ * @brief Append a path component, adding a separator if needed
+ * @return 0 on success, -1 on allocation failure
+ */
+static int append_component(strbuf_t *path, const char *name, size_t len) {
+  if (path->len > 0 && path->buf[path->len - 1] != '/' &&
+      strbuf_append(path, "/", 1) == -1)
+    return -1;
+  return strbuf_append(path, name, len);
+}
+
+/**
+ * @brief Check whether a listed name is a directory, following symlinks
+ */
+static bool is_directory(const char *path, unsigned char type) {
+  if (type == DT_DIR)
+    return true;
+  if (type != DT_UNKNOWN && type != DT_LNK)
+    return false;
+
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * @brief Record the current path as a match
+ * @return 0 on success, -1 on allocation failure
+ */
+static int add_match(glob_state_t *st) {
+  if (reserve((void **)&st->matches, &st->capacity, st->count + 1,
+              sizeof(char *)) == -1)
+    return -1;
+
+  char *match = arena_strndup(st->arena, st->path.buf, st->path.len);
+  if (!match)
+    return -1;
+  st->matches[st->count++] = match;
+  return 0;
+}
+
+/**
+ * @brief Length of the part of a component that has to match exactly
+ *
+ * Used to skip most names before calling fnmatch; stops at the first
+ * metacharacter or escape.
+ */
+static size_t literal_prefix(const char *component) {
+  return strcspn(component, "*?[\\");
+}
+
+/**
+ * @brief Check whether a component contains an unescaped metacharacter
+ */
+static bool component_has_meta(const char *component) {
+  for (const char *p = component; *p; p++) {
+    if (*p == '\\' && p[1] != '\0')
+      p++;
+    else if (*p == '*' || *p == '?' || *p == '[')
+      return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Append a literal component to the path, dropping its escapes
+ * @return 0 on success, -1 on allocation failure
+ */
+static int append_literal(strbuf_t *path, const char *component) {
+  if (append_component(path, "", 0) == -1)
+    return -1;
+  for (const char *p = component; *p; p++) {
+    if (*p == '\\' && p[1] != '\0')
+      p++;
+    if (strbuf_append(path, p, 1) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Match the path built so far, as the last component was reached
+ * @param st Expansion state
+ * @param dir_only The pattern ended in a slash
+ * @param type File type if known from a listing, else DT_UNKNOWN
+ * @param check Whether the path still has to be checked for existence
+ * @return 0 on success, -1 on allocation failure
+ */
+static int finish_match(glob_state_t *st, bool dir_only, unsigned char type,
+                        bool check) {
+  if (dir_only) {
+    if (!is_directory(st->path.buf, type))
+      return 0;
+    if (strbuf_append(&st->path, "/", 1) == -1)
+      return -1;
+    return add_match(st);
+  }
+
+  struct stat sb;
+  if (check && lstat(st->path.buf, &sb) == -1)
+    return 0;
+  return add_match(st);
+}
+
+/**
+ * @brief Expand the pattern from one component on, below the current path
+ * @param st Expansion state
+ * @param rest First remaining component (no leading slash)
+ * @return 0 on success, -1 on allocation failure
+ */
+static int expand_from(glob_state_t *st, const char *rest) {
+  const char *end = strchr(rest, '/');
+  if (!end)
+    end = rest + strlen(rest);
+  const char *next = end;
+  while (*next == '/')
+    next++;
+  bool last = *next == '\0';
+  bool dir_only = last && *end == '/';
+
+  // Each level keeps its component in its own slice of the scratch buffer
+  char *component = st->components + (rest - st->pattern);
+  memcpy(component, rest, (size_t)(end - rest));
+  component[end - rest] = '\0';
+
+  size_t base_len = st->path.len;
+  int result = 0;
+
+  if (!component_has_meta(component)) {
+    // Literal fast path: no listing, one existence check at the very end
+    if (append_literal(&st->path, component) == -1)
+      result = -1;
+    else if (last)
+      result = finish_match(st, dir_only, DT_UNKNOWN, true);
+    else
+      result = expand_from(st, next);
+    strbuf_truncate(&st->path, base_len);
+    return result;
+  }
+
+  const dir_listing_t *dir = get_listing(st->path.buf);
+  if (!dir)
+    return -1;
+
+  size_t prefix = literal_prefix(component);
+  for (size_t i = 0; i < dir->count && result == 0; i++) {
+    const char *name = dir->names + dir->entries[i].name;
+    unsigned char type = dir->entries[i].type;
+    if (strncmp(name, component, prefix) != 0 ||
+        fnmatch(component, name, FNM_PERIOD) != 0)
+      continue;
+
+    if (append_component(&st->path, name, strlen(name)) == -1) {
+      result = -1;
+    } else if (last) {
+      result = finish_match(st, dir_only, type, false);
+    } else if (is_directory(st->path.buf, type)) {
+      result = expand_from(st, next);
+    }
+    strbuf_truncate(&st->path, base_len);
+  }
+  return result;
+}
+
+/**
+ * @brief Compare two strings for qsort
+ */
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int glob_expand(const char *pattern, arena_t *arena, char ***matches,
+                size_t *count) {
+  glob_state_t st = {pattern, NULL, {NULL, 0, 0}, arena, NULL, 0, 0};
+  *matches = NULL;
+  *count = 0;
+
+  st.components = malloc(strlen(pattern) + 1);
+  int result = st.components && strbuf_append(&st.path, "", 0) == 0 ? 0 : -1;
+
+  const char *rest = pattern;
+  if (result == 0 && *rest == '/') {
+    while (*rest == '/')
+      rest++;
+    result = strbuf_append(&st.path, "/", 1);
+  }
+  if (result == 0)
+    result = *rest ? expand_from(&st, rest) : add_match(&st);
+
+  if (result == 0 && st.count > 0) {
+    qsort(st.matches, st.count, sizeof(char *), compare_paths);
+    *matches = arena_alloc(arena, st.count * sizeof(char *));
+    if (*matches) {
+      memcpy(*matches, st.matches, st.count * sizeof(char *));
+      *count = st.count;
+    } else {
+      result = -1;
+    }
+  }
+
+  free(st.matches);
+  free(st.path.buf);
+  free(st.components);
+  return result;
+}
+
+void glob_cache_clear(void) {
+  for (size_t i = 0; i < g_glob.count; i++) {
+    dir_listing_t *dir = g_glob.dirs[i];
+    free(dir->names);
+    free(dir->entries);
+    free(dir->path);
+    free(dir);
+  }
+  g_glob.count = 0;
+}
+
+const char *glob_dir_entry(const char *path, size_t index, bool *is_dir) {
+  const dir_listing_t *dir = get_listing(path);
+  if (!dir || index >= dir->count)
+    return NULL;
+
+  const char *name = dir->names + dir->entries[index].name;
+  unsigned char type = dir->entries[index].type;
+  *is_dir = type == DT_DIR;
+  if (type == DT_UNKNOWN || type == DT_LNK) {
+    strbuf_t full = {NULL, 0, 0};
+    if (strbuf_append(&full, path, strlen(path)) == 0 &&
+        append_component(&full, name, strlen(name)) == 0)
+      *is_dir = is_directory(full.buf, type);
+    free(full.buf);
+  }
+  return name;
+}
+
+void glob_cache_stats(glob_cache_stats_t *stats) {
+  stats->lists = g_glob.lists;
+  stats->reads = g_glob.reads;
+  stats->dirs = g_glob.count;
+}
@@ -0,0 +1,425 @@
+/**
+ * @file history.c
+ * @brief Persistent command history: append-only log plus a mapped index
+ *
+ * The log is plain text, one command per line, only ever appended to with
+ * O_APPEND, so several shells can share it. Next to it lives a binary
+ * index of fixed-size records (offset, length and the first bytes of each
+ * entry). Opening history maps the index instead of reading the log, so
+ * startup costs the same at ten entries or ten million; the log is mapped
+ * too but only touched where an entry is actually looked at.
+ *
+ * The shell itself opens history lazily: history_open_lazily only notes
+ * that it is wanted, and the first call that needs entries opens it.
+ *
+ * Entries the index does not know yet (written by an older shell, or lost
+ * to a crash between the two appends) are indexed from the tail of the
+ * log when history is opened. An index that does not fit its log is
+ * rebuilt from scratch.
+ */
+
+#define _GNU_SOURCE // memmem
+
+#include "shell.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief First bytes of every index file (also its format version)
+ */
+#define HISTORY_MAGIC "shhidx1\n"
+
+/**
+ * @brief Size of the index header
+ */
+#define HISTORY_HEADER_SIZE (sizeof(HISTORY_MAGIC) - 1)
+
+/**
+ * @brief Log file used when no path is given, relative to $HOME
+ */
+#define HISTORY_DEFAULT_FILE ".shell_history"
+
+/**
+ * @brief Bytes of each entry kept in its index record
+ */
+#define HISTORY_PREFIX_LEN 4
+
+/**
+ * @brief Index record of one entry
+ */
+typedef struct {
+  uint64_t offset;                 /**< Offset of the entry in the log */
+  uint32_t len;                    /**< Length without the newline */
+  char prefix[HISTORY_PREFIX_LEN]; /**< First bytes, NUL-padded */
+} history_record_t;
+
+/**
+ * @brief Open history: the mapped files and this session's additions
+ */
+static struct {
+  bool open;                       /**< history_open succeeded */
+  int log_fd;                      /**< Log, opened O_APPEND */
+  int index_fd;                    /**< Index, opened O_APPEND */
+  const char *log;                 /**< Mapping of the log (or NULL) */
+  size_t log_mapped;               /**< Bytes of the log mapped */
+  const history_record_t *records; /**< Records mapped from the index */
+  size_t index_mapped;             /**< Bytes of the index mapped */
+  size_t mapped_count;             /**< Records in the index mapping */
+  history_record_t *added;         /**< Records appended since opening */
+  size_t added_count;              /**< Records in added */
+  size_t added_cap;                /**< Allocated records in added */
+  bool pending;                    /**< Open on first use */
+  bool interactive;                /**< Open on first use without HISTFILE */
+} g_history = {false, -1, -1, NULL, 0, NULL, 0, 0, NULL, 0, 0, false, false};
+
+/**
+ * @brief Fill in a record for an entry
+ */
+static history_record_t make_record(uint64_t offset, const char *entry,
+                                    size_t len) {
+  history_record_t record = {offset, (uint32_t)len, {0}};
+  memcpy(record.prefix, entry,
+         len < HISTORY_PREFIX_LEN ? len : HISTORY_PREFIX_LEN);
+  return record;
+}
+
+/**
+ * @brief Write a whole buffer, retrying short writes
+ * @return 0 on success, -1 on failure (errno set)
+ */
+static int write_all(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/**
+ * @brief Map at least the first end bytes of the log
+ * @return 0 on success, -1 if the log is shorter or cannot be mapped
+ */
+static int map_log(size_t end) {
+  if (end <= g_history.log_mapped)
+    return 0;
+
+  struct stat st;
+  if (fstat(g_history.log_fd, &st) == -1 || (size_t)st.st_size < end)
+    return -1;
+
+  void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+                   g_history.log_fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  if (g_history.log)
+    munmap((void *)g_history.log, g_history.log_mapped);
+  g_history.log = map;
+  g_history.log_mapped = (size_t)st.st_size;
+  return 0;
+}
+
+/**
+ * @brief Get the record of an entry
+ */
+static const history_record_t *record_at(size_t index) {
+  if (index < g_history.mapped_count)
+    return &g_history.records[index];
+  return &g_history.added[index - g_history.mapped_count];
+}
+
+/**
+ * @brief Bring the index file in line with the log before mapping it
+ *
+ * Drops a torn record at the end, starts over when the index claims more
+ * than the log holds, and indexes every complete line past the last
+ * record.
+ *
+ * @param log_size Current size of the log
+ * @return 0 on success, -1 on failure
+ */
+static int sync_index(size_t log_size) {
+  struct stat st;
+  if (fstat(g_history.index_fd, &st) == -1)
+    return -1;
+
+  char magic[HISTORY_HEADER_SIZE];
+  size_t size = (size_t)st.st_size;
+  bool valid = size >= HISTORY_HEADER_SIZE &&
+               pread(g_history.index_fd, magic, sizeof(magic), 0) ==
+                   (ssize_t)sizeof(magic) &&
+               memcmp(magic, HISTORY_MAGIC, sizeof(magic)) == 0;
+
+  // Shells appending at once may write their records out of order, so the
+  // indexed part of the log ends after the furthest of the last few
+  uint64_t indexed = 0;
+  size_t whole = valid ? (size - HISTORY_HEADER_SIZE) /
+                             sizeof(history_record_t)
+                       : 0;
+  history_record_t tail[64];
+  size_t tail_count = whole < 64 ? whole : 64;
+  if (tail_count > 0) {
+    off_t at = (off_t)(HISTORY_HEADER_SIZE +
+                       (whole - tail_count) * sizeof(history_record_t));
+    ssize_t want = (ssize_t)(tail_count * sizeof(history_record_t));
+    valid = pread(g_history.index_fd, tail, (size_t)want, at) == want;
+    for (size_t i = 0; valid && i < tail_count; i++) {
+      uint64_t end = tail[i].offset + tail[i].len + 1;
+      valid = end <= log_size;
+      if (end > indexed)
+        indexed = end;
+    }
+  }
+
+  if (!valid) {
+    // Unknown format, or a log that was replaced: index it all again
+    whole = 0;
+    indexed = 0;
+    if (ftruncate(g_history.index_fd, 0) == -1 ||
+        write_all(g_history.index_fd, HISTORY_MAGIC, HISTORY_HEADER_SIZE) ==
+            -1)
+      return -1;
+  } else if (size != HISTORY_HEADER_SIZE + whole * sizeof(history_record_t) &&
+             ftruncate(g_history.index_fd,
+                       (off_t)(HISTORY_HEADER_SIZE +
+                               whole * sizeof(history_record_t))) == -1) {
+    return -1;
+  }
+
+  if (indexed >= log_size)
+    return 0;
+  if (map_log(log_size) == -1)
+    return -1;
+
+  // Index the tail in batches; a last line without newline is left for
+  // whoever finishes writing it
+  history_record_t batch[256];
+  size_t batched = 0;
+  const char *end = g_history.log + log_size;
+  for (const char *p = g_history.log + indexed; p < end;) {
+    const char *nl = memchr(p, '\n', (size_t)(end - p));
+    if (!nl)
+      break;
+    if (nl > p)
+      batch[batched++] = make_record((uint64_t)(p - g_history.log), p,
+                                     (size_t)(nl - p));
+    if (batched == sizeof(batch) / sizeof(batch[0])) {
+      if (write_all(g_history.index_fd, batch, batched * sizeof(batch[0])) ==
+          -1)
+        return -1;
+      batched = 0;
+    }
+    p = nl + 1;
+  }
+  if (batched > 0 &&
+      write_all(g_history.index_fd, batch, batched * sizeof(batch[0])) == -1)
+    return -1;
+  return 0;
+}
+
+/**
+ * @brief Map the index (if it has any records)
+ * @return 0 on success, -1 on failure
+ */
+static int map_index(void) {
+  struct stat st;
+  if (fstat(g_history.index_fd, &st) == -1)
+    return -1;
+
+  size_t size = (size_t)st.st_size;
+  size_t count = (size - HISTORY_HEADER_SIZE) / sizeof(history_record_t);
+  if (count == 0)
+    return 0;
+
+  void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, g_history.index_fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  g_history.records =
+      (const history_record_t *)((const char *)map + HISTORY_HEADER_SIZE);
+  g_history.index_mapped = size;
+  g_history.mapped_count = count;
+  return 0;
+}
+
+/**
+ * @brief Open history now if history_open_lazily asked for it
+ */
+static void open_pending(void) {
+  if (!g_history.pending)
+    return;
+  g_history.pending = false;
+
+  // History is kept for terminals, or wherever HISTFILE asks for it
+  const char *path = vars_get("HISTFILE");
+  if (!path && !g_history.interactive)
+    return;
+  struct timespec start;
+  bool profiled = startup_profile_start(&start);
+  history_open(path);
+  if (profiled)
+    startup_profile_stop(STARTUP_HISTORY, &start);
+}
+
+void history_open_lazily(bool interactive) {
+  history_close();
+  g_history.pending = true;
+  g_history.interactive = interactive;
+}
+
+int history_open(const char *path) {
+  history_close();
+
+  char default_path[4096];
+  if (!path) {
+    const char *home = vars_get("HOME");
+    if (!home || (size_t)snprintf(default_path, sizeof(default_path),
+                                  "%s/%s", home, HISTORY_DEFAULT_FILE) >=
+                     sizeof(default_path))
+      return -1;
+    path = default_path;
+  }
+
+  size_t path_len = strlen(path);
+  char *index_path = malloc(path_len + 5);
+  if (!index_path)
+    return -1;
+  memcpy(index_path, path, path_len);
+  memcpy(index_path + path_len, ".idx", 5);
+
+  int flags = O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC;
+  g_history.log_fd = open(path, flags, 0600);
+  g_history.index_fd = open(index_path, flags, 0600);
+  free(index_path);
+
+  struct stat st;
+  if (g_history.log_fd == -1 || g_history.index_fd == -1 ||
+      fstat(g_history.log_fd, &st) == -1 ||
+      sync_index((size_t)st.st_size) == -1 || map_index() == -1) {
+    fprintf(stderr, "history: %s: %s\n", path, strerror(errno));
+    history_close();
+    return -1;
+  }
+
+  g_history.open = true;
+  return 0;
+}
+
+void history_close(void) {
+  if (g_history.log)
+    munmap((void *)g_history.log, g_history.log_mapped);
+  if (g_history.records)
+    munmap((char *)g_history.records - HISTORY_HEADER_SIZE,
+           g_history.index_mapped);
+  if (g_history.log_fd != -1)
+    close(g_history.log_fd);
+  if (g_history.index_fd != -1)
+    close(g_history.index_fd);
+  free(g_history.added);
+  memset(&g_history, 0, sizeof(g_history));
+  g_history.log_fd = -1;
+  g_history.index_fd = -1;
+}
+
+int history_add(const char *line, size_t len) {
+  open_pending();
+
+  // Only single lines are logged; the rest is silently left out
+  if (!g_history.open || len == 0 || len > UINT32_MAX ||
+      memchr(line, '\n', len))
+    return 0;
+
+  // Repeating the previous command adds nothing
+  size_t count = history_count();
+  size_t last_len;
+  const char *last = count ? history_get(count - 1, &last_len) : NULL;
+  if (last && last_len == len && memcmp(last, line, len) == 0)
+    return 0;
+
+  if (g_history.added_count == g_history.added_cap) {
+    size_t cap = g_history.added_cap ? g_history.added_cap * 2 : 64;
+    history_record_t *added =
+        realloc(g_history.added, cap * sizeof(history_record_t));
+    if (!added)
+      return -1;
+    g_history.added = added;
+    g_history.added_cap = cap;
+  }
+
+  // One write, so a line from another shell never lands inside ours; the
+  // O_APPEND offset afterwards tells where it went
+  char *entry = malloc(len + 1);
+  if (!entry)
+    return -1;
+  memcpy(entry, line, len);
+  entry[len] = '\n';
+  int err = write_all(g_history.log_fd, entry, len + 1);
+  free(entry);
+  off_t end = err == 0 ? lseek(g_history.log_fd, 0, SEEK_CUR) : -1;
+  if (end == -1)
+    return -1;
+
+  history_record_t record = make_record((uint64_t)end - len - 1, line, len);
+  if (write_all(g_history.index_fd, &record, sizeof(record)) == -1)
+    return -1;
+  g_history.added[g_history.added_count++] = record;
+  return 0;
+}
+
+size_t history_count(void) {
+  open_pending();
+  return g_history.mapped_count + g_history.added_count;
+}
+
+const char *history_get(size_t index, size_t *len) {
+  if (index >= history_count())
+    return NULL;
+
+  const history_record_t *record = record_at(index);
+  if (map_log(record->offset + record->len) == -1)
+    return NULL;
+  *len = record->len;
+  return g_history.log + record->offset;
+}
+
+bool history_search(const char *text, size_t len, history_match_t match,
+                    size_t *index) {
+  size_t i = *index < history_count() ? *index : history_count();
+  size_t key_len = len < HISTORY_PREFIX_LEN ? len : HISTORY_PREFIX_LEN;
+
+  while (i-- > 0) {
+    const history_record_t *record = record_at(i);
+    if (record->len < len)
+      continue;
+
+    // Prefix searches reject almost every entry on the record alone
+    if (match == HISTORY_PREFIX && memcmp(record->prefix, text, key_len) != 0)
+      continue;
+    if (match == HISTORY_PREFIX && len <= HISTORY_PREFIX_LEN) {
+      *index = i;
+      return true;
+    }
+
+    size_t entry_len;
+    const char *entry = history_get(i, &entry_len);
+    if (!entry)
+      return false;
+    if (match == HISTORY_PREFIX ? memcmp(entry, text, len) == 0
+                                : memmem(entry, entry_len, text, len) != NULL) {
+      *index = i;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file input.c
+ * @brief Buffered line reader for the REPL
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "shell.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Minimum number of bytes requested from read() per refill
+ */
+#define INPUT_CHUNK (64 * 1024)
+
+void input_init(input_t *in, int fd) {
+  in->fd = fd;
+  in->buf = NULL;
+  in->capacity = 0;
+  in->start = 0;
+  in->end = 0;
+  in->eof = false;
+}
+
+void input_free(input_t *in) {
+  if (!in)
+    return;
+  free(in->buf);
+  in->buf = NULL;
+  in->capacity = 0;
+  in->start = 0;
+  in->end = 0;
+}
+
+/**
+ * @brief Make room for at least one more chunk after the buffered bytes
+ *
+ * The unread tail is slid to the front of the buffer first; the buffer only
+ * grows when a single line is longer than what is left.
+ *
+ * @param in Input reader
+ * @param scan Offset memchr has already searched up to, adjusted on return
+ * @return 0 on success, -1 on allocation failure
+ */
+static int make_room(input_t *in, size_t *scan) {
+  if (in->start > 0) {
+    size_t pending = in->end - in->start;
+    memmove(in->buf, in->buf + in->start, pending);
+    *scan -= in->start;
+    in->end = pending;
+    in->start = 0;
+  }
+
+  // Keep one byte spare for the terminator of an unterminated last line
+  if (in->capacity - in->end >= INPUT_CHUNK + 1)
+    return 0;
+
+  size_t capacity = in->capacity ? in->capacity : INPUT_CHUNK + 1;
+  while (capacity - in->end < INPUT_CHUNK + 1)
+    capacity *= 2;
+
+  char *buf = realloc(in->buf, capacity);
+  if (!buf)
+    return -1;
+  in->buf = buf;
+  in->capacity = capacity;
+  return 0;
+}
+
+int input_read_line(input_t *in, char **line, size_t *len) {
+  size_t scan = in->start;
+
+  while (1) {
+    // Hand out the next complete line straight from the buffer
+    char *nl = in->buf ? memchr(in->buf + scan, '\n', in->end - scan) : NULL;
+    if (nl) {
+      *nl = '\0';
+      *line = in->buf + in->start;
+      *len = (size_t)(nl - *line);
+      in->start = (size_t)(nl - in->buf) + 1;
+      return 1;
+    }
+    scan = in->end;
+
+    if (in->eof) {
+      if (in->start == in->end)
+        return 0;
+
+      // Last line without a trailing newline; make_room left a spare byte
+      in->buf[in->end] = '\0';
+      *line = in->buf + in->start;
+      *len = in->end - in->start;
+      in->start = in->end;
+      return 1;
+    }
+
+    if (make_room(in, &scan) == -1)
+      return -1;
+
+    ssize_t n = read(in->fd, in->buf + in->end, in->capacity - in->end - 1);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      in->eof = true;
+    in->end += (size_t)n;
+  }
+}
@@ -0,0 +1,554 @@
+/**
+ * @file jobs.c
+ * @brief Job table, batched SIGCHLD-driven reaping of child processes, and
+ * job control
+ *
+ * With job control (an interactive shell on its terminal) every job is a
+ * process group of its own, and a foreground job owns the terminal until
+ * it exits or stops, so the kernel delivers Ctrl+C and Ctrl+Z to all of
+ * its processes and to nothing else. Stops are tracked only then.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // wait4
+
+#include "shell.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Set by the SIGCHLD handler when some child changed state
+ */
+static volatile sig_atomic_t g_child_exited = 0;
+
+/**
+ * @brief All jobs the shell still tracks, in creation order
+ */
+static struct {
+  job_t **jobs;          /**< Job pointers */
+  size_t count;          /**< Number of jobs */
+  size_t capacity;       /**< Allocated slots */
+  unsigned long touches; /**< Stamps handed out for job_t::touched */
+} g_table = {NULL, 0, 0, 0};
+
+/**
+ * @brief Job control state
+ */
+static struct {
+  int tty;              /**< Terminal (close-on-exec copy), or -1 if off */
+  pid_t pgid;           /**< The shell's own process group */
+  pid_t original;       /**< Foreground group before the shell took over */
+  struct termios modes; /**< Terminal settings the shell runs with */
+} g_control = {.tty = -1};
+
+/**
+ * @brief SIGCHLD handler: only flags that reaping is needed
+ * @param sig Signal number
+ */
+static void sigchld_handler(int sig) {
+  (void)sig;
+  g_child_exited = 1;
+}
+
+void jobs_init(void) {
+  struct sigaction sa;
+  sa.sa_handler = sigchld_handler;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+
+  if (sigaction(SIGCHLD, &sa, NULL) == -1) {
+    perror("sigaction");
+  }
+}
+
+/**
+ * @brief Set the job control stop signals to an action
+ */
+static void set_stop_signals(void (*action)(int)) {
+  signal(SIGTSTP, action);
+  signal(SIGTTIN, action);
+  signal(SIGTTOU, action);
+}
+
+int jobs_control_init(int fd) {
+  // A shell started in the background waits until it is brought forward
+  pid_t pgrp;
+  while ((pgrp = tcgetpgrp(fd)) != -1 && pgrp != getpgrp())
+    kill(-getpgrp(), SIGTTIN);
+  if (pgrp == -1)
+    return -1;
+
+  // The stop signals are for jobs. Ignoring SIGTTOU also lets the shell
+  // take the terminal back from a job while it is not in the foreground
+  set_stop_signals(SIG_IGN);
+
+  pid_t pid = getpid();
+  int tty = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+  if ((pgrp != pid && setpgid(0, 0) == -1) || tty == -1 ||
+      tcsetpgrp(tty, pid) == -1 || tcgetattr(tty, &g_control.modes) == -1) {
+    perror("job control");
+    if (tty != -1)
+      close(tty);
+    set_stop_signals(SIG_DFL);
+    return -1;
+  }
+
+  g_control.tty = tty;
+  g_control.pgid = pid;
+  g_control.original = pgrp;
+  return 0;
+}
+
+void jobs_control_end(void) {
+  if (g_control.tty == -1)
+    return;
+  if (g_control.original != g_control.pgid)
+    tcsetpgrp(g_control.tty, g_control.original);
+  close(g_control.tty);
+  g_control.tty = -1;
+}
+
+void jobs_control_forget(void) {
+  // Stop signals stay ignored: the shell waiting on a subshell in its own
+  // group must not see it stop
+  if (g_control.tty == -1)
+    return;
+  close(g_control.tty);
+  g_control.tty = -1;
+}
+
+int jobs_terminal(void) { return g_control.tty; }
+
+int jobs_decode_status(int status) {
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  if (WIFSTOPPED(status))
+    return 128 + WSTOPSIG(status);
+  return 0;
+}
+
+/**
+ * @brief Build the "cmd1 args | cmd2 args" text shown by the jobs builtin
+ * @return Newly allocated string, or NULL on allocation failure
+ */
+static char *describe_pipeline(const pipeline_t *pipeline) {
+  size_t len = 1;
+  for (size_t i = 0; i < pipeline->num_commands; i++) {
+    char **argv = pipeline->commands[i].argv;
+    for (int j = 0; argv && argv[j]; j++)
+      len += strlen(argv[j]) + 1;
+    len += 3;
+  }
+
+  char *text = malloc(len);
+  if (!text)
+    return NULL;
+
+  char *p = text;
+  for (size_t i = 0; i < pipeline->num_commands; i++) {
+    char **argv = pipeline->commands[i].argv;
+    if (i > 0) {
+      memcpy(p, " | ", 3);
+      p += 3;
+    }
+    for (int j = 0; argv && argv[j]; j++) {
+      size_t arg_len = strlen(argv[j]);
+      if (j > 0)
+        *p++ = ' ';
+      memcpy(p, argv[j], arg_len);
+      p += arg_len;
+    }
+  }
+  *p = '\0';
+  return text;
+}
+
+/**
+ * @brief Free a job and everything it owns
+ */
+static void free_job(job_t *job) {
+  if (!job)
+    return;
+  free(job->procs);
+  free(job->command);
+  free(job);
+}
+
+/**
+ * @brief Remove a job from the table (without freeing it)
+ */
+static void unlink_job(job_t *job) {
+  for (size_t i = 0; i < g_table.count; i++) {
+    if (g_table.jobs[i] == job) {
+      memmove(&g_table.jobs[i], &g_table.jobs[i + 1],
+              (g_table.count - i - 1) * sizeof(job_t *));
+      g_table.count--;
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Add a job to the table
+ * @param command Allocated command text, owned by the job (freed on failure)
+ * @param pids Process IDs in pipeline order
+ * @param num_procs Number of processes
+ * @param background Whether the job runs in the background
+ * @return New job, or NULL on allocation failure
+ */
+static job_t *add_job(char *command, const pid_t *pids, size_t num_procs,
+                      bool background) {
+  job_t *job = command ? calloc(1, sizeof(job_t)) : NULL;
+  if (!job) {
+    free(command);
+    return NULL;
+  }
+  job->command = command;
+
+  if (g_table.count == g_table.capacity) {
+    size_t capacity = g_table.capacity ? g_table.capacity * 2 : 8;
+    job_t **jobs = realloc(g_table.jobs, capacity * sizeof(job_t *));
+    if (!jobs) {
+      free_job(job);
+      return NULL;
+    }
+    g_table.jobs = jobs;
+    g_table.capacity = capacity;
+  }
+
+  job->procs = calloc(num_procs ? num_procs : 1, sizeof(job_proc_t));
+  if (!job->procs) {
+    free_job(job);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < num_procs; i++)
+    job->procs[i].pid = pids[i];
+  job->num_procs = num_procs;
+  job->pgid = num_procs ? pids[0] : 0;
+  job->background = background;
+  if (background)
+    job->touched = ++g_table.touches;
+
+  // Job numbers continue from the highest one in use, like other shells
+  int id = 1;
+  for (size_t i = 0; i < g_table.count; i++) {
+    if (g_table.jobs[i]->id >= id)
+      id = g_table.jobs[i]->id + 1;
+  }
+  job->id = id;
+
+  g_table.jobs[g_table.count++] = job;
+  return job;
+}
+
+job_t *jobs_add(const pipeline_t *pipeline, const pid_t *pids,
+                size_t num_procs, bool background) {
+  return add_job(describe_pipeline(pipeline), pids, num_procs, background);
+}
+
+job_t *jobs_add_command(const char *command, pid_t pid) {
+  return add_job(strdup(command), &pid, 1, false);
+}
+
+/**
+ * @brief Store the status of a reaped, stopped or continued child in
+ * whichever job owns it
+ * @param pid Process the status is for
+ * @param status Raw wait status
+ * @param usage Resource usage reported by wait4
+ */
+static void record_exit(pid_t pid, int status, const struct rusage *usage) {
+  for (size_t i = 0; i < g_table.count; i++) {
+    job_t *job = g_table.jobs[i];
+    for (size_t j = 0; j < job->num_procs; j++) {
+      job_proc_t *proc = &job->procs[j];
+      if (proc->pid != pid || proc->done)
+        continue;
+
+      if (WIFSTOPPED(status)) {
+        proc->stopped = true;
+        proc->status = status;
+        return;
+      }
+      if (WIFCONTINUED(status)) {
+        proc->stopped = false;
+        job->stop_shown = false;
+        return;
+      }
+      proc->stopped = false;
+      proc->done = true;
+      proc->status = status;
+      proc->usage = *usage;
+      clock_gettime(CLOCK_MONOTONIC, &proc->exited);
+      job->num_done++;
+      return;
+    }
+  }
+  // Not one of ours (e.g. already abandoned); nothing to record
+}
+
+void jobs_reap(void) {
+  // Nothing exited since the last batch: no syscall at all
+  if (!g_child_exited)
+    return;
+
+  // Clear first so an exit racing with the loop triggers another batch
+  g_child_exited = 0;
+
+  int options = WNOHANG;
+  if (g_control.tty != -1)
+    options |= WUNTRACED | WCONTINUED;
+  while (1) {
+    int status;
+    struct rusage usage;
+    pid_t pid = wait4(-1, &status, options, &usage);
+    if (pid <= 0)
+      break;
+    record_exit(pid, status, &usage);
+  }
+}
+
+bool jobs_is_done(const job_t *job) { return job->num_done >= job->num_procs; }
+
+bool jobs_is_stopped(const job_t *job) {
+  if (jobs_is_done(job))
+    return false;
+  for (size_t i = 0; i < job->num_procs; i++) {
+    if (!job->procs[i].done && !job->procs[i].stopped)
+      return false;
+  }
+  return true;
+}
+
+int jobs_status(const job_t *job) {
+  if (job->num_procs == 0)
+    return 0;
+
+  // A stopped job reports the signal that stopped it
+  for (size_t i = job->num_procs; jobs_is_stopped(job) && i-- > 0;) {
+    if (job->procs[i].stopped)
+      return jobs_decode_status(job->procs[i].status);
+  }
+  return jobs_decode_status(job->procs[job->num_procs - 1].status);
+}
+
+int jobs_wait(job_t *job) {
+  // Block for whichever child exits (or, with job control, stops) next;
+  // children of other jobs are recorded as they come instead of being left
+  // as zombies
+  int options = g_control.tty != -1 ? WUNTRACED : 0;
+  while (!jobs_is_done(job) && !jobs_is_stopped(job)) {
+    int status;
+    struct rusage usage;
+    pid_t pid = wait4(-1, &status, options, &usage);
+    if (pid == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno != ECHILD)
+        perror("wait4");
+
+      // No children left: nothing more will be reported for this job
+      for (size_t i = 0; i < job->num_procs; i++) {
+        if (!job->procs[i].done) {
+          job->procs[i].done = true;
+          job->num_done++;
+        }
+      }
+      break;
+    }
+    record_exit(pid, status, &usage);
+  }
+
+  return jobs_status(job);
+}
+
+int jobs_wait_any(void) {
+  int status;
+  struct rusage usage;
+  pid_t pid;
+  while ((pid = wait4(-1, &status, 0, &usage)) == -1 && errno == EINTR)
+    ;
+
+  if (pid == -1) {
+    if (errno != ECHILD) {
+      perror("wait4");
+      return -1;
+    }
+    // No children left: nothing more will be reported for any job
+    for (size_t i = 0; i < g_table.count; i++) {
+      job_t *job = g_table.jobs[i];
+      for (size_t j = 0; j < job->num_procs; j++) {
+        if (!job->procs[j].done) {
+          job->procs[j].done = true;
+          job->num_done++;
+        }
+      }
+    }
+    return -1;
+  }
+  record_exit(pid, status, &usage);
+  return 0;
+}
+
+/**
+ * @brief Send SIGCONT to a stopped job
+ * @return 0 on success, -1 on failure (message printed)
+ */
+static int continue_job(job_t *job) {
+  if (!jobs_is_stopped(job))
+    return 0;
+  if (kill(-job->pgid, SIGCONT) == -1) {
+    perror("kill");
+    return -1;
+  }
+  for (size_t i = 0; i < job->num_procs; i++)
+    job->procs[i].stopped = false;
+  job->stop_shown = false;
+  return 0;
+}
+
+int jobs_foreground(job_t *job, bool resume) {
+  bool control = g_control.tty != -1 && job->pgid > 0;
+  if (control) {
+    tcsetpgrp(g_control.tty, job->pgid);
+    if (resume && job->has_modes)
+      tcsetattr(g_control.tty, TCSADRAIN, &job->modes);
+  }
+  if (resume && continue_job(job) == -1) {
+    if (control)
+      tcsetpgrp(g_control.tty, g_control.pgid);
+    return 1;
+  }
+  job->background = false;
+
+  int status = jobs_wait(job);
+  if (!control)
+    return status;
+
+  // Take the terminal back. Settings a job leaves behind stick when it
+  // exits normally (stty); a stopped or killed job's are undone
+  tcsetpgrp(g_control.tty, g_control.pgid);
+  if (jobs_is_stopped(job)) {
+    job->has_modes = tcgetattr(g_control.tty, &job->modes) == 0;
+    tcsetattr(g_control.tty, TCSADRAIN, &g_control.modes);
+    job->background = true;
+    job->touched = ++g_table.touches;
+    job->stop_shown = true;
+    fprintf(stderr, "\n[%d]  %-8s %s\n", job->id, "Stopped", job->command);
+  } else if (status > 128) {
+    tcsetattr(g_control.tty, TCSADRAIN, &g_control.modes);
+  } else {
+    tcgetattr(g_control.tty, &g_control.modes);
+  }
+  return status;
+}
+
+int jobs_background(job_t *job) {
+  if (continue_job(job) == -1)
+    return -1;
+  job->background = true;
+  job->touched = ++g_table.touches;
+  return 0;
+}
+
+job_t *jobs_current(void) {
+  job_t *current = NULL;
+  for (size_t i = 0; i < g_table.count; i++) {
+    job_t *job = g_table.jobs[i];
+    if (job->background && !jobs_is_done(job) &&
+        (!current || job->touched >= current->touched))
+      current = job;
+  }
+  return current;
+}
+
+void jobs_remove(job_t *job) {
+  unlink_job(job);
+  free_job(job);
+}
+
+job_t *jobs_find(const char *spec) {
+  if (!spec)
+    return NULL;
+
+  // %n names a job number, anything else a process ID
+  bool by_id = (spec[0] == '%');
+  char *end;
+  long value = strtol(by_id ? spec + 1 : spec, &end, 10);
+  if (*end != '\0' || end == (by_id ? spec + 1 : spec))
+    return NULL;
+
+  for (size_t i = 0; i < g_table.count; i++) {
+    job_t *job = g_table.jobs[i];
+    if (!job->background)
+      continue;
+    if (by_id && job->id == value)
+      return job;
+    for (size_t j = 0; !by_id && j < job->num_procs; j++) {
+      if (job->procs[j].pid == (pid_t)value)
+        return job;
+    }
+  }
+  return NULL;
+}
+
+int jobs_wait_all(void) {
+  int status = 0;
+  for (size_t i = 0; i < g_table.count;) {
+    job_t *job = g_table.jobs[i];
+    if (!job->background) {
+      i++;
+      continue;
+    }
+    status = jobs_wait(job);
+
+    // Stopped jobs are left for fg and bg
+    if (jobs_is_done(job))
+      jobs_remove(job);
+    else
+      i++;
+  }
+  return status;
+}
+
+void jobs_print(FILE *out) {
+  jobs_reap();
+  for (size_t i = 0; i < g_table.count; i++) {
+    job_t *job = g_table.jobs[i];
+    if (!job->background)
+      continue;
+    fprintf(out, "[%d]  %-8s %s\n", job->id,
+            jobs_is_done(job)      ? "Done"
+            : jobs_is_stopped(job) ? "Stopped"
+                                   : "Running",
+            job->command);
+  }
+}
+
+void jobs_notify(void) {
+  for (size_t i = 0; i < g_table.count;) {
+    job_t *job = g_table.jobs[i];
+    if (job->background && jobs_is_done(job)) {
+      fprintf(stderr, "[%d]  Done     %s\n", job->id, job->command);
+      jobs_remove(job);
+      continue;
+    }
+    if (job->background && !job->stop_shown && jobs_is_stopped(job)) {
+      fprintf(stderr, "[%d]  Stopped  %s\n", job->id, job->command);
+      job->stop_shown = true;
+    }
+    i++;
+  }
+}
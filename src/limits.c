@@ -0,0 +1,150 @@
+/**
+ * @file limits.c
+ * @brief Resource limits and cgroup placement for spawned stages
+ * (set -o limit-cpu, limit-as, limit-nofile and cgroup)
+ */
+
+#define _GNU_SOURCE // syscall
+
+#include "shell.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <linux/sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * @brief set -o name and setrlimit resource of each limit
+ */
+static const struct {
+  const char *name; /**< Option name */
+  int resource;     /**< RLIMIT_* constant */
+} g_resources[LIMIT_COUNT] = {
+    {"limit-cpu", RLIMIT_CPU},
+    {"limit-as", RLIMIT_AS},
+    {"limit-nofile", RLIMIT_NOFILE},
+};
+
+/**
+ * @brief Limits and cgroup applied to new stages
+ */
+static struct {
+  rlim_t values[LIMIT_COUNT]; /**< Limit per resource, or RLIM_INFINITY */
+  int cgroup_fd;              /**< Cgroup directory, or -1 for none */
+  char *cgroup_path;          /**< Its path as given, for set -o */
+  bool no_clone3;             /**< clone3 was refused; fork and move */
+} g_limits = {{RLIM_INFINITY, RLIM_INFINITY, RLIM_INFINITY}, -1, NULL, false};
+
+/**
+ * @brief Set in a child clone3 already started inside the cgroup
+ */
+static bool g_placed = false;
+
+void limits_set(limit_resource_t resource, rlim_t value) {
+  g_limits.values[resource] = value;
+}
+
+const char *limits_name(limit_resource_t resource) {
+  return g_resources[resource].name;
+}
+
+int limits_set_cgroup(const char *dir) {
+  int fd = -1;
+  char *path = NULL;
+  if (dir) {
+    // Only cgroup v2 takes a directory descriptor in clone3
+    struct statfs fs;
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+      return -1;
+    int err = 0;
+    if (fstatfs(fd, &fs) == -1)
+      err = errno;
+    else if (fs.f_type != CGROUP2_SUPER_MAGIC)
+      err = EINVAL;
+    else if (!(path = strdup(dir)))
+      err = ENOMEM;
+    if (err != 0) {
+      close(fd);
+      errno = err;
+      return -1;
+    }
+  }
+
+  if (g_limits.cgroup_fd != -1)
+    close(g_limits.cgroup_fd);
+  free(g_limits.cgroup_path);
+  g_limits.cgroup_fd = fd;
+  g_limits.cgroup_path = path;
+  return 0;
+}
+
+bool limits_active(void) {
+  for (int i = 0; i < LIMIT_COUNT; i++) {
+    if (g_limits.values[i] != RLIM_INFINITY)
+      return true;
+  }
+  return g_limits.cgroup_fd != -1;
+}
+
+pid_t limits_fork(void) {
+#if defined(SYS_clone3) && defined(CLONE_INTO_CGROUP)
+  if (g_limits.cgroup_fd != -1 && !g_limits.no_clone3) {
+    struct clone_args args = {
+        .flags = CLONE_INTO_CGROUP,
+        .exit_signal = SIGCHLD,
+        .cgroup = (uint64_t)g_limits.cgroup_fd,
+    };
+    long pid = syscall(SYS_clone3, &args, sizeof(args));
+    if (pid == 0)
+      g_placed = true;
+    if (pid != -1 || (errno != ENOSYS && errno != E2BIG))
+      return (pid_t)pid;
+
+    // Before Linux 5.7: fork, and the child moves itself
+    g_limits.no_clone3 = true;
+  }
+#endif
+  return fork();
+}
+
+int limits_apply(void) {
+  if (g_limits.cgroup_fd != -1 && !g_placed) {
+    int fd = openat(g_limits.cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    if (fd == -1 || write(fd, "0\n", 2) != 2) {
+      fprintf(stderr, "cgroup: %s: %s\n", g_limits.cgroup_path,
+              strerror(errno));
+      return -1;
+    }
+    close(fd);
+  }
+
+  for (int i = 0; i < LIMIT_COUNT; i++) {
+    rlim_t value = g_limits.values[i];
+    if (value == RLIM_INFINITY)
+      continue;
+    struct rlimit limit = {value, value};
+    if (setrlimit(g_resources[i].resource, &limit) == -1) {
+      fprintf(stderr, "%s: %s\n", g_resources[i].name, strerror(errno));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void limits_print(FILE *out) {
+  for (int i = 0; i < LIMIT_COUNT; i++) {
+    if (g_limits.values[i] == RLIM_INFINITY)
+      fprintf(out, "%s\toff\n", g_resources[i].name);
+    else
+      fprintf(out, "%s\t%llu\n", g_resources[i].name,
+              (unsigned long long)g_limits.values[i]);
+  }
+  fprintf(out, "cgroup\t\t%s\n",
+          g_limits.cgroup_path ? g_limits.cgroup_path : "off");
+}
@@ -0,0 +1,948 @@
+/**
+ * @file lineedit.c
+ * @brief Raw-mode line editor with history search and tab completion
+ *
+ * The line is kept in one buffer and redrawn on a single terminal row,
+ * scrolled sideways when it does not fit, with one write per redraw. Keys
+ * are waited for with poll() together with the pipes of any directory
+ * being listed for a completion, so a slow listing never holds up typing:
+ * Tab on a word whose directories are still arriving completes once they
+ * have (or after a short wait, from what is there by then), and any other
+ * key simply carries on editing.
+ *
+ * Up and Down step through the history entries starting with what was
+ * typed, Ctrl+R searches the history for text anywhere in an entry.
+ */
+
+#define _DEFAULT_SOURCE // TIOCGWINSZ
+
+#include "shell.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Milliseconds to wait for the rest of an escape sequence
+ */
+#define LINEEDIT_ESCAPE_MS 50
+
+/**
+ * @brief Milliseconds Tab waits for listings before using what has arrived
+ */
+#define LINEEDIT_COMPLETE_MS 150
+
+/**
+ * @brief Candidates listed below the line, at most
+ */
+#define LINEEDIT_LIST_MAX 100
+
+/**
+ * @brief Listing pipes polled together with the terminal, at most
+ */
+#define LINEEDIT_MAX_FDS 32
+
+/**
+ * @brief Bytes of Ctrl+R search text, at most
+ */
+#define LINEEDIT_SEARCH_MAX 256
+
+/**
+ * @brief Control key codes
+ */
+#define CONTROL(c) ((c) & 0x1f)
+
+/**
+ * @brief Growable byte buffer
+ */
+typedef struct {
+  char *buf;       /**< Contents (NUL-terminated once anything was added) */
+  size_t len;      /**< Length without the terminator */
+  size_t capacity; /**< Allocated bytes */
+} buffer_t;
+
+/**
+ * @brief What a key did to the line being read
+ */
+typedef enum {
+  KEY_CONTINUE, /**< Keep editing */
+  KEY_ACCEPT,   /**< The line is complete */
+  KEY_EOF,      /**< End of input */
+  KEY_ERROR     /**< Reading the terminal failed */
+} key_result_t;
+
+/**
+ * @brief Editor state
+ */
+static struct {
+  int in_fd;                   /**< Terminal the keys come from */
+  int out_fd;                  /**< Terminal the line is drawn on */
+  struct termios cooked;       /**< Terminal settings outside the editor */
+  buffer_t line;               /**< Line being edited */
+  size_t pos;                  /**< Cursor offset in line */
+  const char *prompt;          /**< Prompt of the current line */
+  buffer_t frame;              /**< Output of one redraw */
+  buffer_t typed;              /**< Line as typed before browsing history */
+  size_t history_index;        /**< Entry shown, history_count() if none */
+  unsigned tabs;               /**< Consecutive Tab presses */
+  bool complete_wanted;        /**< Tab is waiting for listings */
+  struct timespec complete_by; /**< When to stop waiting for them */
+} g_edit = {.in_fd = -1, .out_fd = -1};
+
+/**
+ * @brief Make room for at least need bytes plus a terminator
+ * @return 0 on success, -1 on allocation failure
+ */
+static int buffer_reserve(buffer_t *b, size_t need) {
+  if (need + 1 <= b->capacity)
+    return 0;
+
+  size_t capacity = b->capacity ? b->capacity : 256;
+  while (capacity < need + 1)
+    capacity *= 2;
+  char *buf = realloc(b->buf, capacity);
+  if (!buf)
+    return -1;
+  b->buf = buf;
+  b->capacity = capacity;
+  return 0;
+}
+
+/**
+ * @brief Append bytes to a buffer
+ * @return 0 on success, -1 on allocation failure
+ */
+static int buffer_append(buffer_t *b, const char *data, size_t len) {
+  if (buffer_reserve(b, b->len + len) == -1)
+    return -1;
+  memcpy(b->buf + b->len, data, len);
+  b->len += len;
+  b->buf[b->len] = '\0';
+  return 0;
+}
+
+/**
+ * @brief Replace the contents of a buffer
+ * @return 0 on success, -1 on allocation failure
+ */
+static int buffer_set(buffer_t *b, const char *data, size_t len) {
+  b->len = 0;
+  return buffer_append(b, data, len);
+}
+
+/**
+ * @brief Write a whole buffer to the terminal
+ */
+static void write_out(const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(g_edit.out_fd, data, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return;
+    data += n;
+    len -= (size_t)n;
+  }
+}
+
+/**
+ * @brief Ring the terminal bell
+ */
+static void bell(void) { write_out("\a", 1); }
+
+/**
+ * @brief Check whether a byte continues a UTF-8 character
+ */
+static bool is_continuation(char c) {
+  return ((unsigned char)c & 0xc0) == 0x80;
+}
+
+/**
+ * @brief Count the characters (taken as one column each) in a span
+ */
+static size_t columns(const char *text, size_t len) {
+  size_t cols = 0;
+  for (size_t i = 0; i < len; i++)
+    cols += !is_continuation(text[i]);
+  return cols;
+}
+
+/**
+ * @brief Offset of the character before pos
+ */
+static size_t prev_char(size_t pos) {
+  while (pos > 0 && is_continuation(g_edit.line.buf[--pos]))
+    ;
+  return pos;
+}
+
+/**
+ * @brief Offset of the character after pos
+ */
+static size_t next_char(size_t pos) {
+  while (pos < g_edit.line.len && is_continuation(g_edit.line.buf[++pos]))
+    ;
+  return pos;
+}
+
+/**
+ * @brief Get the terminal width
+ */
+static size_t terminal_columns(void) {
+  struct winsize ws;
+  if (ioctl(g_edit.out_fd, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+    return 80;
+  return ws.ws_col;
+}
+
+/**
+ * @brief Redraw the prompt and the line, scrolling it to keep the cursor
+ * in view
+ */
+static void refresh(void) {
+  size_t prompt_cols = columns(g_edit.prompt, strlen(g_edit.prompt));
+  size_t cols = terminal_columns();
+  size_t avail = cols > prompt_cols + 1 ? cols - prompt_cols - 1 : 1;
+
+  // Skip just enough characters for the cursor to fit
+  const char *text = g_edit.line.buf ? g_edit.line.buf : "";
+  size_t cursor = columns(text, g_edit.pos);
+  size_t skip = cursor >= avail ? cursor - avail + 1 : 0;
+  size_t first = 0;
+  for (; skip > 0; skip--) {
+    first++;
+    while (first < g_edit.pos && is_continuation(text[first]))
+      first++;
+  }
+  size_t last = first;
+  for (size_t shown = 0; last < g_edit.line.len; last++) {
+    if (!is_continuation(text[last]) && ++shown > avail)
+      break;
+  }
+
+  buffer_t *f = &g_edit.frame;
+  f->len = 0;
+  char move[32] = "\r";
+  size_t column = prompt_cols + columns(text + first, g_edit.pos - first);
+  if (column > 0)
+    snprintf(move, sizeof(move), "\r\x1b[%zuC", column);
+  if (buffer_append(f, "\r", 1) == 0 &&
+      buffer_append(f, g_edit.prompt, strlen(g_edit.prompt)) == 0 &&
+      buffer_append(f, text + first, last - first) == 0 &&
+      buffer_append(f, "\x1b[0K", 4) == 0 &&
+      buffer_append(f, move, strlen(move)) == 0)
+    write_out(f->buf, f->len);
+}
+
+/**
+ * @brief Forget the history entry being shown; the next Up starts over
+ * from the line as it is now
+ */
+static void stop_browsing(void) { g_edit.history_index = history_count(); }
+
+/**
+ * @brief Insert text at the cursor
+ * @return 0 on success, -1 on allocation failure
+ */
+static int insert_text(const char *text, size_t len) {
+  buffer_t *l = &g_edit.line;
+  if (buffer_reserve(l, l->len + len) == -1)
+    return -1;
+  memmove(l->buf + g_edit.pos + len, l->buf + g_edit.pos,
+          l->len - g_edit.pos + 1);
+  memcpy(l->buf + g_edit.pos, text, len);
+  l->len += len;
+  g_edit.pos += len;
+  stop_browsing();
+  return 0;
+}
+
+/**
+ * @brief Delete the bytes between two offsets and leave the cursor there
+ */
+static void delete_range(size_t from, size_t to) {
+  buffer_t *l = &g_edit.line;
+  if (from >= to)
+    return;
+  memmove(l->buf + from, l->buf + to, l->len - to + 1);
+  l->len -= to - from;
+  g_edit.pos = from;
+  stop_browsing();
+}
+
+/**
+ * @brief Show a history entry (or the typed line) as the line
+ */
+static void show_entry(const char *text, size_t len, size_t index) {
+  if (buffer_set(&g_edit.line, text, len) == -1)
+    return;
+  g_edit.pos = len;
+  g_edit.history_index = index;
+  refresh();
+}
+
+/**
+ * @brief Check whether the line holds exactly the given text
+ */
+static bool line_is(const char *text, size_t len) {
+  return g_edit.line.len == len &&
+         memcmp(g_edit.line.buf ? g_edit.line.buf : "", text, len) == 0;
+}
+
+/**
+ * @brief Up: show the next older entry starting with the typed text
+ */
+static void history_up(void) {
+  size_t count = history_count();
+  if (g_edit.history_index >= count) {
+    if (buffer_set(&g_edit.typed, g_edit.line.buf ? g_edit.line.buf : "",
+                   g_edit.line.len) == -1)
+      return;
+    g_edit.history_index = count;
+  }
+
+  size_t index = g_edit.history_index;
+  while (history_search(g_edit.typed.buf, g_edit.typed.len, HISTORY_PREFIX,
+                        &index)) {
+    size_t len;
+    const char *entry = history_get(index, &len);
+    if (entry && !line_is(entry, len)) {
+      show_entry(entry, len, index);
+      return;
+    }
+  }
+  bell();
+}
+
+/**
+ * @brief Down: show the next newer matching entry, or the typed line
+ */
+static void history_down(void) {
+  size_t count = history_count();
+  if (g_edit.history_index >= count) {
+    bell();
+    return;
+  }
+
+  for (size_t i = g_edit.history_index + 1; i < count; i++) {
+    size_t len;
+    const char *entry = history_get(i, &len);
+    if (entry && len >= g_edit.typed.len &&
+        memcmp(entry, g_edit.typed.buf, g_edit.typed.len) == 0 &&
+        !line_is(entry, len)) {
+      show_entry(entry, len, i);
+      return;
+    }
+  }
+  show_entry(g_edit.typed.buf, g_edit.typed.len, count);
+}
+
+/**
+ * @brief Get the point in time some milliseconds from now
+ */
+static void deadline_after(struct timespec *when, int ms) {
+  clock_gettime(CLOCK_MONOTONIC, when);
+  when->tv_sec += ms / 1000;
+  when->tv_nsec += (long)(ms % 1000) * 1000000;
+  if (when->tv_nsec >= 1000000000) {
+    when->tv_sec++;
+    when->tv_nsec -= 1000000000;
+  }
+}
+
+/**
+ * @brief Milliseconds until a point in time (0 if it has passed)
+ */
+static int ms_until(const struct timespec *when) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long ms = (when->tv_sec - now.tv_sec) * 1000 +
+            (when->tv_nsec - now.tv_nsec) / 1000000;
+  return ms > 0 ? (int)ms : 0;
+}
+
+static void complete_word(bool force);
+
+/**
+ * @brief Wait for the next byte from the terminal
+ *
+ * Listing pipes are served meanwhile, and a Tab waiting for them is
+ * completed as soon as they are done or its time is up.
+ *
+ * @param c Output byte
+ * @param timeout_ms Milliseconds to wait, or -1 for as long as it takes
+ * @return 1 if a byte was read, 0 on timeout, -1 at end of input or on error
+ */
+static int read_byte(unsigned char *c, int timeout_ms) {
+  struct timespec deadline;
+  if (timeout_ms >= 0)
+    deadline_after(&deadline, timeout_ms);
+
+  while (1) {
+    struct pollfd fds[1 + LINEEDIT_MAX_FDS];
+    int listers[LINEEDIT_MAX_FDS];
+    size_t num_listers = complete_fds(listers, LINEEDIT_MAX_FDS);
+    fds[0] = (struct pollfd){g_edit.in_fd, POLLIN, 0};
+    for (size_t i = 0; i < num_listers; i++)
+      fds[1 + i] = (struct pollfd){listers[i], POLLIN, 0};
+
+    int wait = timeout_ms >= 0 ? ms_until(&deadline) : -1;
+    if (g_edit.complete_wanted) {
+      int complete_wait = ms_until(&g_edit.complete_by);
+      if (wait == -1 || complete_wait < wait)
+        wait = complete_wait;
+    }
+
+    int ready = poll(fds, 1 + num_listers, wait);
+    if (ready == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    bool listed = false;
+    for (size_t i = 0; i < num_listers; i++)
+      listed |= fds[1 + i].revents != 0;
+    if (listed && complete_progress() && g_edit.complete_wanted)
+      complete_word(false);
+    if (g_edit.complete_wanted && ms_until(&g_edit.complete_by) == 0)
+      complete_word(true);
+
+    // A key typed while Tab waits gets the completion first if the
+    // listings have made it by now, and otherwise ends the wait
+    if (fds[0].revents && g_edit.complete_wanted) {
+      complete_progress();
+      complete_word(false);
+    }
+    if (fds[0].revents) {
+      ssize_t n = read(g_edit.in_fd, c, 1);
+      if (n == 1)
+        return 1;
+      if (n == -1 && (errno == EINTR || errno == EAGAIN))
+        continue;
+      if (n == 0)
+        errno = 0;
+      return -1;
+    }
+    if (timeout_ms >= 0 && ms_until(&deadline) == 0)
+      return 0;
+  }
+}
+
+/**
+ * @brief Check whether a byte ends a word for completion
+ */
+static bool is_word_break(char c) { return c && strchr(" \t|&;<>()", c); }
+
+/**
+ * @brief Check whether a byte has to be escaped in a completed name
+ */
+static bool needs_escape(char c) {
+  return c && strchr(" \t\\'\"|&;<>()$`*?[#", c);
+}
+
+/**
+ * @brief Print candidates in columns below the line and redraw it
+ */
+static void list_matches(const complete_result_t *r) {
+  size_t width = 0;
+  for (size_t i = 0; i < r->count && i < LINEEDIT_LIST_MAX; i++) {
+    size_t w = columns(r->matches[i].name, strlen(r->matches[i].name)) +
+               r->matches[i].dir;
+    if (w > width)
+      width = w;
+  }
+  width += 2;
+  size_t per_row = terminal_columns() / width;
+  if (per_row == 0)
+    per_row = 1;
+
+  buffer_t *f = &g_edit.frame;
+  f->len = 0;
+  buffer_append(f, "\n", 1);
+  for (size_t i = 0; i < r->count && i < LINEEDIT_LIST_MAX; i++) {
+    const complete_match_t *m = &r->matches[i];
+    size_t w = columns(m->name, strlen(m->name)) + m->dir;
+    buffer_append(f, m->name, strlen(m->name));
+    if (m->dir)
+      buffer_append(f, "/", 1);
+    if ((i + 1) % per_row == 0 || i + 1 == r->count) {
+      buffer_append(f, "\n", 1);
+    } else {
+      for (; w < width; w++)
+        buffer_append(f, " ", 1);
+    }
+  }
+  if (r->count > LINEEDIT_LIST_MAX) {
+    char more[64];
+    int n = snprintf(more, sizeof(more), "\n... and %zu more\n",
+                     r->count - LINEEDIT_LIST_MAX);
+    buffer_append(f, more, (size_t)n);
+  }
+  write_out(f->buf, f->len);
+  refresh();
+}
+
+/**
+ * @brief Complete the word before the cursor
+ *
+ * Inserts the name if there is only one candidate, or else as much as all
+ * candidates share; a repeated Tab lists them. While directories are still
+ * being listed the completion waits for them, unless forced.
+ *
+ * @param force Use what has been listed so far
+ */
+static void complete_word(bool force) {
+  bool waiting = g_edit.complete_wanted;
+  g_edit.complete_wanted = false;
+  const char *text = g_edit.line.buf ? g_edit.line.buf : "";
+
+  // The word runs back to a break that is not escaped
+  size_t start = g_edit.pos;
+  while (start > 0 && !(is_word_break(text[start - 1]) &&
+                        !(start >= 2 && text[start - 2] == '\\')))
+    start--;
+  size_t before = start;
+  while (before > 0 && (text[before - 1] == ' ' || text[before - 1] == '\t'))
+    before--;
+  bool command = before == 0 || strchr("|&;(", text[before - 1]);
+
+  // Complete the word as the command will see it
+  char *word = malloc(g_edit.pos - start + 1);
+  if (!word)
+    return;
+  size_t len = 0;
+  for (size_t i = start; i < g_edit.pos; i++) {
+    if (text[i] == '\\' && i + 1 < g_edit.pos)
+      word[len++] = text[++i];
+    else if (text[i] != '\'' && text[i] != '"')
+      word[len++] = text[i];
+  }
+
+  complete_result_t r;
+  int status = complete_query(word, len, command, &r);
+  free(word);
+  if (status == -1) {
+    bell();
+    return;
+  }
+  if (r.pending && !force) {
+    // The wait is counted from the Tab, however the names trickle in
+    if (!waiting) {
+      deadline_after(&g_edit.complete_by, LINEEDIT_COMPLETE_MS);
+    }
+    g_edit.complete_wanted = true;
+    return;
+  }
+  if (r.count == 0) {
+    bell();
+    return;
+  }
+
+  size_t common = strlen(r.matches[0].name);
+  for (size_t i = 1; i < r.count; i++) {
+    size_t j = r.prefix_len;
+    while (j < common && r.matches[i].name[j] == r.matches[0].name[j])
+      j++;
+    common = j;
+  }
+
+  if (common == r.prefix_len && r.count > 1) {
+    if (g_edit.tabs >= 2)
+      list_matches(&r);
+    else
+      bell();
+    return;
+  }
+
+  // The names live in the listings, which the insertion cannot touch
+  const char *name = r.matches[0].name;
+  for (size_t i = r.prefix_len; i < common; i++) {
+    if (needs_escape(name[i]) && insert_text("\\", 1) == -1)
+      return;
+    if (insert_text(name + i, 1) == -1)
+      return;
+  }
+  if (r.count == 1 && !r.pending)
+    insert_text(r.matches[0].dir ? "/" : " ", 1);
+  refresh();
+}
+
+/**
+ * @brief Draw the Ctrl+R search line
+ */
+static void refresh_search(const char *text, size_t len, bool failed) {
+  buffer_t *f = &g_edit.frame;
+  f->len = 0;
+  const char *label = failed ? "(failed reverse-i-search)`"
+                             : "(reverse-i-search)`";
+  buffer_append(f, "\r", 1);
+  buffer_append(f, label, strlen(label));
+  buffer_append(f, text, len);
+  buffer_append(f, "': ", 3);
+
+  // Only what fits on the row; the cursor stays at its end
+  size_t used = columns(f->buf + 1, f->len - 1);
+  size_t cols = terminal_columns();
+  const char *line = g_edit.line.buf ? g_edit.line.buf : "";
+  size_t shown = 0;
+  while (shown < g_edit.line.len && used + 1 < cols) {
+    used += !is_continuation(line[shown]);
+    shown++;
+  }
+  while (shown < g_edit.line.len && is_continuation(line[shown]))
+    shown++;
+  buffer_append(f, line, shown);
+  buffer_append(f, "\x1b[0K", 4);
+  write_out(f->buf, f->len);
+}
+
+/**
+ * @brief Ctrl+R: search the history for entries containing some text
+ *
+ * Typing narrows the search, Ctrl+R steps to older matches, Enter runs
+ * the match and Ctrl+G gives up. Any other key keeps the match as the
+ * line and is then handled as usual.
+ *
+ * @param key Output key ending the search, or 0 if none is left to handle
+ * @return Result for the line being read
+ */
+static key_result_t history_search_keys(unsigned char *key) {
+  char text[LINEEDIT_SEARCH_MAX];
+  size_t len = 0;
+  size_t found = history_count();
+  bool failed = false;
+  buffer_t saved = {NULL, 0, 0};
+  if (buffer_set(&saved, g_edit.line.buf ? g_edit.line.buf : "",
+                 g_edit.line.len) == -1)
+    return KEY_CONTINUE;
+
+  *key = 0;
+  key_result_t result = KEY_CONTINUE;
+  refresh_search(text, len, failed);
+  while (1) {
+    unsigned char c;
+    if (read_byte(&c, -1) != 1) {
+      result = errno ? KEY_ERROR : KEY_EOF;
+      break;
+    }
+
+    size_t from = found;
+    if (c == CONTROL('G') || c == CONTROL('C')) {
+      buffer_set(&g_edit.line, saved.buf, saved.len);
+      g_edit.pos = saved.len;
+      break;
+    } else if (c == '\r' || c == '\n') {
+      result = KEY_ACCEPT;
+      break;
+    } else if (c == 127 || c == CONTROL('H')) {
+      while (len > 0 && is_continuation(text[--len]))
+        ;
+      from = history_count();
+    } else if (c == CONTROL('R')) {
+      // Older matches only; the same search again goes on from here
+    } else if (c >= 32 && len < sizeof(text)) {
+      text[len++] = (char)c;
+      from = found < history_count() ? found + 1 : found;
+    } else {
+      *key = c;
+      break;
+    }
+
+    size_t index = from;
+    failed = len > 0 &&
+             !history_search(text, len, HISTORY_SUBSTRING, &index);
+    if (!failed && len > 0) {
+      size_t entry_len;
+      const char *entry = history_get(index, &entry_len);
+      if (entry && buffer_set(&g_edit.line, entry, entry_len) == 0) {
+        g_edit.pos = entry_len;
+        found = index;
+      }
+    }
+    refresh_search(text, len, failed);
+  }
+
+  free(saved.buf);
+  stop_browsing();
+  if (result == KEY_CONTINUE)
+    refresh();
+  return result;
+}
+
+/**
+ * @brief Read the rest of an escape sequence and act on it
+ */
+static void escape_sequence(void) {
+  unsigned char c;
+  if (read_byte(&c, LINEEDIT_ESCAPE_MS) != 1)
+    return;
+
+  // Meta-b and Meta-f move by words
+  size_t pos = g_edit.pos;
+  const char *text = g_edit.line.buf ? g_edit.line.buf : "";
+  if (c == 'b' || c == 'f') {
+    if (c == 'b') {
+      while (pos > 0 && text[pos - 1] == ' ')
+        pos--;
+      while (pos > 0 && text[pos - 1] != ' ')
+        pos--;
+    } else {
+      while (pos < g_edit.line.len && text[pos] == ' ')
+        pos++;
+      while (pos < g_edit.line.len && text[pos] != ' ')
+        pos++;
+    }
+    g_edit.pos = pos;
+    refresh();
+    return;
+  }
+  if (c != '[' && c != 'O')
+    return;
+
+  // CSI: parameters, then one final byte
+  char params[16];
+  size_t num = 0;
+  unsigned char final;
+  while (1) {
+    if (read_byte(&final, LINEEDIT_ESCAPE_MS) != 1)
+      return;
+    if (final >= 0x40 && final <= 0x7e)
+      break;
+    if (num < sizeof(params) - 1)
+      params[num++] = (char)final;
+  }
+  params[num] = '\0';
+
+  // Ctrl+arrows (1;5C, 1;5D) move by words too
+  bool word = strcmp(params, "1;5") == 0;
+  switch (final) {
+  case 'A':
+    history_up();
+    return;
+  case 'B':
+    history_down();
+    return;
+  case 'C':
+    if (word) {
+      while (pos < g_edit.line.len && text[pos] == ' ')
+        pos++;
+      while (pos < g_edit.line.len && text[pos] != ' ')
+        pos++;
+    } else if (pos < g_edit.line.len) {
+      pos = next_char(pos);
+    }
+    break;
+  case 'D':
+    if (word) {
+      while (pos > 0 && text[pos - 1] == ' ')
+        pos--;
+      while (pos > 0 && text[pos - 1] != ' ')
+        pos--;
+    } else if (pos > 0) {
+      pos = prev_char(pos);
+    }
+    break;
+  case 'H':
+    pos = 0;
+    break;
+  case 'F':
+    pos = g_edit.line.len;
+    break;
+  case '~':
+    if (strcmp(params, "1") == 0 || strcmp(params, "7") == 0) {
+      pos = 0;
+    } else if (strcmp(params, "4") == 0 || strcmp(params, "8") == 0) {
+      pos = g_edit.line.len;
+    } else if (strcmp(params, "3") == 0 && pos < g_edit.line.len) {
+      delete_range(pos, next_char(pos));
+      pos = g_edit.pos;
+    }
+    break;
+  default:
+    return;
+  }
+  g_edit.pos = pos;
+  refresh();
+}
+
+/**
+ * @brief Act on one key
+ * @param c Key read from the terminal
+ * @return What the key did to the line
+ */
+static key_result_t handle_key(unsigned char c) {
+  g_edit.tabs = c == '\t' ? g_edit.tabs + 1 : 0;
+  if (c != '\t')
+    g_edit.complete_wanted = false;
+
+  const char *text = g_edit.line.buf ? g_edit.line.buf : "";
+  size_t pos = g_edit.pos;
+  switch (c) {
+  case '\r':
+  case '\n':
+    return KEY_ACCEPT;
+  case CONTROL('D'):
+    if (g_edit.line.len == 0)
+      return KEY_EOF;
+    delete_range(pos, next_char(pos));
+    break;
+  case CONTROL('C'):
+    write_out("^C", 2);
+    g_edit.line.len = 0;
+    g_edit.pos = 0;
+    if (g_edit.line.buf)
+      g_edit.line.buf[0] = '\0';
+    return KEY_ACCEPT;
+  case 127:
+  case CONTROL('H'):
+    if (pos > 0)
+      delete_range(prev_char(pos), pos);
+    break;
+  case CONTROL('A'):
+    g_edit.pos = 0;
+    break;
+  case CONTROL('E'):
+    g_edit.pos = g_edit.line.len;
+    break;
+  case CONTROL('B'):
+    if (pos > 0)
+      g_edit.pos = prev_char(pos);
+    break;
+  case CONTROL('F'):
+    if (pos < g_edit.line.len)
+      g_edit.pos = next_char(pos);
+    break;
+  case CONTROL('U'):
+    delete_range(0, pos);
+    break;
+  case CONTROL('K'):
+    delete_range(pos, g_edit.line.len);
+    break;
+  case CONTROL('W'): {
+    size_t start = pos;
+    while (start > 0 && text[start - 1] == ' ')
+      start--;
+    while (start > 0 && text[start - 1] != ' ')
+      start--;
+    delete_range(start, pos);
+    break;
+  }
+  case CONTROL('L'):
+    write_out("\x1b[H\x1b[2J", 7);
+    break;
+  case CONTROL('P'):
+    history_up();
+    return KEY_CONTINUE;
+  case CONTROL('N'):
+    history_down();
+    return KEY_CONTINUE;
+  case CONTROL('R'): {
+    unsigned char key;
+    key_result_t result = history_search_keys(&key);
+    return result == KEY_CONTINUE && key ? handle_key(key) : result;
+  }
+  case '\t':
+    complete_word(g_edit.tabs >= 2);
+    return KEY_CONTINUE;
+  case 27:
+    escape_sequence();
+    return KEY_CONTINUE;
+  default:
+    if (c < 32)
+      return KEY_CONTINUE; // Other control keys do nothing
+
+    // Typing at the end of a line that fits needs no redraw
+    char ch = (char)c;
+    bool at_end = pos == g_edit.line.len;
+    if (insert_text(&ch, 1) == -1)
+      return KEY_CONTINUE;
+    if (at_end && columns(g_edit.prompt, strlen(g_edit.prompt)) +
+                          columns(g_edit.line.buf, g_edit.line.len) <
+                      terminal_columns()) {
+      write_out(&ch, 1);
+      return KEY_CONTINUE;
+    }
+    break;
+  }
+  refresh();
+  return KEY_CONTINUE;
+}
+
+int lineedit_init(int in_fd, int out_fd) {
+  const char *term = getenv("TERM");
+  if (!isatty(in_fd) || (term && strcmp(term, "dumb") == 0) ||
+      tcgetattr(in_fd, &g_edit.cooked) == -1)
+    return -1;
+  g_edit.in_fd = in_fd;
+  g_edit.out_fd = out_fd;
+  return 0;
+}
+
+int lineedit_read(const char *prompt, char **line, size_t *len) {
+  // Commands may have changed the settings (stty); start from theirs
+  struct termios raw;
+  if (tcgetattr(g_edit.in_fd, &g_edit.cooked) == -1)
+    return -1;
+  raw = g_edit.cooked;
+  raw.c_iflag &= ~(tcflag_t)(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+  raw.c_lflag &= ~(tcflag_t)(ECHO | ICANON | IEXTEN | ISIG);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  if (tcsetattr(g_edit.in_fd, TCSADRAIN, &raw) == -1)
+    return -1;
+
+  complete_new_line();
+  g_edit.prompt = prompt;
+  buffer_set(&g_edit.line, "", 0);
+  g_edit.pos = 0;
+  g_edit.tabs = 0;
+  g_edit.complete_wanted = false;
+  stop_browsing();
+  refresh();
+
+  key_result_t result = KEY_CONTINUE;
+  while (result == KEY_CONTINUE) {
+    unsigned char c;
+    if (read_byte(&c, -1) != 1) {
+      result = errno ? KEY_ERROR : KEY_EOF;
+      break;
+    }
+    result = handle_key(c);
+  }
+
+  // Leave the whole line on screen, and the cursor below it
+  int saved_errno = errno;
+  if (result == KEY_ACCEPT) {
+    if (g_edit.pos != g_edit.line.len) {
+      g_edit.pos = g_edit.line.len;
+      refresh();
+    }
+    write_out("\n", 1);
+  }
+  tcsetattr(g_edit.in_fd, TCSADRAIN, &g_edit.cooked);
+  errno = saved_errno;
+
+  if (result == KEY_ERROR || !g_edit.line.buf)
+    return -1;
+  if (result == KEY_EOF && g_edit.line.len == 0)
+    return 0;
+  *line = g_edit.line.buf;
+  *len = g_edit.line.len;
+  return 1;
+}
+
+void lineedit_free(void) {
+  free(g_edit.line.buf);
+  free(g_edit.frame.buf);
+  free(g_edit.typed.buf);
+  memset(&g_edit.line, 0, sizeof(g_edit.line));
+  memset(&g_edit.frame, 0, sizeof(g_edit.frame));
+  memset(&g_edit.typed, 0, sizeof(g_edit.typed));
+  complete_clear();
+}
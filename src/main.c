@@ -0,0 +1,58 @@
+/**
+ * @file main.c
+ * @brief Command line entry point of the shell
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "shell.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Print command line usage
+ * @param prog Program name
+ */
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [--startup-profile] [-c commands | script]\n",
+          prog);
+}
+
+/**
+ * @brief Main entry point
+ *
+ * Without arguments the interactive REPL runs. "-c commands" runs the given
+ * commands and "script" runs a file, both without a prompt. Arguments after
+ * the script or command string are accepted and ignored.
+ * "--startup-profile" first prints where startup time went, to stderr, once
+ * the first command can be read.
+ */
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--startup-profile") == 0) {
+    startup_profile_enable();
+    argv[1] = argv[0];
+    argv++;
+    argc--;
+  }
+  profile_init();
+
+  if (argc < 2)
+    return shell_main();
+
+  if (strcmp(argv[1], "-c") == 0) {
+    if (argc < 3) {
+      fprintf(stderr, "%s: -c: option requires an argument\n", argv[0]);
+      usage(argv[0]);
+      return 2;
+    }
+    return shell_run_string(argv[2]);
+  }
+
+  if (argv[1][0] == '-' && argv[1][1] != '\0') {
+    fprintf(stderr, "%s: %s: invalid option\n", argv[0], argv[1]);
+    usage(argv[0]);
+    return 2;
+  }
+
+  return shell_run_file(argv[1]);
+}
@@ -0,0 +1,347 @@
+/**
+ * @file mover.c
+ * @brief In-shell data mover for trivial cat and tee stages
+ *
+ * Stages that only copy bytes around are performed by the shell itself
+ * instead of a cat or tee process. Where the kernel allows it, the data is
+ * moved with splice, tee or copy_file_range so it never enters user space.
+ */
+
+#define _GNU_SOURCE
+
+#include "shell.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Bytes requested per splice, tee or copy_file_range call
+ */
+#define MOVER_CHUNK (1 << 20)
+
+/**
+ * @brief Size of the user-space buffer used when the kernel cannot help
+ */
+#define MOVER_BUFFER_SIZE (64 * 1024)
+
+/**
+ * @brief Exit status of a command killed by SIGPIPE
+ */
+#define MOVER_EPIPE_STATUS (128 + SIGPIPE)
+
+/**
+ * @brief Result of a copy strategy that may not apply to the descriptors
+ */
+typedef enum {
+  MOVE_DONE,        /**< Everything was copied */
+  MOVE_FAILED,      /**< A read or write failed (errno set) */
+  MOVE_INTERRUPTED, /**< SIGINT arrived while copying */
+  MOVE_UNSUPPORTED  /**< Strategy not usable here; nothing was copied */
+} move_result_t;
+
+static char g_buffer[MOVER_BUFFER_SIZE];
+
+bool mover_handles(const command_t *cmd, bool from_pipe) {
+  if (!cmd->argv || !cmd->argv[0])
+    return false;
+
+  // Options, and "-" for stdin, are left to the real commands
+  size_t operands = 0;
+  for (int i = 1; cmd->argv[i]; i++) {
+    if (cmd->argv[i][0] == '-')
+      return false;
+    operands++;
+  }
+
+  // Files opened onto stdin and stdout are all the shell sets up itself
+  for (size_t i = 0; i < cmd->num_redirs; i++) {
+    const redir_t *r = &cmd->redirs[i];
+    if (r->kind != REDIR_OPEN || r->fd > STDOUT_FILENO)
+      return false;
+  }
+
+  // Without operands both read stdin, which must not be the shell's own
+  bool has_input = from_pipe || command_redir(cmd, STDIN_FILENO);
+  if (strcmp(cmd->argv[0], "cat") == 0)
+    return operands > 0 || has_input;
+  if (strcmp(cmd->argv[0], "tee") == 0)
+    return operands <= 1 && has_input;
+  return false;
+}
+
+/**
+ * @brief Check whether an errno value from a first attempt means the
+ * descriptors do not support the system call
+ */
+static bool is_unsupported(int err) {
+  return err == EINVAL || err == ENOSYS || err == EXDEV || err == EBADF ||
+         err == EOPNOTSUPP;
+}
+
+/**
+ * @brief Write a whole buffer, retrying short writes
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n == -1) {
+      if (errno == EINTR && !shell_interrupted())
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/**
+ * @brief Copy through a user-space buffer, optionally to a second output
+ * @param in_fd Source
+ * @param out_fd Destination
+ * @param copy_fd Second destination, or -1
+ */
+static move_result_t copy_buffered(int in_fd, int out_fd, int copy_fd) {
+  while (1) {
+    if (shell_interrupted())
+      return MOVE_INTERRUPTED;
+
+    ssize_t n = read(in_fd, g_buffer, sizeof(g_buffer));
+    if (n == 0)
+      return MOVE_DONE;
+    if (n == -1) {
+      if (errno == EINTR)
+        continue; // Stops at the check above if it was Ctrl+C
+      return MOVE_FAILED;
+    }
+
+    if (write_all(out_fd, g_buffer, (size_t)n) == -1 ||
+        (copy_fd != -1 && write_all(copy_fd, g_buffer, (size_t)n) == -1))
+      return errno == EINTR ? MOVE_INTERRUPTED : MOVE_FAILED;
+  }
+}
+
+/**
+ * @brief Move data between a pipe and another descriptor with splice
+ */
+static move_result_t copy_spliced(int in_fd, int out_fd) {
+  bool moved = false;
+  while (1) {
+    if (shell_interrupted())
+      return MOVE_INTERRUPTED;
+
+    ssize_t n = splice(in_fd, NULL, out_fd, NULL, MOVER_CHUNK,
+                       SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n == 0)
+      return MOVE_DONE;
+    if (n == -1) {
+      if (errno == EINTR)
+        continue; // Stops at the check above if it was Ctrl+C
+      return !moved && is_unsupported(errno) ? MOVE_UNSUPPORTED : MOVE_FAILED;
+    }
+    moved = true;
+  }
+}
+
+/**
+ * @brief Copy between two regular files inside the kernel
+ */
+static move_result_t copy_range(int in_fd, int out_fd) {
+  bool moved = false;
+  while (1) {
+    if (shell_interrupted())
+      return MOVE_INTERRUPTED;
+
+    ssize_t n = copy_file_range(in_fd, NULL, out_fd, NULL, MOVER_CHUNK, 0);
+    if (n == 0)
+      return MOVE_DONE;
+    if (n == -1) {
+      if (errno == EINTR)
+        continue; // Stops at the check above if it was Ctrl+C
+      return !moved && is_unsupported(errno) ? MOVE_UNSUPPORTED : MOVE_FAILED;
+    }
+    moved = true;
+  }
+}
+
+/**
+ * @brief Copy everything from in_fd to out_fd with the cheapest mechanism
+ *
+ * splice when either side is a pipe, copy_file_range between regular files
+ * and a read/write loop for everything else (terminals, O_APPEND outputs).
+ */
+static move_result_t copy_data(int in_fd, int out_fd) {
+  struct stat in_st, out_st;
+  if (fstat(in_fd, &in_st) == -1 || fstat(out_fd, &out_st) == -1)
+    return copy_buffered(in_fd, out_fd, -1);
+
+  move_result_t result = MOVE_UNSUPPORTED;
+  if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode))
+    result = copy_spliced(in_fd, out_fd);
+  else if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode))
+    result = copy_range(in_fd, out_fd);
+
+  if (result == MOVE_UNSUPPORTED)
+    result = copy_buffered(in_fd, out_fd, -1);
+  return result;
+}
+
+/**
+ * @brief Duplicate a pipe into another pipe and drain it into a file
+ *
+ * tee() copies pages into out_fd without consuming them; splice() then
+ * consumes the same bytes into file_fd.
+ */
+static move_result_t copy_teed(int in_fd, int out_fd, int file_fd) {
+  bool moved = false;
+  while (1) {
+    if (shell_interrupted())
+      return MOVE_INTERRUPTED;
+
+    ssize_t n = tee(in_fd, out_fd, MOVER_CHUNK, 0);
+    if (n == 0)
+      return MOVE_DONE;
+    if (n == -1) {
+      if (errno == EINTR)
+        continue; // Stops at the check above if it was Ctrl+C
+      return !moved && is_unsupported(errno) ? MOVE_UNSUPPORTED : MOVE_FAILED;
+    }
+    moved = true;
+
+    // Exactly the duplicated bytes must leave the input pipe
+    while (n > 0) {
+      ssize_t done = splice(in_fd, NULL, file_fd, NULL, (size_t)n,
+                            SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (done == -1 && errno == EINTR && shell_interrupted())
+        return MOVE_INTERRUPTED;
+      if (done == -1 && (errno == EINTR || errno == EAGAIN))
+        continue;
+      if (done <= 0) {
+        // Fall back for this batch: read the bytes and write them out
+        ssize_t got = read(in_fd, g_buffer,
+                           (size_t)n < sizeof(g_buffer) ? (size_t)n
+                                                        : sizeof(g_buffer));
+        if (got <= 0 || write_all(file_fd, g_buffer, (size_t)got) == -1)
+          return MOVE_FAILED;
+        done = got;
+      }
+      n -= done;
+    }
+  }
+}
+
+/**
+ * @brief Turn a copy result into an exit status, reporting errors
+ * @param result Copy result
+ * @param prog Command name for messages
+ * @param name Operand the error relates to
+ * @return Exit status for this copy
+ */
+static int report(move_result_t result, const char *prog, const char *name) {
+  switch (result) {
+  case MOVE_DONE:
+    return 0;
+  case MOVE_INTERRUPTED:
+    return 128 + SIGINT;
+  default:
+    // The real command would have been killed silently by SIGPIPE
+    if (errno == EPIPE)
+      return MOVER_EPIPE_STATUS;
+    fprintf(stderr, "%s: %s: %s\n", prog, name, strerror(errno));
+    return 1;
+  }
+}
+
+/**
+ * @brief cat: concatenate operands (or stdin) to stdout
+ */
+static int run_cat(const command_t *cmd, int input_fd, int output_fd) {
+  if (!cmd->argv[1])
+    return report(copy_data(input_fd, output_fd), "cat", "-");
+
+  struct stat out_st;
+  bool out_regular = fstat(output_fd, &out_st) == 0 && S_ISREG(out_st.st_mode);
+
+  int status = 0;
+  for (int i = 1; cmd->argv[i]; i++) {
+    const char *name = cmd->argv[i];
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+      status = 1;
+      continue;
+    }
+
+    // Copying a file onto itself would never reach end of file
+    struct stat in_st;
+    if (out_regular && fstat(fd, &in_st) == 0 &&
+        in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+      fprintf(stderr, "cat: %s: input file is output file\n", name);
+      close(fd);
+      status = 1;
+      continue;
+    }
+
+    int result = report(copy_data(fd, output_fd), "cat", name);
+    close(fd);
+    if (result > 1)
+      return result;
+    if (result != 0)
+      status = result;
+  }
+  return status;
+}
+
+/**
+ * @brief tee: copy stdin to stdout and to at most one file
+ */
+static int run_tee(const command_t *cmd, int input_fd, int output_fd) {
+  const char *name = cmd->argv[1];
+  if (!name)
+    return report(copy_data(input_fd, output_fd), "tee", "-");
+
+  int file_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (file_fd == -1) {
+    // Like tee, keep feeding stdout when the file cannot be opened
+    fprintf(stderr, "tee: %s: %s\n", name, strerror(errno));
+    int status = report(copy_data(input_fd, output_fd), "tee", "-");
+    return status ? status : 1;
+  }
+
+  move_result_t result = copy_teed(input_fd, output_fd, file_fd);
+  if (result == MOVE_UNSUPPORTED)
+    result = copy_buffered(input_fd, output_fd, file_fd);
+  close(file_fd);
+  return report(result, "tee", name);
+}
+
+int mover_run(const command_t *cmd, int input_fd, int output_fd) {
+  // A reader that went away must end the stage with EPIPE, not kill the
+  // shell with SIGPIPE
+  struct sigaction ignore, saved;
+  ignore.sa_handler = SIG_IGN;
+  sigemptyset(&ignore.sa_mask);
+  ignore.sa_flags = 0;
+  sigaction(SIGPIPE, &ignore, &saved);
+
+  // Ctrl+C must break a read, splice or tee blocked on a stalled pipe
+  // rather than have the kernel restart it
+  struct sigaction interrupt, saved_interrupt;
+  sigaction(SIGINT, NULL, &saved_interrupt);
+  interrupt = saved_interrupt;
+  interrupt.sa_flags &= ~SA_RESTART;
+  sigaction(SIGINT, &interrupt, NULL);
+
+  int status = strcmp(cmd->argv[0], "cat") == 0
+                   ? run_cat(cmd, input_fd, output_fd)
+                   : run_tee(cmd, input_fd, output_fd);
+
+  sigaction(SIGINT, &saved_interrupt, NULL);
+  sigaction(SIGPIPE, &saved, NULL);
+  return status;
+}
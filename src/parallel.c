@@ -0,0 +1,391 @@
+/**
+ * @file parallel.c
+ * @brief Bounded-concurrency job runner behind the parallel builtin
+ *
+ * Every input becomes one job: a worker process forked from the shell that
+ * runs either the command template with {} replaced by the input, or the
+ * input itself as a command line. At most a fixed number of workers run
+ * at once, and a new one starts as soon as any of them exits, so a slow
+ * job never holds up the queue behind it. Workers are ordinary entries in
+ * the job table, collected by the same wait4 loop as every other job.
+ *
+ * Grouped output goes to one memfd per job and is copied out in one piece
+ * when the job ends, or, in keep-order mode, once every earlier job's
+ * output has been copied.
+ */
+
+#define _GNU_SOURCE // memfd_create
+
+#include "shell.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * @brief A started job whose output has not been copied out yet
+ */
+typedef struct {
+  job_t *job; /**< Worker in the job table (NULL once collected) */
+  int out_fd; /**< memfd holding the job's output, or -1 */
+} slot_t;
+
+/**
+ * @brief State of one parallel run
+ */
+typedef struct {
+  const parallel_opts_t *opts; /**< Options the run was started with */
+  slot_t *slots;               /**< Started jobs, oldest first */
+  size_t first;                /**< First live slot */
+  size_t count;                /**< End of the live slots */
+  size_t capacity;             /**< Allocated slots */
+  size_t running;              /**< Workers not collected yet */
+  size_t failed;               /**< Jobs that exited with non-zero status */
+  input_t input;               /**< Reader for inputs taken from stdin */
+  size_t next_input;           /**< Next entry of opts->inputs */
+} runner_t;
+
+/**
+ * @brief Get the next input, from the ::: list or a line of stdin
+ * @return 1 if an input was read, 0 when there are no more, -1 on error
+ */
+static int next_input(runner_t *r, const char **input) {
+  const parallel_opts_t *opts = r->opts;
+  if (opts->inputs) {
+    if (!opts->inputs[r->next_input])
+      return 0;
+    *input = opts->inputs[r->next_input++];
+    return 1;
+  }
+
+  char *line;
+  size_t len;
+  int got = input_read_line(&r->input, &line, &len);
+  *input = line;
+  return got;
+}
+
+/**
+ * @brief Build the argv of a templated job
+ *
+ * Every {} in a word is replaced by the input; a template without {} gets
+ * the input as an extra last argument.
+ *
+ * @return NULL-terminated vector in one allocation, or NULL on failure
+ */
+static char **build_argv(const parallel_opts_t *opts, const char *input) {
+  size_t input_len = strlen(input);
+  size_t argc = opts->command_len;
+  size_t bytes = 0;
+  bool placed = false;
+  for (size_t i = 0; i < argc; i++) {
+    size_t holes = 0;
+    for (const char *p = opts->command[i]; (p = strstr(p, "{}")); p += 2)
+      holes++;
+    placed |= holes > 0;
+    bytes += strlen(opts->command[i]) - 2 * holes + holes * input_len + 1;
+  }
+  if (!placed)
+    bytes += input_len + 1;
+
+  size_t slots = argc + !placed + 1;
+  char **argv = malloc(slots * sizeof(char *) + bytes);
+  if (!argv)
+    return NULL;
+
+  char *out = (char *)(argv + slots);
+  for (size_t i = 0; i < argc; i++) {
+    argv[i] = out;
+    const char *word = opts->command[i];
+    for (const char *hole; (hole = strstr(word, "{}")); word = hole + 2) {
+      memcpy(out, word, (size_t)(hole - word));
+      out += hole - word;
+      memcpy(out, input, input_len);
+      out += input_len;
+    }
+    size_t rest = strlen(word) + 1;
+    memcpy(out, word, rest);
+    out += rest;
+  }
+  if (!placed) {
+    argv[argc++] = out;
+    memcpy(out, input, input_len + 1);
+  }
+  argv[argc] = NULL;
+  return argv;
+}
+
+/**
+ * @brief Join argv into the text shown for a job
+ * @return Newly allocated string, or NULL on allocation failure
+ */
+static char *join_argv(char **argv) {
+  size_t len = 1;
+  for (size_t i = 0; argv[i]; i++)
+    len += strlen(argv[i]) + 1;
+
+  char *text = malloc(len);
+  if (!text)
+    return NULL;
+  char *p = text;
+  for (size_t i = 0; argv[i]; i++) {
+    if (i > 0)
+      *p++ = ' ';
+    size_t word_len = strlen(argv[i]);
+    memcpy(p, argv[i], word_len);
+    p += word_len;
+  }
+  *p = '\0';
+  return text;
+}
+
+/**
+ * @brief Body of a worker process
+ * @param argv Templated command, or NULL to run line as a command line
+ * @param line Input used as a command line when argv is NULL
+ * @param out_fd Descriptor for the job's stdout, or -1 to keep the shell's
+ * @return Exit status of the job
+ */
+static int run_worker(char **argv, const char *line, int out_fd) {
+  // Jobs must not compete with the runner for the inputs on stdin
+  int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (null_fd != -1) {
+    dup2(null_fd, STDIN_FILENO);
+    close(null_fd);
+  }
+  if (out_fd != -1)
+    dup2(out_fd, STDOUT_FILENO);
+
+  int status;
+  if (argv) {
+    command_t cmd = {0};
+    cmd.argv = argv;
+    pipeline_t pipeline = {0};
+    pipeline.commands = &cmd;
+    pipeline.num_commands = 1;
+    status = execute_pipeline(&pipeline);
+  } else {
+    pipeline_t pipeline;
+    if (parse_command(line, &pipeline) == -1) {
+      fprintf(stderr, "parallel: %s: parse error\n", line);
+      return 2;
+    }
+    status = execute_list(&pipeline);
+  }
+  fflush(stdout);
+  return status;
+}
+
+/**
+ * @brief Make room for one more slot, reusing space before first
+ * @return 0 on success, -1 on allocation failure
+ */
+static int reserve_slot(runner_t *r) {
+  if (r->first > 0 && r->count == r->capacity) {
+    memmove(r->slots, r->slots + r->first,
+            (r->count - r->first) * sizeof(slot_t));
+    r->count -= r->first;
+    r->first = 0;
+  }
+  if (r->count < r->capacity)
+    return 0;
+
+  size_t capacity = r->capacity ? r->capacity * 2 : 16;
+  slot_t *slots = realloc(r->slots, capacity * sizeof(slot_t));
+  if (!slots)
+    return -1;
+  r->slots = slots;
+  r->capacity = capacity;
+  return 0;
+}
+
+/**
+ * @brief Fork a worker for one input and give it a slot
+ * @return 0 on success, -1 if the job could not be started
+ */
+static int start_job(runner_t *r, const char *input) {
+  const parallel_opts_t *opts = r->opts;
+  char **argv = NULL;
+  char *text = NULL;
+  int out_fd = -1;
+
+  if (reserve_slot(r) == -1 ||
+      (opts->command_len > 0 &&
+       (!(argv = build_argv(opts, input)) || !(text = join_argv(argv))))) {
+    perror("parallel");
+    free(argv);
+    return -1;
+  }
+  if (opts->group &&
+      (out_fd = memfd_create("parallel-output", MFD_CLOEXEC)) == -1) {
+    perror("memfd_create");
+    free(argv);
+    free(text);
+    return -1;
+  }
+
+  // Buffered output must not be written again by the worker
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0)
+    _exit(run_worker(argv, input, out_fd));
+  free(argv);
+  if (pid == -1) {
+    perror("fork");
+    free(text);
+    if (out_fd != -1)
+      close(out_fd);
+    return -1;
+  }
+
+  job_t *job = jobs_add_command(text ? text : input, pid);
+  free(text);
+  if (!job) {
+    // Untracked workers are waited for on the spot
+    fprintf(stderr, "jobs: out of memory\n");
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+      ;
+    r->failed++;
+    if (out_fd != -1)
+      close(out_fd);
+    return 0;
+  }
+
+  r->slots[r->count++] = (slot_t){job, out_fd};
+  r->running++;
+  return 0;
+}
+
+/**
+ * @brief Copy a finished job's output to stdout and close it
+ */
+static void emit_output(int out_fd) {
+  if (out_fd == -1)
+    return;
+
+  off_t size = lseek(out_fd, 0, SEEK_END);
+  off_t offset = 0;
+  while (offset < size) {
+    ssize_t n =
+        sendfile(STDOUT_FILENO, out_fd, &offset, (size_t)(size - offset));
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+  }
+
+  // Outputs sendfile cannot write to (older kernels, some devices)
+  if (offset < size && lseek(out_fd, offset, SEEK_SET) != -1) {
+    char buffer[16384];
+    ssize_t n;
+    while ((n = read(out_fd, buffer, sizeof(buffer))) > 0) {
+      for (ssize_t done = 0; done < n;) {
+        ssize_t w = write(STDOUT_FILENO, buffer + done, (size_t)(n - done));
+        if (w == -1 && errno == EINTR)
+          continue;
+        if (w == -1) {
+          perror("parallel: write");
+          close(out_fd);
+          return;
+        }
+        done += w;
+      }
+    }
+  }
+  close(out_fd);
+}
+
+/**
+ * @brief Collect finished workers and copy out the output that is due
+ * @return Number of workers collected
+ */
+static size_t collect(runner_t *r) {
+  size_t collected = 0;
+  for (size_t i = r->first; i < r->count; i++) {
+    slot_t *slot = &r->slots[i];
+    if (!slot->job || !jobs_is_done(slot->job))
+      continue;
+    r->failed += jobs_status(slot->job) != 0;
+    jobs_remove(slot->job);
+    slot->job = NULL;
+    r->running--;
+    collected++;
+  }
+
+  // In keep-order mode output waits for every earlier job
+  for (size_t i = r->first; i < r->count;) {
+    slot_t *slot = &r->slots[i];
+    if (slot->job) {
+      if (r->opts->keep_order)
+        break;
+      i++;
+      continue;
+    }
+    emit_output(slot->out_fd);
+    if (i == r->first) {
+      r->first++;
+      i++;
+    } else {
+      memmove(slot, slot + 1, (r->count - i - 1) * sizeof(slot_t));
+      r->count--;
+    }
+  }
+  if (r->first == r->count)
+    r->first = r->count = 0;
+  return collected;
+}
+
+int parallel_run(const parallel_opts_t *opts) {
+  long max = opts->jobs > 0 ? opts->jobs : sysconf(_SC_NPROCESSORS_ONLN);
+  if (max < 1)
+    max = 1;
+
+  runner_t r = {0};
+  r.opts = opts;
+  if (!opts->inputs)
+    input_init(&r.input, STDIN_FILENO);
+
+  bool more = true;
+  while (1) {
+    // Top the workers up from the queue; Ctrl+C stops new starts
+    while (more && r.running < (size_t)max && !shell_interrupted()) {
+      const char *input;
+      int got = next_input(&r, &input);
+      if (got == -1)
+        perror("parallel: read");
+      if (got != 1) {
+        more = false;
+        break;
+      }
+
+      // A blank line is no command at all
+      if (opts->command_len == 0 && input[strspn(input, " \t")] == '\0')
+        continue;
+      if (start_job(&r, input) == -1) {
+        r.failed++;
+        more = false;
+      }
+    }
+    if (r.running == 0)
+      break;
+
+    // Sleep until whichever worker (or other child) exits first
+    if (collect(&r) == 0)
+      jobs_wait_any();
+  }
+  collect(&r);
+
+  free(r.slots);
+  if (!opts->inputs)
+    input_free(&r.input);
+
+  // Like GNU parallel: the number of failed jobs, up to 101
+  return r.failed > 100 ? 101 : (int)r.failed;
+}
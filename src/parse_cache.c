@@ -0,0 +1,283 @@
+/**
+ * @file parse_cache.c
+ * @brief LRU cache of parsed pipelines keyed by the raw command line
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "shell.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Number of pipelines kept by default
+ */
+#define PARSE_CACHE_DEFAULT_ENTRIES 64
+
+/**
+ * @brief Smallest bucket array (must be a power of two)
+ */
+#define PARSE_CACHE_MIN_BUCKETS 16
+
+/**
+ * @brief Longest line worth remembering; longer ones (a command with its
+ * here-document bodies) are neither hashed nor kept
+ */
+#define PARSE_CACHE_MAX_LINE (64 * 1024)
+
+/**
+ * @brief A cached pipeline and its bookkeeping
+ */
+typedef struct parse_entry {
+  pipeline_t pipeline;       /**< Parsed line; also owns the key copy */
+  uint64_t hash;             /**< Hash of the raw line */
+  const char *line;          /**< Raw line (lives in pipeline.arena) */
+  size_t len;                /**< Length of the raw line */
+  unsigned refs;             /**< Callers currently using the pipeline */
+  bool cached;               /**< Still reachable through the table */
+  struct parse_entry *chain; /**< Next entry in the same bucket */
+  struct parse_entry *prev;  /**< More recently used neighbour */
+  struct parse_entry *next;  /**< Less recently used neighbour */
+} parse_entry_t;
+
+/**
+ * @brief Hash table with chained buckets plus an LRU list
+ */
+static struct {
+  parse_entry_t **buckets; /**< Bucket heads (NULL until first insert) */
+  size_t num_buckets;      /**< Number of buckets */
+  parse_entry_t *head;     /**< Most recently used entry */
+  parse_entry_t *tail;     /**< Least recently used entry */
+  size_t count;            /**< Entries in the table */
+  size_t capacity;         /**< Maximum entries (0 disables caching) */
+  unsigned long hits;      /**< Lookups answered from the cache */
+  unsigned long misses;    /**< Lookups that had to parse */
+  unsigned long evictions; /**< Entries dropped to make room */
+} g_cache = {NULL, 0, NULL, NULL, 0, PARSE_CACHE_DEFAULT_ENTRIES, 0, 0, 0};
+
+/**
+ * @brief Shared result for blank and comment lines
+ */
+static const pipeline_t g_empty_pipeline = {
+    NULL, 0, {NULL}, false, false, NULL, false, LIST_END, NULL};
+
+/**
+ * @brief 64-bit FNV-1a hash of a byte span
+ */
+static uint64_t hash_line(const char *line, size_t len) {
+  uint64_t hash = 14695981039346656037u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)line[i];
+    hash *= 1099511628211u;
+  }
+  return hash;
+}
+
+/**
+ * @brief Free an entry and the pipeline it owns
+ */
+static void destroy_entry(parse_entry_t *entry) {
+  free_pipeline(&entry->pipeline);
+  free(entry);
+}
+
+/**
+ * @brief Unlink an entry from the LRU list
+ */
+static void lru_unlink(parse_entry_t *entry) {
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    g_cache.head = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    g_cache.tail = entry->prev;
+  entry->prev = NULL;
+  entry->next = NULL;
+}
+
+/**
+ * @brief Put an entry at the most recently used end of the LRU list
+ */
+static void lru_push_front(parse_entry_t *entry) {
+  entry->prev = NULL;
+  entry->next = g_cache.head;
+  if (g_cache.head)
+    g_cache.head->prev = entry;
+  else
+    g_cache.tail = entry;
+  g_cache.head = entry;
+}
+
+/**
+ * @brief Take an entry out of the table; it is freed once nobody uses it
+ */
+static void drop_entry(parse_entry_t *entry) {
+  size_t bucket = entry->hash & (g_cache.num_buckets - 1);
+  parse_entry_t **link = &g_cache.buckets[bucket];
+  while (*link != entry)
+    link = &(*link)->chain;
+  *link = entry->chain;
+
+  lru_unlink(entry);
+  entry->cached = false;
+  g_cache.count--;
+
+  if (entry->refs == 0)
+    destroy_entry(entry);
+}
+
+/**
+ * @brief Find the entry for a raw line
+ * @return Entry, or NULL on a miss
+ */
+static parse_entry_t *find_entry(const char *line, size_t len,
+                                 uint64_t hash) {
+  if (!g_cache.buckets)
+    return NULL;
+
+  parse_entry_t *entry = g_cache.buckets[hash & (g_cache.num_buckets - 1)];
+  for (; entry; entry = entry->chain) {
+    if (entry->hash == hash && entry->len == len &&
+        memcmp(entry->line, line, len) == 0)
+      return entry;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Make the table take an entry, evicting the least recently used
+ * @return true if the entry is now cached
+ */
+static bool insert_entry(parse_entry_t *entry) {
+  if (g_cache.capacity == 0)
+    return false;
+
+  if (!g_cache.buckets) {
+    size_t num_buckets = PARSE_CACHE_MIN_BUCKETS;
+    while (num_buckets < g_cache.capacity)
+      num_buckets *= 2;
+    g_cache.buckets = calloc(num_buckets, sizeof(parse_entry_t *));
+    if (!g_cache.buckets)
+      return false;
+    g_cache.num_buckets = num_buckets;
+  }
+
+  while (g_cache.count >= g_cache.capacity) {
+    drop_entry(g_cache.tail);
+    g_cache.evictions++;
+  }
+
+  parse_entry_t **bucket =
+      &g_cache.buckets[entry->hash & (g_cache.num_buckets - 1)];
+  entry->chain = *bucket;
+  *bucket = entry;
+  lru_push_front(entry);
+  entry->cached = true;
+  g_cache.count++;
+  return true;
+}
+
+/**
+ * @brief Look a line up, parsing and inserting it on a miss
+ * @return 0 on success, -1 on parse or allocation failure
+ */
+static int lookup(const char *line, size_t len, const pipeline_t **pipeline) {
+  bool cacheable = len <= PARSE_CACHE_MAX_LINE;
+  uint64_t hash = cacheable ? hash_line(line, len) : 0;
+  parse_entry_t *entry = cacheable ? find_entry(line, len, hash) : NULL;
+  if (entry) {
+    g_cache.hits++;
+    lru_unlink(entry);
+    lru_push_front(entry);
+    entry->refs++;
+    *pipeline = &entry->pipeline;
+    return 0;
+  }
+
+  pipeline_t parsed;
+  if (parse_command_len(line, len, &parsed) == -1)
+    return -1;
+
+  // Blank lines and comments are cheaper to re-parse than to remember
+  if (parsed.num_commands == 0) {
+    *pipeline = &g_empty_pipeline;
+    return 0;
+  }
+
+  g_cache.misses++;
+
+  entry = calloc(1, sizeof(parse_entry_t));
+  if (!entry) {
+    free_pipeline(&parsed);
+    return -1;
+  }
+  entry->pipeline = parsed;
+  entry->hash = hash;
+  entry->len = len;
+  entry->refs = 1;
+
+  // The key lives in the pipeline's own arena; without it the entry is
+  // simply handed out uncached
+  if (cacheable)
+    entry->line = arena_strndup(&entry->pipeline.arena, line, len);
+  if (entry->line)
+    insert_entry(entry);
+
+  *pipeline = &entry->pipeline;
+  return 0;
+}
+
+int parse_cache_parse(const char *line, size_t len,
+                      const pipeline_t **pipeline) {
+  if (!line || !pipeline)
+    return -1;
+
+  struct timespec start;
+  bool profiled = profile_start(&start);
+  int result = lookup(line, len, pipeline);
+  if (profiled)
+    profile_stop(PROFILE_LOOKUP, &start);
+  return result;
+}
+
+void parse_cache_release(const pipeline_t *pipeline) {
+  if (!pipeline || pipeline == &g_empty_pipeline)
+    return;
+
+  // The pipeline is the first member of its entry
+  parse_entry_t *entry = (parse_entry_t *)pipeline;
+  if (--entry->refs == 0 && !entry->cached)
+    destroy_entry(entry);
+}
+
+void parse_cache_clear(void) {
+  while (g_cache.tail)
+    drop_entry(g_cache.tail);
+  free(g_cache.buckets);
+  g_cache.buckets = NULL;
+  g_cache.num_buckets = 0;
+}
+
+void parse_cache_resize(size_t capacity) {
+  // The bucket array is sized for the capacity, so start over
+  parse_cache_clear();
+  g_cache.capacity = capacity;
+}
+
+void parse_cache_stats(parse_cache_stats_t *stats) {
+  stats->hits = g_cache.hits;
+  stats->misses = g_cache.misses;
+  stats->evictions = g_cache.evictions;
+  stats->entries = g_cache.count;
+  stats->capacity = g_cache.capacity;
+}
+
+void parse_cache_reset_stats(void) {
+  g_cache.hits = 0;
+  g_cache.misses = 0;
+  g_cache.evictions = 0;
+}
@@ -7,163 +7,815 @@
 
 #include "shell.h"
 #include <ctype.h>
-#include <stdlib.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 
 /**
- * @brief Tokenize a command line into an array of tokens
- * @param line Input command line
- * @param tokens Output array of token pointers (must be freed)
- * @param max_tokens Maximum number of tokens
- * @return Number of tokens parsed, or -1 on error
+ * @brief Initial arena size for a line of the given length
+ *
+ * Covers the line copy plus argv and command storage for typical input, so
+ * most pipelines are built from a single malloc.
  */
-static int tokenize(const char *line, char **tokens, int max_tokens) {
-  char *line_copy = strdup(line);
-  if (!line_copy)
-    return -1;
+#define PARSE_ARENA_HINT(len) (256 + 3 * (len))
 
-  int count = 0;
-  char *token = line_copy;
+/**
+ * @brief Pipeline stages held inline before the command array moves to the
+ * arena
+ */
+#define PARSE_INLINE_STAGES 8
 
-  while (count < max_tokens - 1) {
-    // Skip leading whitespace
-    while (isspace(*token))
-      token++;
+/**
+ * @brief argv slots held inline before the word vector moves to the arena
+ */
+#define PARSE_INLINE_WORDS 64
 
-    if (*token == '\0')
-      break;
+/**
+ * @brief Redirections held inline before their vector moves to the arena
+ */
+#define PARSE_INLINE_REDIRS 8
 
-    const char *start = token;
-    bool in_quotes = false;
-    char quote_char = '\0';
-
-    // Find end of token
-    while (*token != '\0') {
-      if (!in_quotes && (*token == '"' || *token == '\'')) {
-        in_quotes = true;
-        quote_char = *token;
-        token++;
-      } else if (in_quotes && *token == quote_char) {
-        in_quotes = false;
-        token++;
-      } else if (!in_quotes && isspace(*token)) {
-        break;
-      } else {
-        token++;
-      }
-    }
+/**
+ * @brief Most digits in a descriptor number (keeps it within an int)
+ */
+#define PARSE_FD_DIGITS 9
 
-    if (token != start) {
-      // Null-terminate token
-      if (*token != '\0') {
-        *token = '\0';
-        token++;
-      }
-      tokens[count++] = strdup(start);
+/**
+ * @brief Token kinds produced by the lexer
+ */
+typedef enum {
+  TOK_END,       /**< End of line */
+  TOK_WORD,      /**< Ordinary word (quotes already removed) */
+  TOK_PIPE,      /**< | */
+  TOK_LESS,      /**< < */
+  TOK_GREAT,     /**< > */
+  TOK_DGREAT,    /**< >> */
+  TOK_CLOBBER,   /**< >| */
+  TOK_LESSGREAT, /**< <> */
+  TOK_LESSAND,   /**< <& */
+  TOK_GREATAND,  /**< >& */
+  TOK_IO_NUMBER, /**< Descriptor number right before a redirection */
+  TOK_DLESS,     /**< << */
+  TOK_DLESSDASH, /**< <<- */
+  TOK_TLESS,     /**< <<< */
+  TOK_AMP,       /**< & */
+  TOK_SEMI,      /**< ; */
+  TOK_AND_IF,    /**< && */
+  TOK_OR_IF,     /**< || */
+  TOK_NEWLINE,   /**< Newline (here-document bodies may follow) */
+  TOK_ERROR      /**< Unterminated quote or command substitution */
+} token_kind_t;
+
+/**
+ * @brief Lexer state over a mutable line buffer
+ */
+typedef struct {
+  char *pos;            /**< Next byte to scan */
+  token_kind_t pending; /**< Operator found right after the last word */
+  const char *base;     /**< Start of the buffer being unquoted */
+  const char *orig;     /**< Untouched copy of the same bytes */
+  arena_t *arena;       /**< Arena for source text of expandable words */
+  bool quoted;          /**< The last word had quotes or escapes removed */
+} lexer_t;
+
+/**
+ * @brief Characters a backslash escapes inside double quotes
+ */
+static const char DQUOTE_ESCAPES[] = "\"\\$`";
+
+/**
+ * @brief Check whether an unquoted byte ends a word
+ */
+static bool is_word_break(char c) {
+  return c == '\0' || c == '|' || c == '<' || c == '>' || c == '&' ||
+         c == ';' || isspace((unsigned char)c);
+}
+
+size_t parse_substitution_len(const char *text) {
+  if (*text == '`') {
+    for (size_t i = 1; text[i]; i++) {
+      if (text[i] == '\\' && text[i + 1] != '\0')
+        i++;
+      else if (text[i] == '`')
+        return i + 1;
     }
+    return 0;
   }
 
-  tokens[count] = NULL;
-  free(line_copy);
-  return count;
+  // $( runs to the ) that balances it, skipping quoted text and the
+  // substitutions nested inside
+  int depth = 1;
+  char quote_char = '\0';
+  for (size_t i = 2; text[i]; i++) {
+    char c = text[i];
+    if (quote_char == '\'') {
+      if (c == '\'')
+        quote_char = '\0';
+    } else if (c == '\\') {
+      if (text[++i] == '\0')
+        return 0;
+    } else if (c == '`' || (c == '$' && text[i + 1] == '(')) {
+      size_t len = parse_substitution_len(text + i);
+      if (len == 0)
+        return 0;
+      i += len - 1;
+    } else if (quote_char == '"') {
+      if (c == '"')
+        quote_char = '\0';
+    } else if (c == '"' || c == '\'') {
+      quote_char = c;
+    } else if (c == '(') {
+      depth++;
+    } else if (c == ')' && --depth == 0) {
+      return i + 1;
+    }
+  }
+  return 0;
 }
 
 /**
- * @brief Free token array allocated by tokenize
+ * @brief Classify the operator starting at pos by its first byte
+ * @param pos Position of an operator byte (or NUL)
+ * @param len Output length of the operator in bytes
+ * @return Token kind of the operator, or TOK_WORD if pos starts a word
  */
-static void free_tokens(char **tokens) {
-  if (!tokens)
-    return;
-  for (int i = 0; tokens[i]; i++) {
-    free(tokens[i]);
+static token_kind_t classify_operator(const char *pos, size_t *len) {
+  *len = 1;
+  switch (*pos) {
+  case '\0':
+    *len = 0;
+    return TOK_END;
+  case '|':
+    if (pos[1] == '|') {
+      *len = 2;
+      return TOK_OR_IF;
+    }
+    return TOK_PIPE;
+  case ';':
+    return TOK_SEMI;
+  case '<':
+    if (pos[1] == '<' && pos[2] == '<') {
+      *len = 3;
+      return TOK_TLESS;
+    }
+    if (pos[1] == '<') {
+      *len = pos[2] == '-' ? 3 : 2;
+      return pos[2] == '-' ? TOK_DLESSDASH : TOK_DLESS;
+    }
+    if (pos[1] == '&' || pos[1] == '>') {
+      *len = 2;
+      return pos[1] == '&' ? TOK_LESSAND : TOK_LESSGREAT;
+    }
+    return TOK_LESS;
+  case '\n':
+    return TOK_NEWLINE;
+  case '&':
+    if (pos[1] == '&') {
+      *len = 2;
+      return TOK_AND_IF;
+    }
+    return TOK_AMP;
+  case '>':
+    if (pos[1] == '>' || pos[1] == '&' || pos[1] == '|') {
+      *len = 2;
+      return pos[1] == '>' ? TOK_DGREAT
+             : pos[1] == '&' ? TOK_GREATAND
+                             : TOK_CLOBBER;
+    }
+    return TOK_GREAT;
+  default:
+    return TOK_WORD;
   }
-  free(tokens);
 }
 
 /**
- * @brief Parse tokens into a pipeline structure
- * @param tokens Array of token strings
- * @param pipeline Output pipeline structure
- * @return 0 on success, -1 on error
+ * @brief Check whether a token is a redirection that takes a descriptor
+ * number (here-documents are always stdin)
+ */
+static bool is_redirection(token_kind_t kind) {
+  return kind == TOK_LESS || kind == TOK_GREAT || kind == TOK_DGREAT ||
+         kind == TOK_CLOBBER || kind == TOK_LESSGREAT ||
+         kind == TOK_LESSAND || kind == TOK_GREATAND;
+}
+
+/**
+ * @brief Read a descriptor number
+ * @param text Start of the digits
+ * @param len Number of bytes that must all be digits
+ * @return Descriptor, or -1 if text is not a short enough number
  */
-static int parse_tokens(char **tokens, pipeline_t *pipeline) {
-  if (!tokens || !tokens[0])
+static int parse_fd(const char *text, size_t len) {
+  if (len == 0 || len > PARSE_FD_DIGITS)
     return -1;
+  int fd = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (!isdigit((unsigned char)text[i]))
+      return -1;
+    fd = fd * 10 + (text[i] - '0');
+  }
+  return fd;
+}
 
-  // Count commands (separated by |)
-  size_t num_commands = 1;
-  for (int i = 0; tokens[i]; i++) {
-    if (strcmp(tokens[i], "|") == 0) {
-      num_commands++;
+/**
+ * @brief Scan the next token out of the line, unquoting words in place
+ *
+ * Quotes are stripped and backslash escapes resolved while scanning. Each
+ * word is compacted towards its own start, so the output never overtakes
+ * the input. When a word runs straight into an operator, the operator is
+ * remembered in the lexer before its first byte is overwritten by the
+ * word's terminator.
+ *
+ * A word with an unquoted *, ? or [, or a $ outside single quotes, is
+ * expanded when it runs, which needs its quotes, so its source text is
+ * returned as well: the word itself if nothing was unquoted, otherwise a
+ * copy from the untouched buffer. Command substitutions ($(...) and
+ * `...`) are kept verbatim, blanks and operators included.
+ *
+ * Unquoted digits that run straight into a redirection operator are not a
+ * word but the descriptor it redirects (TOK_IO_NUMBER, as in 2>&1).
+ *
+ * @param lex Lexer state
+ * @param text Output word text for TOK_WORD
+ * @param raw Output source text of a word needing expansion, else NULL
+ * @return Kind of the scanned token
+ */
+static token_kind_t next_token(lexer_t *lex, char **text, char **raw) {
+  *raw = NULL;
+  if (lex->pending != TOK_WORD) {
+    token_kind_t kind = lex->pending;
+    lex->pending = TOK_WORD;
+    return kind;
+  }
+
+  // Skip leading whitespace; a newline is a token of its own
+  while (isspace((unsigned char)*lex->pos) && *lex->pos != '\n')
+    lex->pos++;
+
+  size_t op_len;
+  token_kind_t kind = classify_operator(lex->pos, &op_len);
+  if (kind != TOK_WORD) {
+    lex->pos += op_len;
+    return kind;
+  }
+
+  char *src = lex->pos;
+  char *dst = src;
+  char quote_char = '\0';
+  bool special = false;
+  *text = src;
+
+  // Find end of word, unquoting into dst as we go
+  while (quote_char != '\0' || !is_word_break(*src)) {
+    char c = *src;
+
+    if (c == '\0') {
+      // Unterminated quote
+      return TOK_ERROR;
+    } else if (quote_char == '\'') {
+      // Single quotes preserve everything up to the closing quote
+      if (c == '\'')
+        quote_char = '\0';
+      else
+        *dst++ = c;
+      src++;
+    } else if (c == '\\' && src[1] != '\0') {
+      // Inside double quotes only a few characters are escapable
+      if (quote_char == '"' && !strchr(DQUOTE_ESCAPES, src[1])) {
+        *dst++ = *src++;
+      } else {
+        src++;
+        *dst++ = *src++;
+      }
+    } else if (c == '`' || (c == '$' && src[1] == '(')) {
+      size_t len = parse_substitution_len(src);
+      if (len == 0)
+        return TOK_ERROR;
+      memmove(dst, src, len);
+      dst += len;
+      src += len;
+      special = true;
+    } else if (quote_char == '"') {
+      if (c == '"')
+        quote_char = '\0';
+      else
+        *dst++ = c;
+      special |= c == '$';
+      src++;
+    } else if (c == '"' || c == '\'') {
+      quote_char = c;
+      src++;
+    } else {
+      special |= c == '*' || c == '?' || c == '[' || c == '$';
+      *dst++ = *src++;
     }
   }
 
-  if (num_commands > MAX_PIPES)
+  lex->quoted = dst != src;
+  if (special && dst == src) {
+    *raw = *text;
+  } else if (special) {
+    *raw = arena_strndup(lex->arena, lex->orig + (*text - lex->base),
+                         (size_t)(src - *text));
+    if (!*raw)
+      return TOK_ERROR;
+  }
+
+  // Remember a directly following operator (or skip the separator) before
+  // the terminator overwrites its first byte
+  lex->pending = classify_operator(src, &op_len);
+  if (lex->pending == TOK_END)
+    lex->pending = TOK_WORD;
+  lex->pos = src + op_len;
+  *dst = '\0';
+  if (!special && !lex->quoted && is_redirection(lex->pending) &&
+      parse_fd(*text, (size_t)(dst - *text)) != -1)
+    return TOK_IO_NUMBER;
+  return TOK_WORD;
+}
+
+/**
+ * @brief Double a vector's capacity, moving it into the arena
+ * @param arena Arena providing the new storage
+ * @param items Current storage (inline or arena)
+ * @param cap Capacity in elements, updated on success
+ * @param elem_size Size of one element
+ * @return New storage, or NULL on allocation failure
+ */
+static void *grow_vector(arena_t *arena, const void *items, size_t *cap,
+                         size_t elem_size) {
+  void *grown = arena_alloc(arena, *cap * 2 * elem_size);
+  if (!grown)
+    return NULL;
+
+  memcpy(grown, items, *cap * elem_size);
+  *cap *= 2;
+  return grown;
+}
+
+/**
+ * @brief Finish the current command by copying its words and
+ * redirections into the arena
+ * @param arena Arena owning the pipeline
+ * @param cmd Command being closed
+ * @param words Scratch vector holding the command's words
+ * @param raws Source text of each word needing expansion (else NULL)
+ * @param argc Number of words
+ * @param expand Whether any raws entry is set
+ * @param redirs Scratch vector holding the command's redirections
+ * @param num_redirs Number of redirections
+ * @return 0 on success, -1 on allocation failure
+ */
+static int close_command(arena_t *arena, command_t *cmd, char **words,
+                         char **raws, size_t argc, bool expand,
+                         const redir_t *redirs, size_t num_redirs) {
+  cmd->argv = arena_alloc(arena, (argc + 1) * sizeof(char *));
+  if (!cmd->argv)
     return -1;
 
-  pipeline->commands = calloc(num_commands, sizeof(command_t));
-  if (!pipeline->commands)
+  memcpy(cmd->argv, words, argc * sizeof(char *));
+  cmd->argv[argc] = NULL;
+
+  if (num_redirs > 0) {
+    cmd->redirs = arena_alloc(arena, num_redirs * sizeof(redir_t));
+    if (!cmd->redirs)
+      return -1;
+    memcpy(cmd->redirs, redirs, num_redirs * sizeof(redir_t));
+    cmd->num_redirs = num_redirs;
+  }
+
+  if (expand) {
+    cmd->raw_argv = arena_alloc(arena, argc * sizeof(char *));
+    if (!cmd->raw_argv)
+      return -1;
+    memcpy(cmd->raw_argv, raws, argc * sizeof(char *));
+  }
+  return 0;
+}
+
+/**
+ * @brief Check whether a line is blank or a comment
+ * @param line Line to check
+ * @param len Length of the line (SIZE_MAX if it is NUL-terminated)
+ */
+static bool is_blank_line(const char *line, size_t len) {
+  size_t i = 0;
+  while (i < len && isspace((unsigned char)line[i]))
+    i++;
+  return i == len || line[i] == '\0' || line[i] == '#';
+}
+
+/**
+ * @brief Fill in a redirection from its operator and the word after it
+ * @param r Redirection to fill in
+ * @param kind Redirection operator
+ * @param fd Descriptor number written before the operator, or -1
+ * @param word Filename, or descriptor number (or -) after <& and >&
+ * @param raw Source text of a filename needing expansion, else NULL
+ * @return 0 on success, -1 if a descriptor was expected but not given
+ */
+static int make_redir(redir_t *r, token_kind_t kind, int fd,
+                      const char *word, const char *raw) {
+  bool input = kind == TOK_LESS || kind == TOK_LESSAND ||
+               kind == TOK_LESSGREAT;
+  r->fd = fd != -1 ? fd : input ? STDIN_FILENO : STDOUT_FILENO;
+  r->source = -1;
+  r->flags = 0;
+  r->path = NULL;
+  r->raw_path = NULL;
+
+  if (kind == TOK_LESSAND || kind == TOK_GREATAND) {
+    r->kind = strcmp(word, "-") == 0 ? REDIR_CLOSE : REDIR_DUP;
+    if (r->kind == REDIR_DUP)
+      r->source = parse_fd(word, strlen(word));
+    return r->kind == REDIR_DUP && r->source == -1 ? -1 : 0;
+  }
+
+  r->kind = REDIR_OPEN;
+  r->path = word;
+  r->raw_path = raw;
+  if (kind == TOK_LESS)
+    r->flags = O_RDONLY;
+  else if (kind == TOK_LESSGREAT)
+    r->flags = O_RDWR | O_CREAT;
+  else if (kind == TOK_DGREAT)
+    r->flags = O_WRONLY | O_CREAT | O_APPEND;
+  else
+    r->flags = O_WRONLY | O_CREAT | O_TRUNC;
+  return 0;
+}
+
+const redir_t *command_redir(const command_t *cmd, int fd) {
+  const redir_t *found = NULL;
+  for (size_t i = 0; i < cmd->num_redirs; i++) {
+    if (cmd->redirs[i].fd == fd)
+      found = &cmd->redirs[i];
+  }
+  return found;
+}
+
+/**
+ * @brief Set up a here-string: the word followed by a newline
+ * @param arena Arena owning the pipeline
+ * @param doc Here-string to fill in
+ * @param text Word with quotes removed
+ * @param raw Source text of the word if it needs expansion, else NULL
+ * @return 0 on success, -1 on allocation failure
+ */
+static int here_string(arena_t *arena, here_doc_t *doc, const char *text,
+                       const char *raw) {
+  // Only parameters and substitutions matter here; glob characters stay
+  // as they are
+  doc->expand = raw && strpbrk(raw, "$`");
+  const char *word = doc->expand ? raw : text;
+  size_t len = strlen(word);
+
+  char *body = arena_alloc(arena, len + 2);
+  if (!body)
     return -1;
-  pipeline->num_commands = num_commands;
-
-  int cmd_idx = 0;
-  int token_idx = 0;
-
-  while (cmd_idx < (int)num_commands && tokens[token_idx]) {
-    command_t *cmd = &pipeline->commands[cmd_idx];
-    cmd->argv = NULL;
-    cmd->input_file = NULL;
-    cmd->output_file = NULL;
-    cmd->append_output = false;
-    cmd->background = false;
-
-    // Collect arguments for this command
-    char **argv = calloc(MAX_TOKENS, sizeof(char *));
-    if (!argv)
-      goto error;
-    int argc = 0;
+  memcpy(body, word, len);
+  body[len] = '\n';
+  body[len + 1] = '\0';
+  doc->body = body;
+  doc->len = len + 1;
+  return 0;
+}
 
-    // Parse tokens until pipe, end, or redirection
-    while (tokens[token_idx]) {
-      if (strcmp(tokens[token_idx], "|") == 0) {
-        token_idx++;
-        break;
-      } else if (strcmp(tokens[token_idx], "<") == 0) {
-        token_idx++;
-        if (!tokens[token_idx])
-          goto error;
-        cmd->input_file = strdup(tokens[token_idx++]);
-      } else if (strcmp(tokens[token_idx], ">") == 0) {
-        token_idx++;
-        if (!tokens[token_idx])
-          goto error;
-        cmd->output_file = strdup(tokens[token_idx++]);
-        cmd->append_output = false;
-      } else if (strcmp(tokens[token_idx], ">>") == 0) {
-        token_idx++;
-        if (!tokens[token_idx])
-          goto error;
-        cmd->output_file = strdup(tokens[token_idx++]);
-        cmd->append_output = true;
-      } else if (strcmp(tokens[token_idx], "&") == 0) {
-        // Background execution (only valid for last command)
-        if (cmd_idx == (int)num_commands - 1) {
-          cmd->background = true;
+/**
+ * @brief Cut the here-document bodies out of the lines after the command
+ *
+ * Bodies stay where they are in the line buffer; only <<- moves text, to
+ * drop the leading tabs. A body without its delimiter line takes the rest
+ * of the text and marks the pipeline unterminated.
+ *
+ * @param pipeline Pipeline the here-documents belong to
+ * @param text First byte after the command line's newline, or NULL
+ */
+static void read_here_doc_bodies(pipeline_t *pipeline, char *text) {
+  for (here_doc_t *doc = pipeline->here_docs; doc; doc = doc->next) {
+    const here_doc_t *waiting = doc;
+    char *dst = text;
+    doc->body = text ? text : "";
+
+    while (text && *text && waiting == doc) {
+      char *nl = strchr(text, '\n');
+      size_t len = nl ? (size_t)(nl - text) : strlen(text);
+      char *line = text;
+      text = nl ? nl + 1 : text + len;
+
+      if (doc->strip_tabs) {
+        while (len > 0 && *line == '\t') {
+          line++;
+          len--;
         }
-        token_idx++;
+      }
+      parse_here_doc_line(&waiting, line, len);
+      if (waiting != doc)
         break;
+
+      if (dst != line)
+        memmove(dst, line, len);
+      dst += len;
+      if (nl)
+        *dst++ = '\n';
+    }
+
+    if (waiting == doc)
+      pipeline->unterminated = true;
+    doc->len = dst ? (size_t)(dst - doc->body) : 0;
+    if (dst)
+      *dst = '\0';
+
+    // Bodies without $, ` or \ come out of expansion unchanged
+    doc->expand = doc->expand && strpbrk(doc->body, "$`\\");
+  }
+}
+
+/**
+ * @brief Skip a leading unquoted "time" keyword
+ * @param pos In/out scan position, moved past the keyword if present
+ * @return true if the keyword was found
+ */
+static bool skip_time_keyword(char **pos) {
+  char *start = *pos;
+  while (isspace((unsigned char)*start) && *start != '\n')
+    start++;
+  if (strncmp(start, "time", 4) != 0 ||
+      !(start[4] == '\0' || isspace((unsigned char)start[4])))
+    return false;
+  *pos = start + 4;
+  return true;
+}
+
+/**
+ * @brief State shared by the pipelines of one line
+ */
+typedef struct {
+  lexer_t lex;            /**< Lexer over the whole line */
+  pipeline_t *head;       /**< First pipeline; owns the arena */
+  here_doc_t **docs_tail; /**< Where the next here-document is linked */
+  char *bodies;           /**< Start of the here-document bodies, or NULL */
+} list_parser_t;
+
+/**
+ * @brief Parse one pipeline of a list, up to its control operator
+ *
+ * The lexer hands tokens straight to a small state machine that fills in
+ * commands as it goes. Commands and the per-command word scratch vector
+ * start in inline buffers and only spill into the arena past
+ * PARSE_INLINE_STAGES stages, PARSE_INLINE_WORDS words or
+ * PARSE_INLINE_REDIRS redirections, doubling from there, so they are
+ * limited only by memory. Each argv (and redirection vector) is copied
+ * into the arena at its exact size when its command ends.
+ *
+ * @param lp List state
+ * @param pipeline Pipeline to fill in (allocated from the head's arena)
+ * @return Token that ended the pipeline (TOK_END, TOK_NEWLINE, TOK_SEMI,
+ * TOK_AND_IF, TOK_OR_IF or TOK_AMP), or TOK_ERROR
+ */
+static token_kind_t parse_pipeline(list_parser_t *lp, pipeline_t *pipeline) {
+  command_t inline_cmds[PARSE_INLINE_STAGES];
+  char *inline_words[PARSE_INLINE_WORDS];
+  char *inline_raws[PARSE_INLINE_WORDS];
+  redir_t inline_redirs[PARSE_INLINE_REDIRS];
+  arena_t *arena = &lp->head->arena;
+
+  command_t *cmds = inline_cmds;
+  size_t cmd_cap = PARSE_INLINE_STAGES;
+  size_t num_cmds = 0;
+
+  char **words = inline_words;
+  char **raws = inline_raws;
+  size_t word_cap = PARSE_INLINE_WORDS;
+  size_t argc = 0;
+  bool cmd_expand = false;
+
+  redir_t *redirs = inline_redirs;
+  size_t redir_cap = PARSE_INLINE_REDIRS;
+  size_t num_redirs = 0;
+  int io_fd = -1;
+
+  command_t *cmd = NULL;
+  token_kind_t kind;
+
+  while (1) {
+    char *text = NULL;
+    char *raw = NULL;
+    kind = next_token(&lp->lex, &text, &raw);
+
+    if (kind == TOK_ERROR)
+      return TOK_ERROR;
+
+    // Start a new command on its first token
+    if (!cmd) {
+      if (num_cmds == cmd_cap) {
+        cmds = grow_vector(arena, cmds, &cmd_cap, sizeof(command_t));
+        if (!cmds)
+          return TOK_ERROR;
+      }
+      cmd = &cmds[num_cmds++];
+      memset(cmd, 0, sizeof(*cmd));
+      argc = 0;
+      cmd_expand = false;
+      num_redirs = 0;
+    }
+
+    switch (kind) {
+    case TOK_WORD:
+      if (argc == word_cap) {
+        size_t raw_cap = word_cap;
+        raws = grow_vector(arena, raws, &raw_cap, sizeof(char *));
+        words = grow_vector(arena, words, &word_cap, sizeof(char *));
+        if (!raws || !words)
+          return TOK_ERROR;
+      }
+      raws[argc] = raw;
+      words[argc++] = text;
+      cmd_expand |= raw != NULL;
+      continue;
+
+    case TOK_IO_NUMBER:
+      // The lexer only returns one right before a redirection operator
+      io_fd = parse_fd(text, strlen(text));
+      continue;
+
+    case TOK_LESS:
+    case TOK_GREAT:
+    case TOK_DGREAT:
+    case TOK_CLOBBER:
+    case TOK_LESSGREAT:
+    case TOK_LESSAND:
+    case TOK_GREATAND: {
+      // Redirection operators take the next word as their filename, or
+      // as the descriptor to copy (the 1 of 2>&1>file, too)
+      token_kind_t target = next_token(&lp->lex, &text, &raw);
+      if (target != TOK_WORD && target != TOK_IO_NUMBER)
+        return TOK_ERROR;
+      if (num_redirs == redir_cap) {
+        redirs = grow_vector(arena, redirs, &redir_cap, sizeof(redir_t));
+        if (!redirs)
+          return TOK_ERROR;
+      }
+      redir_t *r = &redirs[num_redirs++];
+      if (make_redir(r, kind, io_fd, text, raw) == -1)
+        return TOK_ERROR;
+      io_fd = -1;
+      pipeline->expand |= r->raw_path != NULL;
+      if (r->fd == STDIN_FILENO)
+        cmd->here_doc = NULL;
+      continue;
+    }
+
+    case TOK_DLESS:
+    case TOK_DLESSDASH:
+    case TOK_TLESS: {
+      if (next_token(&lp->lex, &text, &raw) != TOK_WORD)
+        return TOK_ERROR;
+      here_doc_t *doc = arena_alloc(arena, sizeof(here_doc_t));
+      if (!doc)
+        return TOK_ERROR;
+      memset(doc, 0, sizeof(*doc));
+
+      if (kind == TOK_TLESS) {
+        if (here_string(arena, doc, text, raw) == -1)
+          return TOK_ERROR;
       } else {
-        if (argc >= MAX_TOKENS - 1)
-          goto error;
-        argv[argc++] = strdup(tokens[token_idx++]);
+        // A quoted delimiter keeps the body literal
+        doc->delimiter = text;
+        doc->strip_tabs = kind == TOK_DLESSDASH;
+        doc->expand = !lp->lex.quoted;
+        *lp->docs_tail = doc;
+        lp->docs_tail = &doc->next;
+      }
+      // The here-document replaces what stdin was redirected to so far
+      cmd->here_doc = doc;
+      size_t kept = 0;
+      for (size_t i = 0; i < num_redirs; i++) {
+        if (redirs[i].fd != STDIN_FILENO)
+          redirs[kept++] = redirs[i];
       }
+      num_redirs = kept;
+      continue;
+    }
+
+    case TOK_NEWLINE:
+      // Only here-document bodies may follow the command line
+      if (!lp->head->here_docs)
+        continue;
+      lp->bodies = lp->lex.pos;
+      break;
+
+    case TOK_AMP:
+      cmd->background = true;
+      break;
+
+    case TOK_PIPE:
+    case TOK_SEMI:
+    case TOK_AND_IF:
+    case TOK_OR_IF:
+    case TOK_END:
+    case TOK_ERROR:
+      break;
     }
 
-    argv[argc] = NULL;
-    cmd->argv = argv;
-    cmd_idx++;
+    // An empty stage (e.g. "| wc", "ls |" or "&& ls") is a syntax error
+    if (argc == 0 && num_redirs == 0 && !cmd->here_doc)
+      return TOK_ERROR;
+    if (close_command(arena, cmd, words, raws, argc, cmd_expand, redirs,
+                      num_redirs) == -1)
+      return TOK_ERROR;
+    pipeline->expand |= cmd_expand;
+    cmd = NULL;
+
+    if (kind != TOK_PIPE)
+      break;
+  }
+
+  // Move the command array out of inline storage
+  if (cmds == inline_cmds) {
+    cmds = arena_alloc(arena, num_cmds * sizeof(command_t));
+    if (!cmds)
+      return TOK_ERROR;
+    memcpy(cmds, inline_cmds, num_cmds * sizeof(command_t));
   }
 
+  pipeline->commands = cmds;
+  pipeline->num_commands = num_cmds;
+  return kind;
+}
+
+/**
+ * @brief Check whether nothing but blanks is left of the line
+ */
+static bool at_list_end(const lexer_t *lex) {
+  const char *pos = lex->pos;
+  while (isspace((unsigned char)*pos) && *pos != '\n')
+    pos++;
+  return *pos == '\0' || *pos == '\n';
+}
+
+/**
+ * @brief Parse a mutable line into a list of pipelines in a single pass
+ *
+ * Pipelines are joined by ;, &, && and ||. The first one is the caller's;
+ * the others are allocated from its arena and chained through next, so
+ * the whole list is parsed, cached and freed as one.
+ *
+ * @param line Line buffer that argv entries will point into
+ * @param orig Untouched copy of line, for words that need expansion
+ * @param pipeline Pipeline whose arena may already hold the line
+ * @return 0 on success, -1 on error (pipeline is freed)
+ */
+static int parse_line(char *line, const char *orig, pipeline_t *pipeline) {
+  list_parser_t lp = {{line, TOK_WORD, line, orig, &pipeline->arena, false},
+                      pipeline,
+                      &pipeline->here_docs,
+                      NULL};
+  pipeline_t *current = pipeline;
+
+  while (1) {
+    // A leading unquoted "time" is a keyword timing the whole pipeline
+    if (skip_time_keyword(&lp.lex.pos)) {
+      current->timed = true;
+      if (current == pipeline && is_blank_line(lp.lex.pos, SIZE_MAX))
+        return 0;
+    }
+
+    token_kind_t kind = parse_pipeline(&lp, current);
+    if (kind == TOK_ERROR)
+      goto error;
+
+    // ; and & may end the line; && and || need a pipeline after them
+    bool separator = kind == TOK_SEMI || kind == TOK_AMP;
+    if (kind == TOK_END || kind == TOK_NEWLINE ||
+        (separator && at_list_end(&lp.lex)))
+      break;
+
+    pipeline_t *next = arena_alloc(&pipeline->arena, sizeof(pipeline_t));
+    if (!next)
+      goto error;
+    memset(next, 0, sizeof(*next));
+    current->next_op = separator           ? LIST_SEQ
+                       : kind == TOK_AND_IF ? LIST_AND
+                                            : LIST_OR;
+    current->next = next;
+    current = next;
+  }
+
+  // The bodies start on the line after the last command all the same
+  if (pipeline->here_docs) {
+    if (!lp.bodies && (lp.bodies = strchr(lp.lex.pos, '\n')))
+      lp.bodies++;
+    read_here_doc_bodies(pipeline, lp.bodies);
+  }
+
+  // Here-documents with something to expand make their pipeline expand
+  for (pipeline_t *p = pipeline; p; p = p->next) {
+    for (size_t i = 0; i < p->num_commands; i++) {
+      const here_doc_t *doc = p->commands[i].here_doc;
+      p->expand |= doc && doc->expand;
+    }
+  }
   return 0;
 
 error:
@@ -171,60 +823,72 @@ error:
   return -1;
 }
 
-int parse_command(const char *line, pipeline_t *pipeline) {
+int parse_command_len(const char *line, size_t len, pipeline_t *pipeline) {
   if (!line || !pipeline)
     return -1;
 
   // Initialize pipeline
   pipeline->commands = NULL;
   pipeline->num_commands = 0;
+  pipeline->arena.head = NULL;
+  pipeline->timed = false;
+  pipeline->expand = false;
+  pipeline->here_docs = NULL;
+  pipeline->unterminated = false;
+  pipeline->next_op = LIST_END;
+  pipeline->next = NULL;
 
   // Skip empty lines and comments
-  const char *p = line;
-  while (isspace(*p))
-    p++;
-  if (*p == '\0' || *p == '#')
+  if (is_blank_line(line, len))
     return 0;
 
-  // Tokenize
-  char **tokens = calloc(MAX_TOKENS, sizeof(char *));
-  if (!tokens)
-    return -1;
+  struct timespec start;
+  bool profiled = profile_start(&start);
 
-  int token_count = tokenize(line, tokens, MAX_TOKENS);
-  if (token_count < 0) {
-    free(tokens);
+  // Copy the line once into the arena and parse the copy in place
+  char *copy = NULL;
+  if (arena_reserve(&pipeline->arena, PARSE_ARENA_HINT(len)) == 0)
+    copy = arena_strndup(&pipeline->arena, line, len);
+  if (!copy) {
+    free_pipeline(pipeline);
     return -1;
   }
 
-  // Parse tokens into pipeline
-  int result = parse_tokens(tokens, pipeline);
-  free_tokens(tokens);
-
+  int result = parse_line(copy, line, pipeline);
+  if (profiled)
+    profile_stop(PROFILE_PARSE, &start);
   return result;
 }
 
-void free_pipeline(pipeline_t *pipeline) {
-  if (!pipeline)
+void parse_here_doc_line(const here_doc_t **doc, const char *line,
+                         size_t len) {
+  if (!*doc)
     return;
 
-  for (size_t i = 0; i < pipeline->num_commands; i++) {
-    command_t *cmd = &pipeline->commands[i];
-
-    if (cmd->argv) {
-      for (int j = 0; cmd->argv[j]; j++) {
-        free(cmd->argv[j]);
-      }
-      free(cmd->argv);
+  const char *delimiter = (*doc)->delimiter;
+  if ((*doc)->strip_tabs) {
+    while (len > 0 && *line == '\t') {
+      line++;
+      len--;
     }
-
-    if (cmd->input_file)
-      free(cmd->input_file);
-    if (cmd->output_file)
-      free(cmd->output_file);
   }
+  if (strlen(delimiter) == len && memcmp(line, delimiter, len) == 0)
+    *doc = (*doc)->next;
+}
+
+int parse_command(const char *line, pipeline_t *pipeline) {
+  if (!line)
+    return -1;
+  return parse_command_len(line, strlen(line), pipeline);
+}
+
+void free_pipeline(pipeline_t *pipeline) {
+  if (!pipeline)
+    return;
 
-  free(pipeline->commands);
+  // Every string, argv vector and command lives in the arena
+  arena_release(&pipeline->arena);
   pipeline->commands = NULL;
   pipeline->num_commands = 0;
+  pipeline->next = NULL;
 }
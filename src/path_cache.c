@@ -0,0 +1,266 @@
+/**
+ * @file path_cache.c
+ * @brief Cache of command name to executable path lookups ($PATH search)
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "shell.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Initial number of slots in the cache (must be a power of two)
+ */
+#define PATH_CACHE_INITIAL_SLOTS 64
+
+/**
+ * @brief Search path used when PATH is unset
+ */
+#define PATH_CACHE_DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+/**
+ * @brief One remembered command location
+ */
+typedef struct {
+  char *name;    /**< Command name (NULL if the slot is empty) */
+  char *path;    /**< Resolved executable path */
+  unsigned hits; /**< Number of lookups served from the cache */
+} path_entry_t;
+
+/**
+ * @brief Open-addressing hash table keyed by command name
+ */
+static struct {
+  path_entry_t *slots; /**< Slot array (NULL until first insert) */
+  size_t capacity;     /**< Number of slots */
+  size_t count;        /**< Occupied slots */
+  char *path_var;      /**< Copy of PATH the entries were resolved against */
+} g_cache = {NULL, 0, 0, NULL};
+
+/**
+ * @brief FNV-1a hash of a NUL-terminated string
+ */
+static uint32_t hash_name(const char *name) {
+  uint32_t hash = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+    hash ^= *p;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief Find the slot for a name: its entry, or the empty slot ending the
+ * probe sequence
+ */
+static path_entry_t *find_slot(path_entry_t *slots, size_t capacity,
+                               const char *name) {
+  size_t mask = capacity - 1;
+  size_t i = hash_name(name) & mask;
+  while (slots[i].name && strcmp(slots[i].name, name) != 0)
+    i = (i + 1) & mask;
+  return &slots[i];
+}
+
+/**
+ * @brief Double the table (or create it) and rehash every entry
+ * @return 0 on success, -1 on allocation failure
+ */
+static int grow_table(void) {
+  size_t capacity =
+      g_cache.capacity ? g_cache.capacity * 2 : PATH_CACHE_INITIAL_SLOTS;
+  path_entry_t *slots = calloc(capacity, sizeof(path_entry_t));
+  if (!slots)
+    return -1;
+
+  for (size_t i = 0; i < g_cache.capacity; i++) {
+    if (g_cache.slots[i].name)
+      *find_slot(slots, capacity, g_cache.slots[i].name) = g_cache.slots[i];
+  }
+
+  free(g_cache.slots);
+  g_cache.slots = slots;
+  g_cache.capacity = capacity;
+  return 0;
+}
+
+/**
+ * @brief Get the search path currently in effect
+ */
+static const char *current_path(void) {
+  const char *path = getenv("PATH");
+  return path ? path : PATH_CACHE_DEFAULT_PATH;
+}
+
+/**
+ * @brief Drop all entries if PATH changed since they were resolved
+ */
+static void check_path_changed(void) {
+  const char *path = current_path();
+  if (g_cache.path_var && strcmp(g_cache.path_var, path) == 0)
+    return;
+
+  path_cache_clear();
+  g_cache.path_var = strdup(path);
+}
+
+/**
+ * @brief Check whether a path names an executable regular file
+ */
+static bool is_executable(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+         access(path, X_OK) == 0;
+}
+
+/**
+ * @brief Walk PATH looking for an executable called name
+ * @param name Command name without a slash
+ * @return Newly allocated full path, or NULL if not found
+ */
+static char *search_path(const char *name) {
+  const char *dir = current_path();
+  size_t name_len = strlen(name);
+
+  while (1) {
+    const char *end = strchr(dir, ':');
+    size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+
+    // An empty PATH element means the current directory
+    char *candidate = malloc(dir_len + name_len + 3);
+    if (!candidate)
+      return NULL;
+    if (dir_len == 0) {
+      memcpy(candidate, "./", 2);
+      memcpy(candidate + 2, name, name_len + 1);
+    } else {
+      memcpy(candidate, dir, dir_len);
+      candidate[dir_len] = '/';
+      memcpy(candidate + dir_len + 1, name, name_len + 1);
+    }
+
+    if (is_executable(candidate))
+      return candidate;
+    free(candidate);
+
+    if (!end)
+      return NULL;
+    dir = end + 1;
+  }
+}
+
+const char *path_cache_lookup(const char *name) {
+  if (!name || !*name)
+    return NULL;
+
+  // Names with a slash are used as given and never cached
+  if (strchr(name, '/'))
+    return name;
+
+  check_path_changed();
+
+  if (g_cache.slots) {
+    path_entry_t *entry = find_slot(g_cache.slots, g_cache.capacity, name);
+    if (entry->name) {
+      entry->hits++;
+      return entry->path;
+    }
+  }
+
+  // The first search is the cache's warmup
+  struct timespec start;
+  bool profiled = !g_cache.slots && startup_profile_start(&start);
+  char *path = search_path(name);
+  if (profiled)
+    startup_profile_stop(STARTUP_PATH_CACHE, &start);
+  if (!path)
+    return NULL;
+
+  // Keep the load factor under 3/4; on allocation failure the caller falls
+  // back to an uncached search
+  if ((g_cache.count + 1) * 4 > g_cache.capacity * 3 && grow_table() == -1) {
+    free(path);
+    return NULL;
+  }
+
+  path_entry_t *entry = find_slot(g_cache.slots, g_cache.capacity, name);
+  entry->name = strdup(name);
+  if (!entry->name) {
+    free(path);
+    return NULL;
+  }
+  entry->path = path;
+  entry->hits = 1;
+  g_cache.count++;
+  return entry->path;
+}
+
+void path_cache_forget(const char *name) {
+  if (!name || !g_cache.slots)
+    return;
+
+  path_entry_t *entry = find_slot(g_cache.slots, g_cache.capacity, name);
+  if (!entry->name)
+    return;
+
+  free(entry->name);
+  free(entry->path);
+  entry->name = NULL;
+  entry->path = NULL;
+  g_cache.count--;
+
+  // Re-insert the rest of the probe run so later lookups still find it
+  size_t mask = g_cache.capacity - 1;
+  size_t i = ((size_t)(entry - g_cache.slots) + 1) & mask;
+  while (g_cache.slots[i].name) {
+    path_entry_t moved = g_cache.slots[i];
+    g_cache.slots[i].name = NULL;
+    g_cache.slots[i].path = NULL;
+    *find_slot(g_cache.slots, g_cache.capacity, moved.name) = moved;
+    i = (i + 1) & mask;
+  }
+}
+
+void path_cache_clear(void) {
+  for (size_t i = 0; i < g_cache.capacity; i++) {
+    free(g_cache.slots[i].name);
+    free(g_cache.slots[i].path);
+  }
+  free(g_cache.slots);
+  free(g_cache.path_var);
+  g_cache.slots = NULL;
+  g_cache.capacity = 0;
+  g_cache.count = 0;
+  g_cache.path_var = NULL;
+}
+
+const char **path_cache_names(size_t *count) {
+  *count = 0;
+  const char **names = malloc((g_cache.count ? g_cache.count : 1) *
+                              sizeof(const char *));
+  if (!names)
+    return NULL;
+  for (size_t i = 0; i < g_cache.capacity; i++) {
+    if (g_cache.slots[i].name)
+      names[(*count)++] = g_cache.slots[i].name;
+  }
+  return names;
+}
+
+void path_cache_print(FILE *out) {
+  if (g_cache.count == 0) {
+    fprintf(out, "hash: hash table empty\n");
+    return;
+  }
+
+  fprintf(out, "hits\tcommand\n");
+  for (size_t i = 0; i < g_cache.capacity; i++) {
+    if (g_cache.slots[i].name)
+      fprintf(out, "%4u\t%s\n", g_cache.slots[i].hits, g_cache.slots[i].path);
+  }
+}
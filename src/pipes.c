@@ -0,0 +1,102 @@
+/**
+ * @file pipes.c
+ * @brief Pipe buffer sizing for inter-stage pipes (set -o pipesize)
+ */
+
+#define _GNU_SOURCE
+
+#include "shell.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/**
+ * @brief Kernel default pipe capacity, where adaptive sizing starts
+ */
+#define PIPE_SIZE_DEFAULT_BYTES (64 * 1024)
+
+/**
+ * @brief Upper bound for adaptive sizing (the default pipe-max-size)
+ */
+#define PIPE_SIZE_AUTO_MAX (1024 * 1024)
+
+/**
+ * @brief Average voluntary context switches per process above which a
+ * pipeline counts as stalling on its pipes
+ */
+#define PIPE_SIZE_BUSY_SWITCHES 1000
+
+/**
+ * @brief Current pipe sizing policy
+ */
+static struct {
+  pipe_size_mode_t mode; /**< How new pipes are sized */
+  size_t requested;      /**< Fixed size, or current adaptive size */
+  size_t effective;      /**< Capacity of the most recently sized pipe */
+  size_t limit;          /**< Largest size the kernel accepted (0 unknown) */
+} g_pipes = {PIPE_SIZE_DEFAULT, 0, 0, 0};
+
+void pipe_size_set(pipe_size_mode_t mode, size_t bytes) {
+  g_pipes.mode = mode;
+  g_pipes.requested = mode == PIPE_SIZE_AUTO ? PIPE_SIZE_DEFAULT_BYTES : bytes;
+  g_pipes.effective = 0;
+}
+
+void pipe_size_apply(int fd) {
+  if (g_pipes.mode == PIPE_SIZE_DEFAULT)
+    return;
+
+  size_t size = g_pipes.requested;
+  if (g_pipes.limit && size > g_pipes.limit)
+    size = g_pipes.limit;
+
+  // Unprivileged processes cannot exceed /proc/sys/fs/pipe-max-size; halve
+  // until the kernel agrees and remember the limit for later pipes
+  while (fcntl(fd, F_SETPIPE_SZ, (int)size) == -1) {
+    if (errno != EPERM || size <= PIPE_SIZE_DEFAULT_BYTES)
+      break;
+    size /= 2;
+    g_pipes.limit = size;
+  }
+
+  int effective = fcntl(fd, F_GETPIPE_SZ);
+  if (effective > 0)
+    g_pipes.effective = (size_t)effective;
+}
+
+void pipe_size_observe(const job_t *job) {
+  if (g_pipes.mode != PIPE_SIZE_AUTO || job->num_procs < 2)
+    return;
+
+  // Processes that keep waiting on each other switch voluntarily far more
+  // often than ones that mostly compute
+  long switches = 0;
+  for (size_t i = 0; i < job->num_procs; i++)
+    switches += job->procs[i].usage.ru_nvcsw;
+  if (switches / (long)job->num_procs < PIPE_SIZE_BUSY_SWITCHES)
+    return;
+
+  size_t max = g_pipes.limit ? g_pipes.limit : PIPE_SIZE_AUTO_MAX;
+  if (g_pipes.requested < max)
+    g_pipes.requested *= 2;
+}
+
+void pipe_size_print(FILE *out) {
+  switch (g_pipes.mode) {
+  case PIPE_SIZE_DEFAULT:
+    fprintf(out, "pipesize\tdefault\n");
+    return;
+  case PIPE_SIZE_FIXED:
+    fprintf(out, "pipesize\t%zu", g_pipes.requested);
+    break;
+  case PIPE_SIZE_AUTO:
+    fprintf(out, "pipesize\tauto (now %zu)", g_pipes.requested);
+    break;
+  }
+
+  if (g_pipes.effective)
+    fprintf(out, ", effective %zu\n", g_pipes.effective);
+  else
+    fprintf(out, "\n");
+}
@@ -0,0 +1,241 @@
+/**
+ * @file profile.c
+ * @brief Latency histograms for the parse, spawn and wait hot paths, and
+ * the startup breakdown of --startup-profile
+ *
+ * Always compiled in, but off unless SHELL_PROFILE is set: every probe is
+ * then a single branch. When on, each probe costs two vDSO clock reads and
+ * a few adds into a fixed log-linear histogram, so nothing is allocated.
+ *
+ * Startup phases are timed once each. What runs before the first prompt
+ * is reported there; subsystems that start lazily later report when they
+ * are first used.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "shell.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Linear sub-buckets per power of two (as a bit count)
+ */
+#define PROFILE_SUB_BITS 3
+#define PROFILE_SUB_BUCKETS (1 << PROFILE_SUB_BITS)
+
+/**
+ * @brief Buckets covering every 64-bit nanosecond value
+ */
+#define PROFILE_BUCKETS ((64 - PROFILE_SUB_BITS + 1) * PROFILE_SUB_BUCKETS)
+
+/**
+ * @brief Samples of one phase
+ */
+typedef struct {
+  uint64_t count;                    /**< Number of samples */
+  uint64_t total;                    /**< Sum of all samples (ns) */
+  uint64_t max;                      /**< Largest sample (ns) */
+  uint64_t buckets[PROFILE_BUCKETS]; /**< Log-linear histogram */
+} phase_hist_t;
+
+static const char *const g_phase_names[PROFILE_NUM_PHASES] = {
+    "lookup", "parse", "spawn", "wait"};
+
+static const char *const g_startup_names[STARTUP_NUM_PHASES] = {
+    "signal setup", "terminal", "history index", "PATH cache warmup"};
+
+/**
+ * @brief Profiling state
+ */
+static struct {
+  bool enabled;                            /**< SHELL_PROFILE was set */
+  pid_t owner;                             /**< Process that dumps at exit */
+  phase_hist_t phases[PROFILE_NUM_PHASES]; /**< Per-phase histograms */
+} g_profile;
+
+/**
+ * @brief Startup timing state
+ */
+static struct {
+  bool enabled;                        /**< --startup-profile was given */
+  FILE *out;                           /**< Report stream once reported */
+  struct timespec main_start;          /**< Clock when main started */
+  uint64_t before_main;                /**< CPU time from exec to main (ns) */
+  uint64_t phases[STARTUP_NUM_PHASES]; /**< Duration of each phase (ns) */
+  bool timed[STARTUP_NUM_PHASES];      /**< Phase has run */
+} g_startup;
+
+/**
+ * @brief Nanoseconds since a CLOCK_MONOTONIC reading
+ */
+static uint64_t elapsed_ns(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  int64_t ns = (int64_t)(now.tv_sec - start->tv_sec) * 1000000000 +
+               (now.tv_nsec - start->tv_nsec);
+  return ns > 0 ? (uint64_t)ns : 0;
+}
+
+/**
+ * @brief Histogram bucket of a value
+ *
+ * Values below 2^PROFILE_SUB_BITS get a bucket each; above that every
+ * power of two is split into PROFILE_SUB_BUCKETS equal parts.
+ */
+static size_t bucket_of(uint64_t ns) {
+  if (ns < PROFILE_SUB_BUCKETS)
+    return (size_t)ns;
+  int msb = 63 - __builtin_clzll(ns);
+  size_t sub = (size_t)(ns >> (msb - PROFILE_SUB_BITS)) &
+               (PROFILE_SUB_BUCKETS - 1);
+  return (size_t)(msb - PROFILE_SUB_BITS + 1) * PROFILE_SUB_BUCKETS + sub;
+}
+
+/**
+ * @brief Middle of the value range a bucket stands for
+ */
+static uint64_t bucket_value(size_t bucket) {
+  if (bucket < PROFILE_SUB_BUCKETS)
+    return bucket;
+  int shift = (int)(bucket / PROFILE_SUB_BUCKETS) - 1;
+  uint64_t low = (uint64_t)(PROFILE_SUB_BUCKETS + bucket % PROFILE_SUB_BUCKETS)
+                 << shift;
+  return low + ((uint64_t)1 << shift) / 2;
+}
+
+/**
+ * @brief atexit hook: dump the counters once, from the shell itself
+ */
+static void dump_at_exit(void) {
+  // Forked children that fail to exec exit through here too
+  if (getpid() != g_profile.owner)
+    return;
+  profile_print(stderr);
+}
+
+void profile_init(void) {
+  const char *value = getenv("SHELL_PROFILE");
+  if (!value || !*value || strcmp(value, "0") == 0 || g_profile.enabled)
+    return;
+
+  g_profile.enabled = true;
+  g_profile.owner = getpid();
+  atexit(dump_at_exit);
+}
+
+bool profile_enabled(void) { return g_profile.enabled; }
+
+bool profile_start(struct timespec *start) {
+  if (!g_profile.enabled)
+    return false;
+  clock_gettime(CLOCK_MONOTONIC, start);
+  return true;
+}
+
+void profile_stop(profile_phase_t phase, const struct timespec *start) {
+  profile_record(phase, elapsed_ns(start));
+}
+
+void profile_record(profile_phase_t phase, uint64_t ns) {
+  phase_hist_t *hist = &g_profile.phases[phase];
+  hist->count++;
+  hist->total += ns;
+  if (ns > hist->max)
+    hist->max = ns;
+  hist->buckets[bucket_of(ns)]++;
+}
+
+uint64_t profile_percentile(profile_phase_t phase, double percent) {
+  const phase_hist_t *hist = &g_profile.phases[phase];
+  if (hist->count == 0)
+    return 0;
+
+  // Smallest bucket holding at least percent of all samples
+  uint64_t rank = (uint64_t)(percent / 100.0 * (double)hist->count + 0.5);
+  if (rank == 0)
+    rank = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < PROFILE_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    // The top bucket is represented by the exact maximum
+    if (seen >= rank)
+      return seen < hist->count ? bucket_value(i) : hist->max;
+  }
+  return hist->max;
+}
+
+void profile_print(FILE *out) {
+  fprintf(out, "%-9s %10s %12s %10s %10s %10s %10s\n", "phase", "count",
+          "total_us", "mean_us", "p50_us", "p99_us", "max_us");
+  for (int i = 0; i < PROFILE_NUM_PHASES; i++) {
+    const phase_hist_t *hist = &g_profile.phases[i];
+    double mean = hist->count ? (double)hist->total / hist->count : 0;
+    fprintf(out, "%-9s %10llu %12.3f %10.3f %10.3f %10.3f %10.3f\n",
+            g_phase_names[i], (unsigned long long)hist->count,
+            hist->total / 1000.0, mean / 1000.0,
+            profile_percentile(i, 50) / 1000.0,
+            profile_percentile(i, 99) / 1000.0, hist->max / 1000.0);
+  }
+}
+
+void profile_reset(void) {
+  memset(g_profile.phases, 0, sizeof(g_profile.phases));
+}
+
+void startup_profile_enable(void) {
+  // The process CPU clock starts at exec, so it covers the dynamic loader
+  // and libc setup that no probe inside main can see
+  struct timespec cpu;
+  clock_gettime(CLOCK_MONOTONIC, &g_startup.main_start);
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu) == 0)
+    g_startup.before_main =
+        (uint64_t)cpu.tv_sec * 1000000000 + (uint64_t)cpu.tv_nsec;
+  g_startup.enabled = true;
+}
+
+bool startup_profile_start(struct timespec *start) {
+  if (!g_startup.enabled)
+    return false;
+  clock_gettime(CLOCK_MONOTONIC, start);
+  return true;
+}
+
+void startup_profile_stop(startup_phase_t phase,
+                          const struct timespec *start) {
+  if (g_startup.timed[phase])
+    return;
+  g_startup.phases[phase] = elapsed_ns(start);
+  g_startup.timed[phase] = true;
+
+  if (g_startup.out)
+    fprintf(g_startup.out, "%-18s %10.3f  (first use)\n",
+            g_startup_names[phase], g_startup.phases[phase] / 1000.0);
+}
+
+void startup_profile_report(FILE *out) {
+  if (!g_startup.enabled || g_startup.out)
+    return;
+  g_startup.out = out;
+
+  uint64_t since_main = elapsed_ns(&g_startup.main_start);
+  uint64_t other = since_main;
+  fprintf(out, "%-18s %10s\n", "startup", "time_us");
+  fprintf(out, "%-18s %10.3f\n", "before main", g_startup.before_main / 1000.0);
+  for (int i = 0; i < STARTUP_NUM_PHASES; i++) {
+    if (!g_startup.timed[i]) {
+      fprintf(out, "%-18s %10s\n", g_startup_names[i], "not yet");
+      continue;
+    }
+    fprintf(out, "%-18s %10.3f\n", g_startup_names[i],
+            g_startup.phases[i] / 1000.0);
+    other -= g_startup.phases[i] < other ? g_startup.phases[i] : other;
+  }
+  fprintf(out, "%-18s %10.3f\n", "other", other / 1000.0);
+  fprintf(out, "%-18s %10.3f\n", "first prompt",
+          (g_startup.before_main + since_main) / 1000.0);
+  fflush(out);
+}
@@ -3,38 +3,63 @@
  * @brief Main shell implementation with process control and I/O redirection
  */
 
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // pipe2, memfd_create
 
 #include "shell.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+/**
+ * @brief Largest here-document fed through a pipe instead of a memfd
+ * (the default pipe capacity, so the write never blocks)
+ */
+#define HERE_DOC_PIPE_MAX (64 * 1024)
+
 static volatile sig_atomic_t g_interrupted = 0;
-static pid_t g_foreground_pgid = 0;
+static int g_last_status = 0;
+static int g_substitution_status = -1; // Last in this pipeline, -1 if none
+static bool g_line_editor = false;     // The REPL reads through lineedit_read
+
+/**
+ * @brief Process group a stage is launched into
+ *
+ * Without job control stages stay in the shell's group, which is then the
+ * one the terminal signals anyway.
+ */
+typedef struct {
+  bool own_group; /**< Job control: the stage goes into its job's group */
+  pid_t pgid;     /**< Group to join, or 0 to start one (the first stage) */
+  int terminal;   /**< Terminal to hand the group (foreground), or -1 */
+} stage_group_t;
 
 /**
  * @brief Signal handler for SIGINT (Ctrl+C)
+ *
+ * The kernel delivers Ctrl+C to the whole foreground group itself; the
+ * shell only notes that it happened.
  * @param sig Signal number
  */
 static void sigint_handler(int sig) {
   (void)sig;
   g_interrupted = 1;
-  if (g_foreground_pgid > 0) {
-    kill(-g_foreground_pgid, SIGINT);
-  }
 }
 
 /**
  * @brief Setup signal handlers for the shell
  */
 void setup_signal_handlers(void) {
+  struct timespec start;
+  bool profiled = startup_profile_start(&start);
+
   struct sigaction sa;
   sa.sa_handler = sigint_handler;
   sigemptyset(&sa.sa_mask);
@@ -44,83 +69,213 @@ void setup_signal_handlers(void) {
     perror("sigaction");
   }
 
-  // Ignore SIGTSTP (Ctrl+Z) for now
-  signal(SIGTSTP, SIG_IGN);
+  // Reap children as they exit
+  jobs_init();
+
+  if (profiled)
+    startup_profile_stop(STARTUP_SIGNALS, &start);
 }
 
 /**
- * @brief Setup input redirection for a command
- * @param input_file File path for input redirection
- * @return File descriptor, or -1 on error
+ * @brief Check whether a command's redirections replace a descriptor
+ * before anything copies it, so setting it up first would be wasted
+ * @param cmd Command structure
+ * @param fd Descriptor (STDIN_FILENO or STDOUT_FILENO for the pipe ends)
+ * @return true if the first redirection involving fd overwrites it
  */
-static int setup_input_redirection(const char *input_file) {
-  if (!input_file)
-    return -1;
-
-  int fd = open(input_file, O_RDONLY);
-  if (fd == -1) {
-    perror(input_file);
-    return -1;
+static bool redirs_replace(const command_t *cmd, int fd) {
+  for (size_t i = 0; i < cmd->num_redirs; i++) {
+    const redir_t *r = &cmd->redirs[i];
+    if (r->kind == REDIR_DUP && r->source == fd)
+      return false;
+    if (r->fd == fd)
+      return true;
   }
+  return false;
+}
 
-  if (dup2(fd, STDIN_FILENO) == -1) {
-    perror("dup2");
-    close(fd);
-    return -1;
-  }
+/**
+ * @brief Report a redirection that names a descriptor that is not open
+ */
+static void report_bad_fd(int fd) {
+  fprintf(stderr, "%d: %s\n", fd, strerror(EBADF));
+}
 
-  close(fd);
+/**
+ * @brief Apply a command's redirections in a forked child
+ *
+ * A file that opens straight into its slot (the slot was free) needs no
+ * dup2, and copying a descriptor onto itself is no work at all.
+ *
+ * @param cmd Command structure
+ * @return 0 on success, -1 on error (reported)
+ */
+static int apply_redirs(const command_t *cmd) {
+  for (size_t i = 0; i < cmd->num_redirs; i++) {
+    const redir_t *r = &cmd->redirs[i];
+    if (r->kind == REDIR_CLOSE) {
+      close(r->fd);
+    } else if (r->kind == REDIR_DUP) {
+      if (r->source != r->fd && dup2(r->source, r->fd) == -1) {
+        report_bad_fd(r->source);
+        return -1;
+      }
+    } else {
+      int fd = open(r->path, r->flags, 0644);
+      if (fd == -1) {
+        perror(r->path);
+        return -1;
+      }
+      if (fd != r->fd) {
+        int err = dup2(fd, r->fd);
+        close(fd);
+        if (err == -1) {
+          perror("dup2");
+          return -1;
+        }
+      }
+    }
+  }
   return 0;
 }
 
 /**
- * @brief Setup output redirection for a command
- * @param output_file File path for output redirection
- * @param append Whether to append or truncate
- * @return 0 on success, -1 on error
+ * @brief Check whether a command can be launched with posix_spawn
+ *
+ * Everything the fork path sets up in the child (pipe dup2s, file
+ * redirections, the process group and the terminal) maps onto spawn file
+ * actions and attributes. Builtins run inside the child instead of
+ * exec'ing, so they need the fork path, and so do resource limits and
+ * cgroup placement, which spawn has no attribute for.
+ *
+ * @param cmd Command structure
+ * @return true if spawn_command can express the command's setup
  */
-static int setup_output_redirection(const char *output_file, bool append) {
-  if (!output_file)
+static bool can_spawn(const command_t *cmd) {
+  return builtin_lookup(cmd->argv[0]) == NULL && !limits_active();
+}
+
+/**
+ * @brief Launch a command with posix_spawn instead of fork
+ *
+ * posix_spawn shares the parent's address space until the child execs, so
+ * its cost does not grow with the shell's memory footprint. File actions
+ * run in the same order as the fork path: pipe ends first, unless a
+ * redirection replaces them anyway, then the redirections in order.
+ *
+ * @param cmd Command structure
+ * @param path Resolved executable path for argv[0]
+ * @param input_fd Input file descriptor (for pipes)
+ * @param output_fd Output file descriptor (for pipes)
+ * @param is_first Whether this is the first command in pipeline
+ * @param is_last Whether this is the last command in pipeline
+ * @param group Process group to start the command in
+ * @return Process ID on success, -1 on error (errno set, nothing printed)
+ */
+static pid_t spawn_command(const command_t *cmd, const char *path,
+                           int input_fd, int output_fd, bool is_first,
+                           bool is_last, const stage_group_t *group) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  pid_t pid = -1;
+  int err;
+
+  if ((err = posix_spawn_file_actions_init(&actions)) != 0) {
+    errno = err;
     return -1;
+  }
+  if ((err = posix_spawnattr_init(&attr)) != 0) {
+    posix_spawn_file_actions_destroy(&actions);
+    errno = err;
+    return -1;
+  }
 
-  int flags = O_WRONLY | O_CREAT;
-  if (append) {
-    flags |= O_APPEND;
-  } else {
-    flags |= O_TRUNC;
+  // Join the job's process group with the stop signals the shell ignores
+  // back to their defaults. A foreground job's first stage takes the
+  // terminal before it execs (first, while stdin is still the terminal)
+  if (group->own_group) {
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGTSTP);
+    sigaddset(&stop_signals, SIGTTIN);
+    sigaddset(&stop_signals, SIGTTOU);
+    err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+                                              POSIX_SPAWN_SETSIGDEF);
+    if (err == 0)
+      err = posix_spawnattr_setpgroup(&attr, group->pgid);
+    if (err == 0)
+      err = posix_spawnattr_setsigdefault(&attr, &stop_signals);
+#if defined(__GLIBC__) &&                                                      \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+    if (err == 0 && group->terminal != -1 && group->pgid == 0)
+      err = posix_spawn_file_actions_addtcsetpgrp_np(&actions, group->terminal);
+#endif
+    if (err != 0)
+      goto out;
   }
 
-  int fd = open(output_file, flags, 0644);
-  if (fd == -1) {
-    perror(output_file);
-    return -1;
+  // Setup pipe or here-document input; the descriptors themselves are
+  // close-on-exec, so no close actions are needed
+  if ((!is_first || cmd->here_doc) && input_fd != -1 &&
+      !redirs_replace(cmd, STDIN_FILENO)) {
+    err = posix_spawn_file_actions_adddup2(&actions, input_fd, STDIN_FILENO);
+    if (err != 0)
+      goto out;
   }
 
-  if (dup2(fd, STDOUT_FILENO) == -1) {
-    perror("dup2");
-    close(fd);
-    return -1;
+  // Setup pipe output (if not last command)
+  if (!is_last && output_fd != -1 && !redirs_replace(cmd, STDOUT_FILENO)) {
+    err = posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+    if (err != 0)
+      goto out;
   }
 
-  close(fd);
-  return 0;
+  // Redirections; addopen opens straight into the target slot
+  for (size_t i = 0; i < cmd->num_redirs && err == 0; i++) {
+    const redir_t *r = &cmd->redirs[i];
+    if (r->kind == REDIR_OPEN)
+      err = posix_spawn_file_actions_addopen(&actions, r->fd, r->path,
+                                             r->flags, 0644);
+    else if (r->kind == REDIR_CLOSE)
+      err = posix_spawn_file_actions_addclose(&actions, r->fd);
+    else if (r->source != r->fd)
+      err = posix_spawn_file_actions_adddup2(&actions, r->source, r->fd);
+  }
+  if (err != 0)
+    goto out;
+
+  err = posix_spawn(&pid, path, &actions, &attr, cmd->argv, vars_envp());
+  if (err != 0)
+    pid = -1;
+
+out:
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  if (err != 0)
+    errno = err;
+  return pid;
 }
 
 /**
- * @brief Execute a single command with redirection
+ * @brief Launch a command by forking and setting it up in the child
+ *
+ * This is the general path for stages spawn_command cannot express. It is
+ * also used to report errors, since it can tell apart a failed redirection
+ * from a missing command and exits with the matching status.
+ *
  * @param cmd Command structure
+ * @param path Resolved executable path, or NULL to search PATH in the child
  * @param input_fd Input file descriptor (for pipes)
  * @param output_fd Output file descriptor (for pipes)
  * @param is_first Whether this is the first command in pipeline
  * @param is_last Whether this is the last command in pipeline
+ * @param group Process group to start the command in
  * @return Process ID on success, -1 on error
  */
-static pid_t execute_command(const command_t *cmd, int input_fd, int output_fd,
-                             bool is_first, bool is_last) {
-  if (!cmd || !cmd->argv || !cmd->argv[0])
-    return -1;
-
-  pid_t pid = fork();
+static pid_t fork_command(const command_t *cmd, const char *path, int input_fd,
+                          int output_fd, bool is_first, bool is_last,
+                          const stage_group_t *group) {
+  pid_t pid = limits_fork();
   if (pid == -1) {
     perror("fork");
     return -1;
@@ -128,14 +283,25 @@ static pid_t execute_command(const command_t *cmd, int input_fd, int output_fd,
 
   if (pid == 0) {
     // Child process
-    // Set process group for signal handling
-    if (!cmd->background) {
-      setpgid(0, 0);
+    // Join the job's group (the parent does the same, whoever is first) and
+    // take the terminal while the stop signals are still ignored
+    if (group->own_group) {
+      setpgid(0, group->pgid);
+      if (group->terminal != -1)
+        tcsetpgrp(group->terminal, getpgrp());
+      signal(SIGTSTP, SIG_DFL);
+      signal(SIGTTIN, SIG_DFL);
+      signal(SIGTTOU, SIG_DFL);
     }
 
-    // Setup pipe input (if not first command)
-    if (!is_first && input_fd != -1) {
-      if (dup2(input_fd, STDIN_FILENO) == -1) {
+    // Resource limits (and the cgroup, if clone3 could not start us there)
+    if (limits_apply() == -1)
+      exit(1);
+
+    // Setup pipe or here-document input
+    if ((!is_first || cmd->here_doc) && input_fd != -1) {
+      if (!redirs_replace(cmd, STDIN_FILENO) &&
+          dup2(input_fd, STDIN_FILENO) == -1) {
         perror("dup2 input");
         exit(1);
       }
@@ -144,29 +310,26 @@ static pid_t execute_command(const command_t *cmd, int input_fd, int output_fd,
 
     // Setup pipe output (if not last command)
     if (!is_last && output_fd != -1) {
-      if (dup2(output_fd, STDOUT_FILENO) == -1) {
+      if (!redirs_replace(cmd, STDOUT_FILENO) &&
+          dup2(output_fd, STDOUT_FILENO) == -1) {
         perror("dup2 output");
         exit(1);
       }
       close(output_fd);
     }
 
-    // Setup input redirection (overrides pipe input)
-    if (cmd->input_file) {
-      if (setup_input_redirection(cmd->input_file) == -1) {
-        exit(1);
-      }
-    }
+    // Redirections, in order, over the pipe ends
+    if (apply_redirs(cmd) == -1)
+      exit(1);
 
-    // Setup output redirection (overrides pipe output)
-    if (cmd->output_file) {
-      if (setup_output_redirection(cmd->output_file, cmd->append_output) ==
-          -1) {
-        exit(1);
-      }
-    }
+    // Builtins in a pipeline stage run in the forked child
+    const builtin_t *builtin = builtin_lookup(cmd->argv[0]);
+    if (builtin)
+      exit(builtin->fn(cmd->argv));
 
-    // Execute command
+    // Execute command, searching PATH again if the cached entry went stale
+    if (path)
+      execv(path, cmd->argv);
     execvp(cmd->argv[0], cmd->argv);
     perror(cmd->argv[0]);
     exit(127); // Command not found
@@ -177,100 +340,705 @@ static pid_t execute_command(const command_t *cmd, int input_fd, int output_fd,
 }
 
 /**
- * @brief Execute a pipeline of commands
- * @param pipeline Pipeline structure to execute
- * @return Exit status of the last command in pipeline
+ * @brief Execute a single command with redirection
+ * @param cmd Command structure
+ * @param input_fd Input file descriptor (for pipes)
+ * @param output_fd Output file descriptor (for pipes)
+ * @param is_first Whether this is the first command in pipeline
+ * @param is_last Whether this is the last command in pipeline
+ * @param group Process group to start the command in
+ * @return Process ID on success, -1 on error
  */
-int execute_pipeline(pipeline_t *pipeline) {
-  if (!pipeline || pipeline->num_commands == 0)
-    return 0;
+static pid_t execute_command(const command_t *cmd, int input_fd, int output_fd,
+                             bool is_first, bool is_last,
+                             const stage_group_t *group) {
+  if (!cmd || !cmd->argv || !cmd->argv[0])
+    return -1;
 
-  size_t num_cmds = pipeline->num_commands;
-  pid_t *pids = calloc(num_cmds, sizeof(pid_t));
-  int(*pipe_fds)[2] = calloc(num_cmds - 1, sizeof(int[2]));
+  // Fast path: no page-table copy, the child execs straight away
+  const char *path = NULL;
+  if (can_spawn(cmd) && (path = path_cache_lookup(cmd->argv[0]))) {
+    pid_t pid = spawn_command(cmd, path, input_fd, output_fd, is_first,
+                              is_last, group);
 
-  if (!pids || (!pipe_fds && num_cmds > 1)) {
-    free(pids);
-    free(pipe_fds);
+    // A cached binary that disappeared: search PATH again and retry once.
+    // A redirection to a missing file fails with ENOENT as well, and then
+    // the entry is still good
+    if (pid == -1 && errno == ENOENT && path != cmd->argv[0] &&
+        access(path, X_OK) == -1) {
+      path_cache_forget(cmd->argv[0]);
+      path = path_cache_lookup(cmd->argv[0]);
+      if (path)
+        pid = spawn_command(cmd, path, input_fd, output_fd, is_first, is_last,
+                            group);
+    }
+
+    if (pid != -1)
+      return pid;
+    // Fall through to fork, which reports the failure the usual way
+  }
+
+  return fork_command(cmd, path, input_fd, output_fd, is_first, is_last,
+                      group);
+}
+
+/**
+ * @brief Redirections saved in place before a builtin needs the heap
+ */
+#define SAVED_FDS_INLINE 8
+
+/**
+ * @brief A descriptor the shell replaced to run a builtin
+ */
+typedef struct {
+  int fd;   /**< Descriptor replaced */
+  int copy; /**< Close-on-exec copy of its old file, or -1 if it was closed */
+} saved_fd_t;
+
+/**
+ * @brief Save a descriptor's current file (once) before replacing it
+ * @param fd Descriptor about to be replaced or closed
+ * @param saved Saved descriptors so far
+ * @param num_saved In/out number of saved descriptors
+ * @return 0 on success, -1 on error
+ */
+static int save_fd(int fd, saved_fd_t *saved, size_t *num_saved) {
+  for (size_t i = 0; i < *num_saved; i++) {
+    if (saved[i].fd == fd)
+      return 0;
+  }
+
+  int copy = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+  if (copy == -1 && errno != EBADF) {
+    perror("fcntl");
+    return -1;
+  }
+  saved[(*num_saved)++] = (saved_fd_t){fd, copy};
+  return 0;
+}
+
+/**
+ * @brief Move source onto fd, saving fd's current file first
+ * @return 0 on success, -1 on error
+ */
+static int redirect_saving(int source, int fd, saved_fd_t *saved,
+                           size_t *num_saved) {
+  if (save_fd(fd, saved, num_saved) == -1)
+    return -1;
+  if (dup2(source, fd) == -1) {
+    report_bad_fd(source);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Run a builtin in the shell process with its redirections applied
+ *
+ * Only descriptors the stage actually redirects are saved and replaced,
+ * and they are restored, last change first, before returning.
+ *
+ * @param builtin Builtin to run
+ * @param cmd Command structure
+ * @param input_fd Pipe read end feeding the stage, or -1
+ * @return Exit status of the builtin
+ */
+static int run_builtin(const builtin_t *builtin, const command_t *cmd,
+                       int input_fd) {
+  // Each redirection replaces at most one descriptor, the pipe one more
+  saved_fd_t inline_saved[SAVED_FDS_INLINE];
+  saved_fd_t *saved = inline_saved;
+  size_t num_saved = 0;
+  int status = 1;
+
+  if (cmd->num_redirs + 1 > SAVED_FDS_INLINE &&
+      !(saved = malloc((cmd->num_redirs + 1) * sizeof(saved_fd_t)))) {
+    perror("malloc");
     return 1;
   }
 
-  // Create pipes for multi-command pipelines
-  for (size_t i = 0; i < num_cmds - 1; i++) {
-    if (pipe(pipe_fds[i]) == -1) {
-      perror("pipe");
-      free(pids);
-      free(pipe_fds);
-      return 1;
+  fflush(stdout);
+
+  if (input_fd != -1 && !redirs_replace(cmd, STDIN_FILENO) &&
+      redirect_saving(input_fd, STDIN_FILENO, saved, &num_saved) == -1)
+    goto restore;
+
+  for (size_t i = 0; i < cmd->num_redirs; i++) {
+    const redir_t *r = &cmd->redirs[i];
+    if (r->kind == REDIR_DUP) {
+      if (r->source != r->fd &&
+          redirect_saving(r->source, r->fd, saved, &num_saved) == -1)
+        goto restore;
+      continue;
+    }
+
+    if (save_fd(r->fd, saved, &num_saved) == -1)
+      goto restore;
+    if (r->kind == REDIR_CLOSE) {
+      close(r->fd);
+      continue;
+    }
+    int fd = open(r->path, r->flags | O_CLOEXEC, 0644);
+    if (fd == -1) {
+      perror(r->path);
+      goto restore;
+    }
+    if (fd != r->fd) {
+      int err = dup2(fd, r->fd);
+      close(fd);
+      if (err == -1) {
+        perror("dup2");
+        goto restore;
+      }
+    }
+  }
+
+  status = builtin->fn(cmd->argv);
+
+restore:
+  fflush(stdout);
+  for (size_t i = num_saved; i-- > 0;) {
+    if (saved[i].copy == -1) {
+      close(saved[i].fd);
+    } else {
+      dup2(saved[i].copy, saved[i].fd);
+      close(saved[i].copy);
+    }
+  }
+  if (saved != inline_saved)
+    free(saved);
+  return status;
+}
+
+/**
+ * @brief Run a stage accepted by mover_handles inside the shell
+ *
+ * The stage's own file redirections override the pipe ends, as they would
+ * in a child.
+ *
+ * @param cmd Command structure
+ * @param input_fd Pipe read end feeding the stage, or -1 for stdin
+ * @param output_fd Pipe write end the stage feeds, or -1 for stdout
+ * @return Exit status of the stage
+ */
+static int run_mover(const command_t *cmd, int input_fd, int output_fd) {
+  int in_file = -1;
+  int out_file = -1;
+  int status = 1;
+
+  // mover_handles only lets files opened onto stdin and stdout through;
+  // each is still opened (and created), though only the last one counts
+  for (size_t i = 0; i < cmd->num_redirs; i++) {
+    const redir_t *r = &cmd->redirs[i];
+    int fd = open(r->path, r->flags | O_CLOEXEC, 0644);
+    if (fd == -1) {
+      perror(r->path);
+      goto out;
+    }
+    int *slot = r->fd == STDIN_FILENO ? &in_file : &out_file;
+    if (*slot != -1)
+      close(*slot);
+    *slot = fd;
+  }
+
+  fflush(stdout);
+  status = mover_run(cmd,
+                     in_file != -1    ? in_file
+                     : input_fd != -1 ? input_fd
+                                      : STDIN_FILENO,
+                     out_file != -1    ? out_file
+                     : output_fd != -1 ? output_fd
+                                       : STDOUT_FILENO);
+
+out:
+  if (in_file != -1)
+    close(in_file);
+  if (out_file != -1)
+    close(out_file);
+  return status;
+}
+
+/**
+ * @brief Put a here-document's body behind a descriptor for stdin
+ *
+ * Bodies that fit into a pipe are written into one and read back by the
+ * command; larger ones go into an anonymous memory file, so nothing ever
+ * touches the file system and the writer never has to run alongside the
+ * reader.
+ *
+ * @param doc Here-document or here-string
+ * @return Read descriptor (close-on-exec) positioned at the start, or -1
+ */
+static int open_here_doc(const here_doc_t *doc) {
+  int fds[2];
+  if (doc->len <= HERE_DOC_PIPE_MAX &&
+      pipe2(fds, O_CLOEXEC | O_NONBLOCK) == 0) {
+    // A pipe that is smaller than usual (pipe-user-pages-soft) falls back
+    ssize_t n = doc->len ? write(fds[1], doc->body, doc->len) : 0;
+    close(fds[1]);
+    if (n == (ssize_t)doc->len && fcntl(fds[0], F_SETFL, 0) == 0)
+      return fds[0];
+    close(fds[0]);
+  }
+
+  int fd = memfd_create("here-document", MFD_CLOEXEC);
+  if (fd == -1) {
+    perror("memfd_create");
+    return -1;
+  }
+  for (size_t done = 0; done < doc->len;) {
+    ssize_t n = write(fd, doc->body + done, doc->len - done);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1) {
+      perror("here-document");
+      close(fd);
+      return -1;
     }
+    done += (size_t)n;
   }
+  lseek(fd, 0, SEEK_SET);
+  return fd;
+}
 
-  // Execute commands
+/**
+ * @brief Reap children that never made it into the job table
+ * @param pids Process IDs
+ * @param count Number of processes
+ */
+static void reap_untracked(const pid_t *pids, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    while (wait4(pids[i], NULL, 0, NULL) == -1 && errno == EINTR)
+      ;
+  }
+}
+
+/**
+ * @brief Turn two getrusage snapshots of the shell into the usage of what
+ * ran in between (max RSS stays absolute)
+ * @param before Usage before the in-process stage
+ * @param after Usage after it; overwritten with the difference
+ */
+static void rusage_since(const struct rusage *before, struct rusage *after) {
+  long long user =
+      ((long long)after->ru_utime.tv_sec - before->ru_utime.tv_sec) *
+          1000000 +
+      (after->ru_utime.tv_usec - before->ru_utime.tv_usec);
+  long long sys =
+      ((long long)after->ru_stime.tv_sec - before->ru_stime.tv_sec) *
+          1000000 +
+      (after->ru_stime.tv_usec - before->ru_stime.tv_usec);
+
+  after->ru_utime.tv_sec = (time_t)(user / 1000000);
+  after->ru_utime.tv_usec = (suseconds_t)(user % 1000000);
+  after->ru_stime.tv_sec = (time_t)(sys / 1000000);
+  after->ru_stime.tv_usec = (suseconds_t)(sys % 1000000);
+  after->ru_nvcsw -= before->ru_nvcsw;
+  after->ru_nivcsw -= before->ru_nivcsw;
+}
+
+/**
+ * @brief Run a pipeline whose words are final
+ * @param pipeline Pipeline to run
+ * @return Exit status of the last command in pipeline
+ */
+static int run_pipeline(const pipeline_t *pipeline) {
+  size_t num_cmds = pipeline->num_commands;
+  const command_t *last = &pipeline->commands[num_cmds - 1];
+  bool background = last->background;
+
+  // At most one foreground stage runs in the shell itself. A builtin in the
+  // last stage does, so cd and friends affect the shell; otherwise the
+  // first plain cat or tee stage is done by moving the data directly. With
+  // job control that is only done for a lone stage: next to processes
+  // that Ctrl+Z can stop, the shell could block forever on their pipes.
+  // Under resource limits every stage gets a process that carries them
+  int terminal = jobs_terminal();
+  const builtin_t *last_builtin = NULL;
+  size_t inline_stage = num_cmds;
+  if (!background && last->argv)
+    last_builtin = builtin_lookup(last->argv[0]);
+  if (last_builtin) {
+    inline_stage = num_cmds - 1;
+  } else if (!background && (terminal == -1 || num_cmds == 1) &&
+             !limits_active()) {
+    for (size_t i = 0; i < num_cmds && inline_stage == num_cmds; i++) {
+      const command_t *cmd = &pipeline->commands[i];
+      if (mover_handles(cmd, i > 0 || cmd->here_doc))
+        inline_stage = i;
+    }
+  }
+  bool has_inline = inline_stage < num_cmds;
+  size_t num_procs = has_inline ? num_cmds - 1 : num_cmds;
+
+  // Launch timestamps are only kept when something will report them
+  bool want_stats = !background && stats_wanted(pipeline);
+  pipeline_run_t run = {.inline_stage = inline_stage};
+  struct timespec *times = NULL;
+
+  pid_t *pids = NULL;
+  if (num_procs > 0)
+    pids = calloc(num_procs, sizeof(pid_t));
+  if (want_stats)
+    times = calloc(2 * num_cmds, sizeof(struct timespec));
+  if ((num_procs > 0 && !pids) || (want_stats && !times)) {
+    free(pids);
+    free(times);
+    return 1;
+  }
+  if (want_stats)
+    clock_gettime(CLOCK_MONOTONIC, &run.start);
+
+  // With job control all stages share the first one's group, and a
+  // foreground job gets the terminal
+  stage_group_t group = {terminal != -1, 0, background ? -1 : terminal};
+
+  // Builtin output still sitting in stdio must come out before anything the
+  // children write, and must not be duplicated into forked children
+  if (num_procs > 0)
+    fflush(stdout);
+
+  // Each pipe is created close-on-exec right before the stage that writes
+  // to it, so every child ends up holding just its own stdin and stdout
+  // ends and a reader sees EOF as soon as its writer exits. The in-process
+  // stage's ends stay open in the shell until it has run.
+  int inline_in = -1;
+  int inline_out = -1;
+  int prev_read = -1;
+  size_t launched = 0;
   for (size_t i = 0; i < num_cmds; i++) {
-    int input_fd = (i > 0) ? pipe_fds[i - 1][0] : -1;
-    int output_fd = (i < num_cmds - 1) ? pipe_fds[i][1] : -1;
+    int input_fd = prev_read;
+    int output_fd = -1;
+    prev_read = -1;
 
-    bool is_first = (i == 0);
-    bool is_last = (i == num_cmds - 1);
+    // A here-document replaces the pipe from the previous stage
+    if (pipeline->commands[i].here_doc) {
+      if (input_fd != -1)
+        close(input_fd);
+      input_fd = open_here_doc(pipeline->commands[i].here_doc);
+      if (input_fd == -1)
+        goto fail;
+    }
 
-    pid_t pid = execute_command(&pipeline->commands[i], input_fd, output_fd,
-                                is_first, is_last);
-    if (pid == -1) {
-      // Cleanup on error
-      for (size_t j = 0; j < i; j++) {
-        waitpid(pids[j], NULL, 0);
+    if (i < num_cmds - 1) {
+      int fds[2];
+      if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        if (input_fd != -1)
+          close(input_fd);
+        goto fail;
       }
-      free(pids);
-      free(pipe_fds);
-      return 1;
+      pipe_size_apply(fds[1]);
+      output_fd = fds[1];
+      prev_read = fds[0];
+    }
+
+    if (i == inline_stage) {
+      inline_in = input_fd;
+      inline_out = output_fd;
+      continue;
     }
 
-    pids[i] = pid;
+    bool is_first = (i == 0);
+    bool is_last = (i == num_cmds - 1);
+
+    struct timespec spawn_start;
+    bool profiled = profile_start(&spawn_start);
+    if (want_stats)
+      clock_gettime(CLOCK_MONOTONIC, &times[2 * launched]);
+    pid_t pid = execute_command(&pipeline->commands[i], input_fd, output_fd,
+                                is_first, is_last, &group);
+    if (want_stats)
+      clock_gettime(CLOCK_MONOTONIC, &times[2 * launched + 1]);
+    if (profiled)
+      profile_stop(PROFILE_SPAWN, &spawn_start);
 
-    // Close pipe file descriptors in parent
+    // The child has its own copies now
     if (input_fd != -1)
       close(input_fd);
     if (output_fd != -1)
       close(output_fd);
 
-    // Set foreground process group for signal handling
-    if (!pipeline->commands[i].background && is_first) {
-      g_foreground_pgid = pid;
-      setpgid(pid, pid);
+    if (pid == -1) {
+      if (prev_read != -1)
+        close(prev_read);
+      goto fail;
+    }
+
+    pids[launched++] = pid;
+
+    // Also from this side, so the next stage can join at once; then hand
+    // over the terminal before anything reads from it
+    if (group.own_group) {
+      if (launched == 1)
+        group.pgid = pid;
+      setpgid(pid, group.pgid);
+      if (launched == 1 && group.terminal != -1)
+        tcsetpgrp(group.terminal, group.pgid);
     }
   }
 
-  // Wait for all processes
+  // Track the processes so they get reaped even if nobody waits for them.
+  // A lone in-process stage has nothing to track, and only needs a job
+  // for its description when the run is reported
   int exit_status = 0;
-  bool background = pipeline->commands[num_cmds - 1].background;
-
-  if (!background) {
-    // Wait for all processes in foreground
-    for (size_t i = 0; i < num_cmds; i++) {
-      int status;
-      if (waitpid(pids[i], &status, 0) == -1) {
-        if (errno != ECHILD) {
-          perror("waitpid");
-        }
-      } else if (i == num_cmds - 1) {
-        // Get exit status from last command
-        if (WIFEXITED(status)) {
-          exit_status = WEXITSTATUS(status);
-        } else if (WIFSIGNALED(status)) {
-          exit_status = 128 + WTERMSIG(status);
-        }
+  bool track = num_procs > 0 || want_stats;
+  job_t *job = track ? jobs_add(pipeline, pids, num_procs, background) : NULL;
+  if (track && !job) {
+    fprintf(stderr, "jobs: out of memory\n");
+    reap_untracked(pids, num_procs);
+    exit_status = 1;
+  } else if (want_stats) {
+    for (size_t i = 0; i < num_procs; i++) {
+      job->procs[i].spawned = times[2 * i];
+      job->procs[i].launched = times[2 * i + 1];
+    }
+  }
+
+  if (has_inline) {
+    const command_t *cmd = &pipeline->commands[inline_stage];
+    struct rusage before;
+    if (want_stats) {
+      clock_gettime(CLOCK_MONOTONIC, &run.inline_start);
+      getrusage(RUSAGE_SELF, &before);
+    }
+    int status = last_builtin ? run_builtin(last_builtin, cmd, inline_in)
+                              : run_mover(cmd, inline_in, inline_out);
+    if (want_stats) {
+      clock_gettime(CLOCK_MONOTONIC, &run.inline_end);
+      getrusage(RUSAGE_SELF, &run.inline_usage);
+      rusage_since(&before, &run.inline_usage);
+      run.inline_status = status;
+    }
+    if (inline_in != -1)
+      close(inline_in);
+    if (inline_out != -1)
+      close(inline_out);
+    if (inline_stage == num_cmds - 1)
+      exit_status = status;
+  }
+
+  if (job && !background) {
+    // Wait for all processes in foreground, in whatever order they exit
+    struct timespec wait_start;
+    bool profiled = profile_start(&wait_start);
+    int status = jobs_foreground(job, false);
+    if (profiled)
+      profile_stop(PROFILE_WAIT, &wait_start);
+    if (inline_stage != num_cmds - 1 || jobs_is_stopped(job))
+      exit_status = status;
+
+    // Ctrl+C went to the job, not the shell; it still ends the list
+    for (size_t i = 0; i < job->num_procs; i++) {
+      int raw = job->procs[i].status;
+      if (job->procs[i].done && WIFSIGNALED(raw) && WTERMSIG(raw) == SIGINT)
+        g_interrupted = 1;
+    }
+
+    // A stopped job stays in the table for fg and bg
+    if (!jobs_is_stopped(job)) {
+      pipe_size_observe(job);
+      if (want_stats) {
+        clock_gettime(CLOCK_MONOTONIC, &run.end);
+        stats_report(pipeline, job, &run, exit_status);
       }
+      jobs_remove(job);
     }
-    g_foreground_pgid = 0;
-  } else {
-    // Background execution - don't wait, just print PID
-    printf("[%d]\n", (int)pids[num_cmds - 1]);
-    g_foreground_pgid = 0;
+  } else if (job) {
+    // Background execution - don't wait, the reaper collects it later
+    printf("[%d] %d\n", job->id, (int)pids[num_procs - 1]);
   }
 
   free(pids);
-  free(pipe_fds);
+  free(times);
   return exit_status;
+
+fail:
+  // Stages already running see EOF or EPIPE once the shell lets go
+  if (inline_in != -1)
+    close(inline_in);
+  if (inline_out != -1)
+    close(inline_out);
+  reap_untracked(pids, launched);
+  if (group.pgid > 0 && group.terminal != -1)
+    tcsetpgrp(group.terminal, getpgrp());
+  free(pids);
+  free(times);
+  return 1;
+}
+
+/**
+ * @brief Execute a pipeline of commands
+ * @param pipeline Pipeline structure to execute
+ * @return Exit status of the last command in pipeline
+ */
+int execute_pipeline(const pipeline_t *pipeline) {
+  if (!pipeline || pipeline->num_commands == 0)
+    return 0;
+  g_substitution_status = -1;
+  if (!pipeline->expand)
+    return run_pipeline(pipeline);
+
+  pipeline_t expanded;
+  int result = expand_pipeline(pipeline, &expanded);
+  if (result != 0) {
+    if (result == -1)
+      perror("expansion");
+    return 1;
+  }
+
+  // Ctrl+C during a command substitution abandons the command
+  if (g_interrupted) {
+    free_pipeline(&expanded);
+    return 130;
+  }
+  int status = run_pipeline(&expanded);
+  free_pipeline(&expanded);
+  return status;
+}
+
+int execute_list(const pipeline_t *list) {
+  int status = g_last_status;
+  list_op_t op = LIST_SEQ;
+
+  for (const pipeline_t *p = list; p; op = p->next_op, p = p->next) {
+    if ((op == LIST_AND && status != 0) || (op == LIST_OR && status == 0))
+      continue;
+
+    // Directory listings are only reused within one pipeline
+    glob_cache_clear();
+    status = execute_pipeline(p);
+    g_last_status = status;
+
+    if (g_interrupted || builtin_exit_requested(NULL))
+      break;
+  }
+  return status;
+}
+
+int shell_last_status(void) { return g_last_status; }
+
+bool shell_interrupted(void) { return g_interrupted != 0; }
+
+/**
+ * @brief Where the lines after a command line come from
+ */
+typedef struct {
+  input_t *input;   /**< Reader, or NULL for text held in memory */
+  const char *text; /**< Next unread byte of the text */
+  const char *end;  /**< End of the text */
+  bool prompt;      /**< Print a continuation prompt before each read */
+} line_source_t;
+
+/**
+ * @brief Get the next line from a source
+ * @return 1 if a line was read, 0 at end of input, -1 on error
+ */
+static int source_next_line(line_source_t *src, const char **line,
+                            size_t *len) {
+  if (src->input) {
+    if (src->prompt && g_line_editor) {
+      char *read;
+      int got = lineedit_read("> ", &read, len);
+      *line = read;
+      return got;
+    }
+    if (src->prompt) {
+      printf("> ");
+      fflush(stdout);
+    }
+    char *read;
+    int got = input_read_line(src->input, &read, len);
+    *line = read;
+    return got;
+  }
+
+  if (src->text >= src->end)
+    return 0;
+  const char *nl = memchr(src->text, '\n', (size_t)(src->end - src->text));
+  *line = src->text;
+  *len = nl ? (size_t)(nl - src->text) : (size_t)(src->end - src->text);
+  src->text = nl ? nl + 1 : src->end;
+  return 1;
+}
+
+/**
+ * @brief Parse a command line together with its here-document bodies
+ *
+ * The command line is parsed on its own first. Only when that leaves
+ * here-documents waiting for their delimiters are the following lines
+ * collected and the whole text parsed again. Text in memory is contiguous
+ * already and is parsed as one span; lines from a reader are joined in a
+ * buffer, since each read replaces the previous line.
+ *
+ * @param line Command line (not NUL-terminated)
+ * @param len Length of the command line
+ * @param src Source of the lines that follow
+ * @param pipeline Output pipeline, released with parse_cache_release
+ * @param lines Output number of lines read after the command line
+ * @return 0 on success, -1 on parse or allocation failure
+ */
+static int parse_with_here_docs(const char *line, size_t len,
+                                line_source_t *src,
+                                const pipeline_t **pipeline, size_t *lines) {
+  *lines = 0;
+  if (parse_cache_parse(line, len, pipeline) == -1)
+    return -1;
+  if (!(*pipeline)->unterminated)
+    return 0;
+
+  // Lines from a reader are only valid until the next read
+  char *joined = NULL;
+  size_t joined_cap = 0;
+  if (src->input) {
+    joined_cap = len + 256;
+    if (!(joined = malloc(joined_cap))) {
+      perror("here-document");
+      parse_cache_release(*pipeline);
+      return -1;
+    }
+    memcpy(joined, line, len);
+    line = joined;
+  }
+
+  // Every document of a single line still waits for its delimiter
+  const here_doc_t *waiting = (*pipeline)->here_docs;
+  const char *next;
+  size_t next_len;
+  while (waiting && source_next_line(src, &next, &next_len) == 1) {
+    (*lines)++;
+    parse_here_doc_line(&waiting, next, next_len);
+    if (!src->input) {
+      len = (size_t)(next + next_len - line);
+      continue;
+    }
+
+    if (len + 1 + next_len >= joined_cap) {
+      size_t cap = (len + 1 + next_len) * 2;
+      char *grown = realloc(joined, cap);
+      if (!grown) {
+        perror("here-document");
+        free(joined);
+        parse_cache_release(*pipeline);
+        return -1;
+      }
+      joined = grown;
+      joined_cap = cap;
+      line = joined;
+    }
+    joined[len++] = '\n';
+    memcpy(joined + len, next, next_len);
+    len += next_len;
+  }
+  if (waiting)
+    fprintf(stderr, "warning: here-document delimited by end-of-file "
+                    "(wanted '%s')\n",
+            waiting->delimiter);
+
+  parse_cache_release(*pipeline);
+  int result = parse_cache_parse(line, len, pipeline);
+  free(joined);
+  return result;
 }
 
 /**
@@ -278,60 +1046,81 @@ int execute_pipeline(pipeline_t *pipeline) {
  * @return Exit status
  */
 int shell_main(void) {
-  char line[MAX_LINE_LEN];
+  input_t input;
   int exit_status = 0;
 
   setup_signal_handlers();
+  input_init(&input, STDIN_FILENO);
+
+  // History, completion and the PATH cache all start on first use, so
+  // nothing here scales with their size
+  bool interactive = isatty(STDIN_FILENO);
+  history_open_lazily(interactive);
+  struct timespec start;
+  bool profiled = startup_profile_start(&start);
+  if (interactive)
+    jobs_control_init(STDIN_FILENO);
+  g_line_editor =
+      interactive && lineedit_init(STDIN_FILENO, STDOUT_FILENO) == 0;
+  if (profiled)
+    startup_profile_stop(STARTUP_TERMINAL, &start);
+  startup_profile_report(stderr);
 
   while (1) {
     // Reset interrupt flag
     g_interrupted = 0;
 
-    // Print prompt
-    printf("shell> ");
-    fflush(stdout);
+    // Collect finished background jobs (free when nothing has exited)
+    jobs_reap();
+    jobs_notify();
 
-    // Read command line
-    if (!fgets(line, sizeof(line), stdin)) {
-      if (feof(stdin)) {
-        printf("\n");
-        break; // EOF (Ctrl+D)
-      }
-      if (ferror(stdin)) {
-        perror("fgets");
-        break;
-      }
+    // Read command line; it lives in the reader's (or editor's) buffer
+    // until the next read
+    char *line;
+    size_t len;
+    int got;
+    if (g_line_editor) {
+      fflush(stdout);
+      got = lineedit_read("shell> ", &line, &len);
+    } else {
+      printf("shell> ");
+      fflush(stdout);
+      got = input_read_line(&input, &line, &len);
     }
-
-    // Remove newline
-    size_t len = strlen(line);
-    if (len > 0 && line[len - 1] == '\n') {
-      line[len - 1] = '\0';
+    if (got == 0) {
+      printf("\n");
+      break; // EOF (Ctrl+D)
+    }
+    if (got == -1) {
+      perror("read");
+      break;
     }
 
     // Skip empty lines
-    if (strlen(line) == 0)
+    if (len == 0)
       continue;
+    history_add(line, len);
 
-    // Handle built-in commands
-    if (strcmp(line, "exit") == 0) {
-      break;
-    }
-
-    // Parse command
-    pipeline_t pipeline;
-    if (parse_command(line, &pipeline) == -1) {
+    // Parse command, or reuse the pipeline of an identical earlier line
+    const pipeline_t *pipeline;
+    line_source_t rest = {&input, NULL, NULL, true};
+    size_t body_lines;
+    if (parse_with_here_docs(line, len, &rest, &pipeline, &body_lines) == -1) {
       fprintf(stderr, "Parse error\n");
       continue;
     }
 
-    if (pipeline.num_commands == 0) {
+    if (pipeline->num_commands == 0) {
       continue;
     }
 
-    // Execute pipeline
-    exit_status = execute_pipeline(&pipeline);
-    free_pipeline(&pipeline);
+    // Execute the line's pipelines
+    exit_status = execute_list(pipeline);
+    parse_cache_release(pipeline);
+
+    // The exit builtin ran in the shell process
+    if (builtin_exit_requested(&exit_status))
+      break;
 
     // Check for interrupt
     if (g_interrupted) {
@@ -339,10 +1128,186 @@ int shell_main(void) {
     }
   }
 
+  if (g_line_editor)
+    lineedit_free();
+  jobs_control_end();
+  history_close();
+  input_free(&input);
   return exit_status;
 }
 
 /**
- * @brief Main entry point
+ * @brief Parse and run one line of a script
+ * @param line Start of the line (not NUL-terminated)
+ * @param len Length of the line
+ * @param rest Source of the lines after it, for here-document bodies
+ * @param name Script name for error messages
+ * @param lineno In/out number of the last line read, for error messages
+ * @return true if the script should stop (exit builtin)
  */
-int main(void) { return shell_main(); }
+static bool run_script_line(const char *line, size_t len,
+                            line_source_t *rest, const char *name,
+                            size_t *lineno) {
+  g_interrupted = 0;
+  jobs_reap();
+
+  const pipeline_t *pipeline;
+  size_t first = ++*lineno, body_lines;
+  int parsed = parse_with_here_docs(line, len, rest, &pipeline, &body_lines);
+  *lineno += body_lines;
+  if (parsed == -1) {
+    fprintf(stderr, "%s: line %zu: parse error\n", name, first);
+    g_last_status = 2;
+    return false;
+  }
+
+  if (pipeline->num_commands > 0)
+    execute_list(pipeline);
+  parse_cache_release(pipeline);
+  return builtin_exit_requested(NULL);
+}
+
+/**
+ * @brief Run every line of a script held in memory
+ * @param text Script contents (need not be NUL-terminated)
+ * @param size Length of text in bytes
+ * @param name Script name for error messages
+ * @return Exit status of the last command
+ */
+static int run_script_text(const char *text, size_t size, const char *name) {
+  line_source_t src = {NULL, text, text + size, false};
+  const char *line;
+  size_t len;
+  size_t lineno = 0;
+  while (source_next_line(&src, &line, &len) == 1) {
+    if (run_script_line(line, len, &src, name, &lineno))
+      break;
+  }
+  return g_last_status;
+}
+
+/**
+ * @brief Run a script that cannot be mapped, reading it line by line
+ * @param fd Descriptor to read the script from
+ * @param name Script name for error messages
+ * @return Exit status of the last command
+ */
+static int run_script_fd(int fd, const char *name) {
+  input_t input;
+  input_init(&input, fd);
+
+  line_source_t src = {&input, NULL, NULL, false};
+  const char *line;
+  size_t len;
+  size_t lineno = 0;
+  int got;
+  while ((got = source_next_line(&src, &line, &len)) == 1) {
+    if (run_script_line(line, len, &src, name, &lineno))
+      break;
+  }
+  if (got == -1)
+    fprintf(stderr, "%s: %s\n", name, strerror(errno));
+
+  input_free(&input);
+  return g_last_status;
+}
+
+int shell_run_file(const char *path) {
+  // Close-on-exec so the script is not inherited by the commands it runs
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    fprintf(stderr, "shell: %s: %s\n", path, strerror(errno));
+    return 127;
+  }
+
+  setup_signal_handlers();
+  startup_profile_report(stderr);
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      close(fd);
+      posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+      int status = run_script_text(map, size, path);
+      munmap(map, size);
+      return status;
+    }
+  }
+
+  // Pipes, devices, empty files or a failed mapping
+  int status = run_script_fd(fd, path);
+  close(fd);
+  return status;
+}
+
+int shell_run_string(const char *commands) {
+  setup_signal_handlers();
+  startup_profile_report(stderr);
+  return run_script_text(commands, strlen(commands), "-c");
+}
+
+int shell_substitute(const char *commands, size_t len, capture_t *out) {
+  out->data = NULL;
+  out->len = 0;
+  out->mapped = 0;
+
+  // A memory file rather than a pipe: the subshell never blocks on a full
+  // buffer, and the whole output can be mapped at once afterwards
+  int fd = memfd_create("substitution", MFD_CLOEXEC);
+  if (fd == -1) {
+    perror("memfd_create");
+    return -1;
+  }
+
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    close(fd);
+    return -1;
+  }
+  if (pid == 0) {
+    // The subshell stays in the shell's group, without job control
+    jobs_control_forget();
+    if (dup2(fd, STDOUT_FILENO) == -1)
+      _exit(126);
+    int status = run_script_text(commands, len, "substitution");
+    fflush(stdout);
+    _exit(status);
+  }
+
+  int status;
+  job_t *job = jobs_add_command("substitution", pid);
+  if (job) {
+    status = jobs_wait(job);
+    jobs_remove(job);
+  } else {
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+      ;
+    status = jobs_decode_status(status);
+  }
+  g_substitution_status = status;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      perror("mmap");
+      close(fd);
+      return -1;
+    }
+    out->data = map;
+    out->mapped = (size_t)st.st_size;
+    out->len = out->mapped;
+    while (out->len > 0 && out->data[out->len - 1] == '\n')
+      out->len--;
+  }
+  close(fd);
+  return status;
+}
+
+int shell_substitution_status(void) {
+  return g_substitution_status == -1 ? 0 : g_substitution_status;
+}
@@ -0,0 +1,251 @@
+/**
+ * @file stats.c
+ * @brief time keyword, per-stage stats table and JSON lines trace sink
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "shell.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Environment variable naming a trace file to append to
+ */
+#define STATS_TRACE_ENV "SHELL_TRACE"
+
+/**
+ * @brief Reporting settings
+ */
+static struct {
+  bool enabled;     /**< set -o stats */
+  FILE *trace;      /**< Trace sink (NULL if off) */
+  char *trace_path; /**< Path of the trace sink */
+  bool env_checked; /**< SHELL_TRACE has been looked at */
+} g_stats = {false, NULL, NULL, false};
+
+/**
+ * @brief Per-stage numbers gathered from a process or the shell itself
+ */
+typedef struct {
+  const char *name;           /**< argv[0] of the stage */
+  pid_t pid;                  /**< Process ID (0 for the in-process stage) */
+  long long spawn_us;         /**< Launch start, relative to the run start */
+  long long exec_us;          /**< Launch call returned */
+  long long exit_us;          /**< Process reaped (or stage finished) */
+  const struct rusage *usage; /**< CPU, RSS and context switches */
+  int status;                 /**< Exit status */
+} stage_stats_t;
+
+/**
+ * @brief Microseconds from a to b
+ */
+static long long elapsed_us(const struct timespec *a,
+                            const struct timespec *b) {
+  return (long long)(b->tv_sec - a->tv_sec) * 1000000 +
+         (b->tv_nsec - a->tv_nsec) / 1000;
+}
+
+/**
+ * @brief Convert a timeval to microseconds
+ */
+static long long timeval_us(const struct timeval *tv) {
+  return (long long)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/**
+ * @brief Open the trace file named by SHELL_TRACE the first time it matters
+ */
+static void check_env(void) {
+  if (g_stats.env_checked)
+    return;
+  g_stats.env_checked = true;
+
+  const char *path = getenv(STATS_TRACE_ENV);
+  if (path && *path && stats_set_trace(path) == -1)
+    fprintf(stderr, "%s: %s: %s\n", STATS_TRACE_ENV, path, strerror(errno));
+}
+
+bool stats_wanted(const pipeline_t *pipeline) {
+  check_env();
+  return pipeline->timed || g_stats.enabled || g_stats.trace;
+}
+
+void stats_set_enabled(bool enabled) { g_stats.enabled = enabled; }
+
+int stats_set_trace(const char *path) {
+  FILE *trace = NULL;
+  char *copy = NULL;
+
+  if (path) {
+    // Append-only and close-on-exec: many shells may share one trace file
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1)
+      return -1;
+    trace = fdopen(fd, "a");
+    copy = strdup(path);
+    if (!trace || !copy) {
+      if (trace)
+        fclose(trace);
+      else
+        close(fd);
+      free(copy);
+      return -1;
+    }
+  }
+
+  if (g_stats.trace)
+    fclose(g_stats.trace);
+  free(g_stats.trace_path);
+  g_stats.trace = trace;
+  g_stats.trace_path = copy;
+  g_stats.env_checked = true;
+  return 0;
+}
+
+void stats_print(FILE *out) {
+  check_env();
+  fprintf(out, "stats\t\t%s\n", g_stats.enabled ? "on" : "off");
+  fprintf(out, "trace\t\t%s\n", g_stats.trace ? g_stats.trace_path : "off");
+}
+
+/**
+ * @brief Collect the numbers for stage i of a finished run
+ */
+static void stage_stats(const pipeline_t *pipeline, const job_t *job,
+                        const pipeline_run_t *run, size_t i,
+                        stage_stats_t *stage) {
+  char **argv = pipeline->commands[i].argv;
+  stage->name = argv && argv[0] ? argv[0] : "";
+
+  if (i == run->inline_stage) {
+    stage->pid = 0;
+    stage->spawn_us = elapsed_us(&run->start, &run->inline_start);
+    stage->exec_us = stage->spawn_us;
+    stage->exit_us = elapsed_us(&run->start, &run->inline_end);
+    stage->usage = &run->inline_usage;
+    stage->status = run->inline_status;
+    return;
+  }
+
+  // The job has no process for the in-process stage
+  const job_proc_t *proc = &job->procs[i < run->inline_stage ? i : i - 1];
+  stage->pid = proc->pid;
+  stage->spawn_us = elapsed_us(&run->start, &proc->spawned);
+  stage->exec_us = elapsed_us(&run->start, &proc->launched);
+  stage->exit_us = elapsed_us(&run->start, &proc->exited);
+  stage->usage = &proc->usage;
+  stage->status = jobs_decode_status(proc->status);
+}
+
+/**
+ * @brief Write a string as a JSON string literal
+ */
+static void write_json_string(FILE *out, const char *str) {
+  fputc('"', out);
+  for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+    if (*p == '"' || *p == '\\')
+      fprintf(out, "\\%c", *p);
+    else if (*p < 0x20)
+      fprintf(out, "\\u%04x", *p);
+    else
+      fputc(*p, out);
+  }
+  fputc('"', out);
+}
+
+/**
+ * @brief Print "m" and "s" the way the time keyword of other shells does
+ */
+static void print_time(const char *label, long long us) {
+  fprintf(stderr, "%s\t%lldm%lld.%03llds\n", label, us / 60000000,
+          us / 1000000 % 60, us / 1000 % 1000);
+}
+
+void stats_report(const pipeline_t *pipeline, const job_t *job,
+                  const pipeline_run_t *run, int status) {
+  size_t num_stages = pipeline->num_commands;
+  long long real_us = elapsed_us(&run->start, &run->end);
+  long long user_us = 0;
+  long long sys_us = 0;
+
+  for (size_t i = 0; i < num_stages; i++) {
+    stage_stats_t stage;
+    stage_stats(pipeline, job, run, i, &stage);
+    user_us += timeval_us(&stage.usage->ru_utime);
+    sys_us += timeval_us(&stage.usage->ru_stime);
+  }
+
+  if (pipeline->timed) {
+    fputc('\n', stderr);
+    print_time("real", real_us);
+    print_time("user", user_us);
+    print_time("sys", sys_us);
+  }
+
+  if (g_stats.enabled) {
+    fprintf(stderr, "%-5s %-7s %10s %10s %10s %9s %9s %8s %6s %6s %6s  %s\n",
+            "stage", "pid", "spawn_ms", "exec_ms", "exit_ms", "user_ms",
+            "sys_ms", "rss_kb", "vcsw", "ivcsw", "status", "command");
+    for (size_t i = 0; i < num_stages; i++) {
+      stage_stats_t stage;
+      stage_stats(pipeline, job, run, i, &stage);
+
+      char pid[16];
+      if (stage.pid)
+        snprintf(pid, sizeof(pid), "%d", (int)stage.pid);
+      else
+        snprintf(pid, sizeof(pid), "shell");
+
+      fprintf(stderr,
+              "%-5zu %-7s %10.3f %10.3f %10.3f %9.3f %9.3f %8ld %6ld %6ld "
+              "%6d  %s\n",
+              i, pid, stage.spawn_us / 1000.0, stage.exec_us / 1000.0,
+              stage.exit_us / 1000.0,
+              timeval_us(&stage.usage->ru_utime) / 1000.0,
+              timeval_us(&stage.usage->ru_stime) / 1000.0,
+              stage.usage->ru_maxrss, stage.usage->ru_nvcsw,
+              stage.usage->ru_nivcsw, stage.status, stage.name);
+    }
+  }
+
+  if (g_stats.trace) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    FILE *out = g_stats.trace;
+    fprintf(out, "{\"time\":%lld.%06ld,\"shell_pid\":%d,\"command\":",
+            (long long)now.tv_sec, now.tv_nsec / 1000, (int)getpid());
+    write_json_string(out, job->command);
+    fprintf(out,
+            ",\"status\":%d,\"real_us\":%lld,\"user_us\":%lld,"
+            "\"sys_us\":%lld,\"stages\":[",
+            status, real_us, user_us, sys_us);
+
+    for (size_t i = 0; i < num_stages; i++) {
+      stage_stats_t stage;
+      stage_stats(pipeline, job, run, i, &stage);
+
+      fprintf(out, "%s{\"stage\":%zu,\"argv0\":", i ? "," : "", i);
+      write_json_string(out, stage.name);
+      fprintf(out,
+              ",\"pid\":%d,\"in_shell\":%s,\"spawn_us\":%lld,"
+              "\"exec_us\":%lld,\"exit_us\":%lld,\"user_us\":%lld,"
+              "\"sys_us\":%lld,\"maxrss_kb\":%ld,\"nvcsw\":%ld,"
+              "\"nivcsw\":%ld,\"status\":%d}",
+              (int)stage.pid, stage.pid ? "false" : "true", stage.spawn_us,
+              stage.exec_us, stage.exit_us,
+              timeval_us(&stage.usage->ru_utime),
+              timeval_us(&stage.usage->ru_stime), stage.usage->ru_maxrss,
+              stage.usage->ru_nvcsw, stage.usage->ru_nivcsw, stage.status);
+    }
+
+    // One write per line keeps lines from concurrent shells intact
+    fputs("]}\n", out);
+    fflush(out);
+  }
+}
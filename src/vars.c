@@ -0,0 +1,322 @@
+/**
+ * @file vars.c
+ * @brief Shell variables and the environment passed to commands
+ *
+ * Variables live in an open-addressing hash table. Exported ones also have
+ * a slot in a NULL-terminated envp array that is updated in place on every
+ * change, so spawning a command hands the array over as it is instead of
+ * building an environment. environ points at the same array, which keeps
+ * getenv, execvp and forked children consistent with the table.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "shell.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern char **environ;
+
+/**
+ * @brief Initial number of slots in the table (must be a power of two)
+ */
+#define VARS_INITIAL_SLOTS 512
+
+/**
+ * @brief env_slot of a variable that is not exported
+ */
+#define VARS_NOT_EXPORTED SIZE_MAX
+
+/**
+ * @brief One shell variable
+ */
+typedef struct {
+  char *entry;     /**< "NAME=value" (NULL if the slot is empty) */
+  size_t name_len; /**< Length of NAME */
+  size_t env_slot; /**< Index in envp, or VARS_NOT_EXPORTED */
+} var_t;
+
+/**
+ * @brief Variable table and the environment built from it
+ */
+static struct {
+  var_t *slots;     /**< Slot array */
+  size_t capacity;  /**< Number of slots */
+  size_t count;     /**< Occupied slots */
+  char **envp;      /**< Entries of exported variables, NULL-terminated */
+  size_t env_count; /**< Exported variables */
+  size_t env_cap;   /**< Slots in envp, excluding the terminator */
+  bool initialized; /**< environ has been imported */
+} g_vars;
+
+/**
+ * @brief FNV-1a hash of a variable name
+ */
+static uint32_t hash_name(const char *name, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief Find the slot of a name: its variable, or the empty slot ending
+ * the probe sequence
+ */
+static var_t *find_slot(var_t *slots, size_t capacity, const char *name,
+                        size_t len) {
+  size_t mask = capacity - 1;
+  size_t i = hash_name(name, len) & mask;
+  while (slots[i].entry && (slots[i].name_len != len ||
+                            memcmp(slots[i].entry, name, len) != 0))
+    i = (i + 1) & mask;
+  return &slots[i];
+}
+
+/**
+ * @brief Double the table (or create it) and rehash every variable
+ * @return 0 on success, -1 on allocation failure
+ */
+static int grow_table(void) {
+  size_t capacity = g_vars.capacity ? g_vars.capacity * 2 : VARS_INITIAL_SLOTS;
+  var_t *slots = calloc(capacity, sizeof(var_t));
+  if (!slots)
+    return -1;
+
+  for (size_t i = 0; i < g_vars.capacity; i++) {
+    var_t *var = &g_vars.slots[i];
+    if (var->entry)
+      *find_slot(slots, capacity, var->entry, var->name_len) = *var;
+  }
+
+  free(g_vars.slots);
+  g_vars.slots = slots;
+  g_vars.capacity = capacity;
+  return 0;
+}
+
+/**
+ * @brief Give a variable a slot in envp
+ * @return 0 on success, -1 on allocation failure
+ */
+static int env_add(var_t *var) {
+  if (g_vars.env_count == g_vars.env_cap) {
+    size_t cap = g_vars.env_cap ? g_vars.env_cap * 2 : 64;
+    char **envp = realloc(g_vars.envp, (cap + 1) * sizeof(char *));
+    if (!envp)
+      return -1;
+    g_vars.envp = envp;
+    g_vars.env_cap = cap;
+  }
+
+  var->env_slot = g_vars.env_count;
+  g_vars.envp[g_vars.env_count++] = var->entry;
+  g_vars.envp[g_vars.env_count] = NULL;
+  environ = g_vars.envp;
+  return 0;
+}
+
+/**
+ * @brief Take a variable out of envp, moving the last entry into its slot
+ */
+static void env_remove(var_t *var) {
+  size_t slot = var->env_slot;
+  size_t last = --g_vars.env_count;
+  if (slot != last) {
+    char *moved = g_vars.envp[last];
+    size_t len = (size_t)(strchr(moved, '=') - moved);
+    find_slot(g_vars.slots, g_vars.capacity, moved, len)->env_slot = slot;
+    g_vars.envp[slot] = moved;
+  }
+  g_vars.envp[last] = NULL;
+  var->env_slot = VARS_NOT_EXPORTED;
+}
+
+/**
+ * @brief Store a "NAME=value" entry, taking ownership of it
+ * @param entry Allocated entry
+ * @param len Length of NAME
+ * @return The variable, or NULL on allocation failure (entry is freed)
+ */
+static var_t *store_entry(char *entry, size_t len) {
+  if ((g_vars.count + 1) * 4 > g_vars.capacity * 3 && grow_table() == -1) {
+    free(entry);
+    return NULL;
+  }
+
+  var_t *var = find_slot(g_vars.slots, g_vars.capacity, entry, len);
+  if (!var->entry) {
+    var->name_len = len;
+    var->env_slot = VARS_NOT_EXPORTED;
+    g_vars.count++;
+  } else {
+    free(var->entry);
+  }
+
+  var->entry = entry;
+  if (var->env_slot != VARS_NOT_EXPORTED)
+    g_vars.envp[var->env_slot] = entry;
+  return var;
+}
+
+/**
+ * @brief Import the process environment on first use
+ */
+static void ensure_init(void) {
+  if (g_vars.initialized)
+    return;
+  g_vars.initialized = true;
+
+  // Entries without a valid NAME= are dropped, as other shells do
+  for (char **env = environ; env && *env; env++) {
+    const char *eq = strchr(*env, '=');
+    if (!eq || !vars_valid_name(*env, (size_t)(eq - *env)))
+      continue;
+
+    size_t len = (size_t)(eq - *env);
+    var_t *existing = g_vars.slots
+                          ? find_slot(g_vars.slots, g_vars.capacity, *env, len)
+                          : NULL;
+    if (existing && existing->entry)
+      continue; // the first definition wins, as with getenv
+
+    char *entry = strdup(*env);
+    var_t *var = entry ? store_entry(entry, len) : NULL;
+    if (!var || env_add(var) == -1) {
+      perror("environment");
+      break;
+    }
+  }
+
+  // An empty environment still gets an (empty) array of its own
+  if (!g_vars.envp && (g_vars.envp = calloc(1, sizeof(char *))))
+    environ = g_vars.envp;
+}
+
+/**
+ * @brief Look a variable up
+ * @return The variable, or NULL if it is not set
+ */
+static var_t *lookup(const char *name) {
+  ensure_init();
+  if (!g_vars.slots)
+    return NULL;
+
+  var_t *var = find_slot(g_vars.slots, g_vars.capacity, name, strlen(name));
+  return var->entry ? var : NULL;
+}
+
+bool vars_valid_name(const char *name, size_t len) {
+  if (len == 0 || (name[0] >= '0' && name[0] <= '9'))
+    return false;
+  for (size_t i = 0; i < len; i++) {
+    char c = name[i];
+    if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9')))
+      return false;
+  }
+  return true;
+}
+
+const char *vars_get(const char *name) {
+  var_t *var = lookup(name);
+  return var ? var->entry + var->name_len + 1 : NULL;
+}
+
+int vars_set(const char *name, const char *value) {
+  ensure_init();
+  size_t len = strlen(name);
+  size_t value_len = strlen(value);
+  if (!vars_valid_name(name, len))
+    return -1;
+
+  char *entry = malloc(len + value_len + 2);
+  if (!entry)
+    return -1;
+  memcpy(entry, name, len);
+  entry[len] = '=';
+  memcpy(entry + len + 1, value, value_len + 1);
+  return store_entry(entry, len) ? 0 : -1;
+}
+
+int vars_export(const char *name) {
+  var_t *var = lookup(name);
+  if (!var) {
+    // Exporting an unset name creates it empty
+    if (vars_set(name, "") == -1)
+      return -1;
+    var = lookup(name);
+  }
+  if (var->env_slot != VARS_NOT_EXPORTED)
+    return 0;
+  return env_add(var);
+}
+
+void vars_unset(const char *name) {
+  var_t *var = lookup(name);
+  if (!var)
+    return;
+
+  if (var->env_slot != VARS_NOT_EXPORTED)
+    env_remove(var);
+  free(var->entry);
+  var->entry = NULL;
+  g_vars.count--;
+
+  // Backward-shift deletion keeps every probe sequence unbroken
+  size_t mask = g_vars.capacity - 1;
+  size_t hole = (size_t)(var - g_vars.slots);
+  for (size_t i = (hole + 1) & mask; g_vars.slots[i].entry;
+       i = (i + 1) & mask) {
+    var_t *next = &g_vars.slots[i];
+    size_t home = hash_name(next->entry, next->name_len) & mask;
+    // Move the entry back unless its home lies in (hole, i]
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      g_vars.slots[hole] = *next;
+      next->entry = NULL;
+      hole = i;
+    }
+  }
+}
+
+char **vars_envp(void) {
+  ensure_init();
+  return g_vars.envp;
+}
+
+/**
+ * @brief Compare two environment entries for qsort
+ */
+static int compare_entries(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+void vars_print_exported(FILE *out) {
+  ensure_init();
+  size_t count = g_vars.env_count;
+  char **sorted = malloc((count ? count : 1) * sizeof(char *));
+  if (!sorted) {
+    perror("export");
+    return;
+  }
+  memcpy(sorted, g_vars.envp, count * sizeof(char *));
+  qsort(sorted, count, sizeof(char *), compare_entries);
+
+  // Values are single-quoted so the output can be read back in
+  for (size_t i = 0; i < count; i++) {
+    const char *eq = strchr(sorted[i], '=');
+    fprintf(out, "export %.*s='", (int)(eq - sorted[i]), sorted[i]);
+    for (const char *p = eq + 1; *p; p++) {
+      if (*p == '\'')
+        fputs("'\\''", out);
+      else
+        fputc(*p, out);
+    }
+    fputs("'\n", out);
+  }
+  free(sorted);
+}
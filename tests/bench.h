@@ -0,0 +1,101 @@
+/**
+ * @file bench.h
+ * @brief Minimal timing harness shared by the benchmarks
+ *
+ * Every benchmark runs a fixed amount of work BENCH_REPEAT times (after one
+ * warm-up round) and reports the median and the fastest round. The median
+ * is what should be compared between runs; the minimum shows the noise
+ * floor. Output is one line per benchmark in a fixed column layout.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * @brief Measured rounds per benchmark unless BENCH_REPEAT says otherwise
+ */
+#define BENCH_DEFAULT_REPEAT 7
+
+/**
+ * @brief Upper bound for BENCH_REPEAT
+ */
+#define BENCH_MAX_REPEAT 101
+
+/**
+ * @brief One round of a benchmark
+ * @param arg Benchmark-specific state
+ * @return Operations performed (lines parsed, bytes moved, ...)
+ */
+typedef uint64_t (*bench_fn)(void *arg);
+
+/**
+ * @brief Current monotonic time in nanoseconds
+ */
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Number of measured rounds (BENCH_REPEAT, default 7)
+ */
+static inline int bench_repeat(void) {
+  const char *value = getenv("BENCH_REPEAT");
+  int repeat = value ? atoi(value) : BENCH_DEFAULT_REPEAT;
+  if (repeat < 1)
+    repeat = 1;
+  if (repeat > BENCH_MAX_REPEAT)
+    repeat = BENCH_MAX_REPEAT;
+  return repeat;
+}
+
+/**
+ * @brief Print the column header
+ */
+static inline void bench_header(void) {
+  printf("%-36s %12s %14s %14s %16s\n", "benchmark", "ops/round",
+         "median ns/op", "min ns/op", "median ops/s");
+}
+
+/**
+ * @brief Compare two doubles for qsort
+ */
+static inline int bench_cmp(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief Run a benchmark and print its line
+ * @param name Benchmark name
+ * @param fn One round of work
+ * @param arg State passed to fn
+ */
+static inline void bench_run(const char *name, bench_fn fn, void *arg) {
+  double per_op[BENCH_MAX_REPEAT];
+  int repeat = bench_repeat();
+  uint64_t ops = fn(arg); // warm caches, page in the binaries
+
+  for (int i = 0; i < repeat; i++) {
+    uint64_t start = bench_now_ns();
+    ops = fn(arg);
+    uint64_t elapsed = bench_now_ns() - start;
+    per_op[i] = ops ? (double)elapsed / (double)ops : 0.0;
+  }
+
+  qsort(per_op, (size_t)repeat, sizeof(double), bench_cmp);
+  double median = per_op[repeat / 2];
+  printf("%-36s %12llu %14.2f %14.2f %16.0f\n", name,
+         (unsigned long long)ops, median, per_op[0],
+         median > 0 ? 1e9 / median : 0.0);
+  fflush(stdout);
+}
+
+#endif /* BENCH_H */
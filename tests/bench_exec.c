@@ -0,0 +1,96 @@
+/**
+ * @file bench_exec.c
+ * @brief Macrobenchmarks for execute_pipeline: spawn latency and pipe
+ * throughput
+ *
+ * Runs real processes, so the numbers depend on the machine; compare runs
+ * on the same host. BENCH_PIPE_BYTES sets the bytes pushed through each
+ * throughput pipeline (default 1 GiB).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/shell.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief Pipelines launched per spawn round
+ */
+#define SPAWNS_PER_ROUND 200
+
+/**
+ * @brief Default bytes per throughput round
+ */
+#define BENCH_DEFAULT_PIPE_BYTES (1024ull * 1024 * 1024)
+
+/**
+ * @brief A command line run repeatedly
+ */
+typedef struct {
+  const char *line;  /**< Command line */
+  unsigned runs;     /**< Executions per round */
+  uint64_t ops;      /**< Operations one execution stands for */
+  pipeline_t parsed; /**< Parsed once, reused every time */
+} exec_bench_t;
+
+/**
+ * @brief Execute the pipeline the configured number of times
+ */
+static uint64_t bench_exec(void *arg) {
+  exec_bench_t *bench = arg;
+  for (unsigned i = 0; i < bench->runs; i++)
+    execute_pipeline(&bench->parsed);
+  return (uint64_t)bench->runs * bench->ops;
+}
+
+/**
+ * @brief Parse a benchmark line and run it
+ * @return 0 on success, 1 if the line does not parse
+ */
+static int run_line(const char *name, const char *line, unsigned runs,
+                    uint64_t ops) {
+  exec_bench_t bench = {line, runs, ops, {0}};
+  if (parse_command(line, &bench.parsed) != 0) {
+    fprintf(stderr, "bench_exec: cannot parse '%s'\n", line);
+    return 1;
+  }
+  bench_run(name, bench_exec, &bench);
+  free_pipeline(&bench.parsed);
+  return 0;
+}
+
+/**
+ * @brief Run all execution benchmarks
+ * @return 0 on success, 1 if a benchmark could not be set up
+ */
+int main(void) {
+  const char *value = getenv("BENCH_PIPE_BYTES");
+  unsigned long long bytes = value ? strtoull(value, NULL, 10) : 0;
+  if (bytes == 0)
+    bytes = BENCH_DEFAULT_PIPE_BYTES;
+
+  // Results are dropped: head and cat write to /dev/null
+  char head[128], head_cat[128], head_ext_cat[128];
+  snprintf(head, sizeof(head), "yes | head -c %llu > /dev/null", bytes);
+  snprintf(head_cat, sizeof(head_cat),
+           "yes | head -c %llu | cat > /dev/null", bytes);
+  snprintf(head_ext_cat, sizeof(head_ext_cat),
+           "yes | head -c %llu | /bin/cat > /dev/null", bytes);
+
+  setup_signal_handlers();
+
+  int failures = 0;
+  bench_header();
+  failures += run_line("spawn /bin/true", "/bin/true", SPAWNS_PER_ROUND, 1);
+  failures += run_line("spawn 4-stage /bin/true pipeline",
+                       "/bin/true | /bin/true | /bin/true | /bin/true",
+                       SPAWNS_PER_ROUND / 4, 1);
+  failures += run_line("builtin true (no spawn)", "true",
+                       SPAWNS_PER_ROUND * 100, 1);
+  failures += run_line("pipe bytes: yes | head", head, 1, bytes);
+  failures += run_line("pipe bytes: ... | cat (in shell)", head_cat, 1, bytes);
+  failures += run_line("pipe bytes: ... | /bin/cat", head_ext_cat, 1, bytes);
+  return failures ? 1 : 0;
+}
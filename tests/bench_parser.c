@@ -0,0 +1,156 @@
+/**
+ * @file bench_parser.c
+ * @brief Microbenchmarks for parse_command, free_pipeline and the parse cache
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/shell.h"
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Lines parsed per round
+ */
+#define LINES_PER_ROUND 100000
+
+/**
+ * @brief Stages of the long pipeline
+ */
+#define LONG_STAGES 60
+
+/**
+ * @brief Command lines of the kind people actually type
+ */
+static const char *const g_corpus[] = {
+    "ls -la",
+    "cd ..",
+    "git status",
+    "echo \"hello world\"",
+    "grep -rn 'TODO' src include",
+    "cat access.log | grep ' 500 ' | awk '{print $7}' | sort | uniq -c",
+    "make -j8 > build.log",
+    "find . -name '*.c' | xargs wc -l | sort -n | tail -5",
+    "ps aux | grep shell | grep -v grep",
+    "sort < names.txt | uniq >> unique.txt",
+    "tar czf backup.tar.gz docs src tests &",
+    "ssh host 'uptime; df -h' | tee -a remote.log",
+    "# a comment line",
+    "printf '%s\\n' one two three | wc -l",
+    "curl -s https://example.com/api | jq '.items[] | .name'",
+    "du -sh * | sort -h | tail",
+};
+
+#define CORPUS_SIZE (sizeof(g_corpus) / sizeof(g_corpus[0]))
+
+static char g_long_line[LONG_STAGES * 16];
+
+/**
+ * @brief Work description for the parse benchmarks
+ */
+typedef struct {
+  const char *const *lines; /**< Lines to cycle through */
+  size_t num_lines;         /**< Number of lines */
+  size_t count;             /**< Lines per round */
+} parse_bench_t;
+
+/**
+ * @brief Parse and free every line of a round
+ */
+static uint64_t bench_parse(void *arg) {
+  parse_bench_t *bench = arg;
+  for (size_t i = 0; i < bench->count; i++) {
+    pipeline_t pipeline;
+    if (parse_command(bench->lines[i % bench->num_lines], &pipeline) == 0)
+      free_pipeline(&pipeline);
+  }
+  return bench->count;
+}
+
+/**
+ * @brief Work description for the free_pipeline benchmarks
+ */
+typedef struct {
+  parse_bench_t parse;   /**< Lines to parse */
+  pipeline_t *pipelines; /**< Scratch space for a round */
+  uint64_t free_ns;      /**< Time spent freeing in the last round */
+} free_bench_t;
+
+/**
+ * @brief Parse a round up front and time only the frees
+ */
+static uint64_t bench_free(void *arg) {
+  free_bench_t *bench = arg;
+  size_t count = bench->parse.count;
+  for (size_t i = 0; i < count; i++)
+    parse_command(bench->parse.lines[i % bench->parse.num_lines],
+                  &bench->pipelines[i]);
+
+  uint64_t start = bench_now_ns();
+  for (size_t i = 0; i < count; i++)
+    free_pipeline(&bench->pipelines[i]);
+  bench->free_ns = bench_now_ns() - start;
+  return count;
+}
+
+/**
+ * @brief Look every line up in the parse cache (hits after the warm-up)
+ */
+static uint64_t bench_cache_hit(void *arg) {
+  parse_bench_t *bench = arg;
+  for (size_t i = 0; i < bench->count; i++) {
+    const char *line = bench->lines[i % bench->num_lines];
+    const pipeline_t *pipeline;
+    if (parse_cache_parse(line, strlen(line), &pipeline) == 0)
+      parse_cache_release(pipeline);
+  }
+  return bench->count;
+}
+
+/**
+ * @brief Print the free_pipeline cost, timed without the parsing around it
+ */
+static void run_free_bench(const char *name, free_bench_t *bench) {
+  double per_op[BENCH_MAX_REPEAT];
+  int repeat = bench_repeat();
+  bench_free(bench);
+
+  for (int i = 0; i < repeat; i++) {
+    bench_free(bench);
+    per_op[i] = (double)bench->free_ns / (double)bench->parse.count;
+  }
+
+  qsort(per_op, (size_t)repeat, sizeof(double), bench_cmp);
+  double median = per_op[repeat / 2];
+  printf("%-36s %12zu %14.2f %14.2f %16.0f\n", name, bench->parse.count,
+         median, per_op[0], median > 0 ? 1e9 / median : 0.0);
+}
+
+/**
+ * @brief Run all parser benchmarks
+ * @return 0
+ */
+int main(void) {
+  // cmd0 arg | cmd1 arg | ... with LONG_STAGES stages
+  char *p = g_long_line;
+  for (int i = 0; i < LONG_STAGES; i++)
+    p += sprintf(p, "%scmd%d -x%d", i ? " | " : "", i, i);
+  const char *long_lines[] = {g_long_line};
+
+  parse_bench_t corpus = {g_corpus, CORPUS_SIZE, LINES_PER_ROUND};
+  parse_bench_t long_pipeline = {long_lines, 1, LINES_PER_ROUND / 10};
+
+  static pipeline_t pipelines[LINES_PER_ROUND];
+  free_bench_t free_corpus = {corpus, pipelines, 0};
+  free_bench_t free_long = {long_pipeline, pipelines, 0};
+
+  bench_header();
+  bench_run("parse_command corpus", bench_parse, &corpus);
+  bench_run("parse_command 60-stage pipeline", bench_parse, &long_pipeline);
+  run_free_bench("free_pipeline corpus", &free_corpus);
+  run_free_bench("free_pipeline 60-stage pipeline", &free_long);
+  bench_run("parse_cache_parse corpus (hits)", bench_cache_hit, &corpus);
+  parse_cache_clear();
+  return 0;
+}
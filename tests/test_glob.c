@@ -0,0 +1,240 @@
+/**
+ * @file test_glob.c
+ * @brief Unit tests for pathname expansion and its directory cache
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Scratch directory the tests run in
+ */
+static char g_dir[] = "/tmp/test_glob_XXXXXX";
+
+/**
+ * @brief Needed by $? expansion; the tests do not run pipelines
+ */
+int shell_last_status(void) { return 0; }
+
+/**
+ * @brief Needed by command substitution, which test_subst covers
+ */
+int shell_substitute(const char *commands, size_t len, capture_t *out) {
+  (void)commands;
+  (void)len;
+  *out = (capture_t){NULL, 0, 0};
+  return 0;
+}
+
+/**
+ * @brief Create an empty file
+ * @return 0 on success, -1 on failure
+ */
+static int touch(const char *path) {
+  FILE *f = fopen(path, "w");
+  return f ? fclose(f) : -1;
+}
+
+/**
+ * @brief Compare matches with a space-separated list of expected paths
+ */
+static bool matches_are(char **matches, size_t count, const char *expected) {
+  char joined[512] = "";
+  for (size_t i = 0; i < count; i++) {
+    if (i > 0)
+      strcat(joined, " ");
+    strcat(joined, matches[i]);
+  }
+  if (strcmp(joined, expected) == 0)
+    return true;
+
+  fprintf(stderr, "  got '%s', expected '%s'\n", joined, expected);
+  return false;
+}
+
+/**
+ * @brief Expand a pattern and compare the matches
+ */
+static bool glob_is(const char *pattern, const char *expected) {
+  arena_t arena = {NULL};
+  char **matches;
+  size_t count;
+  bool ok = glob_expand(pattern, &arena, &matches, &count) == 0 &&
+            matches_are(matches, count, expected);
+  arena_release(&arena);
+  return ok;
+}
+
+/**
+ * @brief Parse and expand a line, comparing the first command's argv
+ */
+static bool expands_to(const char *line, const char *expected) {
+  pipeline_t parsed, expanded;
+  if (parse_command(line, &parsed) != 0)
+    return false;
+
+  bool ok;
+  if (!parsed.expand) {
+    char **argv = parsed.commands[0].argv;
+    size_t argc = 0;
+    while (argv[argc])
+      argc++;
+    ok = matches_are(argv, argc, expected);
+  } else {
+    ok = expand_pipeline(&parsed, &expanded) == 0;
+    if (ok) {
+      char **argv = expanded.commands[0].argv;
+      size_t argc = 0;
+      while (argv[argc])
+        argc++;
+      ok = matches_are(argv, argc, expected);
+      free_pipeline(&expanded);
+    }
+  }
+  free_pipeline(&parsed);
+  return ok;
+}
+
+/**
+ * @brief Test single-directory patterns, ordering and hidden files
+ * @return 0 on success, 1 on failure
+ */
+static int test_basic_patterns(void) {
+  if (!glob_is("*.c", "a.c b.c main.c") || !glob_is("?.c", "a.c b.c") ||
+      !glob_is("[ab].c", "a.c b.c") || !glob_is("[!ab]*.c", "main.c")) {
+    fprintf(stderr, "test_basic_patterns: wrong matches\n");
+    return 1;
+  }
+
+  // Dot files need an explicit dot; . and .. are never listed
+  if (!glob_is("*", "a.c b.c main.c notes.txt src") ||
+      !glob_is(".*", ".hidden") || !glob_is("*.none", "")) {
+    fprintf(stderr, "test_basic_patterns: wrong hidden or empty matches\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test patterns spanning several directories
+ * @return 0 on success, 1 on failure
+ */
+static int test_multi_component(void) {
+  char absolute[256], expected[256];
+  snprintf(absolute, sizeof(absolute), "%s/sr?/*.h", g_dir);
+  snprintf(expected, sizeof(expected), "%s/src/shell.h", g_dir);
+
+  if (!glob_is("*/*.c", "src/glob.c src/shell.c") || !glob_is("*/", "src/") ||
+      !glob_is("s*/shell.h", "src/shell.h") ||
+      !glob_is("s*/missing.h", "") || !glob_is(absolute, expected)) {
+    fprintf(stderr, "test_multi_component: wrong matches\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test that quoting keeps metacharacters literal
+ * @return 0 on success, 1 on failure
+ */
+static int test_quoting(void) {
+  if (!expands_to("echo *.c '*.c' \"*\".c \\*.c", "echo a.c b.c main.c *.c "
+                                                    "*.c *.c") ||
+      !expands_to("echo 'a'*.c nomatch*", "echo a.c nomatch*") ||
+      !expands_to("echo plain words", "echo plain words")) {
+    fprintf(stderr, "test_quoting: wrong expansion\n");
+    return 1;
+  }
+
+  // Only lines with an unquoted metacharacter carry expansion work
+  pipeline_t parsed;
+  if (parse_command("echo '*' \"?\"", &parsed) != 0 || parsed.expand ||
+      parsed.commands[0].raw_argv) {
+    fprintf(stderr, "test_quoting: quoted line marked for expansion\n");
+    return 1;
+  }
+  free_pipeline(&parsed);
+  return 0;
+}
+
+/**
+ * @brief Test that globs of one line share a directory read
+ * @return 0 on success, 1 on failure
+ */
+static int test_directory_cache(void) {
+  glob_cache_stats_t before, after;
+  glob_cache_clear();
+  glob_cache_stats(&before);
+
+  if (!expands_to("ls *.c [ab].c | wc *.txt", "ls a.c b.c main.c a.c b.c")) {
+    fprintf(stderr, "test_directory_cache: wrong expansion\n");
+    return 1;
+  }
+
+  // Literal paths do not list anything
+  if (!glob_is("src/shell.h", "src/shell.h")) {
+    fprintf(stderr, "test_directory_cache: literal path not found\n");
+    return 1;
+  }
+
+  glob_cache_stats(&after);
+  if (after.lists - before.lists != 3 || after.reads - before.reads != 1 ||
+      after.dirs != 1) {
+    fprintf(stderr, "test_directory_cache: %lu lists, %lu reads, %zu dirs\n",
+            after.lists - before.lists, after.reads - before.reads,
+            after.dirs);
+    return 1;
+  }
+
+  // A new line reads the directory again, so new files show up
+  glob_cache_clear();
+  touch("c.c");
+  if (!glob_is("*.c", "a.c b.c c.c main.c")) {
+    fprintf(stderr, "test_directory_cache: stale listing after clear\n");
+    return 1;
+  }
+  glob_cache_clear();
+  return 0;
+}
+
+/**
+ * @brief Run all globbing tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running globbing tests...\n");
+
+  if (!mkdtemp(g_dir) || chdir(g_dir) == -1 || mkdir("src", 0755) == -1 ||
+      touch("a.c") || touch("b.c") || touch("main.c") || touch(".hidden") ||
+      touch("notes.txt") || touch("src/shell.c") || touch("src/glob.c") ||
+      touch("src/shell.h")) {
+    fprintf(stderr, "could not create scratch directory\n");
+    return 1;
+  }
+
+  failures += test_basic_patterns();
+  failures += test_multi_component();
+  failures += test_quoting();
+  failures += test_directory_cache();
+
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", g_dir);
+  if (chdir("/") == -1 || system(cmd) != 0)
+    fprintf(stderr, "warning: could not remove scratch directory\n");
+
+  if (failures == 0) {
+    printf("All globbing tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
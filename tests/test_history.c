@@ -0,0 +1,320 @@
+/**
+ * @file test_history.c
+ * @brief Unit tests for the persistent history and its index
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/shell.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Scratch directory the tests run in
+ */
+static char g_dir[] = "/tmp/test_history_XXXXXX";
+
+/**
+ * @brief Add a NUL-terminated line to the history
+ */
+static int add(const char *line) { return history_add(line, strlen(line)); }
+
+/**
+ * @brief Compare an entry with the expected text
+ */
+static bool entry_is(size_t index, const char *expected) {
+  size_t len;
+  const char *entry = history_get(index, &len);
+  if (entry && len == strlen(expected) && memcmp(entry, expected, len) == 0)
+    return true;
+
+  fprintf(stderr, "  entry %zu is '%.*s', expected '%s'\n", index,
+          entry ? (int)len : 0, entry ? entry : "", expected);
+  return false;
+}
+
+/**
+ * @brief Run searches from the newest entry back, joining the indices found
+ */
+static bool search_finds(const char *text, history_match_t match,
+                         const char *expected) {
+  char found[256] = "";
+  size_t used = 0;
+  for (size_t at = history_count();
+       history_search(text, strlen(text), match, &at);)
+    used += (size_t)snprintf(found + used, sizeof(found) - used, "%s%zu",
+                             used ? " " : "", at);
+  if (strcmp(found, expected) == 0)
+    return true;
+
+  fprintf(stderr, "  search '%s' found '%s', expected '%s'\n", text, found,
+          expected);
+  return false;
+}
+
+/**
+ * @brief Get the size of a file
+ */
+static off_t file_size(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+/**
+ * @brief Test adding entries, duplicates and lines that are left out
+ * @return 0 on success, 1 on failure
+ */
+static int test_add_and_get(void) {
+  if (history_open("basic") != 0) {
+    fprintf(stderr, "test_add_and_get: open failed\n");
+    return 1;
+  }
+
+  add("ls -l");
+  add("ls -l");
+  add("echo one\necho two");
+  add("");
+  add("git status");
+  add("ls -l");
+  if (history_count() != 3 || !entry_is(0, "ls -l") ||
+      !entry_is(1, "git status") || !entry_is(2, "ls -l") ||
+      history_get(3, &(size_t){0}) != NULL) {
+    fprintf(stderr, "test_add_and_get: wrong entries\n");
+    history_close();
+    return 1;
+  }
+  history_close();
+
+  // Closed history records nothing
+  if (add("ignored") != 0 || history_count() != 0) {
+    fprintf(stderr, "test_add_and_get: closed history recorded\n");
+    return 1;
+  }
+
+  // Reopening maps what the last session wrote
+  if (history_open("basic") != 0 || history_count() != 3 ||
+      !entry_is(1, "git status") || file_size("basic.idx") != 8 + 3 * 16) {
+    fprintf(stderr, "test_add_and_get: entries lost on reopen\n");
+    history_close();
+    return 1;
+  }
+  history_close();
+  return 0;
+}
+
+/**
+ * @brief Test prefix and substring searches
+ * @return 0 on success, 1 on failure
+ */
+static int test_search(void) {
+  if (history_open("search") != 0) {
+    fprintf(stderr, "test_search: open failed\n");
+    return 1;
+  }
+
+  const char *lines[] = {"make test", "git commit -m fix", "make", "ls",
+                         "git status", "echo make"};
+  for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++)
+    add(lines[i]);
+
+  // Short prefixes are answered from the index; longer ones check the log
+  int failed = !search_finds("mak", HISTORY_PREFIX, "2 0") ||
+               !search_finds("make t", HISTORY_PREFIX, "0") ||
+               !search_finds("git s", HISTORY_PREFIX, "4") ||
+               !search_finds("gi", HISTORY_PREFIX, "4 1") ||
+               !search_finds("", HISTORY_PREFIX, "5 4 3 2 1 0") ||
+               !search_finds("make", HISTORY_SUBSTRING, "5 2 0") ||
+               !search_finds("it", HISTORY_SUBSTRING, "4 1") ||
+               !search_finds("nothing", HISTORY_SUBSTRING, "") ||
+               !search_finds("ls -la", HISTORY_PREFIX, "");
+  history_close();
+  if (failed) {
+    fprintf(stderr, "test_search: wrong matches\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test catching up with the log and repairing a broken index
+ * @return 0 on success, 1 on failure
+ */
+static int test_recovery(void) {
+  if (history_open("recover") != 0) {
+    fprintf(stderr, "test_recovery: open failed\n");
+    return 1;
+  }
+  add("one");
+  add("two");
+  history_close();
+
+  // Lines the index missed, and an unfinished one that stays unindexed
+  int fd = open("recover", O_WRONLY | O_APPEND);
+  if (fd == -1 || write(fd, "three\nfour\nfiv", 14) != 14) {
+    fprintf(stderr, "test_recovery: could not extend the log\n");
+    return 1;
+  }
+  close(fd);
+  if (history_open("recover") != 0 || history_count() != 4 ||
+      !entry_is(2, "three") || !entry_is(3, "four")) {
+    fprintf(stderr, "test_recovery: log tail not indexed\n");
+    history_close();
+    return 1;
+  }
+  history_close();
+
+  // A record torn in half is dropped, then indexed again from the log
+  if (truncate("recover.idx", 8 + 3 * 16 + 7) == -1 ||
+      history_open("recover") != 0 || history_count() != 4 ||
+      !entry_is(3, "four")) {
+    fprintf(stderr, "test_recovery: torn record not repaired\n");
+    history_close();
+    return 1;
+  }
+  history_close();
+
+  // A log replaced by a shorter one gets a fresh index
+  fd = open("recover", O_WRONLY | O_TRUNC);
+  if (fd == -1 || write(fd, "new\n", 4) != 4) {
+    fprintf(stderr, "test_recovery: could not replace the log\n");
+    return 1;
+  }
+  close(fd);
+  if (history_open("recover") != 0 || history_count() != 1 ||
+      !entry_is(0, "new")) {
+    fprintf(stderr, "test_recovery: replaced log not reindexed\n");
+    history_close();
+    return 1;
+  }
+  history_close();
+
+  // So does an index that is not one at all
+  fd = open("recover.idx", O_WRONLY | O_TRUNC);
+  if (fd == -1 || write(fd, "garbage!garbage!", 16) != 16) {
+    fprintf(stderr, "test_recovery: could not damage the index\n");
+    return 1;
+  }
+  close(fd);
+  if (history_open("recover") != 0 || history_count() != 1 ||
+      !entry_is(0, "new")) {
+    fprintf(stderr, "test_recovery: damaged index not rebuilt\n");
+    history_close();
+    return 1;
+  }
+  history_close();
+  return 0;
+}
+
+/**
+ * @brief Test that a large history reopens from its index alone
+ * @return 0 on success, 1 on failure
+ */
+static int test_large_history(void) {
+  FILE *f = fopen("large", "w");
+  if (!f) {
+    fprintf(stderr, "test_large_history: could not write the log\n");
+    return 1;
+  }
+  for (int i = 0; i < 50000; i++)
+    fprintf(f, "command number %d\n", i);
+  fclose(f);
+
+  // The first open indexes the whole log, the second only maps it
+  int failed = history_open("large") != 0 || history_count() != 50000;
+  history_close();
+  off_t index_size = file_size("large.idx");
+  failed |= history_open("large") != 0 || history_count() != 50000 ||
+            !entry_is(49999, "command number 49999") ||
+            !search_finds("command number 4999", HISTORY_PREFIX,
+                          "49999 49998 49997 49996 49995 49994 49993 49992 "
+                          "49991 49990 4999");
+
+  // Substring searches walk back past the entries that do not match
+  size_t at = history_count();
+  failed |= !history_search("number 7", 8, HISTORY_SUBSTRING, &at) ||
+            at != 7999 || file_size("large.idx") != index_size;
+  history_close();
+  if (failed) {
+    fprintf(stderr, "test_large_history: wrong entries\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test that lazily opened history is opened by its first use
+ * @return 0 on success, 1 on failure
+ */
+static int test_lazy_open(void) {
+  // Without HISTFILE only an interactive shell keeps history
+  vars_unset("HISTFILE");
+  history_open_lazily(false);
+  if (add("ignored") != 0 || history_count() != 0) {
+    fprintf(stderr, "test_lazy_open: history kept without HISTFILE\n");
+    history_close();
+    return 1;
+  }
+
+  // HISTFILE counts as it is when history is first needed
+  history_open_lazily(false);
+  vars_set("HISTFILE", "lazy");
+  if (file_size("lazy") != -1) {
+    fprintf(stderr, "test_lazy_open: opened before first use\n");
+    history_close();
+    return 1;
+  }
+  if (add("first") != 0 || history_count() != 1 || file_size("lazy") != 6) {
+    fprintf(stderr, "test_lazy_open: first use did not open history\n");
+    history_close();
+    return 1;
+  }
+  history_close();
+
+  history_open_lazily(false);
+  if (history_count() != 1 || !entry_is(0, "first")) {
+    fprintf(stderr, "test_lazy_open: lookup did not open history\n");
+    history_close();
+    return 1;
+  }
+  history_close();
+  vars_unset("HISTFILE");
+  return 0;
+}
+
+/**
+ * @brief Run all history tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running history tests...\n");
+
+  if (!mkdtemp(g_dir) || chdir(g_dir) == -1) {
+    fprintf(stderr, "could not create scratch directory\n");
+    return 1;
+  }
+
+  failures += test_add_and_get();
+  failures += test_search();
+  failures += test_recovery();
+  failures += test_large_history();
+  failures += test_lazy_open();
+
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", g_dir);
+  if (chdir("/") == -1 || system(cmd) != 0)
+    fprintf(stderr, "warning: could not remove scratch directory\n");
+
+  if (failures == 0) {
+    printf("All history tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
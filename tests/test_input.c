@@ -0,0 +1,193 @@
+/**
+ * @file test_input.c
+ * @brief Unit tests for the buffered line reader
+ */
+
+#include "../include/shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Write data to a fresh temporary file and open it for reading
+ * @return Read descriptor positioned at the start, or -1 on failure
+ */
+static int open_with_contents(const char *data, size_t len) {
+  char path[] = "/tmp/test_input_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd == -1)
+    return -1;
+  unlink(path);
+
+  if (write(fd, data, len) != (ssize_t)len || lseek(fd, 0, SEEK_SET) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * @brief Test that lines are split at newlines, including a final line
+ * without one
+ * @return 0 on success, 1 on failure
+ */
+static int test_read_lines(void) {
+  const char data[] = "echo one\n\nls | wc\nlast";
+  const char *expected[] = {"echo one", "", "ls | wc", "last"};
+
+  int fd = open_with_contents(data, sizeof(data) - 1);
+  if (fd == -1) {
+    fprintf(stderr, "test_read_lines: setup failed\n");
+    return 1;
+  }
+
+  input_t in;
+  input_init(&in, fd);
+
+  int failed = 0;
+  char *line;
+  size_t len;
+  for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+    if (input_read_line(&in, &line, &len) != 1 ||
+        strcmp(line, expected[i]) != 0 || len != strlen(expected[i])) {
+      fprintf(stderr, "test_read_lines: line %zu wrong\n", i);
+      failed = 1;
+      break;
+    }
+  }
+
+  if (!failed && input_read_line(&in, &line, &len) != 0) {
+    fprintf(stderr, "test_read_lines: expected EOF\n");
+    failed = 1;
+  }
+
+  input_free(&in);
+  close(fd);
+  return failed;
+}
+
+/**
+ * @brief Test that lines much longer than one read chunk come back whole
+ * @return 0 on success, 1 on failure
+ */
+static int test_long_line(void) {
+  const size_t long_len = 300 * 1024;
+  char *data = malloc(long_len + 16);
+  if (!data) {
+    fprintf(stderr, "test_long_line: allocation failed\n");
+    return 1;
+  }
+
+  memcpy(data, "short\n", 6);
+  for (size_t i = 0; i < long_len; i++)
+    data[6 + i] = (char)('a' + i % 26);
+  memcpy(data + 6 + long_len, "\nend\n", 5);
+
+  int fd = open_with_contents(data, long_len + 11);
+  if (fd == -1) {
+    free(data);
+    fprintf(stderr, "test_long_line: setup failed\n");
+    return 1;
+  }
+
+  input_t in;
+  input_init(&in, fd);
+
+  int failed = 0;
+  char *line;
+  size_t len;
+  if (input_read_line(&in, &line, &len) != 1 || strcmp(line, "short") != 0) {
+    fprintf(stderr, "test_long_line: first line wrong\n");
+    failed = 1;
+  } else if (input_read_line(&in, &line, &len) != 1 || len != long_len ||
+             memcmp(line, data + 6, long_len) != 0 || line[len] != '\0') {
+    fprintf(stderr, "test_long_line: long line wrong (len %zu)\n", len);
+    failed = 1;
+  } else if (input_read_line(&in, &line, &len) != 1 ||
+             strcmp(line, "end") != 0) {
+    fprintf(stderr, "test_long_line: last line wrong\n");
+    failed = 1;
+  }
+
+  input_free(&in);
+  close(fd);
+  free(data);
+  return failed;
+}
+
+/**
+ * @brief Test reading from a pipe where lines arrive in small pieces
+ * @return 0 on success, 1 on failure
+ */
+static int test_pipe_pieces(void) {
+  int fds[2];
+  if (pipe(fds) == -1) {
+    fprintf(stderr, "test_pipe_pieces: pipe failed\n");
+    return 1;
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "test_pipe_pieces: fork failed\n");
+    close(fds[0]);
+    close(fds[1]);
+    return 1;
+  }
+  if (pid == 0) {
+    // Dribble the input out so lines span several reads
+    const char *pieces[] = {"ec", "ho a", "\nech", "o b\n", "\n"};
+    const struct timespec pause = {0, 1000000};
+    close(fds[0]);
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+      if (write(fds[1], pieces[i], strlen(pieces[i])) == -1)
+        _exit(1);
+      nanosleep(&pause, NULL);
+    }
+    _exit(0);
+  }
+  close(fds[1]);
+
+  input_t in;
+  input_init(&in, fds[0]);
+
+  int failed = 0;
+  char *line;
+  size_t len;
+  if (input_read_line(&in, &line, &len) != 1 || strcmp(line, "echo a") != 0 ||
+      input_read_line(&in, &line, &len) != 1 || strcmp(line, "echo b") != 0 ||
+      input_read_line(&in, &line, &len) != 1 || len != 0 ||
+      input_read_line(&in, &line, &len) != 0) {
+    fprintf(stderr, "test_pipe_pieces: unexpected lines\n");
+    failed = 1;
+  }
+
+  input_free(&in);
+  close(fds[0]);
+  waitpid(pid, NULL, 0);
+  return failed;
+}
+
+/**
+ * @brief Run all input reader tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running input reader tests...\n");
+
+  failures += test_read_lines();
+  failures += test_long_line();
+  failures += test_pipe_pieces();
+
+  if (failures == 0) {
+    printf("All input reader tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
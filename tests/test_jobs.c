@@ -0,0 +1,259 @@
+/**
+ * @file test_jobs.c
+ * @brief Tests for job control: process groups, the terminal, fg and bg
+ */
+
+#define _XOPEN_SOURCE 600 // posix_openpt
+
+#include "../include/shell.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Scratch directory the tests run in
+ */
+static char g_dir[] = "/tmp/test_jobs_XXXXXX";
+
+/**
+ * @brief Master side of the shell's controlling terminal
+ */
+static int g_master = -1;
+
+/**
+ * @brief Terminal the tests run on
+ */
+static int g_tty = -1;
+
+/**
+ * @brief Parse and run one command line
+ * @return Exit status, or -1 if it did not parse
+ */
+static int run(const char *line) {
+  pipeline_t pipeline;
+  if (parse_command(line, &pipeline) == -1)
+    return -1;
+  int status = execute_list(&pipeline);
+  free_pipeline(&pipeline);
+  fflush(stdout);
+  return status;
+}
+
+/**
+ * @brief Read a number a command wrote into a file
+ */
+static long read_number(const char *path) {
+  FILE *f = fopen(path, "r");
+  long value = -1;
+  if (f) {
+    if (fscanf(f, "%ld", &value) != 1)
+      value = -1;
+    fclose(f);
+  }
+  return value;
+}
+
+/**
+ * @brief Type Ctrl+C on the terminal after a delay, from a child
+ * @return Typing process, or -1 on failure
+ */
+static pid_t type_ctrl_c(long delay_ms) {
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+  nanosleep(&(struct timespec){0, delay_ms * 1000000}, NULL);
+  _exit(write(g_master, "\003", 1) == 1 ? 0 : 1);
+}
+
+/**
+ * @brief Test that job control takes the terminal
+ * @return 0 on success, 1 on failure
+ */
+static int test_control_init(void) {
+  if (jobs_control_init(g_tty) != 0 || jobs_terminal() == -1 ||
+      tcgetpgrp(g_tty) != getpid()) {
+    fprintf(stderr, "test_control_init: terminal not taken\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test that every stage of a pipeline lands in one group that owns
+ * the terminal while it runs
+ * @return 0 on success, 1 on failure
+ */
+static int test_one_group(void) {
+  // Field 5 of /proc/PID/stat is the process group, 8 the terminal's
+  const char *line =
+      "sh -c 'read a b c d e f g h rest < /proc/$$/stat; echo $e $h > one' | "
+      "sh -c 'read a b c d e rest < /proc/$$/stat; echo $e > two' | "
+      "sh -c 'read a b c d e rest < /proc/$$/stat; echo $e > three'";
+  if (run(line) != 0) {
+    fprintf(stderr, "test_one_group: pipeline failed\n");
+    return 1;
+  }
+
+  FILE *f = fopen("one", "r");
+  long group = -1, foreground = -1;
+  if (f) {
+    if (fscanf(f, "%ld %ld", &group, &foreground) != 2)
+      group = -1;
+    fclose(f);
+  }
+  if (group <= 0 || group == getpid() || foreground != group ||
+      read_number("two") != group || read_number("three") != group) {
+    fprintf(stderr, "test_one_group: group %ld (terminal %ld), %ld, %ld\n",
+            group, foreground, read_number("two"), read_number("three"));
+    return 1;
+  }
+  if (tcgetpgrp(g_tty) != getpid()) {
+    fprintf(stderr, "test_one_group: terminal not taken back\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test that Ctrl+C reaches every stage, and ends the list
+ * @return 0 on success, 1 on failure
+ */
+static int test_ctrl_c(void) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid_t typist = type_ctrl_c(200);
+  int status = run("sleep 5 | sleep 5 | sleep 5; echo not reached > after");
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  waitpid(typist, NULL, 0);
+
+  double seconds = (double)(end.tv_sec - start.tv_sec) +
+                   (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+  if (status != 130 || seconds > 2 || access("after", F_OK) == 0) {
+    fprintf(stderr, "test_ctrl_c: status %d after %.2fs\n", status, seconds);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Run a command line with its output (job notices included) sent to
+ * the terminal
+ * @return Exit status, or -1 if it did not parse
+ */
+static int run_quietly(const char *line) {
+  int saved_out = dup(STDOUT_FILENO);
+  int saved_err = dup(STDERR_FILENO);
+  dup2(g_tty, STDOUT_FILENO);
+  dup2(g_tty, STDERR_FILENO);
+  int status = run(line);
+  dup2(saved_out, STDOUT_FILENO);
+  dup2(saved_err, STDERR_FILENO);
+  close(saved_out);
+  close(saved_err);
+  return status;
+}
+
+/**
+ * @brief Test a job that stops: it is kept, and fg or bg continue it
+ * @return 0 on success, 1 on failure
+ */
+static int test_stop_fg_bg(void) {
+  // A stopped foreground job gives the terminal back and waits
+  int status = run_quietly("sh -c 'kill -TSTP $$; exit 3'");
+  job_t *job = jobs_current();
+  if (status != 128 + SIGTSTP || !job || !jobs_is_stopped(job) ||
+      tcgetpgrp(g_tty) != getpid()) {
+    fprintf(stderr, "test_stop_fg_bg: job did not stop (%d)\n", status);
+    return 1;
+  }
+  if (run_quietly("fg") != 3 || jobs_current()) {
+    fprintf(stderr, "test_stop_fg_bg: fg did not finish the job\n");
+    return 1;
+  }
+
+  // bg lets it finish unattended
+  run_quietly("sh -c 'kill -TSTP $$; exit 4'");
+  if (run_quietly("bg %1") != 0 || run("wait") != 4 || jobs_current()) {
+    fprintf(stderr, "test_stop_fg_bg: bg did not finish the job\n");
+    return 1;
+  }
+
+  if (run_quietly("fg") != 1 || run_quietly("bg %7") != 1) {
+    fprintf(stderr, "test_stop_fg_bg: missing job accepted\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Run the tests as the leader of a session on a pseudo-terminal
+ * @return Number of failures
+ */
+static int run_tests(void) {
+  if (setsid() == -1 || (g_tty = open(ptsname(g_master), O_RDWR)) == -1) {
+    fprintf(stderr, "could not get a controlling terminal\n");
+    return 1;
+  }
+
+  dup2(g_tty, STDIN_FILENO);
+  setup_signal_handlers();
+
+  int failures = test_control_init();
+  if (failures == 0) {
+    failures += test_one_group();
+    failures += test_ctrl_c();
+    failures += test_stop_fg_bg();
+  }
+  jobs_control_end();
+  return failures;
+}
+
+/**
+ * @brief Run all job control tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  printf("Running job control tests...\n");
+  fflush(stdout);
+
+  g_master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (g_master == -1 || grantpt(g_master) == -1 ||
+      unlockpt(g_master) == -1 || !mkdtemp(g_dir) || chdir(g_dir) == -1) {
+    fprintf(stderr, "could not set up a pseudo-terminal\n");
+    return 1;
+  }
+
+  // The session reports its number of failures as its exit status
+  pid_t session = fork();
+  if (session == 0)
+    _exit(run_tests());
+
+  // Keep the terminal's output drained while the session runs
+  fcntl(g_master, F_SETFL, O_NONBLOCK);
+  char drained[4096];
+  int status;
+  while (waitpid(session, &status, WNOHANG) == 0) {
+    while (read(g_master, drained, sizeof(drained)) > 0)
+      ;
+    nanosleep(&(struct timespec){0, 10000000}, NULL);
+  }
+  int failures = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", g_dir);
+  if (chdir("/") == -1 || system(cmd) != 0)
+    fprintf(stderr, "warning: could not remove scratch directory\n");
+
+  if (failures == 0) {
+    printf("All job control tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
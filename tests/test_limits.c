@@ -0,0 +1,185 @@
+/**
+ * @file test_limits.c
+ * @brief Tests for resource limits and cgroup placement of spawned stages
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Scratch directory the tests run in
+ */
+static char g_dir[] = "/tmp/test_limits_XXXXXX";
+
+/**
+ * @brief Parse and run one command line
+ * @return Exit status, or -1 if it did not parse
+ */
+static int run(const char *line) {
+  pipeline_t pipeline;
+  if (parse_command(line, &pipeline) == -1)
+    return -1;
+  int status = execute_list(&pipeline);
+  free_pipeline(&pipeline);
+  fflush(stdout);
+  return status;
+}
+
+/**
+ * @brief Compare the first line of a file with the expected text
+ */
+static bool line_is(const char *path, const char *expected) {
+  char buf[256] = "";
+  FILE *f = fopen(path, "r");
+  if (f) {
+    if (!fgets(buf, sizeof(buf), f))
+      buf[0] = '\0';
+    fclose(f);
+  }
+  buf[strcspn(buf, "\n")] = '\0';
+  if (strcmp(buf, expected) == 0)
+    return true;
+  fprintf(stderr, "  %s holds '%s', expected '%s'\n", path, buf, expected);
+  return false;
+}
+
+/**
+ * @brief Test that stages get the limits and the shell does not
+ * @return 0 on success, 1 on failure
+ */
+static int test_rlimits(void) {
+  struct rlimit before;
+  getrlimit(RLIMIT_NOFILE, &before);
+
+  if (run("set -o limit-nofile=64 -o limit-cpu=5 -o limit-as=1g") != 0 ||
+      run("sh -c 'echo $(ulimit -n) $(ulimit -Hn)' > nofile; "
+          "sh -c 'ulimit -t' > cpu; sh -c 'ulimit -v' | cat > as") != 0 ||
+      !line_is("nofile", "64 64") || !line_is("cpu", "5") ||
+      !line_is("as", "1048576")) {
+    fprintf(stderr, "test_rlimits: stages not limited\n");
+    return 1;
+  }
+
+  // The shell keeps its own
+  struct rlimit after;
+  getrlimit(RLIMIT_NOFILE, &after);
+  if (after.rlim_cur != before.rlim_cur || after.rlim_max != before.rlim_max) {
+    fprintf(stderr, "test_rlimits: the shell itself was limited\n");
+    return 1;
+  }
+
+  if (run("set +o limit-nofile +o limit-cpu +o limit-as") != 0 ||
+      limits_active()) {
+    fprintf(stderr, "test_rlimits: limits not cleared\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test option values the set builtin refuses
+ * @return 0 on success, 1 on failure
+ */
+static int test_invalid(void) {
+  if (run("set -o limit-cpu=0 2>/dev/null") != 2 ||
+      run("set -o limit-nofile=x 2>/dev/null") != 2 ||
+      run("set -o limit-as=3t 2>/dev/null") != 2 ||
+      run("set -o limit-as 2>/dev/null") != 2 ||
+      run("set -o cgroup=/tmp 2>/dev/null") != 1 ||
+      run("set -o cgroup=missing 2>/dev/null") != 1 || limits_active()) {
+    fprintf(stderr, "test_invalid: bad value accepted\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Find a cgroup v2 mount and make a child cgroup in it
+ * @return 0 on success, -1 if there is none the tests may use
+ */
+static int make_cgroup(char *path, size_t size) {
+  FILE *mounts = fopen("/proc/self/mounts", "r");
+  if (!mounts)
+    return -1;
+
+  char *line = NULL;
+  size_t cap = 0;
+  int found = -1;
+  while (found == -1 && getline(&line, &cap, mounts) != -1) {
+    char dir[200], type[32];
+    if (sscanf(line, "%*s %199s %31s", dir, type) == 2 &&
+        strcmp(type, "cgroup2") == 0) {
+      snprintf(path, size, "%s/%s", dir, strrchr(g_dir, '/') + 1);
+      found = mkdir(path, 0755);
+    }
+  }
+  free(line);
+  fclose(mounts);
+  return found;
+}
+
+/**
+ * @brief Test that stages start inside the chosen cgroup
+ * @return 0 on success, 1 on failure
+ */
+static int test_cgroup(void) {
+  char cgroup[256];
+  if (make_cgroup(cgroup, sizeof(cgroup)) == -1) {
+    printf("  no cgroup v2 mount to create a cgroup in; not tested\n");
+    return 0;
+  }
+
+  char line[512], expected[256];
+  snprintf(line, sizeof(line),
+           "set -o cgroup=%s; sh -c 'cat /proc/$$/cgroup' | tail -n 1 > group",
+           cgroup);
+  snprintf(expected, sizeof(expected), "0::/%s", strrchr(g_dir, '/') + 1);
+  int failed = run(line) != 0 || !line_is("group", expected);
+  run("set +o cgroup");
+  if (rmdir(cgroup) == -1)
+    fprintf(stderr, "warning: could not remove %s\n", cgroup);
+  if (failed || limits_active()) {
+    fprintf(stderr, "test_cgroup: stage not placed\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Run all resource limit tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running resource limit tests...\n");
+  fflush(stdout);
+
+  if (!mkdtemp(g_dir) || chdir(g_dir) == -1) {
+    fprintf(stderr, "could not create scratch directory\n");
+    return 1;
+  }
+
+  failures += test_rlimits();
+  failures += test_invalid();
+  failures += test_cgroup();
+
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", g_dir);
+  if (chdir("/") == -1 || system(cmd) != 0)
+    fprintf(stderr, "warning: could not remove scratch directory\n");
+
+  if (failures == 0) {
+    printf("All resource limit tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
@@ -0,0 +1,348 @@
+/**
+ * @file test_lineedit.c
+ * @brief Tests for the line editor and its background tab completion
+ */
+
+#define _XOPEN_SOURCE 600 // posix_openpt
+
+#include "../include/shell.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Scratch directory the tests run in
+ */
+static char g_dir[] = "/tmp/test_lineedit_XXXXXX";
+
+/**
+ * @brief Master side of the terminal the editor runs on
+ */
+static int g_master = -1;
+
+/**
+ * @brief Create a file with the given mode
+ * @return 0 on success, -1 on failure
+ */
+static int create(const char *path, mode_t mode) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+  return fd == -1 ? -1 : close(fd);
+}
+
+/**
+ * @brief Wait until every directory being listed has arrived
+ */
+static void wait_listings(void) {
+  int fds[64];
+  size_t count;
+  while ((count = complete_fds(fds, 64)) > 0) {
+    struct pollfd pfds[64];
+    for (size_t i = 0; i < count; i++)
+      pfds[i] = (struct pollfd){fds[i], POLLIN, 0};
+    poll(pfds, count, 1000);
+    complete_progress();
+  }
+}
+
+/**
+ * @brief Query completions once the listings are in, joining the names
+ * (directories with a trailing slash)
+ */
+static bool completes_to(const char *word, bool command,
+                         const char *expected) {
+  complete_result_t r;
+  if (complete_query(word, strlen(word), command, &r) == 0 && r.pending) {
+    wait_listings();
+    complete_query(word, strlen(word), command, &r);
+  }
+
+  char joined[512] = "";
+  for (size_t i = 0; i < r.count; i++) {
+    if (i > 0)
+      strcat(joined, " ");
+    strcat(joined, r.matches[i].name);
+    if (r.matches[i].dir)
+      strcat(joined, "/");
+  }
+  if (strcmp(joined, expected) == 0 && !r.pending)
+    return true;
+
+  fprintf(stderr, "  '%s' completes to '%s', expected '%s'\n", word, joined,
+          expected);
+  return false;
+}
+
+/**
+ * @brief Test file name completion and the per-prefix candidate cache
+ * @return 0 on success, 1 on failure
+ */
+static int test_file_completion(void) {
+  complete_stats_t before, after;
+  complete_stats(&before);
+
+  // The first query only starts the listing
+  complete_result_t r;
+  if (complete_query("al", 2, false, &r) != 0 || !r.pending) {
+    fprintf(stderr, "test_file_completion: listing not in the background\n");
+    return 1;
+  }
+
+  if (!completes_to("al", false, "alpdir/ alpha.txt alpine.c") ||
+      !completes_to("alp", false, "alpdir/ alpha.txt alpine.c") ||
+      !completes_to("alph", false, "alpha.txt") ||
+      !completes_to("", false, "alpdir/ alpha.txt alpine.c beta bin/") ||
+      !completes_to(".", false, ".hidden") ||
+      !completes_to("zzz", false, "")) {
+    fprintf(stderr, "test_file_completion: wrong candidates\n");
+    return 1;
+  }
+
+  // One listing served every query; longer prefixes only narrowed it
+  complete_stats(&after);
+  if (after.listers - before.listers != 1 ||
+      after.refines - before.refines < 2) {
+    fprintf(stderr, "test_file_completion: %lu listers, %lu refines\n",
+            after.listers - before.listers, after.refines - before.refines);
+    return 1;
+  }
+
+  if (!completes_to("alpdir/", false, "inner") ||
+      !completes_to("./alpdir/in", true, "inner")) {
+    fprintf(stderr, "test_file_completion: wrong subdirectory candidates\n");
+    return 1;
+  }
+
+  // A new line lists the directory again, so new files show up
+  complete_new_line();
+  create("alpaca", 0644);
+  if (!completes_to("alpa", false, "alpaca")) {
+    fprintf(stderr, "test_file_completion: stale listing after a line\n");
+    return 1;
+  }
+  unlink("alpaca");
+  return 0;
+}
+
+/**
+ * @brief Test command completion from builtins and PATH
+ * @return 0 on success, 1 on failure
+ */
+static int test_command_completion(void) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/bin", g_dir);
+  setenv("PATH", path, 1);
+  complete_new_line();
+
+  // Builtins are there at once, executables once PATH is listed
+  complete_result_t r;
+  if (complete_query("ec", 2, true, &r) != 0 || r.count != 1 ||
+      strcmp(r.matches[0].name, "echo") != 0) {
+    fprintf(stderr, "test_command_completion: builtin not offered\n");
+    return 1;
+  }
+  if (!completes_to("my", true, "mytest mytool") ||
+      !completes_to("myt", true, "mytest mytool") ||
+      !completes_to("histo", true, "history")) {
+    fprintf(stderr, "test_command_completion: wrong candidates\n");
+    return 1;
+  }
+
+  // PATH listings outlive the line
+  complete_stats_t before, after;
+  complete_stats(&before);
+  complete_new_line();
+  complete_query("my", 2, true, &r);
+  complete_stats(&after);
+  if (after.listers != before.listers || r.pending || r.count != 2) {
+    fprintf(stderr, "test_command_completion: PATH listed again\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Feed keys to the terminal from a child, pausing at each '|'
+ * @return Writer process, or -1 on failure
+ */
+static pid_t type_keys(const char *keys) {
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+
+  for (const char *p = keys; *p;) {
+    size_t len = strcspn(p, "|");
+    if (write(g_master, p, len) != (ssize_t)len)
+      _exit(1);
+    p += len;
+    if (*p == '|') {
+      p++;
+      nanosleep(&(struct timespec){0, 300000000}, NULL);
+    }
+  }
+  _exit(0);
+}
+
+/**
+ * @brief Read one line from typed keys and compare it
+ */
+static bool reads(const char *keys, int expected_status,
+                  const char *expected) {
+  pid_t writer = type_keys(keys);
+  char *line = NULL;
+  size_t len = 0;
+  int status = lineedit_read("$ ", &line, &len);
+  waitpid(writer, NULL, 0);
+
+  // Throw away what the editor drew
+  char drawn[4096];
+  while (read(g_master, drawn, sizeof(drawn)) > 0)
+    ;
+
+  if (status == expected_status &&
+      (status != 1 || (len == strlen(expected) &&
+                       memcmp(line, expected, len) == 0)))
+    return true;
+  fprintf(stderr, "  keys '%s' read %d '%.*s', expected %d '%s'\n", keys,
+          status, status == 1 ? (int)len : 0, status == 1 ? line : "",
+          expected_status, expected);
+  return false;
+}
+
+/**
+ * @brief Test editing keys on a pseudo-terminal
+ * @return 0 on success, 1 on failure
+ */
+static int test_editing(void) {
+  if (!reads("hello\r", 1, "hello") ||
+      !reads("world\001hello \r", 1, "hello world") ||
+      !reads("abc\033[D\033[DX\r", 1, "aXbc") ||
+      !reads("one two\027three\r", 1, "one three") ||
+      !reads("abcd\177\177\r", 1, "ab") ||
+      !reads("keep\033[Hcut\013\r", 1, "cut") ||
+      !reads("x\033[1;5Dy\033[F!\r", 1, "yx!") ||
+      !reads("caf\303\251s\033[D\177e\r", 1, "cafes") ||
+      !reads("typed\003", 1, "") || !reads("\004", 0, "")) {
+    fprintf(stderr, "test_editing: wrong line\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test Tab on the terminal, including a completion that waits
+ * for its listing
+ * @return 0 on success, 1 on failure
+ */
+static int test_tab(void) {
+  complete_new_line();
+  if (!reads("cat alph\t|\r", 1, "cat alpha.txt ") ||
+      !reads("cd alpd\t|\r", 1, "cd alpdir/") ||
+      !reads("ls al\t|\r", 1, "ls alp") ||
+      !reads("myt\t|o\t|\r", 1, "mytool ")) {
+    fprintf(stderr, "test_tab: wrong completion\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test Up/Down prefix search and Ctrl+R through the history
+ * @return 0 on success, 1 on failure
+ */
+static int test_history_keys(void) {
+  if (history_open("history") != 0) {
+    fprintf(stderr, "test_history_keys: could not open history\n");
+    return 1;
+  }
+  const char *entries[] = {"make test", "ls -l", "make", "git status"};
+  for (size_t i = 0; i < 4; i++)
+    history_add(entries[i], strlen(entries[i]));
+
+  int failed = !reads("\033[A\r", 1, "git status") ||
+               !reads("ma\033[A\r", 1, "make") ||
+               !reads("ma\033[A\033[A\r", 1, "make test") ||
+               !reads("ma\033[A\033[A\033[B\r", 1, "make") ||
+               !reads("ma\033[A\033[B\r", 1, "ma") ||
+               !reads("\022-l\r", 1, "ls -l") ||
+               !reads("\022ma\022\r", 1, "make test") ||
+               !reads("x\022ma\007\r", 1, "x") ||
+               !reads("\022stat\001#\r", 1, "#git status");
+  history_close();
+  if (failed) {
+    fprintf(stderr, "test_history_keys: wrong line\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Run all line editor tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running line editor tests...\n");
+
+  signal(SIGPIPE, SIG_IGN);
+  const char *path = getenv("PATH");
+  char saved_path[4096];
+  snprintf(saved_path, sizeof(saved_path), "%s", path ? path : "/usr/bin:/bin");
+  if (!mkdtemp(g_dir) || chdir(g_dir) == -1 || mkdir("alpdir", 0755) == -1 ||
+      mkdir("bin", 0755) == -1 || mkdir("bin/mysub", 0755) == -1 ||
+      create("alpha.txt", 0644) || create("alpine.c", 0644) ||
+      create("beta", 0644) || create(".hidden", 0644) ||
+      create("alpdir/inner", 0644) || create("bin/mytool", 0755) ||
+      create("bin/mytest", 0755) || create("bin/mydata", 0644)) {
+    fprintf(stderr, "could not create scratch directory\n");
+    return 1;
+  }
+
+  // The editor runs on the slave side of a pseudo-terminal
+  int slave = -1;
+  g_master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (g_master != -1 && grantpt(g_master) == 0 && unlockpt(g_master) == 0)
+    slave = open(ptsname(g_master), O_RDWR | O_NOCTTY);
+  struct termios raw;
+  if (slave == -1 || tcgetattr(slave, &raw) == -1) {
+    fprintf(stderr, "could not open a pseudo-terminal\n");
+    return 1;
+  }
+  raw.c_lflag &= ~(tcflag_t)(ICANON | ECHO | ISIG | IEXTEN);
+  raw.c_iflag &= ~(tcflag_t)(ICRNL | IXON);
+  tcsetattr(slave, TCSANOW, &raw);
+  fcntl(g_master, F_SETFL, O_NONBLOCK);
+  if (lineedit_init(slave, slave) != 0) {
+    fprintf(stderr, "editor refused the pseudo-terminal\n");
+    return 1;
+  }
+
+  failures += test_file_completion();
+  failures += test_command_completion();
+  failures += test_editing();
+  failures += test_tab();
+  failures += test_history_keys();
+  lineedit_free();
+  setenv("PATH", saved_path, 1);
+
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", g_dir);
+  if (chdir("/") == -1 || system(cmd) != 0)
+    fprintf(stderr, "warning: could not remove scratch directory\n");
+
+  if (failures == 0) {
+    printf("All line editor tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
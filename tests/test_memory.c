@@ -1,14 +1,295 @@
 /**
  * @file test_memory.c
  * @brief Unit tests for memory management and cleanup
+ *
+ * Linked with -Wl,--wrap for malloc, calloc, realloc and free, so every
+ * allocation made by the parser and the arena goes through the counting
+ * wrappers below. They track live and peak bytes, and can fail the Nth
+ * allocation to drive the parser's error paths.
  */
 
+#define _GNU_SOURCE
+
 #include "../include/shell.h"
 #include <assert.h>
+#include <dirent.h>
+#include <malloc.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/**
+ * @brief Seed inputs, one per file as AFL and libFuzzer expect
+ */
+#define CORPUS_DIR "corpus/parser"
+
+/**
+ * @brief Largest corpus entry read
+ */
+#define CORPUS_MAX_INPUT (64 * 1024)
+
+/**
+ * @brief Mutated inputs tried per run (fixed seed, so runs are repeatable)
+ */
+#define MUTATION_ROUNDS 20000
+
+/**
+ * @brief Largest lines built by test_linear_growth, well past the limits
+ * of 256 words and 64 stages the parser used to have
+ */
+#define LINEAR_MAX_WORDS 2000
+#define LINEAR_MAX_STAGES 500
+
+/**
+ * @brief Peak parser memory allowed for a line: a fixed base plus a cost
+ * per input byte, per word (argv slot or file name) and per stage
+ */
+#define BUDGET_BASE 1024
+#define BUDGET_PER_BYTE 6
+#define BUDGET_PER_WORD 128
+#define BUDGET_PER_STAGE 384
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+/**
+ * @brief Allocation accounting shared by the wrappers
+ */
+static struct {
+  size_t allocs;   /**< Successful allocations */
+  size_t live;     /**< Bytes currently allocated */
+  size_t peak;     /**< Highest live since the last reset */
+  long fail_after; /**< Allocations left before one fails (-1: never) */
+  bool failed;     /**< An allocation was failed on purpose */
+} g_mem = {0, 0, 0, -1, false};
+
+/**
+ * @brief Decide whether the next allocation is failed on purpose
+ */
+static bool should_fail(void) {
+  if (g_mem.fail_after < 0)
+    return false;
+  if (g_mem.fail_after-- > 0)
+    return false;
+  g_mem.failed = true;
+  return true;
+}
+
+/**
+ * @brief Account for a new allocation
+ */
+static void *track(void *ptr) {
+  if (ptr) {
+    g_mem.allocs++;
+    g_mem.live += malloc_usable_size(ptr);
+    if (g_mem.live > g_mem.peak)
+      g_mem.peak = g_mem.live;
+  }
+  return ptr;
+}
+
+void *__wrap_malloc(size_t size) {
+  return should_fail() ? NULL : track(__real_malloc(size));
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  return should_fail() ? NULL : track(__real_calloc(count, size));
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  if (should_fail())
+    return NULL;
+  size_t old = ptr ? malloc_usable_size(ptr) : 0;
+  void *grown = __real_realloc(ptr, size);
+  if (grown) {
+    g_mem.live -= old;
+    g_mem.allocs--; // track() counts it again
+    track(grown);
+  }
+  return grown;
+}
+
+void __wrap_free(void *ptr) {
+  if (ptr)
+    g_mem.live -= malloc_usable_size(ptr);
+  __real_free(ptr);
+}
+
+/**
+ * @brief Corpus entries loaded from CORPUS_DIR
+ */
+static struct {
+  char **inputs; /**< Input bytes (not NUL-terminated) */
+  size_t *lens;  /**< Input lengths */
+  char **names;  /**< File names for messages */
+  size_t count;  /**< Number of inputs */
+} g_corpus;
+
+/**
+ * @brief Outcome of parsing one input under the accounting wrappers
+ */
+typedef struct {
+  int result;    /**< Return value of parse_command_len */
+  size_t allocs; /**< Allocations made while parsing */
+  size_t peak;   /**< Peak bytes while parsing */
+  size_t words;  /**< Upper bound on words in the input */
+  size_t stages; /**< Upper bound on stages in the input */
+  size_t leaked; /**< Bytes still live after free_pipeline */
+} parse_usage_t;
+
+/**
+ * @brief Bound the words and stages of an input without parsing it
+ *
+ * Failed parses must stay within budget too, so the shape comes from the
+ * raw bytes: every run of non-blanks and every operator may start a word,
+ * and every |, ; or & may start a stage (or a pipeline of a list).
+ */
+static void input_shape(const char *input, size_t len, size_t *words,
+                        size_t *stages) {
+  *words = 0;
+  *stages = 1;
+  bool in_word = false;
+  for (size_t i = 0; i < len; i++) {
+    char c = input[i];
+    bool blank = c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    if (c != '\0' && strchr("|<>&;", c)) {
+      (*words)++;
+      *stages += c == '|' || c == ';' || c == '&';
+    }
+    if (!blank && !in_word)
+      (*words)++;
+    in_word = !blank;
+  }
+}
+
+/**
+ * @brief Parse an input from a clean slate, then free it and check that
+ * every byte came back
+ * @param fail_after Allocations to allow before failing one (-1: never)
+ */
+static parse_usage_t measure_parse(const char *input, size_t len,
+                                   long fail_after) {
+  parse_usage_t usage = {0};
+
+  // No spare arena block: every byte the parse needs shows up
+  arena_trim();
+  size_t base = g_mem.live;
+  g_mem.allocs = 0;
+  g_mem.peak = base;
+  g_mem.fail_after = fail_after;
+  g_mem.failed = false;
+
+  pipeline_t pipeline;
+  usage.result = parse_command_len(input, len, &pipeline);
+  g_mem.fail_after = -1;
+  usage.allocs = g_mem.allocs;
+  usage.peak = g_mem.peak - base;
+
+  input_shape(input, len, &usage.words, &usage.stages);
+  if (usage.result == 0)
+    free_pipeline(&pipeline);
+
+  arena_trim();
+  usage.leaked = g_mem.live - base;
+  return usage;
+}
+
+/**
+ * @brief Bytes a parse of this shape may peak at
+ */
+static size_t parse_budget(size_t len, const parse_usage_t *usage) {
+  return BUDGET_BASE + BUDGET_PER_BYTE * len + BUDGET_PER_WORD * usage->words +
+         BUDGET_PER_STAGE * usage->stages;
+}
+
+/**
+ * @brief Check budget and leaks for one parse
+ * @return 0 if within bounds, 1 otherwise (with a message)
+ */
+static int check_usage(const char *test, const char *name, size_t len,
+                       const parse_usage_t *usage) {
+  if (usage->leaked) {
+    fprintf(stderr, "%s: %s: %zu bytes leaked\n", test, name, usage->leaked);
+    return 1;
+  }
+  if (usage->peak > parse_budget(len, usage)) {
+    fprintf(stderr,
+            "%s: %s: peak %zu bytes over budget %zu (%zu bytes, %zu words, "
+            "%zu stages)\n",
+            test, name, usage->peak, parse_budget(len, usage), len,
+            usage->words, usage->stages);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Load every file in CORPUS_DIR
+ * @return 0 on success, -1 if the corpus cannot be read
+ */
+static int load_corpus(void) {
+  DIR *dir = opendir(CORPUS_DIR);
+  if (!dir) {
+    perror(CORPUS_DIR);
+    return -1;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    if (entry->d_name[0] == '.')
+      continue;
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", CORPUS_DIR, entry->d_name);
+    FILE *file = fopen(path, "rb");
+    if (!file)
+      continue;
+
+    char *input = malloc(CORPUS_MAX_INPUT);
+    size_t len = input ? fread(input, 1, CORPUS_MAX_INPUT, file) : 0;
+    fclose(file);
+
+    size_t n = g_corpus.count + 1;
+    char **inputs = realloc(g_corpus.inputs, n * sizeof(char *));
+    if (inputs)
+      g_corpus.inputs = inputs;
+    size_t *lens = realloc(g_corpus.lens, n * sizeof(size_t));
+    if (lens)
+      g_corpus.lens = lens;
+    char **names = realloc(g_corpus.names, n * sizeof(char *));
+    if (names)
+      g_corpus.names = names;
+    if (!input || !inputs || !lens || !names) {
+      free(input);
+      closedir(dir);
+      return -1;
+    }
+
+    g_corpus.inputs[g_corpus.count] = input;
+    g_corpus.lens[g_corpus.count] = len;
+    g_corpus.names[g_corpus.count] = strdup(entry->d_name);
+    g_corpus.count++;
+  }
+  closedir(dir);
+  return g_corpus.count ? 0 : -1;
+}
+
+/**
+ * @brief Free the loaded corpus
+ */
+static void free_corpus(void) {
+  for (size_t i = 0; i < g_corpus.count; i++) {
+    free(g_corpus.inputs[i]);
+    free(g_corpus.names[i]);
+  }
+  free(g_corpus.inputs);
+  free(g_corpus.lens);
+  free(g_corpus.names);
+}
+
 /**
  * @brief Test that free_pipeline handles NULL gracefully
  * @return 0 on success, 1 on failure
@@ -88,6 +369,265 @@ static int test_free_pipeline_with_redirections(void) {
   return 0;
 }
 
+/**
+ * @brief Test that a typical pipeline is built from a single arena block
+ * @return 0 on success, 1 on failure
+ */
+static int test_pipeline_single_block(void) {
+  pipeline_t pipeline;
+  int result = parse_command("cat < in.txt | sort -u | wc -l > out", &pipeline);
+
+  if (result != 0) {
+    fprintf(stderr, "test_pipeline_single_block: parse failed\n");
+    return 1;
+  }
+
+  if (!pipeline.arena.head || pipeline.arena.head->next != NULL) {
+    fprintf(stderr, "test_pipeline_single_block: expected one arena block\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+
+  free_pipeline(&pipeline);
+
+  if (pipeline.arena.head != NULL) {
+    fprintf(stderr, "test_pipeline_single_block: arena not released\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Test that the arena grows past its first block on large input
+ * @return 0 on success, 1 on failure
+ */
+static int test_arena_growth(void) {
+  arena_t arena = {0};
+  char *chunks[64];
+
+  for (int i = 0; i < 64; i++) {
+    chunks[i] = arena_alloc(&arena, 100);
+    if (!chunks[i]) {
+      fprintf(stderr, "test_arena_growth: allocation failed\n");
+      arena_release(&arena);
+      return 1;
+    }
+    memset(chunks[i], i, 100);
+  }
+
+  // Earlier allocations must survive the arena growing new blocks
+  for (int i = 0; i < 64; i++) {
+    if (chunks[i][0] != (char)i || chunks[i][99] != (char)i) {
+      fprintf(stderr, "test_arena_growth: chunk %d corrupted\n", i);
+      arena_release(&arena);
+      return 1;
+    }
+  }
+
+  char *copy = arena_strndup(&arena, "hello world", 5);
+  if (!copy || strcmp(copy, "hello") != 0) {
+    fprintf(stderr, "test_arena_growth: strndup mismatch\n");
+    arena_release(&arena);
+    return 1;
+  }
+
+  arena_release(&arena);
+  if (arena.head != NULL) {
+    fprintf(stderr, "test_arena_growth: arena not reset\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Test the memory budget and leak freedom over the seed corpus
+ * @return 0 on success, 1 on failure
+ */
+static int test_corpus_budget(void) {
+  int failures = 0;
+  for (size_t i = 0; i < g_corpus.count; i++) {
+    parse_usage_t usage =
+        measure_parse(g_corpus.inputs[i], g_corpus.lens[i], -1);
+    failures += check_usage("test_corpus_budget", g_corpus.names[i],
+                            g_corpus.lens[i], &usage);
+  }
+  return failures ? 1 : 0;
+}
+
+/**
+ * @brief Test that failing any single allocation leaks nothing
+ *
+ * Every corpus entry is parsed with its first, second, ... allocation
+ * failing until a parse gets through without hitting the failure.
+ *
+ * @return 0 on success, 1 on failure
+ */
+static int test_allocation_failures(void) {
+  int failures = 0;
+  for (size_t i = 0; i < g_corpus.count; i++) {
+    for (long n = 0;; n++) {
+      parse_usage_t usage =
+          measure_parse(g_corpus.inputs[i], g_corpus.lens[i], n);
+      bool failed = g_mem.failed;
+
+      if (usage.leaked) {
+        fprintf(stderr, "test_allocation_failures: %s: %zu bytes leaked "
+                        "with allocation %ld failing\n",
+                g_corpus.names[i], usage.leaked, n);
+        failures++;
+        break;
+      }
+      if (failed && usage.result != -1) {
+        fprintf(stderr, "test_allocation_failures: %s: allocation %ld "
+                        "failed but the parse succeeded\n",
+                g_corpus.names[i], n);
+        failures++;
+        break;
+      }
+      if (!failed)
+        break;
+    }
+  }
+  return failures ? 1 : 0;
+}
+
+/**
+ * @brief Small deterministic PRNG (xorshift64)
+ */
+static uint64_t next_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+/**
+ * @brief Mutate a buffer in place the way AFL's havoc stage would
+ * @return New length (at most cap)
+ */
+static size_t mutate(char *buf, size_t len, size_t cap, uint64_t *rng) {
+  static const char interesting[] = "|<>&;'\"\\ #\t\n";
+  int steps = 1 + (int)(next_random(rng) % 4);
+
+  for (int s = 0; s < steps; s++) {
+    size_t pos = len ? next_random(rng) % len : 0;
+    switch (next_random(rng) % 5) {
+    case 0: // flip a bit
+      if (len)
+        buf[pos] ^= (char)(1 << (next_random(rng) % 8));
+      break;
+    case 1: // overwrite with a shell metacharacter
+      if (len)
+        buf[pos] = interesting[next_random(rng) % (sizeof(interesting) - 1)];
+      break;
+    case 2: // insert a metacharacter
+      if (len < cap) {
+        memmove(buf + pos + 1, buf + pos, len - pos);
+        buf[pos] = interesting[next_random(rng) % (sizeof(interesting) - 1)];
+        len++;
+      }
+      break;
+    case 3: // delete a span
+      if (len) {
+        size_t n = 1 + next_random(rng) % (len - pos);
+        memmove(buf + pos, buf + pos + n, len - pos - n);
+        len -= n;
+      }
+      break;
+    case 4: // duplicate a span
+      if (len) {
+        size_t n = 1 + next_random(rng) % (len - pos);
+        if (n > cap - len)
+          n = cap - len;
+        memmove(buf + pos + n, buf + pos, len - pos);
+        len += n;
+      }
+      break;
+    }
+  }
+  return len;
+}
+
+/**
+ * @brief Test budget and leak freedom over mutated corpus entries
+ * @return 0 on success, 1 on failure
+ */
+static int test_mutated_corpus(void) {
+  static char buf[2 * CORPUS_MAX_INPUT];
+  uint64_t rng = 0x9e3779b97f4a7c15u;
+  int failures = 0;
+
+  for (int round = 0; round < MUTATION_ROUNDS && failures < 5; round++) {
+    size_t i = next_random(&rng) % g_corpus.count;
+    size_t len = g_corpus.lens[i];
+    memcpy(buf, g_corpus.inputs[i], len);
+    len = mutate(buf, len, sizeof(buf), &rng);
+
+    // Every 16th input also sees one allocation fail part way through
+    long fail_after = round % 16 == 0 ? (long)(next_random(&rng) % 4) : -1;
+    parse_usage_t usage = measure_parse(buf, len, fail_after);
+
+    char name[64];
+    snprintf(name, sizeof(name), "round %d of %s", round, g_corpus.names[i]);
+    if (fail_after >= 0) {
+      if (usage.leaked) {
+        fprintf(stderr, "test_mutated_corpus: %s: %zu bytes leaked\n", name,
+                usage.leaked);
+        failures++;
+      }
+      continue;
+    }
+    failures += check_usage("test_mutated_corpus", name, len, &usage);
+  }
+  return failures ? 1 : 0;
+}
+
+/**
+ * @brief Test that memory and allocation counts grow linearly with input
+ * @return 0 on success, 1 on failure
+ */
+static int test_linear_growth(void) {
+  static char line[64 * 1024];
+  int failures = 0;
+
+  // Ever more words in one command, then ever more stages
+  for (int shape = 0; shape < 2; shape++) {
+    size_t len = 0;
+    int limit = shape == 0 ? LINEAR_MAX_WORDS : LINEAR_MAX_STAGES;
+    for (int n = 1; n <= limit; n++) {
+      if (shape == 0)
+        len += (size_t)sprintf(line + len, " w%d", n);
+      else
+        len += (size_t)sprintf(line + len, "%sc%d", n > 1 ? " | " : "", n);
+      parse_usage_t usage = measure_parse(line, len, -1);
+
+      char name[32];
+      snprintf(name, sizeof(name), "%s x%d", shape ? "stages" : "words", n);
+      if (usage.result != 0) {
+        fprintf(stderr, "test_linear_growth: %s: parse failed\n", name);
+        return 1;
+      }
+      failures += check_usage("test_linear_growth", name, len, &usage);
+
+      // The arena doubles its blocks, so mallocs grow logarithmically
+      size_t log_len = 0;
+      while (((size_t)1 << log_len) < len)
+        log_len++;
+      if (usage.allocs > 2 + log_len) {
+        fprintf(stderr, "test_linear_growth: %s: %zu allocations\n", name,
+                usage.allocs);
+        failures++;
+      }
+      if (failures)
+        return 1;
+    }
+  }
+  return 0;
+}
+
 /**
  * @brief Run all memory management tests
  * @return 0 if all tests pass, 1 if any test fails
@@ -101,6 +641,19 @@ int main(void) {
   failures += test_free_pipeline_cleanup();
   failures += test_free_pipeline_multiple_commands();
   failures += test_free_pipeline_with_redirections();
+  failures += test_pipeline_single_block();
+  failures += test_arena_growth();
+
+  if (load_corpus() == -1) {
+    fprintf(stderr, "cannot load the parser corpus from %s\n", CORPUS_DIR);
+    failures++;
+  } else {
+    failures += test_corpus_budget();
+    failures += test_allocation_failures();
+    failures += test_mutated_corpus();
+  }
+  failures += test_linear_growth();
+  free_corpus();
 
   if (failures == 0) {
     printf("All memory management tests passed!\n");
@@ -0,0 +1,328 @@
+/**
+ * @file test_mover.c
+ * @brief Unit tests for the in-shell cat/tee data mover
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/shell.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Scratch directory for test files
+ */
+static char g_dir[] = "/tmp/test_mover_XXXXXX";
+
+/**
+ * @brief Set by the SIGINT handler, like the shell's flag
+ */
+static volatile sig_atomic_t g_interrupted = 0;
+
+/**
+ * @brief The mover polls this to stop on Ctrl+C
+ */
+bool shell_interrupted(void) { return g_interrupted != 0; }
+
+/**
+ * @brief Record Ctrl+C
+ */
+static void sigint_handler(int sig) {
+  (void)sig;
+  g_interrupted = 1;
+}
+
+/**
+ * @brief Build a path inside the scratch directory
+ */
+static const char *scratch(const char *name) {
+  static char path[2][256];
+  static int next = 0;
+  next ^= 1;
+  snprintf(path[next], sizeof(path[next]), "%s/%s", g_dir, name);
+  return path[next];
+}
+
+/**
+ * @brief Create a file with the given contents
+ * @return 0 on success, -1 on failure
+ */
+static int write_file(const char *path, const char *data) {
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return -1;
+  fputs(data, f);
+  return fclose(f);
+}
+
+/**
+ * @brief Read up to size - 1 bytes from fd into a NUL-terminated buffer
+ */
+static void read_fd(int fd, char *buf, size_t size) {
+  size_t len = 0;
+  ssize_t n;
+  while (len < size - 1 && (n = read(fd, buf + len, size - 1 - len)) > 0)
+    len += (size_t)n;
+  buf[len] = '\0';
+}
+
+/**
+ * @brief Read a whole (small) file into buf
+ */
+static void read_file(const char *path, char *buf, size_t size) {
+  buf[0] = '\0';
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return;
+  read_fd(fd, buf, size);
+  close(fd);
+}
+
+/**
+ * @brief Test which stages the mover accepts
+ * @return 0 on success, 1 on failure
+ */
+static int test_handles(void) {
+  struct {
+    char *argv[4];
+    char *input_file;
+    bool from_pipe;
+    bool expected;
+  } cases[] = {
+      {{"cat", "a", "b", NULL}, NULL, false, true},
+      {{"cat", NULL}, NULL, true, true},
+      {{"cat", NULL}, "in", false, true},
+      {{"cat", NULL}, NULL, false, false}, // would read the shell's stdin
+      {{"cat", "-n", "a", NULL}, NULL, false, false},
+      {{"cat", "-", NULL}, NULL, true, false},
+      {{"tee", "out", NULL}, NULL, true, true},
+      {{"tee", "a", "b", NULL}, NULL, true, false},
+      {{"tee", "out", NULL}, NULL, false, false},
+      {{"grep", "x", NULL}, NULL, true, false},
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    redir_t in = {REDIR_OPEN, STDIN_FILENO, -1, O_RDONLY,
+                  cases[i].input_file, NULL};
+    command_t cmd = {0};
+    cmd.argv = cases[i].argv;
+    if (cases[i].input_file) {
+      cmd.redirs = &in;
+      cmd.num_redirs = 1;
+    }
+    if (mover_handles(&cmd, cases[i].from_pipe) != cases[i].expected) {
+      fprintf(stderr, "test_handles: case %zu wrong\n", i);
+      return 1;
+    }
+  }
+
+  // Redirections of other descriptors are left to the real command
+  char *argv[] = {"cat", "a", NULL};
+  redir_t err = {REDIR_OPEN, STDERR_FILENO, -1, O_WRONLY, "/dev/null",
+                 NULL};
+  command_t cmd = {.argv = argv, .redirs = &err, .num_redirs = 1};
+  if (mover_handles(&cmd, false)) {
+    fprintf(stderr, "test_handles: stderr redirection accepted\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test cat of several files into a regular file and a pipe
+ * @return 0 on success, 1 on failure
+ */
+static int test_cat_files(void) {
+  char a[256], b[256];
+  snprintf(a, sizeof(a), "%s", scratch("a"));
+  snprintf(b, sizeof(b), "%s", scratch("b"));
+  if (write_file(a, "alpha\n") || write_file(b, "beta\n")) {
+    fprintf(stderr, "test_cat_files: setup failed\n");
+    return 1;
+  }
+
+  char *argv[] = {"cat", a, b, NULL};
+  command_t cmd = {0};
+  cmd.argv = argv;
+
+  // Regular file to regular file
+  int out = open(scratch("out"), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int status = mover_run(&cmd, STDIN_FILENO, out);
+  close(out);
+
+  char buf[64];
+  read_file(scratch("out"), buf, sizeof(buf));
+  if (status != 0 || strcmp(buf, "alpha\nbeta\n") != 0) {
+    fprintf(stderr, "test_cat_files: file copy got '%s'\n", buf);
+    return 1;
+  }
+
+  // Regular file into a pipe
+  int fds[2];
+  if (pipe(fds) == -1) {
+    fprintf(stderr, "test_cat_files: pipe failed\n");
+    return 1;
+  }
+  status = mover_run(&cmd, STDIN_FILENO, fds[1]);
+  close(fds[1]);
+  read_fd(fds[0], buf, sizeof(buf));
+  close(fds[0]);
+  if (status != 0 || strcmp(buf, "alpha\nbeta\n") != 0) {
+    fprintf(stderr, "test_cat_files: pipe copy got '%s'\n", buf);
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Test missing operands and append outputs (no splice possible)
+ * @return 0 on success, 1 on failure
+ */
+static int test_cat_errors_and_append(void) {
+  char a[256], missing[256];
+  snprintf(a, sizeof(a), "%s", scratch("a"));
+  snprintf(missing, sizeof(missing), "%s", scratch("missing"));
+
+  char *argv[] = {"cat", missing, a, NULL};
+  command_t cmd = {0};
+  cmd.argv = argv;
+
+  int out = open(scratch("log"), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  int first = mover_run(&cmd, STDIN_FILENO, out);
+  int second = mover_run(&cmd, STDIN_FILENO, out);
+  close(out);
+
+  char buf[64];
+  read_file(scratch("log"), buf, sizeof(buf));
+  if (first != 1 || second != 1 || strcmp(buf, "alpha\nalpha\n") != 0) {
+    fprintf(stderr, "test_cat_errors_and_append: status %d, got '%s'\n",
+            first, buf);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test tee from one pipe into another pipe and a file
+ * @return 0 on success, 1 on failure
+ */
+static int test_tee(void) {
+  int in[2], out[2];
+  if (pipe(in) == -1 || pipe(out) == -1) {
+    fprintf(stderr, "test_tee: pipe failed\n");
+    return 1;
+  }
+
+  const char data[] = "one\ntwo\nthree\n";
+  if (write(in[1], data, strlen(data)) != (ssize_t)strlen(data)) {
+    fprintf(stderr, "test_tee: write failed\n");
+    return 1;
+  }
+  close(in[1]);
+
+  char file[256];
+  snprintf(file, sizeof(file), "%s", scratch("teed"));
+  char *argv[] = {"tee", file, NULL};
+  command_t cmd = {0};
+  cmd.argv = argv;
+
+  int status = mover_run(&cmd, in[0], out[1]);
+  close(in[0]);
+  close(out[1]);
+
+  char piped[64], saved[64];
+  read_fd(out[0], piped, sizeof(piped));
+  close(out[0]);
+  read_file(file, saved, sizeof(saved));
+
+  if (status != 0 || strcmp(piped, data) != 0 || strcmp(saved, data) != 0) {
+    fprintf(stderr, "test_tee: pipe '%s', file '%s'\n", piped, saved);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test that Ctrl+C stops a cat blocked on a pipe nobody writes to
+ * @return 0 on success, 1 on failure
+ */
+static int test_interrupt(void) {
+  // The shell installs its handler with SA_RESTART
+  struct sigaction sa;
+  sa.sa_handler = sigint_handler;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  int in[2];
+  if (sigaction(SIGINT, &sa, NULL) == -1 || pipe(in) == -1) {
+    fprintf(stderr, "test_interrupt: setup failed\n");
+    return 1;
+  }
+  int out = open(scratch("stalled"), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  pid_t typist = fork();
+  if (typist == 0) {
+    nanosleep(&(struct timespec){0, 100000000}, NULL);
+    kill(getppid(), SIGINT);
+    _exit(0);
+  }
+
+  // A cat that never returns is killed by the alarm and fails the test
+  char *argv[] = {"cat", NULL};
+  command_t cmd = {0};
+  cmd.argv = argv;
+  alarm(5);
+  int status = mover_run(&cmd, in[0], out);
+  alarm(0);
+  waitpid(typist, NULL, 0);
+  close(in[0]);
+  close(in[1]);
+  close(out);
+  g_interrupted = 0;
+
+  if (status != 128 + SIGINT) {
+    fprintf(stderr, "test_interrupt: status %d\n", status);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Run all data mover tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running data mover tests...\n");
+
+  if (!mkdtemp(g_dir)) {
+    fprintf(stderr, "could not create scratch directory\n");
+    return 1;
+  }
+
+  failures += test_handles();
+  failures += test_cat_files();
+  failures += test_cat_errors_and_append();
+  failures += test_tee();
+  failures += test_interrupt();
+
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", g_dir);
+  if (system(cmd) != 0)
+    fprintf(stderr, "warning: could not remove scratch directory\n");
+
+  if (failures == 0) {
+    printf("All data mover tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
@@ -0,0 +1,168 @@
+/**
+ * @file test_parallel.c
+ * @brief Tests for the parallel job runner
+ */
+
+#define _GNU_SOURCE // memfd_create
+
+#include "../include/shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Result of one captured run
+ */
+typedef struct {
+  int status;     /**< Return value of parallel_run */
+  char out[4096]; /**< Everything written to stdout */
+  double seconds; /**< Wall-clock time of the run */
+} run_result_t;
+
+/**
+ * @brief Run parallel with stdout captured
+ * @param opts Options to run with
+ * @param stdin_text Text to feed as stdin, or NULL to leave stdin alone
+ * @param result Output status, captured text and elapsed time
+ * @return 0 on success, -1 if the capture could not be set up
+ */
+static int run_captured(const parallel_opts_t *opts, const char *stdin_text,
+                        run_result_t *result) {
+  int capture = memfd_create("capture", 0);
+  int saved_out = dup(STDOUT_FILENO);
+  int saved_in = dup(STDIN_FILENO);
+  if (capture == -1 || saved_out == -1 || saved_in == -1)
+    return -1;
+
+  if (stdin_text) {
+    int fds[2];
+    if (pipe(fds) == -1)
+      return -1;
+    if (write(fds[1], stdin_text, strlen(stdin_text)) == -1)
+      return -1;
+    close(fds[1]);
+    dup2(fds[0], STDIN_FILENO);
+    close(fds[0]);
+  }
+
+  struct timespec start, end;
+  fflush(stdout);
+  dup2(capture, STDOUT_FILENO);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  result->status = parallel_run(opts);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  fflush(stdout);
+  dup2(saved_out, STDOUT_FILENO);
+  dup2(saved_in, STDIN_FILENO);
+  close(saved_out);
+  close(saved_in);
+
+  result->seconds = (double)(end.tv_sec - start.tv_sec) +
+                    (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+  ssize_t n = pread(capture, result->out, sizeof(result->out) - 1, 0);
+  result->out[n > 0 ? n : 0] = '\0';
+  close(capture);
+  return 0;
+}
+
+/**
+ * @brief Test that no more than -j jobs run at once, and that a free slot
+ * is refilled at once
+ * @return 0 on success, 1 on failure
+ */
+static int test_concurrency(void) {
+  char *command[] = {"sleep", NULL};
+  char *inputs[] = {"0.2", "0.2", "0.2", "0.2", "0.2", "0.2", NULL};
+  parallel_opts_t opts = {2, false, false, command, 1, inputs};
+  run_result_t result;
+
+  // Three rounds of two jobs
+  if (run_captured(&opts, NULL, &result) == -1 || result.status != 0 ||
+      result.seconds < 0.55) {
+    fprintf(stderr, "test_concurrency: -j 2 took %.2fs\n", result.seconds);
+    return 1;
+  }
+
+  // All six at once
+  opts.jobs = 6;
+  if (run_captured(&opts, NULL, &result) == -1 || result.status != 0 ||
+      result.seconds > 0.55) {
+    fprintf(stderr, "test_concurrency: -j 6 took %.2fs\n", result.seconds);
+    return 1;
+  }
+
+  // One long job does not hold the short ones behind it: 0.5s in all,
+  // where waiting for the jobs in start order would take 0.7s
+  char *mixed[] = {"0.5", "0.1", "0.1", "0.1", "0.1", NULL};
+  opts.jobs = 2;
+  opts.inputs = mixed;
+  if (run_captured(&opts, NULL, &result) == -1 || result.seconds > 0.65) {
+    fprintf(stderr, "test_concurrency: queue stalled (%.2fs)\n",
+            result.seconds);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test templates, grouped output in input order and failure counts
+ * @return 0 on success, 1 on failure
+ */
+static int test_output_and_status(void) {
+  char *command[] = {"sh", "-c", "sleep {}; echo {}", NULL};
+  char *inputs[] = {"0.3", "0.1", "0.2", "0", NULL};
+  parallel_opts_t opts = {4, true, true, command, 3, inputs};
+  run_result_t result;
+
+  if (run_captured(&opts, NULL, &result) == -1 || result.status != 0 ||
+      strcmp(result.out, "0.3\n0.1\n0.2\n0\n") != 0) {
+    fprintf(stderr, "test_output_and_status: -k gave '%s'\n", result.out);
+    return 1;
+  }
+
+  // Without {} the input is appended; -g alone prints as jobs finish
+  char *echo[] = {"echo", "n", NULL};
+  char *words[] = {"b", NULL};
+  parallel_opts_t grouped = {0, true, false, echo, 2, words};
+  if (run_captured(&grouped, NULL, &result) == -1 ||
+      strcmp(result.out, "n b\n") != 0) {
+    fprintf(stderr, "test_output_and_status: append gave '%s'\n",
+            result.out);
+    return 1;
+  }
+
+  // Lines of stdin as command lines; blank lines are skipped
+  const char *text = "echo a && echo b\n\nfalse\nexit 3\necho c | tr c d\n";
+  parallel_opts_t lines = {3, true, true, NULL, 0, NULL};
+  if (run_captured(&lines, text, &result) == -1 ||
+      result.status != 2 || strcmp(result.out, "a\nb\nd\n") != 0) {
+    fprintf(stderr, "test_output_and_status: lines gave %d '%s'\n",
+            result.status, result.out);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Run all parallel runner tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running parallel tests...\n");
+
+  failures += test_concurrency();
+  failures += test_output_and_status();
+
+  if (failures == 0) {
+    printf("All parallel tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
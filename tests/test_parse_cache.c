@@ -0,0 +1,166 @@
+/**
+ * @file test_parse_cache.c
+ * @brief Unit tests for the parsed pipeline cache
+ */
+
+#include "../include/shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Parse a NUL-terminated line through the cache
+ */
+static const pipeline_t *cached_parse(const char *line) {
+  const pipeline_t *pipeline = NULL;
+  if (parse_cache_parse(line, strlen(line), &pipeline) == -1)
+    return NULL;
+  return pipeline;
+}
+
+/**
+ * @brief Test that a repeated line is served from the cache
+ * @return 0 on success, 1 on failure
+ */
+static int test_repeated_line_hits(void) {
+  parse_cache_resize(8);
+  parse_cache_reset_stats();
+
+  const pipeline_t *first = cached_parse("ls -l | wc");
+  const pipeline_t *second = cached_parse("ls -l | wc");
+  const pipeline_t *other = cached_parse("ls -l |  wc");
+
+  parse_cache_stats_t stats;
+  parse_cache_stats(&stats);
+
+  int failed = 0;
+  if (!first || first != second || !other || other == first) {
+    fprintf(stderr, "test_repeated_line_hits: wrong pipelines returned\n");
+    failed = 1;
+  } else if (first->num_commands != 2 ||
+             strcmp(first->commands[1].argv[0], "wc") != 0) {
+    fprintf(stderr, "test_repeated_line_hits: cached pipeline wrong\n");
+    failed = 1;
+  } else if (stats.hits != 1 || stats.misses != 2 || stats.entries != 2) {
+    fprintf(stderr, "test_repeated_line_hits: hits %lu misses %lu\n",
+            stats.hits, stats.misses);
+    failed = 1;
+  }
+
+  parse_cache_release(first);
+  parse_cache_release(second);
+  parse_cache_release(other);
+  return failed;
+}
+
+/**
+ * @brief Test that the least recently used entry is evicted first
+ * @return 0 on success, 1 on failure
+ */
+static int test_lru_eviction(void) {
+  parse_cache_resize(2);
+  parse_cache_reset_stats();
+
+  parse_cache_release(cached_parse("echo a"));
+  parse_cache_release(cached_parse("echo b"));
+  parse_cache_release(cached_parse("echo a")); // a is now most recent
+  parse_cache_release(cached_parse("echo c")); // evicts b
+  parse_cache_release(cached_parse("echo a"));
+  parse_cache_release(cached_parse("echo b"));
+
+  parse_cache_stats_t stats;
+  parse_cache_stats(&stats);
+  if (stats.hits != 2 || stats.misses != 4 || stats.evictions != 2) {
+    fprintf(stderr, "test_lru_eviction: hits %lu misses %lu evictions %lu\n",
+            stats.hits, stats.misses, stats.evictions);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test that a pipeline evicted while in use stays valid
+ * @return 0 on success, 1 on failure
+ */
+static int test_evicted_while_in_use(void) {
+  parse_cache_resize(1);
+
+  const pipeline_t *held = cached_parse("cat < in > out");
+  parse_cache_release(cached_parse("echo other")); // evicts held
+  parse_cache_clear();
+
+  int failed = 0;
+  if (!held || held->num_commands != 1 ||
+      held->commands[0].num_redirs != 2 ||
+      strcmp(held->commands[0].redirs[0].path, "in") != 0 ||
+      strcmp(held->commands[0].redirs[1].path, "out") != 0) {
+    fprintf(stderr, "test_evicted_while_in_use: pipeline damaged\n");
+    failed = 1;
+  }
+
+  // The last release frees it (checked by sanitizer builds)
+  parse_cache_release(held);
+  return failed;
+}
+
+/**
+ * @brief Test blank lines, parse errors and a disabled cache
+ * @return 0 on success, 1 on failure
+ */
+static int test_uncached_lines(void) {
+  parse_cache_resize(4);
+  parse_cache_reset_stats();
+
+  const pipeline_t *pipeline = NULL;
+  if (parse_cache_parse("ls |", 4, &pipeline) != -1) {
+    fprintf(stderr, "test_uncached_lines: parse error not reported\n");
+    return 1;
+  }
+
+  pipeline = cached_parse("   # comment");
+  if (!pipeline || pipeline->num_commands != 0) {
+    fprintf(stderr, "test_uncached_lines: blank line not empty\n");
+    return 1;
+  }
+  parse_cache_release(pipeline);
+
+  parse_cache_resize(0);
+  const pipeline_t *a = cached_parse("echo x");
+  const pipeline_t *b = cached_parse("echo x");
+  parse_cache_stats_t stats;
+  parse_cache_stats(&stats);
+
+  int failed = 0;
+  if (!a || !b || a == b || stats.entries != 0 || stats.hits != 0) {
+    fprintf(stderr, "test_uncached_lines: disabled cache still caches\n");
+    failed = 1;
+  }
+  parse_cache_release(a);
+  parse_cache_release(b);
+  return failed;
+}
+
+/**
+ * @brief Run all parse cache tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running parse cache tests...\n");
+
+  failures += test_repeated_line_hits();
+  failures += test_lru_eviction();
+  failures += test_evicted_while_in_use();
+  failures += test_uncached_lines();
+
+  parse_cache_clear();
+
+  if (failures == 0) {
+    printf("All parse cache tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
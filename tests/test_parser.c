@@ -5,10 +5,41 @@
 
 #include "../include/shell.h"
 #include <assert.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/**
+ * @brief Get the file a command's descriptor is last redirected to
+ * @return Path, or NULL if fd is not redirected to a file
+ */
+static const char *redir_path(const command_t *cmd, int fd) {
+  const redir_t *r = command_redir(cmd, fd);
+  return r && r->kind == REDIR_OPEN ? r->path : NULL;
+}
+
+/**
+ * @brief Check whether a command's stdout is redirected in append mode
+ */
+static bool appends(const command_t *cmd) {
+  const redir_t *r = command_redir(cmd, 1);
+  return r && r->kind == REDIR_OPEN && (r->flags & O_APPEND);
+}
+
+/**
+ * @brief Check one redirection of a command
+ */
+static bool redir_is(const command_t *cmd, size_t i, redir_kind_t kind,
+                     int fd, int source, const char *path) {
+  if (i >= cmd->num_redirs)
+    return false;
+  const redir_t *r = &cmd->redirs[i];
+  return r->kind == kind && r->fd == fd &&
+         (kind != REDIR_DUP || r->source == source) &&
+         (kind != REDIR_OPEN || strcmp(r->path, path) == 0);
+}
+
 /**
  * @brief Test parsing a simple command without arguments
  * @return 0 on success, 1 on failure
@@ -139,14 +170,14 @@ static int test_parse_input_redirection(void) {
     return 1;
   }
 
-  if (pipeline.commands[0].input_file == NULL ||
-      strcmp(pipeline.commands[0].input_file, "input.txt") != 0) {
+  if (redir_path(&pipeline.commands[0], 0) == NULL ||
+      strcmp(redir_path(&pipeline.commands[0], 0), "input.txt") != 0) {
     fprintf(stderr, "test_parse_input_redirection: input file mismatch\n");
     free_pipeline(&pipeline);
     return 1;
   }
 
-  if (pipeline.commands[0].output_file != NULL) {
+  if (redir_path(&pipeline.commands[0], 1) != NULL) {
     fprintf(stderr, "test_parse_input_redirection: unexpected output file\n");
     free_pipeline(&pipeline);
     return 1;
@@ -169,14 +200,14 @@ static int test_parse_output_redirection(void) {
     return 1;
   }
 
-  if (pipeline.commands[0].output_file == NULL ||
-      strcmp(pipeline.commands[0].output_file, "output.txt") != 0) {
+  if (redir_path(&pipeline.commands[0], 1) == NULL ||
+      strcmp(redir_path(&pipeline.commands[0], 1), "output.txt") != 0) {
     fprintf(stderr, "test_parse_output_redirection: output file mismatch\n");
     free_pipeline(&pipeline);
     return 1;
   }
 
-  if (pipeline.commands[0].append_output != false) {
+  if (appends(&pipeline.commands[0]) != false) {
     fprintf(stderr, "test_parse_output_redirection: expected truncate mode\n");
     free_pipeline(&pipeline);
     return 1;
@@ -199,14 +230,14 @@ static int test_parse_append_redirection(void) {
     return 1;
   }
 
-  if (pipeline.commands[0].output_file == NULL ||
-      strcmp(pipeline.commands[0].output_file, "log.txt") != 0) {
+  if (redir_path(&pipeline.commands[0], 1) == NULL ||
+      strcmp(redir_path(&pipeline.commands[0], 1), "log.txt") != 0) {
     fprintf(stderr, "test_parse_append_redirection: output file mismatch\n");
     free_pipeline(&pipeline);
     return 1;
   }
 
-  if (pipeline.commands[0].append_output != true) {
+  if (appends(&pipeline.commands[0]) != true) {
     fprintf(stderr, "test_parse_append_redirection: expected append mode\n");
     free_pipeline(&pipeline);
     return 1;
@@ -336,15 +367,15 @@ static int test_parse_complex_pipeline(void) {
     return 1;
   }
 
-  if (pipeline.commands[0].input_file == NULL ||
-      strcmp(pipeline.commands[0].input_file, "input.txt") != 0) {
+  if (redir_path(&pipeline.commands[0], 0) == NULL ||
+      strcmp(redir_path(&pipeline.commands[0], 0), "input.txt") != 0) {
     fprintf(stderr, "test_parse_complex_pipeline: first command input mismatch\n");
     free_pipeline(&pipeline);
     return 1;
   }
 
-  if (pipeline.commands[1].output_file == NULL ||
-      strcmp(pipeline.commands[1].output_file, "output.txt") != 0) {
+  if (redir_path(&pipeline.commands[1], 1) == NULL ||
+      strcmp(redir_path(&pipeline.commands[1], 1), "output.txt") != 0) {
     fprintf(stderr, "test_parse_complex_pipeline: second command output mismatch\n");
     free_pipeline(&pipeline);
     return 1;
@@ -354,10 +385,556 @@ static int test_parse_complex_pipeline(void) {
   return 0;
 }
 
+/**
+ * @brief Test that words are unquoted in place in the single copy of the
+ * line rather than duplicated one by one
+ * @return 0 on success, 1 on failure
+ */
+static int test_parse_inplace(void) {
+  const char line[] = "grep -v \"a b\" file | wc -l";
+  pipeline_t pipeline;
+  int result = parse_command(line, &pipeline);
+
+  if (result != 0) {
+    fprintf(stderr, "test_parse_inplace: parse failed\n");
+    return 1;
+  }
+
+  if (pipeline.num_commands != 2) {
+    fprintf(stderr, "test_parse_inplace: expected 2 commands\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+
+  char **argv = pipeline.commands[0].argv;
+  if (strcmp(argv[2], "a b") != 0 || strcmp(argv[3], "file") != 0) {
+    fprintf(stderr, "test_parse_inplace: arguments mismatch\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+
+  // Every word of both stages lies at its offset within one copy
+  const char *copy = argv[0];
+  char **wc = pipeline.commands[1].argv;
+  for (int i = 0; argv[i]; i++) {
+    if (argv[i] < copy || argv[i] >= copy + sizeof(line) ||
+        wc[0] != copy + (strstr(line, "wc") - line)) {
+      fprintf(stderr, "test_parse_inplace: argv[%d] not in the copy\n", i);
+      free_pipeline(&pipeline);
+      return 1;
+    }
+  }
+
+  free_pipeline(&pipeline);
+  return 0;
+}
+
+/**
+ * @brief Test quote stripping and backslash escapes
+ * @return 0 on success, 1 on failure
+ */
+static int test_parse_quotes_and_escapes(void) {
+  pipeline_t pipeline;
+  int result = parse_command(
+      "echo 'it''s' a\\ b \"x\\\"y\" \"\" 'no\\n' \"sp\\ace\"", &pipeline);
+
+  if (result != 0) {
+    fprintf(stderr, "test_parse_quotes_and_escapes: parse failed\n");
+    return 1;
+  }
+
+  const char *expected[] = {"echo", "its", "a b", "x\"y",
+                            "",     "no\\n", "sp\\ace", NULL};
+  char **argv = pipeline.commands[0].argv;
+  for (int i = 0; expected[i]; i++) {
+    if (!argv[i] || strcmp(argv[i], expected[i]) != 0) {
+      fprintf(stderr, "test_parse_quotes_and_escapes: argv[%d] is '%s'\n", i,
+              argv[i] ? argv[i] : "(null)");
+      free_pipeline(&pipeline);
+      return 1;
+    }
+  }
+
+  if (argv[7] != NULL) {
+    fprintf(stderr, "test_parse_quotes_and_escapes: expected NULL terminator\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+
+  free_pipeline(&pipeline);
+  return 0;
+}
+
+/**
+ * @brief Test that quoted operators are ordinary arguments
+ * @return 0 on success, 1 on failure
+ */
+static int test_parse_quoted_operators(void) {
+  pipeline_t pipeline;
+  int result = parse_command("echo \"|\" '>' \\&", &pipeline);
+
+  if (result != 0) {
+    fprintf(stderr, "test_parse_quoted_operators: parse failed\n");
+    return 1;
+  }
+
+  command_t *cmd = &pipeline.commands[0];
+  if (pipeline.num_commands != 1 || cmd->num_redirs != 0 ||
+      cmd->background || !cmd->argv[3] || strcmp(cmd->argv[1], "|") != 0 ||
+      strcmp(cmd->argv[2], ">") != 0 || strcmp(cmd->argv[3], "&") != 0) {
+    fprintf(stderr, "test_parse_quoted_operators: operators not literal\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+
+  free_pipeline(&pipeline);
+  return 0;
+}
+
+/**
+ * @brief Test that an unterminated quote is a parse error
+ * @return 0 on success, 1 on failure
+ */
+static int test_parse_unterminated_quote(void) {
+  pipeline_t pipeline;
+  if (parse_command("echo \"oops", &pipeline) != -1) {
+    fprintf(stderr, "test_parse_unterminated_quote: expected failure\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test redirections of any descriptor, copies and closes
+ * @return 0 on success, 1 on failure
+ */
+static int test_parse_fd_redirections(void) {
+  pipeline_t pipeline;
+  if (parse_command("cmd 2>err >out 2>&1 3<in 4>&- <&3 5<>rw >|clob",
+                    &pipeline) != 0) {
+    fprintf(stderr, "test_parse_fd_redirections: parse failed\n");
+    return 1;
+  }
+  const command_t *cmd = &pipeline.commands[0];
+  if (cmd->num_redirs != 8 || cmd->argv[1] ||
+      !redir_is(cmd, 0, REDIR_OPEN, 2, -1, "err") ||
+      !redir_is(cmd, 1, REDIR_OPEN, 1, -1, "out") ||
+      !redir_is(cmd, 2, REDIR_DUP, 2, 1, NULL) ||
+      !redir_is(cmd, 3, REDIR_OPEN, 3, -1, "in") ||
+      !redir_is(cmd, 4, REDIR_CLOSE, 4, -1, NULL) ||
+      !redir_is(cmd, 5, REDIR_DUP, 0, 3, NULL) ||
+      !redir_is(cmd, 6, REDIR_OPEN, 5, -1, "rw") ||
+      !redir_is(cmd, 7, REDIR_OPEN, 1, -1, "clob") ||
+      cmd->redirs[6].flags != (O_RDWR | O_CREAT) ||
+      !(cmd->redirs[7].flags & O_TRUNC) ||
+      command_redir(cmd, 1) != &cmd->redirs[7]) {
+    fprintf(stderr, "test_parse_fd_redirections: redirections mismatch\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  // Only unquoted digits right before the operator name a descriptor
+  if (parse_command("echo 2 >a \"2\">b x2>c 2>&1>d", &pipeline) != 0) {
+    fprintf(stderr, "test_parse_fd_redirections: parse failed\n");
+    return 1;
+  }
+  cmd = &pipeline.commands[0];
+  if (!cmd->argv[3] || strcmp(cmd->argv[1], "2") != 0 ||
+      strcmp(cmd->argv[2], "2") != 0 || strcmp(cmd->argv[3], "x2") != 0 ||
+      cmd->num_redirs != 5 || !redir_is(cmd, 0, REDIR_OPEN, 1, -1, "a") ||
+      !redir_is(cmd, 2, REDIR_OPEN, 1, -1, "c") ||
+      !redir_is(cmd, 3, REDIR_DUP, 2, 1, NULL) ||
+      !redir_is(cmd, 4, REDIR_OPEN, 1, -1, "d")) {
+    fprintf(stderr, "test_parse_fd_redirections: descriptor numbers wrong\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  // A redirection alone is a command; a copy needs a descriptor
+  if (parse_command("2>/dev/null", &pipeline) != 0 ||
+      pipeline.commands[0].num_redirs != 1) {
+    fprintf(stderr, "test_parse_fd_redirections: lone redirection\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+  if (parse_command("echo >&file", &pipeline) != -1 ||
+      parse_command("echo 2>&", &pipeline) != -1) {
+    fprintf(stderr, "test_parse_fd_redirections: bad copy accepted\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test operators that are not separated from words by whitespace
+ * @return 0 on success, 1 on failure
+ */
+static int test_parse_operators_without_spaces(void) {
+  pipeline_t pipeline;
+  int result = parse_command("cat<in.txt|sort>>out.txt&", &pipeline);
+
+  if (result != 0) {
+    fprintf(stderr, "test_parse_operators_without_spaces: parse failed\n");
+    return 1;
+  }
+
+  if (pipeline.num_commands != 2 ||
+      strcmp(pipeline.commands[0].argv[0], "cat") != 0 ||
+      strcmp(redir_path(&pipeline.commands[0], 0), "in.txt") != 0 ||
+      strcmp(pipeline.commands[1].argv[0], "sort") != 0 ||
+      strcmp(redir_path(&pipeline.commands[1], 1), "out.txt") != 0 ||
+      !appends(&pipeline.commands[1]) ||
+      !pipeline.commands[1].background) {
+    fprintf(stderr, "test_parse_operators_without_spaces: mismatch\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+
+  free_pipeline(&pipeline);
+  return 0;
+}
+
+/**
+ * @brief Test a pipeline longer than the parser's inline stage buffer
+ * @return 0 on success, 1 on failure
+ */
+static int test_parse_long_pipeline(void) {
+  char line[1024] = "cat";
+  for (int i = 1; i < 60; i++) {
+    char stage[32];
+    snprintf(stage, sizeof(stage), " | tr a%d b", i);
+    strcat(line, stage);
+  }
+
+  pipeline_t pipeline;
+  if (parse_command(line, &pipeline) != 0) {
+    fprintf(stderr, "test_parse_long_pipeline: parse failed\n");
+    return 1;
+  }
+
+  if (pipeline.num_commands != 60) {
+    fprintf(stderr, "test_parse_long_pipeline: expected 60 commands, got %zu\n",
+            pipeline.num_commands);
+    free_pipeline(&pipeline);
+    return 1;
+  }
+
+  for (size_t i = 1; i < pipeline.num_commands; i++) {
+    char expected[32];
+    snprintf(expected, sizeof(expected), "a%zu", i);
+    char **argv = pipeline.commands[i].argv;
+    if (strcmp(argv[0], "tr") != 0 || strcmp(argv[1], expected) != 0 ||
+        argv[3] != NULL) {
+      fprintf(stderr, "test_parse_long_pipeline: stage %zu mismatch\n", i);
+      free_pipeline(&pipeline);
+      return 1;
+    }
+  }
+
+  free_pipeline(&pipeline);
+  return 0;
+}
+
+/**
+ * @brief Test that empty pipeline stages are syntax errors
+ * @return 0 on success, 1 on failure
+ */
+static int test_parse_empty_stage(void) {
+  const char *lines[] = {"| wc", "ls |", "ls | | wc", "cat <", NULL};
+
+  for (int i = 0; lines[i]; i++) {
+    pipeline_t pipeline;
+    if (parse_command(lines[i], &pipeline) != -1) {
+      fprintf(stderr, "test_parse_empty_stage: '%s' should fail\n", lines[i]);
+      free_pipeline(&pipeline);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Test parsing lines out of a larger buffer without a terminator
+ * @return 0 on success, 1 on failure
+ */
+static int test_parse_len(void) {
+  const char script[] = "echo one two\n   \nwc -l < in";
+  pipeline_t pipeline;
+
+  // Only the first line, although the buffer continues past it
+  if (parse_command_len(script, 12, &pipeline) != 0 ||
+      pipeline.num_commands != 1 ||
+      strcmp(pipeline.commands[0].argv[2], "two") != 0 ||
+      pipeline.commands[0].argv[3] != NULL) {
+    fprintf(stderr, "test_parse_len: first line parsed wrong\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  // A blank span is empty even though non-blank text follows it
+  if (parse_command_len(script + 13, 3, &pipeline) != 0 ||
+      pipeline.num_commands != 0) {
+    fprintf(stderr, "test_parse_len: blank line not empty\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+
+  if (parse_command_len(script + 17, 10, &pipeline) != 0 ||
+      pipeline.num_commands != 1 || !redir_path(&pipeline.commands[0], 0) ||
+      strcmp(redir_path(&pipeline.commands[0], 0), "in") != 0) {
+    fprintf(stderr, "test_parse_len: last line parsed wrong\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  return 0;
+}
+
 /**
  * @brief Run all parser tests
  * @return 0 if all tests pass, 1 if any test fails
  */
+static int test_parse_time_keyword(void) {
+  pipeline_t pipeline;
+
+  if (parse_command("  time ls -l | wc", &pipeline) != 0 ||
+      !pipeline.timed || pipeline.num_commands != 2 ||
+      strcmp(pipeline.commands[0].argv[0], "ls") != 0 ||
+      strcmp(pipeline.commands[0].argv[1], "-l") != 0) {
+    fprintf(stderr, "test_parse_time_keyword: timed pipeline parsed wrong\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  // Quoted, or only a prefix of a longer word: an ordinary command name
+  const char *plain[] = {"'time' ls", "timeout 1 ls", "ls time"};
+  for (size_t i = 0; i < sizeof(plain) / sizeof(plain[0]); i++) {
+    if (parse_command(plain[i], &pipeline) != 0 || pipeline.timed ||
+        pipeline.num_commands != 1) {
+      fprintf(stderr, "test_parse_time_keyword: '%s' was timed\n", plain[i]);
+      free_pipeline(&pipeline);
+      return 1;
+    }
+    free_pipeline(&pipeline);
+  }
+
+  if (parse_command("time", &pipeline) != 0 || !pipeline.timed ||
+      pipeline.num_commands != 0) {
+    fprintf(stderr, "test_parse_time_keyword: bare time not empty\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  return 0;
+}
+
+/**
+ * @brief Test commands and pipelines far beyond the old fixed limits
+ * @return 0 on success, 1 on failure
+ */
+static int test_parse_no_fixed_limits(void) {
+  enum { WORDS = 5000, STAGES = 300 };
+  static char line[WORDS * 8];
+  pipeline_t pipeline;
+
+  // xargs-style: one command with thousands of arguments
+  size_t len = (size_t)sprintf(line, "rm");
+  for (int i = 1; i < WORDS; i++)
+    len += (size_t)sprintf(line + len, " f%d", i);
+  if (parse_command(line, &pipeline) != 0 || pipeline.num_commands != 1) {
+    fprintf(stderr, "test_parse_no_fixed_limits: long command rejected\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  char **argv = pipeline.commands[0].argv;
+  if (strcmp(argv[WORDS - 1], "f4999") != 0 || argv[WORDS] != NULL) {
+    fprintf(stderr, "test_parse_no_fixed_limits: argv tail mismatch\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  len = (size_t)sprintf(line, "cat");
+  for (int i = 1; i < STAGES; i++)
+    len += (size_t)sprintf(line + len, " | tr a%d b", i);
+  if (parse_command(line, &pipeline) != 0 ||
+      pipeline.num_commands != STAGES ||
+      strcmp(pipeline.commands[STAGES - 1].argv[1], "a299") != 0) {
+    fprintf(stderr, "test_parse_no_fixed_limits: long pipeline rejected\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  return 0;
+}
+
+/**
+ * @brief Check a here-document's body
+ * @return true if the body and its length match
+ */
+static bool body_is(const here_doc_t *doc, const char *expected) {
+  if (doc && doc->len == strlen(expected) && strcmp(doc->body, expected) == 0)
+    return true;
+  fprintf(stderr, "  body '%s', expected '%s'\n", doc ? doc->body : "(none)",
+          expected);
+  return false;
+}
+
+/**
+ * @brief Test here-documents and here-strings
+ * @return 0 on success, 1 on failure
+ */
+static int test_parse_here_doc(void) {
+  pipeline_t pipeline;
+
+  // The bodies follow the command line, in the order of the operators
+  if (parse_command("cat <<EOF | wc -l <<-END\nline $X\nEOF\n\tone\n\tEND\n",
+                    &pipeline) != 0 ||
+      pipeline.num_commands != 2 || pipeline.unterminated ||
+      !body_is(pipeline.commands[0].here_doc, "line $X\n") ||
+      !body_is(pipeline.commands[1].here_doc, "one\n") ||
+      !pipeline.commands[0].here_doc->expand ||
+      pipeline.commands[1].here_doc->expand ||
+      pipeline.here_docs != pipeline.commands[0].here_doc) {
+    fprintf(stderr, "test_parse_here_doc: bodies mismatch\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  // A quoted delimiter keeps the body literal; a later < wins
+  if (parse_command("cat <<'E' <in\n$X\nE", &pipeline) != 0 ||
+      pipeline.commands[0].here_doc ||
+      strcmp(redir_path(&pipeline.commands[0], 0), "in") != 0 ||
+      pipeline.here_docs->expand) {
+    fprintf(stderr, "test_parse_here_doc: quoted delimiter or < mismatch\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  // Here-strings get a newline and need no body lines
+  if (parse_command("tr a b <<< 'a b'", &pipeline) != 0 ||
+      pipeline.here_docs || pipeline.unterminated ||
+      !body_is(pipeline.commands[0].here_doc, "a b\n")) {
+    fprintf(stderr, "test_parse_here_doc: here-string mismatch\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  // Without its delimiter line the body takes the rest of the text
+  for (int i = 0; i < 2; i++) {
+    if (parse_command(i ? "cat <<EOF\nx\n" : "cat <<EOF", &pipeline) != 0 ||
+        !pipeline.unterminated ||
+        !body_is(pipeline.commands[0].here_doc, i ? "x\n" : "")) {
+      fprintf(stderr, "test_parse_here_doc: unterminated body accepted\n");
+      free_pipeline(&pipeline);
+      return 1;
+    }
+    free_pipeline(&pipeline);
+  }
+
+  // Readers match body lines against the waiting delimiters
+  const here_doc_t first = {"A", "", 0, false, true, NULL};
+  const here_doc_t tabbed = {"B", "", 0, true, true, NULL};
+  const here_doc_t *waiting = &first;
+  parse_here_doc_line(&waiting, "A ", 2);
+  parse_here_doc_line(&waiting, "\tA", 2);
+  if (waiting != &first) {
+    fprintf(stderr, "test_parse_here_doc: wrong delimiter match\n");
+    return 1;
+  }
+  parse_here_doc_line(&waiting, "A", 1);
+  if (waiting) {
+    fprintf(stderr, "test_parse_here_doc: delimiter not matched\n");
+    return 1;
+  }
+  waiting = &tabbed;
+  parse_here_doc_line(&waiting, "\t\tB", 3);
+  if (waiting) {
+    fprintf(stderr, "test_parse_here_doc: <<- delimiter not matched\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test command lists joined by ;, &, && and ||
+ * @return 0 on success, 1 on failure
+ */
+static int test_parse_lists(void) {
+  pipeline_t pipeline;
+  if (parse_command("make&&./run | tee log||echo failed; sleep 1 & time ls;",
+                    &pipeline) != 0) {
+    fprintf(stderr, "test_parse_lists: parse failed\n");
+    return 1;
+  }
+
+  static const char *const first[] = {"make", "./run", "echo", "sleep", "ls"};
+  static const list_op_t ops[] = {LIST_AND, LIST_OR, LIST_SEQ, LIST_SEQ,
+                                  LIST_END};
+  static const size_t stages[] = {1, 2, 1, 1, 1};
+  const pipeline_t *p = &pipeline;
+  for (size_t i = 0; i < 5; i++, p = p->next) {
+    if (!p || strcmp(p->commands[0].argv[0], first[i]) != 0 ||
+        p->next_op != ops[i] || p->num_commands != stages[i]) {
+      fprintf(stderr, "test_parse_lists: pipeline %zu mismatch\n", i);
+      free_pipeline(&pipeline);
+      return 1;
+    }
+  }
+  const pipeline_t *sleep = pipeline.next->next->next;
+  if (p || !sleep->commands[0].background || !sleep->next->timed ||
+      pipeline.timed) {
+    fprintf(stderr, "test_parse_lists: list tail, & or time mismatch\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  // Quoted operators are words
+  if (parse_command("echo ';' \"&&\" \\|\\|", &pipeline) != 0 ||
+      pipeline.next || pipeline.commands[0].argv[3] == NULL ||
+      strcmp(pipeline.commands[0].argv[2], "&&") != 0) {
+    fprintf(stderr, "test_parse_lists: quoted operator split the line\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  // A here-document makes only its own pipeline expand
+  if (parse_command("true; cat <<E\n$X\nE", &pipeline) != 0 ||
+      pipeline.expand || !pipeline.next->expand ||
+      pipeline.here_docs != pipeline.next->commands[0].here_doc) {
+    fprintf(stderr, "test_parse_lists: here-document in list mismatch\n");
+    free_pipeline(&pipeline);
+    return 1;
+  }
+  free_pipeline(&pipeline);
+
+  static const char *const invalid[] = {"; ls", "ls ;; ls", "ls &&",
+                                        "ls || ; ls", "&& ls", "ls & && ls"};
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    if (parse_command(invalid[i], &pipeline) == 0) {
+      fprintf(stderr, "test_parse_lists: '%s' accepted\n", invalid[i]);
+      free_pipeline(&pipeline);
+      return 1;
+    }
+  }
+  return 0;
+}
+
 int main(void) {
   int failures = 0;
 
@@ -374,6 +951,19 @@ int main(void) {
   failures += test_parse_empty_line();
   failures += test_parse_comment();
   failures += test_parse_complex_pipeline();
+  failures += test_parse_inplace();
+  failures += test_parse_quotes_and_escapes();
+  failures += test_parse_quoted_operators();
+  failures += test_parse_unterminated_quote();
+  failures += test_parse_operators_without_spaces();
+  failures += test_parse_long_pipeline();
+  failures += test_parse_empty_stage();
+  failures += test_parse_len();
+  failures += test_parse_time_keyword();
+  failures += test_parse_no_fixed_limits();
+  failures += test_parse_here_doc();
+  failures += test_parse_lists();
+  failures += test_parse_fd_redirections();
 
   if (failures == 0) {
     printf("All parser tests passed!\n");
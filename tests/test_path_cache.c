@@ -0,0 +1,200 @@
+/**
+ * @file test_path_cache.c
+ * @brief Unit tests for the PATH lookup cache
+ */
+
+#include "../include/shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Scratch directories holding fake executables
+ */
+static char g_dir_a[] = "/tmp/test_path_cache_a_XXXXXX";
+static char g_dir_b[] = "/tmp/test_path_cache_b_XXXXXX";
+
+/**
+ * @brief Create an executable file called name inside dir
+ * @return 0 on success, -1 on failure
+ */
+static int make_tool(const char *dir, const char *name) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return -1;
+  fputs("#!/bin/sh\n", f);
+  fclose(f);
+  return chmod(path, 0755);
+}
+
+/**
+ * @brief Test that lookups resolve against PATH and are cached
+ * @return 0 on success, 1 on failure
+ */
+static int test_lookup_resolves_and_caches(void) {
+  char expected[256];
+  snprintf(expected, sizeof(expected), "%s/tool", g_dir_a);
+
+  const char *first = path_cache_lookup("tool");
+  if (!first || strcmp(first, expected) != 0) {
+    fprintf(stderr, "test_lookup_resolves_and_caches: got '%s'\n",
+            first ? first : "(null)");
+    return 1;
+  }
+
+  // A cached entry is returned as the same pointer without searching
+  if (path_cache_lookup("tool") != first) {
+    fprintf(stderr, "test_lookup_resolves_and_caches: entry not cached\n");
+    return 1;
+  }
+
+  if (path_cache_lookup("no_such_tool_here") != NULL) {
+    fprintf(stderr, "test_lookup_resolves_and_caches: found missing tool\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Test that names containing a slash bypass the cache
+ * @return 0 on success, 1 on failure
+ */
+static int test_lookup_with_slash(void) {
+  const char *name = "./relative/tool";
+  if (path_cache_lookup(name) != name) {
+    fprintf(stderr, "test_lookup_with_slash: name not returned as is\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test that forgetting an entry re-searches PATH on the next lookup
+ * @return 0 on success, 1 on failure
+ */
+static int test_forget_after_removal(void) {
+  char removed[256];
+  snprintf(removed, sizeof(removed), "%s/tool", g_dir_a);
+  unlink(removed);
+
+  path_cache_forget("tool");
+
+  char expected[256];
+  snprintf(expected, sizeof(expected), "%s/tool", g_dir_b);
+  const char *path = path_cache_lookup("tool");
+  if (!path || strcmp(path, expected) != 0) {
+    fprintf(stderr, "test_forget_after_removal: got '%s'\n",
+            path ? path : "(null)");
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Test that changing PATH invalidates cached entries
+ * @return 0 on success, 1 on failure
+ */
+static int test_path_change_invalidates(void) {
+  if (make_tool(g_dir_a, "tool") != 0) {
+    fprintf(stderr, "test_path_change_invalidates: setup failed\n");
+    return 1;
+  }
+
+  // tool is cached from g_dir_b, which is no longer on the new PATH
+  setenv("PATH", g_dir_a, 1);
+
+  char expected[256];
+  snprintf(expected, sizeof(expected), "%s/tool", g_dir_a);
+  const char *path = path_cache_lookup("tool");
+  if (!path || strcmp(path, expected) != 0) {
+    fprintf(stderr, "test_path_change_invalidates: got '%s'\n",
+            path ? path : "(null)");
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Test that many entries survive table growth and deletion
+ * @return 0 on success, 1 on failure
+ */
+static int test_many_entries(void) {
+  char name[32];
+  for (int i = 0; i < 200; i++) {
+    snprintf(name, sizeof(name), "t%d", i);
+    if (make_tool(g_dir_a, name) != 0 || !path_cache_lookup(name)) {
+      fprintf(stderr, "test_many_entries: lookup of %s failed\n", name);
+      return 1;
+    }
+  }
+
+  for (int i = 0; i < 200; i += 2) {
+    snprintf(name, sizeof(name), "t%d", i);
+    path_cache_forget(name);
+  }
+
+  for (int i = 1; i < 200; i += 2) {
+    snprintf(name, sizeof(name), "t%d", i);
+    const char *path = path_cache_lookup(name);
+    if (!path || !strstr(path, name)) {
+      fprintf(stderr, "test_many_entries: %s lost after deletes\n", name);
+      return 1;
+    }
+  }
+
+  path_cache_clear();
+  return 0;
+}
+
+/**
+ * @brief Run all PATH cache tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running PATH cache tests...\n");
+
+  if (!mkdtemp(g_dir_a) || !mkdtemp(g_dir_b) || make_tool(g_dir_a, "tool") ||
+      make_tool(g_dir_b, "tool")) {
+    fprintf(stderr, "could not create scratch directories\n");
+    return 1;
+  }
+
+  const char *saved = getenv("PATH");
+  char *saved_path = strdup(saved ? saved : "/usr/bin:/bin");
+
+  char path_var[512];
+  snprintf(path_var, sizeof(path_var), "%s:%s", g_dir_a, g_dir_b);
+  setenv("PATH", path_var, 1);
+
+  failures += test_lookup_resolves_and_caches();
+  failures += test_lookup_with_slash();
+  failures += test_forget_after_removal();
+  failures += test_path_change_invalidates();
+  failures += test_many_entries();
+
+  setenv("PATH", saved_path, 1);
+  free(saved_path);
+
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s %s", g_dir_a, g_dir_b);
+  if (system(cmd) != 0)
+    fprintf(stderr, "warning: could not remove scratch directories\n");
+
+  if (failures == 0) {
+    printf("All PATH cache tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
@@ -0,0 +1,106 @@
+/**
+ * @file test_pipes.c
+ * @brief Unit tests for pipe buffer sizing
+ */
+
+#define _GNU_SOURCE
+
+#include "../include/shell.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Create a pipe, size it and return its capacity
+ * @return Capacity in bytes, or -1 on failure
+ */
+static int sized_pipe_capacity(void) {
+  int fds[2];
+  if (pipe(fds) == -1)
+    return -1;
+  pipe_size_apply(fds[1]);
+  int size = fcntl(fds[0], F_GETPIPE_SZ);
+  close(fds[0]);
+  close(fds[1]);
+  return size;
+}
+
+/**
+ * @brief Test fixed sizes and going back to the kernel default
+ * @return 0 on success, 1 on failure
+ */
+static int test_fixed_size(void) {
+  int initial = sized_pipe_capacity();
+
+  pipe_size_set(PIPE_SIZE_FIXED, 256 * 1024);
+  int fixed = sized_pipe_capacity();
+
+  pipe_size_set(PIPE_SIZE_DEFAULT, 0);
+  int reset = sized_pipe_capacity();
+
+  if (fixed < 256 * 1024 || reset != initial) {
+    fprintf(stderr, "test_fixed_size: fixed %d, default %d (was %d)\n", fixed,
+            reset, initial);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test that auto mode grows only after a stalling pipeline
+ * @return 0 on success, 1 on failure
+ */
+static int test_auto_growth(void) {
+  pipe_size_set(PIPE_SIZE_AUTO, 0);
+  int start = sized_pipe_capacity();
+
+  job_proc_t procs[2];
+  memset(procs, 0, sizeof(procs));
+  job_t job = {0};
+  job.procs = procs;
+  job.num_procs = 2;
+  job.num_done = 2;
+
+  // Mostly computing: no change
+  procs[0].usage.ru_nvcsw = 3;
+  procs[1].usage.ru_nvcsw = 5;
+  pipe_size_observe(&job);
+  int quiet = sized_pipe_capacity();
+
+  // Constantly waking each other up: the next pipes are larger
+  procs[0].usage.ru_nvcsw = 50000;
+  procs[1].usage.ru_nvcsw = 50000;
+  pipe_size_observe(&job);
+  int grown = sized_pipe_capacity();
+
+  pipe_size_set(PIPE_SIZE_DEFAULT, 0);
+
+  if (quiet != start || grown <= start) {
+    fprintf(stderr, "test_auto_growth: start %d, quiet %d, grown %d\n", start,
+            quiet, grown);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Run all pipe sizing tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running pipe sizing tests...\n");
+
+  failures += test_fixed_size();
+  failures += test_auto_growth();
+
+  if (failures == 0) {
+    printf("All pipe sizing tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
@@ -0,0 +1,155 @@
+/**
+ * @file test_profile.c
+ * @brief Unit tests for the hot-path latency histograms
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Check that an estimate is within the histogram's resolution
+ */
+static bool close_to(uint64_t estimate, uint64_t exact) {
+  uint64_t diff = estimate > exact ? estimate - exact : exact - estimate;
+  return diff * 16 <= exact;
+}
+
+/**
+ * @brief Test that nothing is timed until SHELL_PROFILE turns it on
+ * @return 0 on success, 1 on failure
+ */
+static int test_disabled_by_default(void) {
+  struct timespec start;
+  unsetenv("SHELL_PROFILE");
+  profile_init();
+  if (profile_enabled() || profile_start(&start)) {
+    fprintf(stderr, "test_disabled_by_default: profiling is on\n");
+    return 1;
+  }
+
+  setenv("SHELL_PROFILE", "0", 1);
+  profile_init();
+  if (profile_enabled()) {
+    fprintf(stderr, "test_disabled_by_default: SHELL_PROFILE=0 enabled it\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test percentile estimates on a known distribution
+ *
+ * Samples are recorded directly, so profiling stays off and nothing is
+ * dumped at exit.
+ * @return 0 on success, 1 on failure
+ */
+static int test_percentiles(void) {
+  // 98 fast samples and two slow outliers
+  for (int i = 0; i < 98; i++)
+    profile_record(PROFILE_SPAWN, 1000 + (uint64_t)i);
+  profile_record(PROFILE_SPAWN, 5000000);
+  profile_record(PROFILE_SPAWN, 5000000);
+
+  uint64_t p50 = profile_percentile(PROFILE_SPAWN, 50);
+  uint64_t p99 = profile_percentile(PROFILE_SPAWN, 99);
+  uint64_t p100 = profile_percentile(PROFILE_SPAWN, 100);
+  if (!close_to(p50, 1049) || !close_to(p99, 5000000) || p100 != 5000000) {
+    fprintf(stderr, "test_percentiles: p50 %llu, p99 %llu, p100 %llu\n",
+            (unsigned long long)p50, (unsigned long long)p99,
+            (unsigned long long)p100);
+    return 1;
+  }
+
+  // Small values are exact; phases are kept apart
+  profile_record(PROFILE_WAIT, 3);
+  if (profile_percentile(PROFILE_WAIT, 50) != 3 ||
+      profile_percentile(PROFILE_LOOKUP, 50) != 0) {
+    fprintf(stderr, "test_percentiles: phases mixed up\n");
+    return 1;
+  }
+
+  profile_reset();
+  if (profile_percentile(PROFILE_SPAWN, 99) != 0) {
+    fprintf(stderr, "test_percentiles: reset kept samples\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Count the lines of a stream that contain a string
+ */
+static int lines_with(FILE *f, const char *text) {
+  char line[256];
+  int count = 0;
+  rewind(f);
+  while (fgets(line, sizeof(line), f))
+    count += strstr(line, text) != NULL;
+  return count;
+}
+
+/**
+ * @brief Test the startup breakdown and phases that run after it
+ * @return 0 on success, 1 on failure
+ */
+static int test_startup_profile(void) {
+  struct timespec start;
+  if (startup_profile_start(&start)) {
+    fprintf(stderr, "test_startup_profile: timing before it was enabled\n");
+    return 1;
+  }
+
+  FILE *out = tmpfile();
+  if (!out) {
+    fprintf(stderr, "test_startup_profile: no temporary file\n");
+    return 1;
+  }
+  startup_profile_enable();
+  if (startup_profile_start(&start))
+    startup_profile_stop(STARTUP_SIGNALS, &start);
+  startup_profile_report(out);
+  startup_profile_report(out);
+
+  // Phases that had not run are marked, and then reported on first use
+  int failed = lines_with(out, "startup") != 1 ||
+               lines_with(out, "signal setup") != 1 ||
+               lines_with(out, "not yet") != 3 ||
+               lines_with(out, "first prompt") != 1;
+  for (int i = 0; i < 2; i++) {
+    if (startup_profile_start(&start))
+      startup_profile_stop(STARTUP_HISTORY, &start);
+  }
+  failed |= lines_with(out, "(first use)") != 1;
+  fclose(out);
+  if (failed) {
+    fprintf(stderr, "test_startup_profile: wrong report\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Run all profiling tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running profiling tests...\n");
+
+  failures += test_disabled_by_default();
+  failures += test_percentiles();
+  failures += test_startup_profile();
+
+  if (failures == 0) {
+    printf("All profiling tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
@@ -0,0 +1,242 @@
+/**
+ * @file test_redir.c
+ * @brief Tests for redirections of any descriptor, copies and closes
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/shell.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Scratch directory the tests run in
+ */
+static char g_dir[] = "/tmp/test_redir_XXXXXX";
+
+/**
+ * @brief Parse and run one command line
+ * @return Exit status, or -1 if it did not parse
+ */
+static int run(const char *line) {
+  pipeline_t pipeline;
+  if (parse_command(line, &pipeline) == -1)
+    return -1;
+  int status = execute_list(&pipeline);
+  free_pipeline(&pipeline);
+  fflush(stdout);
+  return status;
+}
+
+/**
+ * @brief Run a command line with the shell's own stderr discarded, for
+ * errors reported before the command's redirections apply
+ * @return Exit status, or -1 if it did not parse
+ */
+static int run_quietly(const char *line) {
+  int saved_err = dup(STDERR_FILENO);
+  int null = open("/dev/null", O_WRONLY);
+  dup2(null, STDERR_FILENO);
+  close(null);
+  int status = run(line);
+  dup2(saved_err, STDERR_FILENO);
+  close(saved_err);
+  return status;
+}
+
+/**
+ * @brief Compare a file's contents with the expected text
+ */
+static bool file_is(const char *path, const char *expected) {
+  char buf[256] = "";
+  FILE *f = fopen(path, "r");
+  if (f) {
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+  }
+  if (strcmp(buf, expected) == 0)
+    return true;
+  fprintf(stderr, "  %s holds '%s', expected '%s'\n", path, buf, expected);
+  return false;
+}
+
+/**
+ * @brief Get the inode a descriptor refers to, or 0 if it is closed
+ */
+static ino_t fd_inode(int fd) {
+  struct stat st;
+  return fstat(fd, &st) == 0 ? st.st_ino : 0;
+}
+
+/**
+ * @brief Test stderr redirection and merging in spawned commands
+ * @return 0 on success, 1 on failure
+ */
+static int test_external(void) {
+  if (run("sh -c 'echo out; echo err >&2' >both 2>&1") != 0 ||
+      !file_is("both", "out\nerr\n")) {
+    fprintf(stderr, "test_external: 2>&1 did not merge\n");
+    return 1;
+  }
+
+  // Order matters: stderr takes the pipe before stdout leaves it
+  if (run("sh -c 'echo out; echo err >&2' 2>&1 >/dev/null | cat >piped") !=
+          0 ||
+      !file_is("piped", "err\n")) {
+    fprintf(stderr, "test_external: 2>&1 >file mixed up\n");
+    return 1;
+  }
+
+  if (run("sh -c 'read line <&3; echo $line more >&4' 3<both 4>>both") != 0 ||
+      !file_is("both", "out\nerr\nout more\n") ||
+      run("sh -c 'echo gone' >&- 2>/dev/null") == 0 ||
+      run("cat 5<>rw <&5") != 0 || access("rw", F_OK) != 0) {
+    fprintf(stderr, "test_external: other descriptors mishandled\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test builtins, in the shell and in a forked pipeline stage
+ * @return 0 on success, 1 on failure
+ */
+static int test_builtins(void) {
+  ino_t out = fd_inode(STDOUT_FILENO);
+  ino_t err = fd_inode(STDERR_FILENO);
+  if (run("echo in-shell 3>three >&3 2>&1") != 0 ||
+      !file_is("three", "in-shell\n") || fd_inode(3) != 0 ||
+      fd_inode(STDOUT_FILENO) != out || fd_inode(STDERR_FILENO) != err) {
+    fprintf(stderr, "test_builtins: descriptors not restored\n");
+    return 1;
+  }
+
+  if (run("echo forked 2>two >&2 | cat >one") != 0 ||
+      !file_is("two", "forked\n") || !file_is("one", "")) {
+    fprintf(stderr, "test_builtins: pipeline stage not redirected\n");
+    return 1;
+  }
+
+  // A copy of a descriptor that is not open fails without side effects
+  if (run("echo lost 2>/dev/null >&9") != 1 ||
+      fd_inode(STDOUT_FILENO) != out ||
+      run("echo closed 2>/dev/null >&-") == 0 ||
+      fd_inode(STDOUT_FILENO) != out) {
+    fprintf(stderr, "test_builtins: bad descriptor handled wrongly\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test that cat with a stderr redirection still copies the data
+ * @return 0 on success, 1 on failure
+ */
+static int test_cat(void) {
+  struct stat st;
+  if (run("cat both missing 2>errors >copy") == 0 ||
+      !file_is("copy", "out\nerr\nout more\n") || stat("errors", &st) != 0 ||
+      st.st_size == 0) {
+    fprintf(stderr, "test_cat: cat redirected wrongly\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test that filenames are expanded, as one word
+ * @return 0 on success, 1 on failure
+ */
+static int test_expanded_paths(void) {
+  if (run("F=target; echo plain > $F; echo quoted >> \"$F\"") != 0 ||
+      !file_is("target", "plain\nquoted\n") ||
+      run("cat < ${F} > copy-of-$F") != 0 ||
+      !file_is("copy-of-target", "plain\nquoted\n") ||
+      access("$F", F_OK) == 0) {
+    fprintf(stderr, "test_expanded_paths: variables not expanded\n");
+    return 1;
+  }
+
+  // The value is not split; a pattern must match a single file
+  if (run("F='two words'; echo one > $F") != 0 ||
+      !file_is("two words", "one\n") || run("cat < tar* >/dev/null") != 0 ||
+      run_quietly("echo no > *t*") != 1 ||
+      run_quietly("echo no > $NOPE") != 1 ||
+      run_quietly("cat < \"$NOPE\"") == 0 || access("$NOPE", F_OK) == 0) {
+    fprintf(stderr, "test_expanded_paths: wrong number of words\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test that a missing input file leaves the command's PATH cache
+ * entry alone
+ * @return 0 on success, 1 on failure
+ */
+static int test_missing_file_keeps_cache(void) {
+  path_cache_clear();
+  run("sh -c true");
+  for (int i = 0; i < 3; i++)
+    run_quietly("sh -c true < missing");
+  run("hash > hashes");
+
+  // Each lookup of a kept entry counts one more hit
+  unsigned hits = 0;
+  char line[256], path[200];
+  FILE *f = fopen("hashes", "r");
+  while (f && fgets(line, sizeof(line), f)) {
+    const char *base = NULL;
+    if (sscanf(line, "%u %199s", &hits, path) == 2 &&
+        (base = strrchr(path, '/')) && strcmp(base, "/sh") == 0)
+      break;
+    hits = 0;
+  }
+  if (f)
+    fclose(f);
+  if (hits < 4) {
+    fprintf(stderr, "test_missing_file_keeps_cache: sh has %u hits\n", hits);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Run all redirection tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running redirection tests...\n");
+  fflush(stdout);
+
+  if (!mkdtemp(g_dir) || chdir(g_dir) == -1) {
+    fprintf(stderr, "could not create scratch directory\n");
+    return 1;
+  }
+
+  failures += test_external();
+  failures += test_builtins();
+  failures += test_cat();
+  failures += test_expanded_paths();
+  failures += test_missing_file_keeps_cache();
+
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", g_dir);
+  if (chdir("/") == -1 || system(cmd) != 0)
+    fprintf(stderr, "warning: could not remove scratch directory\n");
+
+  if (failures == 0) {
+    printf("All redirection tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
@@ -0,0 +1,176 @@
+/**
+ * @file test_stats.c
+ * @brief Unit tests for pipeline stats reporting and the JSON lines trace
+ */
+
+#define _GNU_SOURCE
+
+#include "../include/shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char g_trace[] = "/tmp/test_stats_XXXXXX";
+
+/**
+ * @brief Read the whole trace file
+ * @return Contents (valid until the next call), or NULL on failure
+ */
+static const char *read_trace(void) {
+  FILE *file = fopen(g_trace, "r");
+  if (!file)
+    return NULL;
+
+  static char text[4096];
+  size_t len = fread(text, 1, sizeof(text) - 1, file);
+  fclose(file);
+  text[len] = '\0';
+  return text;
+}
+
+/**
+ * @brief Set a timespec to a number of microseconds
+ */
+static void at_us(struct timespec *ts, long us) {
+  ts->tv_sec = us / 1000000;
+  ts->tv_nsec = (us % 1000000) * 1000;
+}
+
+/**
+ * @brief Test that processes map to the right stages around the in-shell
+ * stage and that the record is one well-formed line
+ * @return 0 on success, 1 on failure
+ */
+static int test_trace_record(void) {
+  pipeline_t pipeline;
+  if (parse_command("seq 3 | cat | grep \"x\\\"y\"", &pipeline) != 0) {
+    fprintf(stderr, "test_trace_record: parse failed\n");
+    return 1;
+  }
+
+  job_proc_t procs[2];
+  memset(procs, 0, sizeof(procs));
+  procs[0].pid = 101;
+  at_us(&procs[0].spawned, 10);
+  at_us(&procs[0].launched, 20);
+  at_us(&procs[0].exited, 500);
+  procs[0].usage.ru_utime.tv_usec = 300;
+  procs[1].pid = 102;
+  procs[1].status = 1 << 8; // exit status 1
+  at_us(&procs[1].spawned, 30);
+  at_us(&procs[1].launched, 40);
+  at_us(&procs[1].exited, 900);
+  procs[1].usage.ru_stime.tv_usec = 200;
+
+  job_t job = {0};
+  job.procs = procs;
+  job.num_procs = 2;
+  job.num_done = 2;
+  job.command = "seq 3 | cat | grep x\"y";
+
+  pipeline_run_t run = {0};
+  run.inline_stage = 1;
+  at_us(&run.end, 1000);
+  at_us(&run.inline_start, 50);
+  at_us(&run.inline_end, 600);
+  run.inline_usage.ru_utime.tv_usec = 100;
+
+  int failures = 0;
+  if (stats_set_trace(g_trace) != 0 || !stats_wanted(&pipeline)) {
+    fprintf(stderr, "test_trace_record: trace not enabled\n");
+    failures++;
+  }
+  stats_report(&pipeline, &job, &run, 1);
+  stats_set_trace(NULL);
+
+  const char *text = read_trace();
+  const char *expected[] = {
+      "\"command\":\"seq 3 | cat | grep x\\\"y\"",
+      "\"status\":1,\"real_us\":1000,\"user_us\":400,\"sys_us\":200,",
+      "{\"stage\":0,\"argv0\":\"seq\",\"pid\":101,\"in_shell\":false,"
+      "\"spawn_us\":10,\"exec_us\":20,\"exit_us\":500,",
+      "{\"stage\":1,\"argv0\":\"cat\",\"pid\":0,\"in_shell\":true,"
+      "\"spawn_us\":50,\"exec_us\":50,\"exit_us\":600,",
+      "{\"stage\":2,\"argv0\":\"grep\",\"pid\":102,",
+      "\"sys_us\":200,\"maxrss_kb\":0,\"nvcsw\":0,\"nivcsw\":0,"
+      "\"status\":1}]}\n",
+  };
+  for (size_t i = 0; text && i < sizeof(expected) / sizeof(expected[0]); i++) {
+    if (!strstr(text, expected[i])) {
+      fprintf(stderr, "test_trace_record: missing %s in %s\n", expected[i],
+              text);
+      failures++;
+    }
+  }
+  if (!text || strchr(text, '\n') != text + strlen(text) - 1) {
+    fprintf(stderr, "test_trace_record: not exactly one line\n");
+    failures++;
+  }
+
+  free_pipeline(&pipeline);
+  return failures ? 1 : 0;
+}
+
+/**
+ * @brief Test that a failed open leaves the current settings alone
+ * @return 0 on success, 1 on failure
+ */
+static int test_trace_errors(void) {
+  pipeline_t pipeline;
+  if (parse_command("true", &pipeline) != 0)
+    return 1;
+
+  int failures = 0;
+  if (stats_wanted(&pipeline)) {
+    fprintf(stderr, "test_trace_errors: stats wanted with nothing enabled\n");
+    failures++;
+  }
+  if (stats_set_trace("/nonexistent/dir/trace") != -1 ||
+      stats_wanted(&pipeline)) {
+    fprintf(stderr, "test_trace_errors: bad path accepted\n");
+    failures++;
+  }
+
+  stats_set_enabled(true);
+  if (!stats_wanted(&pipeline)) {
+    fprintf(stderr, "test_trace_errors: set -o stats ignored\n");
+    failures++;
+  }
+  stats_set_enabled(false);
+
+  free_pipeline(&pipeline);
+  return failures ? 1 : 0;
+}
+
+/**
+ * @brief Run all stats tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running stats tests...\n");
+
+  // Keep a SHELL_TRACE from the environment out of the results
+  unsetenv("SHELL_TRACE");
+  int fd = mkstemp(g_trace);
+  if (fd == -1) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+
+  failures += test_trace_errors();
+  failures += test_trace_record();
+
+  unlink(g_trace);
+
+  if (failures == 0) {
+    printf("All stats tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
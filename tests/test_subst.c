@@ -0,0 +1,187 @@
+/**
+ * @file test_subst.c
+ * @brief Tests for command substitution
+ */
+
+#define _GNU_SOURCE // memfd_create
+
+#include "../include/shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * @brief Scratch directory the tests run in
+ */
+static char g_dir[] = "/tmp/test_subst_XXXXXX";
+
+/**
+ * @brief Parse and run one command line
+ * @return Exit status, or -1 if it did not parse
+ */
+static int run(const char *line) {
+  pipeline_t pipeline;
+  if (parse_command(line, &pipeline) == -1)
+    return -1;
+  int status = execute_list(&pipeline);
+  free_pipeline(&pipeline);
+  fflush(stdout);
+  return status;
+}
+
+/**
+ * @brief Run a command line and compare what it wrote to stdout
+ */
+static bool prints(const char *line, const char *expected) {
+  char out[4096] = "";
+  int capture = memfd_create("capture", 0);
+  int saved_out = dup(STDOUT_FILENO);
+  if (capture != -1 && saved_out != -1) {
+    fflush(stdout);
+    dup2(capture, STDOUT_FILENO);
+    run(line);
+    dup2(saved_out, STDOUT_FILENO);
+    ssize_t n = pread(capture, out, sizeof(out) - 1, 0);
+    out[n > 0 ? n : 0] = '\0';
+  }
+  if (capture != -1)
+    close(capture);
+  if (saved_out != -1)
+    close(saved_out);
+
+  if (strcmp(out, expected) == 0)
+    return true;
+  fprintf(stderr, "  '%s' printed '%s', expected '%s'\n", line, out,
+          expected);
+  return false;
+}
+
+/**
+ * @brief Test how output becomes words
+ * @return 0 on success, 1 on failure
+ */
+static int test_words(void) {
+  if (!prints("printf '<%s>' $(printf 'a  b\\n\\tc\\n\\n')", "<a><b><c>") ||
+      !prints("printf '<%s>' \"$(printf 'a  b\\n\\n')\"", "<a  b>") ||
+      !prints("printf '<%s>' x$(echo 1 2)y", "<x1><2y>") ||
+      !prints("printf '<%s>' $(true) \"$(true)\" end", "<><end>") ||
+      !prints("printf '<%s>' `echo back` \"`echo '$x'`\"", "<back><$x>") ||
+      !prints("printf '<%s>' \"$(echo $(echo in) ')' \"(\")\"", "<in ) (>") ||
+      !prints("printf '<%s>' $(echo '*.none')", "<*.none>") ||
+      !prints("printf '<%s>' $(echo one | tr o 0; echo two)", "<0ne><two>") ||
+      !prints("printf '<%s>' '$(echo no)'", "<$(echo no)>")) {
+    fprintf(stderr, "test_words: wrong words\n");
+    return 1;
+  }
+
+  // Patterns in output match files; a here-string is one word
+  FILE *f = fopen("match.txt", "w");
+  if (f)
+    fclose(f);
+  if (!prints("printf '<%s>' $(echo '*.txt')", "<match.txt>") ||
+      !prints("cat <<< $(echo '*.txt  b')", "*.txt  b\n")) {
+    fprintf(stderr, "test_words: patterns handled wrongly\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test assignments and the status they return
+ * @return 0 on success, 1 on failure
+ */
+static int test_assignments(void) {
+  if (run("x=$(printf 'a  *\\n'; exit 3)") != 3 || run("y=1") != 0) {
+    fprintf(stderr, "test_assignments: wrong status\n");
+    return 1;
+  }
+  const char *x = vars_get("x");
+  if (!x || strcmp(x, "a  *") != 0) {
+    fprintf(stderr, "test_assignments: x is '%s'\n", x ? x : "(unset)");
+    return 1;
+  }
+  if (!prints("v=$(false) || echo failed", "failed\n")) {
+    fprintf(stderr, "test_assignments: failure not seen\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test redirections to a substituted filename
+ * @return 0 on success, 1 on failure
+ */
+static int test_redirections(void) {
+  if (run("echo dollar > $(echo sub); echo back >> `echo sub`") != 0 ||
+      run("echo blank > $(printf 'a b\\n'); cat < \"$(echo a) b\" >> sub") !=
+          0 ||
+      !prints("cat < $(echo sub)", "dollar\nback\nblank\n") ||
+      access("$(echo sub)", F_OK) == 0 || access("`echo sub`", F_OK) == 0) {
+    fprintf(stderr, "test_redirections: substitution not expanded\n");
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test output far larger than a pipe holds
+ * @return 0 on success, 1 on failure
+ */
+static int test_large_output(void) {
+  FILE *f = fopen("large", "w");
+  if (!f) {
+    fprintf(stderr, "test_large_output: could not write the file\n");
+    return 1;
+  }
+  for (int i = 0; i < 100000; i++)
+    fprintf(f, "line %d\n", i);
+  fclose(f);
+
+  if (run("whole=\"$(cat large)\"; echo $(cat large) > words") != 0) {
+    fprintf(stderr, "test_large_output: substitution failed\n");
+    return 1;
+  }
+  const char *whole = vars_get("whole");
+  size_t len = whole ? strlen(whole) : 0;
+  if (len != 1088889 || strncmp(whole, "line 0\nline 1\n", 14) != 0 ||
+      strcmp(whole + len - 10, "line 99999") != 0) {
+    fprintf(stderr, "test_large_output: got %zu bytes\n", len);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Run all command substitution tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running command substitution tests...\n");
+
+  if (!mkdtemp(g_dir) || chdir(g_dir) == -1) {
+    fprintf(stderr, "could not create scratch directory\n");
+    return 1;
+  }
+
+  failures += test_words();
+  failures += test_assignments();
+  failures += test_redirections();
+  failures += test_large_output();
+
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", g_dir);
+  if (chdir("/") == -1 || system(cmd) != 0)
+    fprintf(stderr, "warning: could not remove scratch directory\n");
+
+  if (failures == 0) {
+    printf("All command substitution tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}
@@ -0,0 +1,245 @@
+/**
+ * @file test_vars.c
+ * @brief Unit tests for the variable store, envp and parameter expansion
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern char **environ;
+
+/**
+ * @brief $? expands to this; the tests do not run pipelines
+ */
+int shell_last_status(void) { return 42; }
+
+/**
+ * @brief Needed by command substitution, which test_subst covers
+ */
+int shell_substitute(const char *commands, size_t len, capture_t *out) {
+  (void)commands;
+  (void)len;
+  *out = (capture_t){NULL, 0, 0};
+  return 0;
+}
+
+/**
+ * @brief Count the envp entries for a name and check the value of the last
+ * @return Number of entries called name
+ */
+static int env_entries(const char *name, const char *value, bool *matches) {
+  size_t len = strlen(name);
+  int found = 0;
+  *matches = false;
+  for (char **env = vars_envp(); *env; env++) {
+    if (strncmp(*env, name, len) == 0 && (*env)[len] == '=') {
+      found++;
+      *matches = value && strcmp(*env + len + 1, value) == 0;
+    }
+  }
+  return found;
+}
+
+/**
+ * @brief Parse and expand a line, comparing the first command's argv
+ */
+static bool expands_to(const char *line, const char *expected) {
+  pipeline_t parsed, expanded;
+  if (parse_command(line, &parsed) != 0)
+    return false;
+
+  bool ok = expand_pipeline(&parsed, &expanded) == 0;
+  char joined[512] = "";
+  if (ok) {
+    for (char **argv = expanded.commands[0].argv; *argv; argv++) {
+      strcat(joined, "<");
+      strcat(joined, *argv);
+      strcat(joined, ">");
+    }
+    free_pipeline(&expanded);
+    ok = strcmp(joined, expected) == 0;
+  }
+  free_pipeline(&parsed);
+
+  if (!ok)
+    fprintf(stderr, "  '%s' gave '%s', expected '%s'\n", line, joined,
+            expected);
+  return ok;
+}
+
+/**
+ * @brief Test setting, reading and removing variables
+ * @return 0 on success, 1 on failure
+ */
+static int test_store(void) {
+  if (vars_set("GREETING", "hello") != 0 ||
+      strcmp(vars_get("GREETING"), "hello") != 0 ||
+      vars_set("GREETING", "bye") != 0 ||
+      strcmp(vars_get("GREETING"), "bye") != 0) {
+    fprintf(stderr, "test_store: set and get failed\n");
+    return 1;
+  }
+
+  if (vars_set("1BAD", "x") != -1 || vars_set("BAD-NAME", "x") != -1 ||
+      vars_get("NEVER_SET") != NULL) {
+    fprintf(stderr, "test_store: invalid names accepted\n");
+    return 1;
+  }
+
+  // Enough variables to grow the table, then remove every other one
+  char name[32], value[32];
+  for (int i = 0; i < 2000; i++) {
+    snprintf(name, sizeof(name), "V%d", i);
+    snprintf(value, sizeof(value), "%d", i * 7);
+    if (vars_set(name, value) != 0) {
+      fprintf(stderr, "test_store: cannot set %s\n", name);
+      return 1;
+    }
+  }
+  for (int i = 0; i < 2000; i += 2) {
+    snprintf(name, sizeof(name), "V%d", i);
+    vars_unset(name);
+  }
+  for (int i = 0; i < 2000; i++) {
+    snprintf(name, sizeof(name), "V%d", i);
+    snprintf(value, sizeof(value), "%d", i * 7);
+    const char *got = vars_get(name);
+    bool ok = i % 2 ? got && strcmp(got, value) == 0 : got == NULL;
+    if (!ok) {
+      fprintf(stderr, "test_store: %s is %s\n", name, got ? got : "unset");
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Test that envp follows exports, changes and unsets in place
+ * @return 0 on success, 1 on failure
+ */
+static int test_envp(void) {
+  bool matches;
+  if (!getenv("PATH") || env_entries("PATH", getenv("PATH"), &matches) != 1 ||
+      !matches || environ != vars_envp()) {
+    fprintf(stderr, "test_envp: environment not imported\n");
+    return 1;
+  }
+
+  // Local variables stay out of the environment until exported
+  vars_set("LOCAL_ONLY", "1");
+  if (env_entries("LOCAL_ONLY", NULL, &matches) != 0) {
+    fprintf(stderr, "test_envp: unexported variable in envp\n");
+    return 1;
+  }
+
+  if (vars_export("LOCAL_ONLY") != 0 || vars_set("LOCAL_ONLY", "2") != 0 ||
+      env_entries("LOCAL_ONLY", "2", &matches) != 1 || !matches ||
+      strcmp(getenv("LOCAL_ONLY"), "2") != 0) {
+    fprintf(stderr, "test_envp: exported change not in envp\n");
+    return 1;
+  }
+
+  // Removing an entry from the middle keeps every other one
+  size_t before = 0;
+  for (char **env = vars_envp(); *env; env++)
+    before++;
+  vars_export("EXTRA_A");
+  vars_export("EXTRA_B");
+  vars_unset("LOCAL_ONLY");
+  size_t after = 0;
+  for (char **env = vars_envp(); *env; env++)
+    after++;
+  if (after != before + 1 || env_entries("LOCAL_ONLY", NULL, &matches) != 0 ||
+      env_entries("EXTRA_A", "", &matches) != 1 || !matches ||
+      env_entries("EXTRA_B", "", &matches) != 1 || !matches ||
+      getenv("LOCAL_ONLY") != NULL) {
+    fprintf(stderr, "test_envp: unset broke envp (%zu -> %zu)\n", before,
+            after);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Test parameter expansion, quoting and field splitting
+ * @return 0 on success, 1 on failure
+ */
+static int test_expansion(void) {
+  vars_set("X", "value");
+  vars_set("SPACED", "  a  b ");
+  vars_set("EMPTY", "");
+  int failures = 0;
+
+  failures += !expands_to("echo $X ${X}s $X-x", "<echo><value><values>"
+                                                "<value-x>");
+  failures += !expands_to("echo '$X' \"$X\" \\$X \"\\$X\"",
+                          "<echo><$X><value><$X><$X>");
+  failures += !expands_to("echo $SPACED \"$SPACED\" x$SPACED",
+                          "<echo><a><b><  a  b ><x><a><b>");
+  failures += !expands_to("echo $EMPTY $UNSET_VAR \"$EMPTY\"", "<echo><>");
+  failures += !expands_to("echo $ $1 ${X ${}", "<echo><$><$1><${X><${}>");
+  failures += !expands_to("echo $? a$?b", "<echo><42><a42b>");
+  failures += !expands_to("$EMPTY", "<:>");
+
+  if (failures) {
+    fprintf(stderr, "test_expansion: %d case(s) failed\n", failures);
+    return 1;
+  }
+
+  // Here-documents expand parameters and \$, but never split or glob
+  const char *line = "cat <<E <<< \"$SPACED\"\n$SPACED \\$X ${X}*\nE";
+  pipeline_t doc, expanded;
+  if (parse_command(line, &doc) != 0 || expand_pipeline(&doc, &expanded) != 0 ||
+      strcmp(expanded.commands[0].here_doc->body, "  a  b \n") != 0 ||
+      strcmp(doc.here_docs->body, "$SPACED \\$X ${X}*\n") != 0) {
+    fprintf(stderr, "test_expansion: here-string not expanded\n");
+    return 1;
+  }
+  free_pipeline(&expanded);
+  free_pipeline(&doc);
+
+  if (parse_command("cat <<E\n$SPACED \\$X ${X}*\nE", &doc) != 0 ||
+      expand_pipeline(&doc, &expanded) != 0 ||
+      strcmp(expanded.commands[0].here_doc->body, "  a  b  $X value*\n") != 0) {
+    fprintf(stderr, "test_expansion: here-document not expanded\n");
+    return 1;
+  }
+  free_pipeline(&expanded);
+  free_pipeline(&doc);
+
+  // Expansion happens at run time, so the parsed line never changes
+  pipeline_t parsed;
+  if (parse_command("echo $X 'plain'", &parsed) != 0 || !parsed.expand ||
+      !parsed.commands[0].raw_argv || parsed.commands[0].raw_argv[2]) {
+    fprintf(stderr, "test_expansion: parameter word not marked\n");
+    return 1;
+  }
+  free_pipeline(&parsed);
+  return 0;
+}
+
+/**
+ * @brief Run all variable tests
+ * @return 0 if all tests pass, 1 if any test fails
+ */
+int main(void) {
+  int failures = 0;
+
+  printf("Running variable tests...\n");
+
+  failures += test_store();
+  failures += test_envp();
+  failures += test_expansion();
+
+  if (failures == 0) {
+    printf("All variable tests passed!\n");
+    return 0;
+  } else {
+    printf("%d test(s) failed\n", failures);
+    return 1;
+  }
+}